@@ -35,8 +35,16 @@ namespace gloox
   namespace util
   {
     AtomicRefCount::AtomicRefCount()
-      : m_count( 0 )
+      : m_count( 0 ), m_lock( 0 )
     {
+#if !defined( _WIN32 ) && !defined( __APPLE__ ) && !defined( HAVE_GCC_ATOMIC_BUILTINS )
+      m_lock = new Mutex();
+#endif
+    }
+
+    AtomicRefCount::~AtomicRefCount()
+    {
+      delete m_lock;
     }
 
     int AtomicRefCount::increment()
@@ -50,7 +58,7 @@ namespace gloox
       return static_cast<int>( __sync_add_and_fetch( &m_count, 1 ) );
 #else
       // Fallback to using a lock
-      MutexGuard m( m_lock );
+      MutexGuard m( *m_lock );
       return ++m_count;
 #endif
     }
@@ -66,11 +74,27 @@ namespace gloox
       return static_cast<int>( __sync_sub_and_fetch( &m_count, 1 ) );
 #else
       // Fallback to using a lock
-      MutexGuard m( m_lock );
+      MutexGuard m( *m_lock );
       return --m_count;
 #endif
     }
 
+    int AtomicRefCount::value()
+    {
+#if defined( _WIN32 )
+      return (int) ::InterlockedCompareExchange( (volatile LONG*)&m_count, 0, 0 );
+#elif defined( __APPLE__ )
+      return (int) OSAtomicAdd32Barrier( 0, (volatile int32_t*)&m_count );
+#elif defined( HAVE_GCC_ATOMIC_BUILTINS )
+      // Adding zero reads the value with a full barrier.
+      return static_cast<int>( __sync_add_and_fetch( &m_count, 0 ) );
+#else
+      // Fallback to using a lock
+      MutexGuard m( *m_lock );
+      return m_count;
+#endif
+    }
+
     void AtomicRefCount::reset()
     {
 #if defined( _WIN32 )
@@ -82,7 +106,7 @@ namespace gloox
       __sync_fetch_and_and( &m_count, 0 );
 #else
       // Fallback to using a lock
-      MutexGuard m( m_lock );
+      MutexGuard m( *m_lock );
       m_count = 0;
 #endif
     }
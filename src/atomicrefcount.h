@@ -39,6 +39,11 @@ namespace gloox
          */
         AtomicRefCount();
 
+        /**
+         * Destructor.
+         */
+        ~AtomicRefCount();
+
         /**
          * Increments the reference count, and returns the new value.
          * @return The new value.
@@ -51,6 +56,13 @@ namespace gloox
          */
         int decrement();
 
+        /**
+         * Returns the current value.
+         * @return The current value.
+         * @since 1.1
+         */
+        int value();
+
         /**
          * Resets the reference count to zero.
          * @since 1.0.4
@@ -58,12 +70,14 @@ namespace gloox
         void reset();
         
     private:
+        AtomicRefCount( const AtomicRefCount& );
         AtomicRefCount& operator=( const AtomicRefCount& );
 
         volatile int m_count;
 
-        // The mutex is only used if a native function is unavailable.
-        Mutex m_lock;
+        // The mutex is only created (and used) if a native function is unavailable. Reference
+        // counts are embedded in many small objects, which should not carry a mutex each.
+        Mutex* m_lock;
 
     };
 
@@ -147,6 +147,13 @@ namespace gloox
     return filter;
   }
 
+  bool Capabilities::equals( const StanzaExtension& other ) const
+  {
+    const Capabilities& c = static_cast<const Capabilities&>( other );
+    return c.m_disco == m_disco && c.m_valid == m_valid && c.m_ver == m_ver && c.m_node == m_node
+           && c.m_hash == m_hash;
+  }
+
   Tag* Capabilities::tag() const
   {
     if( !m_valid || m_node.empty() )
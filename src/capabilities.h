@@ -93,6 +93,9 @@ namespace gloox
         return new Capabilities( *this );
       }
 
+      // reimplemented from StanzaExtension
+      virtual bool equals( const StanzaExtension& other ) const;
+
       // reimplemented from DiscoNodeHandler
       virtual StringList handleDiscoNodeFeatures( const JID& from, const std::string& node );
 
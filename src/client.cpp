@@ -623,6 +623,7 @@ namespace gloox
       e->setXmlns( XMLNS_STREAM_MANAGEMENT );
       if( m_smResume )
         e->addAttribute( "resume", "true" );
+      resetQueue();
       send( e );
       m_smContext = CtxSMEnable;
       m_smHandled = 0;
@@ -101,18 +101,19 @@ namespace gloox
       m_compress( true ), m_authed( false ), m_resourceBound( false ), m_block( false ), m_sasl( true ),
       m_tls( TLSOptional ), m_port( port ),
       m_availableSaslMechs( SaslMechAll ), m_smContext( CtxSMInvalid ), m_smHandled( 0 ),
-      m_statisticsHandler( 0 ),
+      m_iqTimeout( 0 ), m_statisticsHandler( 0 ),
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MUC )
       m_mucInvitationHandler( 0 ),
 #endif // GLOOX_MINIMAL
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MESSAGESESSION )
       m_messageSessionHandlerChat( 0 ), m_messageSessionHandlerGroupchat( 0 ),
       m_messageSessionHandlerHeadline( 0 ), m_messageSessionHandlerNormal( 0 ),
+      m_messageSessionSerial( 0 ),
 #endif // GLOOX_MINIMAL
       m_parser( this ), m_seFactory( 0 ), m_authError( AuthErrorUndefined ),
       m_streamError( StreamErrorUndefined ), m_streamErrorAppCondition( 0 ),
       m_selectedSaslMech( SaslMechNone ), m_customConnection( false ),
-      m_smSent( 0 )
+      m_smSent( 0 ), m_smQueueFull( false )
   {
     init();
   }
@@ -129,18 +130,19 @@ namespace gloox
       m_compress( true ), m_authed( false ), m_resourceBound( false ), m_block( false ), m_sasl( true ),
       m_tls( TLSOptional ), m_port( port ),
       m_availableSaslMechs( SaslMechAll ), m_smContext( CtxSMInvalid ), m_smHandled( 0 ),
-      m_statisticsHandler( 0 ),
+      m_iqTimeout( 0 ), m_statisticsHandler( 0 ),
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MUC )
       m_mucInvitationHandler( 0 ),
 #endif // GLOOX_MINIMAL
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MESSAGESESSION )
       m_messageSessionHandlerChat( 0 ), m_messageSessionHandlerGroupchat( 0 ),
       m_messageSessionHandlerHeadline( 0 ), m_messageSessionHandlerNormal( 0 ),
+      m_messageSessionSerial( 0 ),
 #endif // GLOOX_MINIMAL
       m_parser( this ), m_seFactory( 0 ), m_authError( AuthErrorUndefined ),
       m_streamError( StreamErrorUndefined ), m_streamErrorAppCondition( 0 ),
       m_selectedSaslMech( SaslMechNone ), m_customConnection( false ),
-      m_smSent( 0 )
+      m_smSent( 0 ), m_smQueueFull( false )
   {
     init();
   }
@@ -176,14 +178,16 @@ namespace gloox
   {
     m_iqHandlerMapMutex.lock();
     m_iqIDHandlers.clear();
+    m_iqIDsByHandler.clear();
+    m_iqDeadlines.clear();
     m_iqHandlerMapMutex.unlock();
 
-    m_iqExtHandlerMapMutex.lock();
-    m_iqExtHandlers.clear();
-    m_iqExtHandlerMapMutex.unlock();
+    {
+      util::CopyOnWrite<IqHandlerMap>::WriteGuard handlers( m_iqExtHandlers );
+      handlers->clear();
+    }
 
     util::clearList( m_presenceExtensions );
-    util::clearMap( m_smQueue );
 
     setConnectionImpl( 0 );
     setEncryptionImpl( 0 );
@@ -196,7 +200,10 @@ namespace gloox
 #endif // GLOOX_MINIMAL
 
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MESSAGESESSION )
-    util::clearList( m_messageSessions );
+    MessageSessionMap::const_iterator itms = m_messageSessions.begin();
+    for( ; itms != m_messageSessions.end(); ++itms )
+      delete (*itms).first;
+    m_messageSessions.clear();
 #endif // GLOOX_MINIMAL
 
     PresenceJidHandlerList::const_iterator it1 = m_presenceJidHandlers.begin();
@@ -209,7 +216,9 @@ namespace gloox
     if( !m_connection || m_connection->state() == StateDisconnected )
       return ConnNotConnected;
 
-    return m_connection->recv( timeout );
+    ConnectionError ce = m_connection->recv( timeout );
+    checkIqTimeouts();
+    return ce;
   }
 
   bool ClientBase::connect( bool block )
@@ -251,7 +260,8 @@ namespace gloox
       return;
     }
 
-    logInstance().dbg( LogAreaXmlIncoming, tag->xml() );
+    if( logInstance().enabled( LogLevelDebug, LogAreaXmlIncoming ) )
+      logInstance().dbg( LogAreaXmlIncoming, tag->xml() );
     ++m_stats.totalStanzasReceived;
 
     if( tag->name() == "stream" && tag->xmlns() == XMLNS_STREAM )
@@ -444,7 +454,6 @@ namespace gloox
 
     m_encryptionActive = false;
     m_compressionActive = false;
-    m_smSent = 0;
 
     notifyOnDisconnect( reason );
 
@@ -455,14 +464,13 @@ namespace gloox
 
   void ClientBase::parse( const std::string& data )
   {
-    std::string copy = data;
     int i = 0;
-    if( ( i = m_parser.feed( copy ) ) >= 0 )
+    if( ( i = m_parser.feed( data.data(), data.length() ) ) >= 0 )
     {
       std::string error = "parse error (at pos ";
       error += util::int2string( i );
       error += "): ";
-      m_logInstance.err( LogAreaClassClientbase, error + copy );
+      m_logInstance.err( LogAreaClassClientbase, error + data );
       Tag* e = new Tag( "stream:error" );
       new Tag( e, "restricted-xml", "xmlns", XMLNS_XMPP_STREAM );
       send( e );
@@ -967,20 +975,29 @@ namespace gloox
     return true;
   }
 
-  void ClientBase::send( IQ& iq, IqHandler* ih, int context, bool del )
+  void ClientBase::send( IQ& iq, IqHandler* ih, int context, bool del, int timeout )
   {
     if( ih && ( iq.subtype() == IQ::Set || iq.subtype() == IQ::Get ) )
     {
       if( iq.id().empty() )
         iq.setID( getID() );
 
+      if( timeout < 0 )
+        timeout = m_iqTimeout;
+
       TrackStruct track;
       track.ih = ih;
       track.context = context;
       track.del = del;
-      m_iqHandlerMapMutex.lock();
-      m_iqIDHandlers[iq.id()] = track;
-      m_iqHandlerMapMutex.unlock();
+      track.to = iq.to();
+      track.expires = timeout > 0;
+
+      util::MutexGuard m( m_iqHandlerMapMutex );
+      untrackIqID( iq.id(), 0 ); // a re-used ID replaces the older request
+      if( track.expires )
+        track.deadline = m_iqDeadlines.insert( std::make_pair( time( 0 ) + timeout, iq.id() ) );
+      m_iqIDHandlers.insert( std::make_pair( iq.id(), track ) );
+      m_iqIDsByHandler[ih].insert( iq.id() );
     }
 
     send( iq );
@@ -1038,7 +1055,9 @@ namespace gloox
     if( !tag )
     return;
 
-    send( tag->xml() );
+    std::string xml;
+    tag->xml( xml );
+    send( xml );
 
     ++m_stats.totalStanzasSent;
 
@@ -1048,10 +1067,21 @@ namespace gloox
     if( queue && m_smContext >= CtxSMEnabled )
     {
       m_queueMutex.lock();
-      m_smQueue.insert( std::make_pair( ++m_smSent, tag ) );
+      const bool queued = m_smQueue.push( ++m_smSent, xml );
+      const bool full = !queued && !m_smQueueFull;
+      if( !queued )
+        m_smQueueFull = true;
       m_queueMutex.unlock();
+
+      if( full )
+      {
+        logInstance().warn( LogAreaClassClientbase, "Stream Management send queue is full, "
+                                                    "stanzas will not be resent" );
+        notifyStreamEvent( StreamEventSMQueueFull );
+      }
     }
-    else if( del || m_smContext < CtxSMEnabled )
+
+    if( queue || del || m_smContext < CtxSMEnabled )
       delete tag;
   }
 
@@ -1075,34 +1105,69 @@ namespace gloox
     if( m_smContext < CtxSMEnabled || handled < 0 )
       return;
 
-    util::MutexGuard mg( m_queueMutex );
-    SMQueueMap::iterator it = m_smQueue.begin();
-    while( it != m_smQueue.end() )
+    std::string xml;
+    size_t num = 0;
+    m_queueMutex.lock();
+    if( m_smQueue.ack( handled ) )
+      m_smQueueFull = false;
+    if( resend )
     {
-      if( (*it).first <= handled )
-      {
-        delete (*it).second;
-        m_smQueue.erase( it++ );
-      }
-      else if( resend && (*it).first > handled )
-      {
-        send( (*it).second, false, false );
-        ++it;
-      }
-      else
-      {
-        ++it;
-      }
+      m_smQueue.xml( xml );
+      num = m_smQueue.count();
     }
+    m_queueMutex.unlock();
+
+    if( xml.empty() )
+      return;
+
+    send( xml );
+    m_stats.totalStanzasSent += static_cast<int>( num );
+    if( m_statisticsHandler )
+      m_statisticsHandler->handleStatistics( getStatistics() );
+  }
+
+  void ClientBase::resetQueue()
+  {
+    util::MutexGuard mg( m_queueMutex );
+    m_smQueue.clear();
+    m_smQueueFull = false;
+    m_smSent = 0;
+  }
+
+  void ClientBase::setSendQueueLimits( size_t maxBytes, size_t maxStanzas )
+  {
+    util::MutexGuard mg( m_queueMutex );
+    m_smQueue.setLimits( maxBytes, maxStanzas );
   }
 
+  /**
+   * Collects the stanzas re-parsed by sendQueue().
+   */
+  class SendQueueCollector : public TagHandler
+  {
+    public:
+      SendQueueCollector( TagList& list ) : m_list( list ) {}
+      virtual void handleTag( Tag* tag ) { m_list.push_back( tag->clone() ); }
+
+    private:
+      SendQueueCollector& operator=( const SendQueueCollector& );
+      TagList& m_list;
+  };
+
   const TagList ClientBase::sendQueue()
   {
+    m_queueMutex.lock();
+    const StringList stanzas = m_smQueue.stanzas();
+    m_queueMutex.unlock();
+
     TagList l;
-    util::MutexGuard mg( m_queueMutex );
-    SMQueueMap::iterator it = m_smQueue.begin();
-    for( ; it != m_smQueue.end(); ++it )
-      l.push_back( (*it).second->clone() );
+    SendQueueCollector collector( l );
+    StringList::const_iterator it = stanzas.begin();
+    for( ; it != stanzas.end(); ++it )
+    {
+      Parser p( &collector );
+      p.feed( (*it).data(), (*it).length() );
+    }
 
     return l;
   }
@@ -1194,9 +1259,13 @@ namespace gloox
 #ifdef CLIENTBASE_TEST // to create predictable UIDs in test mode
     return "uid" + util::int2string( m_nextId.increment() );
 #else
-    char r[48+1];
-    sprintf( r, "%s%08x", m_uniqueBaseId.c_str(), m_nextId.increment() );
-    std::string ret( r, 48 );
+    static const char hex[] = "0123456789abcdef";
+    const unsigned int id = static_cast<unsigned int>( m_nextId.increment() );
+    std::string ret;
+    ret.reserve( m_uniqueBaseId.length() + 8 );
+    ret += m_uniqueBaseId;
+    for( int shift = 28; shift >= 0; shift -= 4 )
+      ret += hex[( id >> shift ) & 0xf];
     return ret;
 #endif
   }
@@ -1344,8 +1413,12 @@ namespace gloox
 
   void ClientBase::registerMessageSession( MessageSession* session )
   {
-    if( session )
-      m_messageSessions.push_back( session );
+    if( !session || m_messageSessions.find( session ) != m_messageSessions.end() )
+      return;
+
+    MessageSessionEntry& entry = m_messageSessions[session];
+    entry.serial = ++m_messageSessionSerial;
+    indexMessageSession( session, entry );
   }
 
   void ClientBase::disposeMessageSession( MessageSession* session )
@@ -1353,14 +1426,73 @@ namespace gloox
     if( !session )
       return;
 
-    MessageSessionList::iterator it = std::find( m_messageSessions.begin(),
-                                                 m_messageSessions.end(),
-                                                 session );
+    MessageSessionMap::iterator it = m_messageSessions.find( session );
     if( it != m_messageSessions.end() )
     {
-      delete (*it);
+      unindexMessageSession( (*it).second );
       m_messageSessions.erase( it );
+      delete session;
+    }
+  }
+
+  void ClientBase::updateMessageSession( MessageSession* session )
+  {
+    MessageSessionMap::iterator it = m_messageSessions.find( session );
+    if( it == m_messageSessions.end() )
+      return;
+
+    unindexMessageSession( (*it).second );
+    indexMessageSession( session, (*it).second );
+  }
+
+  void ClientBase::indexMessageSession( MessageSession* session, MessageSessionEntry& entry )
+  {
+    entry.full = session->target().full();
+    entry.bare = session->target().bare();
+    m_messageSessionsFull[entry.full].insert( std::make_pair( entry.serial, session ) );
+    m_messageSessionsBare[entry.bare].insert( std::make_pair( entry.serial, session ) );
+  }
+
+  void ClientBase::unindexMessageSession( const MessageSessionEntry& entry )
+  {
+    MessageSessionIndex::iterator it = m_messageSessionsFull.find( entry.full );
+    if( it != m_messageSessionsFull.end() )
+    {
+      (*it).second.erase( entry.serial );
+      if( (*it).second.empty() )
+        m_messageSessionsFull.erase( it );
+    }
+
+    it = m_messageSessionsBare.find( entry.bare );
+    if( it != m_messageSessionsBare.end() )
+    {
+      (*it).second.erase( entry.serial );
+      if( (*it).second.empty() )
+        m_messageSessionsBare.erase( it );
+    }
+  }
+
+  MessageSession* ClientBase::findMessageSession( const MessageSessionIndex& index, const std::string& key,
+                                                  const Message& msg ) const
+  {
+    MessageSessionIndex::const_iterator it = index.find( key );
+    if( it == index.end() )
+      return 0;
+
+    // sessions sharing a JID are tried in the order they were registered
+    MessageSessionBucket::const_iterator it2 = (*it).second.begin();
+    for( ; it2 != (*it).second.end(); ++it2 )
+    {
+      const MessageSession* session = (*it2).second;
+      if( ( msg.thread().empty()
+              || session->threadID() == msg.thread()
+              || session->honorThreadID() ) &&
+// FIXME don't use '== 0' here
+            ( session->types() & msg.subtype() || session->types() == 0 ) )
+        return (*it2).second;
     }
+
+    return 0;
   }
 #endif // GLOOX_MINIMAL
 
@@ -1405,17 +1537,81 @@ namespace gloox
 
   void ClientBase::removeIDHandler( IqHandler* ih )
   {
-    IqTrackMap::iterator t;
+    util::MutexGuard m( m_iqHandlerMapMutex );
+    IqHandlerTrackMap::iterator it = m_iqIDsByHandler.find( ih );
+    if( it == m_iqIDsByHandler.end() )
+      return;
+
+    std::set<std::string> ids;
+    ids.swap( (*it).second );
+    m_iqIDsByHandler.erase( it );
+
+    std::set<std::string>::const_iterator iti = ids.begin();
+    for( ; iti != ids.end(); ++iti )
+    {
+      IqTrackMap::iterator itt = m_iqIDHandlers.find( (*iti) );
+      if( itt == m_iqIDHandlers.end() )
+        continue;
+
+      if( (*itt).second.expires )
+        m_iqDeadlines.erase( (*itt).second.deadline );
+      m_iqIDHandlers.erase( itt );
+    }
+  }
+
+  bool ClientBase::untrackIqID( const std::string& id, TrackStruct* track )
+  {
+    IqTrackMap::iterator it = m_iqIDHandlers.find( id );
+    if( it == m_iqIDHandlers.end() )
+      return false;
+
+    if( (*it).second.expires )
+      m_iqDeadlines.erase( (*it).second.deadline );
+
+    IqHandlerTrackMap::iterator ith = m_iqIDsByHandler.find( (*it).second.ih );
+    if( ith != m_iqIDsByHandler.end() )
+    {
+      (*ith).second.erase( id );
+      if( (*ith).second.empty() )
+        m_iqIDsByHandler.erase( ith );
+    }
+
+    if( track )
+      *track = (*it).second;
+    m_iqIDHandlers.erase( it );
+    return true;
+  }
+
+  void ClientBase::checkIqTimeouts( time_t now )
+  {
+    typedef std::list<std::pair<std::string, TrackStruct> > ExpiredList;
+    ExpiredList expired;
+
     m_iqHandlerMapMutex.lock();
-    IqTrackMap::iterator it = m_iqIDHandlers.begin();
-    while( it != m_iqIDHandlers.end() )
+    while( !m_iqDeadlines.empty() && (*m_iqDeadlines.begin()).first <= now )
     {
-      t = it;
-      ++it;
-      if( ih == (*t).second.ih )
-        m_iqIDHandlers.erase( t );
+      const std::string id = (*m_iqDeadlines.begin()).second;
+      TrackStruct track;
+      untrackIqID( id, &track );
+      expired.push_back( std::make_pair( id, track ) );
     }
     m_iqHandlerMapMutex.unlock();
+
+    ExpiredList::const_iterator it = expired.begin();
+    for( ; it != expired.end(); ++it )
+    {
+      IQ re( IQ::Error, JID(), (*it).first );
+      re.setFrom( (*it).second.to );
+      re.addExtension( new Error( StanzaErrorTypeWait, StanzaErrorRemoteServerTimeout ) );
+      (*it).second.ih->handleIqID( re, (*it).second.context );
+      if( (*it).second.del )
+        delete (*it).second.ih;
+    }
+  }
+
+  void ClientBase::handleTimer( int /*id*/, int /*context*/ )
+  {
+    checkIqTimeouts();
   }
 
   void ClientBase::registerIqHandler( IqHandler* ih, int exttype )
@@ -1423,16 +1619,26 @@ namespace gloox
     if( !ih )
       return;
 
-    util::MutexGuard m( m_iqExtHandlerMapMutex );
     typedef IqHandlerMap::const_iterator IQci;
-    std::pair<IQci, IQci> g = m_iqExtHandlers.equal_range( exttype );
+    {
+      util::CopyOnWrite<IqHandlerMap>::ReadGuard handlers( m_iqExtHandlers );
+      std::pair<IQci, IQci> g = handlers->equal_range( exttype );
+      for( IQci it = g.first; it != g.second; ++it )
+      {
+        if( (*it).second == ih )
+          return;
+      }
+    }
+
+    util::CopyOnWrite<IqHandlerMap>::WriteGuard handlers( m_iqExtHandlers );
+    std::pair<IQci, IQci> g = handlers->equal_range( exttype );
     for( IQci it = g.first; it != g.second; ++it )
     {
       if( (*it).second == ih )
         return;
     }
 
-    m_iqExtHandlers.insert( std::make_pair( exttype, ih ) );
+    handlers->insert( std::make_pair( exttype, ih ) );
   }
 
   void ClientBase::removeIqHandler( IqHandler* ih, int exttype )
@@ -1440,16 +1646,16 @@ namespace gloox
     if( !ih )
       return;
 
-    util::MutexGuard m( m_iqExtHandlerMapMutex );
+    util::CopyOnWrite<IqHandlerMap>::WriteGuard handlers( m_iqExtHandlers );
     typedef IqHandlerMap::iterator IQi;
-    std::pair<IQi, IQi> g = m_iqExtHandlers.equal_range( exttype );
+    std::pair<IQi, IQi> g = handlers->equal_range( exttype );
     IQi it2;
     IQi it = g.first;
     while( it != g.second )
     {
       it2 = it++;
       if( (*it2).second == ih )
-        m_iqExtHandlers.erase( it2 );
+        handlers->erase( it2 );
     }
   }
 
@@ -1636,19 +1842,19 @@ namespace gloox
 
   void ClientBase::notifyIqHandlers( IQ& iq )
   {
-    m_iqHandlerMapMutex.lock();
-    IqTrackMap::iterator it_id = m_iqIDHandlers.find( iq.id() );
-    bool haveIdHandler = ( it_id != m_iqIDHandlers.end() );
-    m_iqHandlerMapMutex.unlock();
-    if( haveIdHandler && ( iq.subtype() == IQ::Result || iq.subtype() == IQ::Error ) )
+    if( iq.subtype() == IQ::Result || iq.subtype() == IQ::Error )
     {
-      (*it_id).second.ih->handleIqID( iq, (*it_id).second.context );
-      if( (*it_id).second.del )
-        delete (*it_id).second.ih;
+      TrackStruct track;
       m_iqHandlerMapMutex.lock();
-      m_iqIDHandlers.erase( it_id );
+      bool haveIdHandler = untrackIqID( iq.id(), &track );
       m_iqHandlerMapMutex.unlock();
-      return;
+      if( haveIdHandler )
+      {
+        track.ih->handleIqID( iq, track.context );
+        if( track.del )
+          delete track.ih;
+        return;
+      }
     }
 
     if( iq.extensions().empty() )
@@ -1675,20 +1881,22 @@ namespace gloox
 //     }
 //     delete tag;
 
-    m_iqExtHandlerMapMutex.lock();
-    typedef IqHandlerMap::const_iterator IQci;
-    const StanzaExtensionList& sel = iq.extensions();
-    StanzaExtensionList::const_iterator itse = sel.begin();
-    for( ; !handled && itse != sel.end(); ++itse )
     {
-      std::pair<IQci, IQci> g = m_iqExtHandlers.equal_range( (*itse)->extensionType() );
-      for( IQci it = g.first; !handled && it != g.second; ++it )
+      // handlers may (un)register handlers, this only affects the next IQ
+      util::CopyOnWrite<IqHandlerMap>::ReadGuard handlers( m_iqExtHandlers );
+      typedef IqHandlerMap::const_iterator IQci;
+      const StanzaExtensionList& sel = iq.extensions();
+      StanzaExtensionList::const_iterator itse = sel.begin();
+      for( ; !handled && itse != sel.end(); ++itse )
       {
-        if( (*it).second->handleIq( iq ) )
-          handled = true;
+        std::pair<IQci, IQci> g = handlers->equal_range( (*itse)->extensionType() );
+        for( IQci it = g.first; !handled && it != g.second; ++it )
+        {
+          if( (*it).second->handleIq( iq ) )
+            handled = true;
+        }
       }
     }
-    m_iqExtHandlerMapMutex.unlock();
 
     if( !handled && ( iq.subtype() == IQ::Get || iq.subtype() == IQ::Set ) )
     {
@@ -1720,34 +1928,13 @@ namespace gloox
 #endif // GLOOX_MINIMAL
 
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MESSAGESESSION )
-    MessageSessionList::const_iterator it1 = m_messageSessions.begin();
-    for( ; it1 != m_messageSessions.end(); ++it1 )
+    MessageSession* ms = findMessageSession( m_messageSessionsFull, msg.from().full(), msg );
+    if( !ms )
+      ms = findMessageSession( m_messageSessionsBare, msg.from().bare(), msg );
+    if( ms )
     {
-      if( (*it1)->target().full() == msg.from().full() &&
-            ( msg.thread().empty()
-              || (*it1)->threadID() == msg.thread()
-              || (*it1)->honorThreadID() ) &&
-// FIXME don't use '== 0' here
-            ( (*it1)->types() & msg.subtype() || (*it1)->types() == 0 ) )
-      {
-        (*it1)->handleMessage( msg );
-        return;
-      }
-    }
-
-    it1 = m_messageSessions.begin();
-    for( ; it1 != m_messageSessions.end(); ++it1 )
-    {
-      if( (*it1)->target().bare() == msg.from().bare() &&
-            ( msg.thread().empty()
-              || (*it1)->threadID() == msg.thread()
-              || (*it1)->honorThreadID() ) &&
-// FIXME don't use '== 0' here
-            ( (*it1)->types() & msg.subtype() || (*it1)->types() == 0 ) )
-      {
-        (*it1)->handleMessage( msg );
-        return;
-      }
+      ms->handleMessage( msg );
+      return;
     }
 
     MessageSessionHandler* msHandler = 0;
@@ -23,16 +23,21 @@
 #include "logsink.h"
 #include "mutex.h"
 #include "taghandler.h"
+#include "timerhandler.h"
 #include "statisticshandler.h"
 #include "tlshandler.h"
 #include "compressiondatahandler.h"
 #include "connectiondatahandler.h"
 #include "parser.h"
 #include "atomicrefcount.h"
+#include "copyonwrite.h"
+#include "smqueue.h"
 
 #include <string>
 #include <list>
 #include <map>
+#include <set>
+#include <ctime>
 
 #if defined( _WIN32 )
 #include <windows.h>
@@ -79,10 +84,13 @@ namespace gloox
    */
   class GLOOX_API ClientBase : public TagHandler, public ConnectionDataHandler,
                                public CompressionDataHandler, public TLSHandler,
-                               public IqHandler
+                               public IqHandler, public TimerHandler
   {
 
     friend class RosterManager;
+#if !defined( GLOOX_MINIMAL ) || defined( WANT_MESSAGESESSION )
+    friend class MessageSession;
+#endif // GLOOX_MINIMAL
 
     public:
       /**
@@ -171,6 +179,18 @@ namespace gloox
        */
       void setCompression( bool compression ) { m_compress = compression; }
 
+      /**
+       * Switches arena allocation of incoming stanzas on/off. Default: off. If enabled, the
+       * Tag and Attribute objects of each incoming stanza are allocated from a per-stanza arena
+       * that is released in one go after handleTag() returns. Their strings and lists are still
+       * allocated from the heap. This should be called before calling connect().
+       * @param arena Whether to allocate incoming stanzas from an arena.
+       * @note Handlers must not keep pointers to (parts of) incoming Tags beyond the
+       * respective callback. Use Tag::clone() to keep a copy. See Parser::setArenaAllocation().
+       * @since 1.1
+       */
+      void setArenaAllocation( bool arena ) { m_parser.setArenaAllocation( arena ); }
+
       /**
        * Sets the port to connect to. This is not necessary if either the default port (5222) is used
        * or SRV records exist which will be resolved.
@@ -262,8 +282,11 @@ namespace gloox
        * @param context A value that allows for restoring context.
        * @param del Whether or not delete the IqHandler object after its being called.
        * Default: @b false.
+       * @param timeout The number of seconds to wait for a reply. If it expires, the IqHandler
+       * receives an IQ of type error with condition remote-server-timeout instead. 0 waits forever,
+       * -1 (the default) uses the value set with setIqTimeout().
        */
-      void send( IQ& iq, IqHandler* ih, int context, bool del = false );
+      void send( IQ& iq, IqHandler* ih, int context, bool del = false, int timeout = -1 );
 
       /**
        * A convenience function that sends the given IQ stanza.
@@ -447,6 +470,23 @@ namespace gloox
        */
       void removeIDHandler( IqHandler* ih );
 
+      /**
+       * Sets the default number of seconds to wait for replies to IQs sent using
+       * send( IQ&, IqHandler*, int, bool, int ). Requests that are not answered in time are
+       * reported to their IqHandler as an error of type wait with condition remote-server-timeout.
+       * @param timeout The timeout in seconds. 0 (the default) waits forever.
+       * @since 1.1
+       */
+      void setIqTimeout( int timeout ) { m_iqTimeout = timeout; }
+
+      /**
+       * Reports all tracked IQ requests whose timeout has expired to their IqHandlers.
+       * This is called from recv() and handleTimer(). If you drive the connection through an
+       * EventLoop, register the ClientBase as a TimerHandler, e.g. with an interval of a second.
+       * @since 1.1
+       */
+      void checkIqTimeouts() { checkIqTimeouts( time( 0 ) ); }
+
       /**
        * Registers @c mh as object that receives Message stanza notifications.
        * @param mh The object to receive Message stanza notifications.
@@ -542,6 +582,10 @@ namespace gloox
        * @param ih The IqHandler.
        * @param exttype The extension type. See
        * @link gloox::StanzaExtensionType StanzaExtensionType @endlink.
+       * @note IQs are dispatched without holding a lock. If the handler is removed by another
+       * thread while an IQ is being dispatched to it, this function waits for the dispatch to
+       * finish. Afterwards the handler will not be called anymore and may be deleted. Do not
+       * call this while holding a lock that the handler may need.
        * @since 1.0
        */
       void removeIqHandler( IqHandler* ih, int exttype );
@@ -698,6 +742,18 @@ namespace gloox
        */
       const TagList sendQueue();
 
+      /**
+       * Limits the Stream Management (@xep{0198}) send queue, which holds sent but not yet
+       * acknowledged stanzas. If a limit is hit, further stanzas are still sent but not queued
+       * (and therefore not resent after stream resumption) until the server acknowledges some
+       * of the queued ones. Registered ConnectionListeners are notified by means of
+       * StreamEventSMQueueFull.
+       * @param maxBytes The maximum number of queued bytes. 0 (the default) means unlimited.
+       * @param maxStanzas The maximum number of queued stanzas. 0 (the default) means unlimited.
+       * @since 1.1
+       */
+      void setSendQueueLimits( size_t maxBytes, size_t maxStanzas );
+
       // reimplemented from ParserHandler
       virtual void handleTag( Tag* tag );
 
@@ -725,6 +781,9 @@ namespace gloox
       // reimplemented from TLSHandler
       virtual void handleHandshakeResult( const TLSBase* base, bool success, CertInfo &certinfo );
 
+      // reimplemented from TimerHandler
+      virtual void handleTimer( int id, int context );
+
     protected:
 #ifdef CLIENTBASE_TEST
     public:
@@ -769,6 +828,13 @@ namespace gloox
        */
       void notifyStreamEvent( StreamEvent event );
 
+      /**
+       * Reports all tracked IQ requests whose deadline is not later than @c now to their
+       * IqHandlers, see checkIqTimeouts().
+       * @param now The current time.
+       */
+      void checkIqTimeouts( time_t now );
+
       /**
        * Disconnects the underlying stream and broadcasts the given reason.
        * @param reason The reason for the disconnect.
@@ -869,6 +935,14 @@ namespace gloox
        */
       int stanzasSent() const { return m_smSent; }
 
+      /**
+       * Empties the send queue and resets the number of sent stanzas. Called when a new
+       * Stream Management session is requested.
+       * @note This function is part of @xep{0198}. You should not need to use it directly.
+       * @since 1.1
+       */
+      void resetQueue();
+
       /**
        * Returns 32 octets of random characters.
        * @return Random characters.
@@ -1022,11 +1096,16 @@ namespace gloox
       // reimplemented from IqHandler
       virtual void handleIqID( const IQ& iq, int context );
 
+      typedef std::multimap<time_t, std::string>           IqDeadlineMap;
+
       struct TrackStruct
       {
         IqHandler* ih;
         int context;
         bool del;
+        JID to;                           // reported as the sender of a timeout error
+        bool expires;
+        IqDeadlineMap::iterator deadline; // only valid if expires is true
       };
 
       struct TagHandlerStruct
@@ -1051,10 +1130,29 @@ namespace gloox
       typedef std::multimap<const std::string, IqHandler*> IqHandlerMapXmlns;
       typedef std::multimap<const int, IqHandler*>         IqHandlerMap;
       typedef std::map<const std::string, TrackStruct>     IqTrackMap;
+      typedef std::map<IqHandler*, std::set<std::string> > IqHandlerTrackMap;
+
+      // stops tracking an IQ ID, the caller must hold m_iqHandlerMapMutex
+      bool untrackIqID( const std::string& id, TrackStruct* track );
+
       typedef std::map<const std::string, MessageHandler*> MessageHandlerMap;
-      typedef std::map<int, Tag*>                          SMQueueMap;
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MESSAGESESSION )
-      typedef std::list<MessageSession*>                   MessageSessionList;
+      struct MessageSessionEntry
+      {
+        unsigned long serial;      // registration order, decides precedence
+        std::string full;          // the keys the session is indexed under
+        std::string bare;
+      };
+      typedef std::map<unsigned long, MessageSession*>       MessageSessionBucket;
+      typedef std::map<std::string, MessageSessionBucket>    MessageSessionIndex;
+      typedef std::map<MessageSession*, MessageSessionEntry> MessageSessionMap;
+
+      // called by MessageSession whenever its target changes
+      void updateMessageSession( MessageSession* session );
+      void indexMessageSession( MessageSession* session, MessageSessionEntry& entry );
+      void unindexMessageSession( const MessageSessionEntry& entry );
+      MessageSession* findMessageSession( const MessageSessionIndex& index, const std::string& key,
+                                          const Message& msg ) const;
 #endif // GLOOX_MINIMAL
       typedef std::list<MessageHandler*>                   MessageHandlerList;
       typedef std::list<PresenceHandler*>                  PresenceHandlerList;
@@ -1064,9 +1162,12 @@ namespace gloox
 
       ConnectionListenerList   m_connectionListeners;
       IqHandlerMapXmlns        m_iqNSHandlers;
-      IqHandlerMap             m_iqExtHandlers;
+      util::CopyOnWrite<IqHandlerMap> m_iqExtHandlers;  // read for every IQ without locking
       IqTrackMap               m_iqIDHandlers;
-      SMQueueMap               m_smQueue;
+      IqHandlerTrackMap        m_iqIDsByHandler;
+      IqDeadlineMap            m_iqDeadlines;
+      int                      m_iqTimeout;
+      SMQueue                  m_smQueue;
       MessageHandlerList       m_messageHandlers;
       PresenceHandlerList      m_presenceHandlers;
       PresenceJidHandlerList   m_presenceJidHandlers;
@@ -1077,16 +1178,18 @@ namespace gloox
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_MUC )
       MUCInvitationHandler   * m_mucInvitationHandler;
 #endif // GLOOX_MINIMAL
-#if !defined( GLOOX_MINIMAL ) || defined( WANT_ )
-      MessageSessionList       m_messageSessions;
+#if !defined( GLOOX_MINIMAL ) || defined( WANT_MESSAGESESSION )
+      MessageSessionMap        m_messageSessions;
+      MessageSessionIndex      m_messageSessionsFull;
+      MessageSessionIndex      m_messageSessionsBare;
       MessageSessionHandler  * m_messageSessionHandlerChat;
       MessageSessionHandler  * m_messageSessionHandlerGroupchat;
       MessageSessionHandler  * m_messageSessionHandlerHeadline;
       MessageSessionHandler  * m_messageSessionHandlerNormal;
+      unsigned long            m_messageSessionSerial;
 #endif // GLOOX_MINIMAL
 
       util::Mutex m_iqHandlerMapMutex;
-      util::Mutex m_iqExtHandlerMapMutex;
       util::Mutex m_queueMutex;
 
       Parser m_parser;
@@ -1114,6 +1217,7 @@ namespace gloox
       util::AtomicRefCount m_nextId;
 
       int m_smSent;
+      bool m_smQueueFull;
 
 #if defined( _WIN32 )
       CredHandle m_credHandle;
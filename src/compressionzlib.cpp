@@ -12,14 +12,16 @@
 
 
 #include "compressionzlib.h"
+#include "mutexguard.h"
 
 #ifdef HAVE_ZLIB
 
 namespace gloox
 {
 
-  CompressionZlib::CompressionZlib( CompressionDataHandler* cdh )
-    : CompressionBase( cdh )
+  CompressionZlib::CompressionZlib( CompressionDataHandler* cdh, int level, int strategy )
+    : CompressionBase( cdh ), m_level( level ), m_strategy( strategy ), m_deflateLevel( level ),
+      m_deflateStrategy( strategy ), m_paramsChanged( false )
   {
   }
 
@@ -38,12 +40,18 @@ namespace gloox
     m_zdeflate.zalloc = Z_NULL;
     m_zdeflate.zfree = Z_NULL;
     m_zdeflate.opaque = Z_NULL;
-    m_zinflate.avail_in = 0;
-    m_zinflate.next_in = Z_NULL;
-    ret = deflateInit( &m_zdeflate, Z_BEST_COMPRESSION/*Z_DEFAULT_COMPRESSION*/ );
+    m_zdeflate.avail_in = 0;
+    m_zdeflate.next_in = Z_NULL;
+    ret = deflateInit2( &m_zdeflate, m_level, Z_DEFLATED, MAX_WBITS, 8, m_strategy );
     if( ret != Z_OK )
+    {
+      inflateEnd( &m_zinflate );
       return false;
+    }
 
+    m_deflateLevel = m_level;
+    m_deflateStrategy = m_strategy;
+    m_paramsChanged = false;
     m_valid = true;
     return true;
   }
@@ -53,6 +61,27 @@ namespace gloox
     cleanup();
   }
 
+  void CompressionZlib::setParameters( int level, int strategy )
+  {
+    util::MutexGuard m( m_compressMutex );
+
+    m_level = level;
+    m_strategy = strategy;
+    m_paramsChanged = true;
+  }
+
+  int CompressionZlib::level() const
+  {
+    util::MutexGuard m( m_compressMutex );
+    return m_level;
+  }
+
+  int CompressionZlib::strategy() const
+  {
+    util::MutexGuard m( m_compressMutex );
+    return m_strategy;
+  }
+
   void CompressionZlib::compress( const std::string& data )
   {
     if( !m_valid )
@@ -61,27 +90,46 @@ namespace gloox
     if( !m_valid || !m_handler || data.empty() )
       return;
 
-    long unsigned int CHUNK = data.length() + ( data.length() / 100 ) + 13;
-    Bytef* out = new Bytef[CHUNK];
-    char* in = const_cast<char*>( data.c_str() );
+    std::string result;
 
     m_compressMutex.lock();
 
-    m_zdeflate.avail_in = static_cast<uInt>( data.length() );
-    m_zdeflate.next_in = reinterpret_cast<Bytef*>( in );
+    m_zdeflate.avail_out = BufferSize;
+    m_zdeflate.next_out = m_deflateBuffer;
 
-    std::string result;
-    do {
-      m_zdeflate.avail_out = static_cast<uInt>( CHUNK );
-      m_zdeflate.next_out = reinterpret_cast<Bytef*>( out );
+    // everything has been flushed by the previous call, so any output
+    // produced by switching parameters ends up in our buffer, too
+    // if zlib rejects the new parameters, the stream goes on with the old ones
+    if( m_paramsChanged )
+    {
+      if( deflateParams( &m_zdeflate, m_level, m_strategy ) == Z_OK )
+      {
+        m_deflateLevel = m_level;
+        m_deflateStrategy = m_strategy;
+      }
+      else
+      {
+        m_level = m_deflateLevel;
+        m_strategy = m_deflateStrategy;
+      }
+      m_paramsChanged = false;
+    }
+
+    m_zdeflate.avail_in = static_cast<uInt>( data.length() );
+    m_zdeflate.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( data.data() ) );
 
+    for( ;; )
+    {
       deflate( &m_zdeflate, Z_SYNC_FLUSH );
-      result.append( reinterpret_cast<char*>( out ), CHUNK - m_zdeflate.avail_out );
-    } while( m_zdeflate.avail_out == 0 );
+      result.append( reinterpret_cast<char*>( m_deflateBuffer ), BufferSize - m_zdeflate.avail_out );
+      if( m_zdeflate.avail_out != 0 )
+        break;
 
-    m_compressMutex.unlock();
+      m_zdeflate.avail_out = BufferSize;
+      m_zdeflate.next_out = m_deflateBuffer;
+    }
 
-    delete[] out;
+    m_compressMutex.unlock();
 
     m_handler->handleCompressedData( result );
   }
@@ -94,25 +142,19 @@ namespace gloox
     if( !m_valid || !m_handler || data.empty() )
       return;
 
-    int CHUNK = 50;
-    char* out = new char[CHUNK];
-    char* in = const_cast<char*>( data.c_str() );
-
     m_zinflate.avail_in = static_cast<uInt>( data.length() );
-    m_zinflate.next_in = reinterpret_cast<Bytef*>( in );
+    m_zinflate.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( data.data() ) );
 
     std::string result;
     do
     {
-      m_zinflate.avail_out = CHUNK;
-      m_zinflate.next_out = reinterpret_cast<Bytef*>( out );
+      m_zinflate.avail_out = BufferSize;
+      m_zinflate.next_out = m_inflateBuffer;
 
       inflate( &m_zinflate, Z_SYNC_FLUSH );
-      result.append( out, CHUNK - m_zinflate.avail_out );
+      result.append( reinterpret_cast<char*>( m_inflateBuffer ), BufferSize - m_zinflate.avail_out );
     } while( m_zinflate.avail_out == 0 );
 
-    delete[] out;
-
     m_handler->handleDecompressedData( result );
   }
 
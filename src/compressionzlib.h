@@ -39,8 +39,14 @@ namespace gloox
       /**
        * Contructor.
        * @param cdh The CompressionDataHandler to receive de/compressed data.
+       * @param level The zlib compression level to use, from @c Z_NO_COMPRESSION (0) to
+       * @c Z_BEST_COMPRESSION (9), or @c Z_DEFAULT_COMPRESSION. Lower levels trade bandwidth
+       * for CPU time.
+       * @param strategy The zlib compression strategy, e.g. @c Z_DEFAULT_STRATEGY or
+       * @c Z_FILTERED.
        */
-      CompressionZlib( CompressionDataHandler* cdh );
+      CompressionZlib( CompressionDataHandler* cdh, int level = Z_BEST_COMPRESSION,
+                       int strategy = Z_DEFAULT_STRATEGY );
 
       /**
        * Virtual Destructor.
@@ -59,11 +65,46 @@ namespace gloox
       // reimplemented from CompressionBase
       virtual void cleanup();
 
+      /**
+       * Changes the compression level and strategy. This can be done at any time, also
+       * while the stream is active. The new parameters take effect with the next call
+       * to compress().
+       * @param level The zlib compression level to use. See the constructor.
+       * @param strategy The zlib compression strategy to use. See the constructor.
+       * @since 1.1
+       */
+      void setParameters( int level, int strategy = Z_DEFAULT_STRATEGY );
+
+      /**
+       * Returns the current compression level.
+       * @return The current compression level.
+       * @since 1.1
+       */
+      int level() const;
+
+      /**
+       * Returns the current compression strategy.
+       * @return The current compression strategy.
+       * @since 1.1
+       */
+      int strategy() const;
+
     private:
+      enum { BufferSize = 16384 }; // the size of the inflate and deflate output buffers
+
       z_stream m_zinflate;
       z_stream m_zdeflate;
 
-      util::Mutex m_compressMutex;
+      Bytef m_inflateBuffer[BufferSize];
+      Bytef m_deflateBuffer[BufferSize];
+
+      int m_level;
+      int m_strategy;
+      int m_deflateLevel;           // the parameters m_zdeflate currently uses
+      int m_deflateStrategy;
+      bool m_paramsChanged;
+
+      mutable util::Mutex m_compressMutex;
 
   };
 
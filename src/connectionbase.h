@@ -20,6 +20,8 @@
 
 #include <string>
 
+#include <stdint.h>
+
 namespace gloox
 {
 
@@ -88,6 +90,48 @@ namespace gloox
        */
       virtual void cleanup() {}
 
+      /**
+       * Sends a range of a file over the wire. Where supported, the data is handed from the file
+       * to the socket by the kernel and never copied into user space. The function returns only
+       * after the range has been sent (or the end of the file has been reached).
+       * Offsets and lengths are 64 bits wide on all platforms, so files larger than 2 GB work
+       * where @c long has only 32 bits (Windows, 32-bit Unices).
+       * @param fd A file descriptor opened for reading. Its file position is not changed.
+       * @param offset The offset of the first byte to send.
+       * @param length The number of bytes to send.
+       * @return The number of bytes sent, or -1 if an error occured or if this connection
+       * can not send files this way. In the latter case, read the file and use send().
+       * @since 1.1
+       */
+      virtual int64_t sendFile( int /*fd*/, int64_t /*offset*/, int64_t /*length*/ ) { return -1; }
+
+      /**
+       * Receives data directly into the given buffer. The data is @b not passed to the
+       * ConnectionDataHandler.
+       * @param buffer The buffer to receive into.
+       * @param length The size of the buffer.
+       * @param timeout The timeout to use for select in microseconds. Default of -1 means blocking.
+       * @return The number of bytes received (0 if no data arrived within @c timeout), or -1
+       * if an error occured or if this connection can not receive data this way. In the
+       * latter case, use recv().
+       * @since 1.1
+       */
+      virtual int64_t recvInto( char* /*buffer*/, int64_t /*length*/, int /*timeout*/ = -1 ) { return -1; }
+
+      /**
+       * Receives data directly into a file. Where supported, the data is moved from the socket
+       * to the file by the kernel and never copied into user space. The data is @b not passed to
+       * the ConnectionDataHandler.
+       * @param fd A file descriptor opened for writing.
+       * @param length The maximum number of bytes to receive.
+       * @param timeout The timeout to use for select in microseconds. Default of -1 means blocking.
+       * @return The number of bytes received and written (0 if no data arrived within
+       * @c timeout), or -1 if an error occured or if this connection can not receive data
+       * this way. In the latter case, use recv().
+       * @since 1.1
+       */
+      virtual int64_t recvToFile( int /*fd*/, int64_t /*length*/, int /*timeout*/ = -1 ) { return -1; }
+
       /**
        * Returns the current connection state.
        * @return The state of the connection.
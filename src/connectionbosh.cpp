@@ -38,7 +38,7 @@ namespace gloox
       m_logInstance( logInstance ), m_parser( this ), m_boshHost( boshHost ), m_path( "/http-bind/" ),
       m_rid( 0 ), m_initialStreamSent( false ), m_openRequests( 0 ),
       m_maxOpenRequests( 2 ), m_wait( 30 ), m_hold( 1 ), m_streamRestart( false ),
-      m_lastRequestTime( std::time( 0 ) ), m_minTimePerRequest( 0 ), m_bufferContentLength( 0 ),
+      m_lastRequestTime( std::time( 0 ) ), m_minTimePerRequest( 0 ),
       m_connMode( ModePipelining )
   {
     initInstance( connection, xmppServer, xmppPort );
@@ -51,7 +51,7 @@ namespace gloox
       m_logInstance( logInstance ), m_parser( this ), m_boshHost( boshHost ), m_path( "/http-bind/" ),
       m_rid( 0 ),  m_initialStreamSent( false ), m_openRequests( 0 ),
       m_maxOpenRequests( 2 ), m_wait( 30 ), m_hold( 1 ), m_streamRestart( false ),
-      m_lastRequestTime( std::time( 0 ) ), m_minTimePerRequest( 0 ), m_bufferContentLength( 0 ),
+      m_lastRequestTime( std::time( 0 ) ), m_minTimePerRequest( 0 ),
       m_connMode( ModePipelining )
   {
     initInstance( connection, xmppServer, xmppPort );
@@ -131,19 +131,24 @@ namespace gloox
     {
       ++m_rid;
 
-      std::string requestBody = "<body rid='" + util::long2string( m_rid ) + "' ";
-      requestBody += "sid='" + m_sid + "' ";
-      requestBody += "type='terminal' ";
-      requestBody += "xml:lang='en' ";
-      requestBody += "xmlns='" + XMLNS_HTTPBIND + "'";
+      m_requestBody.clear();
+      m_requestBody += "<body rid='";
+      m_requestBody += util::long2string( m_rid );
+      m_requestBody += "' sid='";
+      m_requestBody += m_sid;
+      m_requestBody += "' type='terminal' xml:lang='en' xmlns='";
+      m_requestBody += XMLNS_HTTPBIND;
+      m_requestBody += "'";
       if( m_sendBuffer.empty() )  // Make sure that any data in the send buffer gets sent
-        requestBody += "/>";
+        m_requestBody += "/>";
       else
       {
-        requestBody += ">" + m_sendBuffer + "</body>";
-        m_sendBuffer = EmptyString;
+        m_requestBody += ">";
+        m_requestBody += m_sendBuffer;
+        m_requestBody += "</body>";
+        m_sendBuffer.clear();
       }
-      sendRequest( requestBody );
+      sendRequest( m_requestBody );
 
       m_logInstance.dbg( LogAreaClassConnectionBOSH, "BOSH disconnection request sent" );
     }
@@ -155,6 +160,7 @@ namespace gloox
 
     util::ForEach( m_activeConnections, &ConnectionBase::disconnect );
     util::ForEach( m_connectionPool, &ConnectionBase::disconnect );
+    m_buffers.clear();
 
     m_state = StateDisconnected;
     if( m_handler )
@@ -170,8 +176,22 @@ namespace gloox
 
     if( !m_connectionPool.empty() )
       ret = m_connectionPool.front()->recv( 0 );
+
+    // with more than one open request, replies may arrive on any of the active connections.
+    // handleReceivedData() may move connections to the pool, so iterate over a copy
     if( !m_activeConnections.empty() )
-      ret = m_activeConnections.front()->recv( timeout );
+    {
+      const ConnectionList active( m_activeConnections );
+      ConnectionList::const_iterator it = active.begin();
+      ret = ConnNoError;
+      while( it != active.end() )
+      {
+        ConnectionBase* conn = (*it);
+        const ConnectionError e = conn->recv( ++it == active.end() ? timeout : 0 );
+        if( e != ConnNoError )
+          ret = e;
+      }
+    }
 
     // If there are no open requests then the spec allows us to send an empty request...
     // (Some CMs do not obey this, it seems)
@@ -239,25 +259,36 @@ namespace gloox
 
     ++m_rid;
 
-    std::string requestBody = "<body rid='" + util::long2string( m_rid ) + "' ";
-    requestBody += "sid='" + m_sid + "' ";
-    requestBody += "xmlns='" + XMLNS_HTTPBIND + "'";
+    m_requestBody.clear();
+    m_requestBody += "<body rid='";
+    m_requestBody += util::long2string( m_rid );
+    m_requestBody += "' sid='";
+    m_requestBody += m_sid;
+    m_requestBody += "' xmlns='";
+    m_requestBody += XMLNS_HTTPBIND;
+    m_requestBody += "'";
 
     if( m_streamRestart )
     {
-      requestBody += " xmpp:restart='true' to='" + m_server + "' xml:lang='en' xmlns:xmpp='"
-          + XMLNS_XMPP_BOSH + "' />";
+      m_requestBody += " xmpp:restart='true' to='";
+      m_requestBody += m_server;
+      m_requestBody += "' xml:lang='en' xmlns:xmpp='";
+      m_requestBody += XMLNS_XMPP_BOSH;
+      m_requestBody += "' />";
       m_logInstance.dbg( LogAreaClassConnectionBOSH, "Restarting stream" );
     }
     else
     {
-      requestBody += ">" + m_sendBuffer + "</body>";
+      // everything buffered since the last request goes out in this one
+      m_requestBody += ">";
+      m_requestBody += m_sendBuffer;
+      m_requestBody += "</body>";
     }
     // Send a request. Force if we are not sending an empty request, or if there are no connections open
-    if( sendRequest( requestBody ) )
+    if( sendRequest( m_requestBody ) )
     {
       m_logInstance.dbg( LogAreaClassConnectionBOSH, "Successfully sent m_sendBuffer" );
-      m_sendBuffer = EmptyString;
+      m_sendBuffer.clear();
       m_streamRestart = false;
     }
     else
@@ -278,23 +309,32 @@ namespace gloox
     if( !conn )
       return false;
 
-    std::string request = "POST " + m_path;
-    if( m_connMode == ModeLegacyHTTP )
+    // the header fields only change with the path and the connection mode
+    if( m_requestHeader.empty() )
     {
-      request += " HTTP/1.0\r\n";
-      request += "Connection: close\r\n";
-    }
-    else
-      request += " HTTP/1.1\r\n";
+      m_requestHeader = "POST " + m_path;
+      if( m_connMode == ModeLegacyHTTP )
+      {
+        m_requestHeader += " HTTP/1.0\r\n";
+        m_requestHeader += "Connection: close\r\n";
+      }
+      else
+        m_requestHeader += " HTTP/1.1\r\n";
 
-    request += "Host: " + m_boshedHost + "\r\n";
-    request += "Content-Type: text/xml; charset=utf-8\r\n";
-    request += "Content-Length: " + util::long2string( xml.length() ) + "\r\n";
-    request += "User-Agent: gloox/" + GLOOX_VERSION + "\r\n\r\n";
-    request += xml;
+      m_requestHeader += "Host: " + m_boshedHost + "\r\n";
+      m_requestHeader += "Content-Type: text/xml; charset=utf-8\r\n";
+      m_requestHeader += "User-Agent: gloox/" + GLOOX_VERSION + "\r\n";
+    }
 
+    m_request.clear();
+    m_request.reserve( m_requestHeader.length() + xml.length() + 32 );
+    m_request += m_requestHeader;
+    m_request += "Content-Length: ";
+    m_request += util::long2string( static_cast<long>( xml.length() ) );
+    m_request += "\r\n\r\n";
+    m_request += xml;
 
-    if( conn->send( request ) )
+    if( conn->send( m_request ) )
     {
       m_lastRequestTime = time( 0 );
       ++m_openRequests;
@@ -306,35 +346,53 @@ namespace gloox
     return false;
   }
 
-  bool ci_equal( char ch1, char ch2 )
-  {
-    return std::toupper( ch1 ) == std::toupper( ch2 );
-  }
-
-  std::string::size_type ci_find( const std::string& str1, const std::string& str2 )
+  /* Compares the range [begin, end) case-insensitively with a lower-case string. */
+  static bool ci_equal( std::string::const_iterator begin, std::string::const_iterator end,
+                        const char* lower )
   {
-    std::string::const_iterator pos = std::search( str1.begin(), str1.end(),
-                                                   str2.begin(), str2.end(), ci_equal );
-    if( pos == str1.end() )
-      return std::string::npos;
-    else
-      return std::distance( str1.begin(), pos );
+    for( ; begin != end && *lower; ++begin, ++lower )
+    {
+      if( std::tolower( static_cast<unsigned char>( *begin ) ) != *lower )
+        return false;
+    }
+    return begin == end && !*lower;
   }
 
-  const std::string ConnectionBOSH::getHTTPField( const std::string& field )
+  void ConnectionBOSH::parseHTTPHeader( const std::string& buffer, std::string::size_type headerLength,
+                                        HTTPHeader& header )
   {
-    std::string::size_type fp = ci_find( m_bufferHeader, "\r\n" + field + ": " );
-
-    if( fp == std::string::npos )
-      return EmptyString;
-
-    fp += field.length() + 4;
-
-    const std::string::size_type fp2 = m_bufferHeader.find( "\r\n", fp );
-    if( fp2 == std::string::npos )
-      return EmptyString;
+    header.status = headerLength >= 12 ? buffer.substr( 9, 3 ) : EmptyString;
+    header.http10 = buffer.compare( 0, 8, "HTTP/1.0" ) == 0;
+    header.close = false;
+    header.contentLength = 0;
+
+    // one pass over the header lines, the status line is skipped
+    std::string::size_type line = buffer.find( "\r\n" );
+    while( line < headerLength )
+    {
+      line += 2;
+      std::string::size_type eol = buffer.find( "\r\n", line );
+      if( eol > headerLength )
+        eol = headerLength;
+
+      const std::string::const_iterator begin = buffer.begin() + line;
+      const std::string::const_iterator end = buffer.begin() + eol;
+      const std::string::const_iterator colon = std::find( begin, end, ':' );
+      if( colon != end )
+      {
+        std::string::const_iterator value = colon + 1;
+        while( value != end && ( *value == ' ' || *value == '\t' ) )
+          ++value;
+
+        if( ci_equal( begin, colon, "content-length" ) )
+          // through c_str(), the value may be empty and end the buffer
+          header.contentLength = std::strtoul( buffer.c_str() + ( value - buffer.begin() ), 0, 10 );
+        else if( ci_equal( begin, colon, "connection" ) )
+          header.close = ci_equal( value, end, "close" );
+      }
 
-    return m_bufferHeader.substr( fp, fp2 - fp );
+      line = eol;
+    }
   }
 
   ConnectionError ConnectionBOSH::receive()
@@ -351,6 +409,7 @@ namespace gloox
 
     util::ForEach( m_activeConnections, &ConnectionBase::cleanup );
     util::ForEach( m_connectionPool, &ConnectionBase::cleanup );
+    m_buffers.clear();
   }
 
   void ConnectionBOSH::getStatistics( long int& totalIn, long int& totalOut )
@@ -359,46 +418,48 @@ namespace gloox
     util::ForEach( m_connectionPool, &ConnectionBase::getStatistics, totalIn, totalOut );
   }
 
-  void ConnectionBOSH::handleReceivedData( const ConnectionBase* /*connection*/,
+  void ConnectionBOSH::handleReceivedData( const ConnectionBase* connection,
                                            const std::string& data )
   {
-    m_buffer += data;
+    // responses are buffered per transport connection, as several requests may be open.
+    // the buffer is taken out of the map while it is parsed, as the connection may be
+    // dropped (and its buffer erased) from within this loop
+    std::string buffer;
+    buffer.swap( m_buffers[connection] );
+    buffer += data;
     std::string::size_type headerLength = 0;
-    while( ( headerLength = m_buffer.find( "\r\n\r\n" ) ) != std::string::npos )
+    while( ( headerLength = buffer.find( "\r\n\r\n" ) ) != std::string::npos )
     {
-      m_bufferHeader = m_buffer.substr( 0, headerLength+2 );
+      HTTPHeader header;
+      parseHTTPHeader( buffer, headerLength, header );
 
-      const std::string& statusCode = m_bufferHeader.substr( 9, 3 );
-      if( statusCode != "200" )
+      if( header.status != "200" )
       {
         m_logInstance.warn( LogAreaClassConnectionBOSH,
-                            "Received error via legacy HTTP status code: " + statusCode
+                            "Received error via legacy HTTP status code: " + header.status
                                 + ". Disconnecting." );
         m_state = StateDisconnected; // As per XEP, consider connection broken
         disconnect();
       }
 
-      m_bufferContentLength = atol( getHTTPField( "Content-Length" ).c_str() );
-      if( !m_bufferContentLength )
-        return;
+      if( !header.contentLength )
+        break;
 
-      if( m_connMode != ModeLegacyHTTP && ( getHTTPField( "Connection" ) == "close"
-                                            || m_bufferHeader.substr( 0, 8 ) == "HTTP/1.0" ) )
+      if( m_connMode != ModeLegacyHTTP && ( header.close || header.http10 ) )
       {
         m_logInstance.dbg( LogAreaClassConnectionBOSH,
                             "Server indicated lack of support for HTTP/1.1 - falling back to HTTP/1.0" );
         m_connMode = ModeLegacyHTTP;
+        m_requestHeader = EmptyString;
       }
 
-      if( m_buffer.length() >= ( headerLength + 4 + m_bufferContentLength ) )
+      const std::string::size_type length = headerLength + 4 + header.contentLength;
+      if( buffer.length() >= length )
       {
-        putConnection();
+        putConnection( connection );
         --m_openRequests;
-        std::string xml = m_buffer.substr( headerLength + 4, m_bufferContentLength );
-        m_parser.feed( xml );
-        m_buffer.erase( 0, headerLength + 4 + m_bufferContentLength );
-        m_bufferContentLength = 0;
-        m_bufferHeader = EmptyString;
+        m_parser.feed( buffer.data() + headerLength + 4, header.contentLength );
+        buffer.erase( 0, length );
       }
       else
       {
@@ -406,6 +467,11 @@ namespace gloox
         break;
       }
     }
+
+    // put the buffer (and its capacity) back, unless the connection has been dropped meanwhile
+    BufferMap::iterator it = m_buffers.find( connection );
+    if( it != m_buffers.end() )
+      (*it).second.swap( buffer );
   }
 
   void ConnectionBOSH::handleConnect( const ConnectionBase* /*connection*/ )
@@ -435,9 +501,12 @@ namespace gloox
     }
   }
 
-  void ConnectionBOSH::handleDisconnect( const ConnectionBase* /*connection*/,
+  void ConnectionBOSH::handleDisconnect( const ConnectionBase* connection,
                                          ConnectionError reason )
   {
+    // partial responses must not be mistaken for the start of the next one
+    m_buffers.erase( connection );
+
     if( m_handler && m_state == StateConnecting )
     {
       m_state = StateDisconnected;
@@ -449,6 +518,7 @@ namespace gloox
     {
       case ModePipelining:
         m_connMode = ModeLegacyHTTP; // Server seems not to support pipelining
+        m_requestHeader = EmptyString;
         m_logInstance.dbg( LogAreaClassConnectionBOSH,
                            "Connection closed - falling back to HTTP/1.0 connection method" );
         break;
@@ -524,6 +594,8 @@ namespace gloox
       if( m_state < StateConnected )
         m_handler->handleConnect( this );
 
+      warmUp();
+
       m_handler->handleReceivedData( this, "<?xml version='1.0' ?>" // FIXME move to send() so that
                                                                     // it is more clearly a response
                                                                     // to the initial stream opener?
@@ -604,6 +676,19 @@ namespace gloox
 
   ConnectionBase* ConnectionBOSH::activateConnection()
   {
+    // prefer a pooled connection that is still open over (re-)connecting one
+    ConnectionList::iterator it = m_connectionPool.begin();
+    for( ; it != m_connectionPool.end(); ++it )
+    {
+      if( (*it)->state() == StateConnected )
+      {
+        ConnectionBase* conn = (*it);
+        m_connectionPool.erase( it );
+        m_activeConnections.push_back( conn );
+        return conn;
+      }
+    }
+
     ConnectionBase* conn = m_connectionPool.front();
     m_connectionPool.pop_front();
     if( conn->state() == StateConnected )
@@ -618,9 +703,14 @@ namespace gloox
     return 0;
   }
 
-  void ConnectionBOSH::putConnection()
+  void ConnectionBOSH::putConnection( const ConnectionBase* connection )
   {
-    ConnectionBase* conn = m_activeConnections.front();
+    ConnectionList::iterator it = std::find( m_activeConnections.begin(), m_activeConnections.end(),
+                                             connection );
+    if( it == m_activeConnections.end() )
+      return;
+
+    ConnectionBase* conn = (*it);
 
     switch( m_connMode )
     {
@@ -628,12 +718,13 @@ namespace gloox
         m_logInstance.dbg( LogAreaClassConnectionBOSH, "Disconnecting LegacyHTTP connection" );
         conn->disconnect();
         conn->cleanup(); // This is necessary
-        m_activeConnections.pop_front();
+        m_buffers.erase( conn );
+        m_activeConnections.erase( it );
         m_connectionPool.push_back( conn );
         break;
       case ModePersistentHTTP:
         m_logInstance.dbg( LogAreaClassConnectionBOSH, "Deactivating PersistentHTTP connection" );
-        m_activeConnections.pop_front();
+        m_activeConnections.erase( it );
         m_connectionPool.push_back( conn );
         break;
       case ModePipelining:
@@ -643,6 +734,31 @@ namespace gloox
     }
   }
 
+  void ConnectionBOSH::warmUp()
+  {
+    if( m_connMode != ModePersistentHTTP )
+      return;
+
+    ConnectionBase* proto = !m_connectionPool.empty() ? m_connectionPool.front()
+                              : ( !m_activeConnections.empty() ? m_activeConnections.front() : 0 );
+    if( !proto )
+      return;
+
+    // keep one connection per possible open request, so that no request has to wait for a connect
+    int count = static_cast<int>( m_connectionPool.size() + m_activeConnections.size() );
+    for( ; count < m_maxOpenRequests; ++count )
+    {
+      ConnectionBase* conn = proto->newInstance();
+      if( !conn )
+        return;
+
+      m_logInstance.dbg( LogAreaClassConnectionBOSH, "Opening PersistentHTTP connection for the pool" );
+      conn->registerConnectionDataHandler( this );
+      m_connectionPool.push_back( conn );
+      conn->connect();
+    }
+  }
+
 }
 
 #endif // GLOOX_MINIMAL
@@ -24,6 +24,7 @@
 
 #include <string>
 #include <list>
+#include <map>
 #include <ctime>
 
 namespace gloox
@@ -130,7 +131,7 @@ namespace gloox
        * @param path The path, the default is "/http-bind/", which is the default for
        * many connection managers.
        */
-      void setPath( const std::string& path ) { m_path = path; }
+      void setPath( const std::string& path ) { m_path = path; m_requestHeader = EmptyString; }
 
       /**
        * Sets the connection mode
@@ -138,8 +139,10 @@ namespace gloox
        * @note In the case that a mode is selected that the connection manager
        * or proxy does not support, gloox will fall back to using HTTP/1.0 connections,
        * which should work with any server.
+       * @note In ModePersistentHTTP, once the session is established, as many transport connections
+       * as the connection manager allows requests to be open at a time are kept open and re-used.
        */
-      void setMode( ConnMode mode ) { m_connMode = mode; }
+      void setMode( ConnMode mode ) { m_connMode = mode; m_requestHeader = EmptyString; }
 
       // reimplemented from ConnectionBase
       virtual ConnectionError connect();
@@ -180,12 +183,22 @@ namespace gloox
     private:
       ConnectionBOSH& operator=( const ConnectionBOSH& );
       void initInstance( ConnectionBase* connection, const std::string& xmppServer, const int xmppPort );
+      struct HTTPHeader
+      {
+        std::string status;                        // the HTTP status code
+        bool http10;                               // whether the response is HTTP/1.0
+        bool close;                                // whether the response has 'Connection: close'
+        std::string::size_type contentLength;
+      };
+
       bool sendRequest( const std::string& xml );
       bool sendXML();
-      const std::string getHTTPField( const std::string& field );
+      static void parseHTTPHeader( const std::string& buffer, std::string::size_type headerLength,
+                                   HTTPHeader& header );
       ConnectionBase* getConnection();
       ConnectionBase* activateConnection();
-      void putConnection();
+      void putConnection( const ConnectionBase* connection );
+      void warmUp();
 
       //ConnectionBase *m_connection;
       const LogSink& m_logInstance;
@@ -210,11 +223,13 @@ namespace gloox
       time_t m_lastRequestTime;
       unsigned long m_minTimePerRequest;
 
-      std::string m_buffer;   // Buffer of received data
-      std::string m_bufferHeader;   // HTTP header of data currently in buffer // FIXME doens't need to be member
-      std::string::size_type m_bufferContentLength;   // Length of the data in the current response
+      typedef std::map<const ConnectionBase*, std::string> BufferMap;
+      BufferMap m_buffers;   // Buffers of received data, per transport connection
 
       std::string m_sendBuffer;   // Data waiting to be sent
+      std::string m_requestHeader;   // The constant part of the HTTP request header
+      std::string m_requestBody;   // Re-used to build the <body/> of a request
+      std::string m_request;   // Re-used to build a complete HTTP request
 
       typedef std::list<ConnectionBase*> ConnectionList;
       ConnectionList m_activeConnections;
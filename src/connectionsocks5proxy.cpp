@@ -135,6 +135,21 @@ namespace gloox
       return ConnNotConnected;
   }
 
+  int64_t ConnectionSOCKS5Proxy::sendFile( int fd, int64_t offset, int64_t length )
+  {
+    return m_connection ? m_connection->sendFile( fd, offset, length ) : -1;
+  }
+
+  int64_t ConnectionSOCKS5Proxy::recvInto( char* buffer, int64_t length, int timeout )
+  {
+    return m_connection ? m_connection->recvInto( buffer, length, timeout ) : -1;
+  }
+
+  int64_t ConnectionSOCKS5Proxy::recvToFile( int fd, int64_t length, int timeout )
+  {
+    return m_connection ? m_connection->recvToFile( fd, length, timeout ) : -1;
+  }
+
   bool ConnectionSOCKS5Proxy::send( const std::string& data )
   {
 //     if( m_s5state != S5StateConnected )
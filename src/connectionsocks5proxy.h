@@ -115,6 +115,15 @@ namespace gloox
       // reimplemented from ConnectionBase
       virtual void getStatistics( long int &totalIn, long int &totalOut );
 
+      // reimplemented from ConnectionBase
+      virtual int64_t sendFile( int fd, int64_t offset, int64_t length );
+
+      // reimplemented from ConnectionBase
+      virtual int64_t recvInto( char* buffer, int64_t length, int timeout = -1 );
+
+      // reimplemented from ConnectionBase
+      virtual int64_t recvToFile( int fd, int64_t length, int timeout = -1 );
+
       // reimplemented from ConnectionDataHandler
       virtual void handleReceivedData( const ConnectionBase* connection, const std::string& data );
 
@@ -12,13 +12,17 @@
 
 
 
+#include "config.h" // large file support, before any system header
+
 #include "gloox.h"
 
 #include "connectiontcpbase.h"
 #include "dns.h"
+#include "eventloop.h"
 #include "logsink.h"
 #include "prep.h"
 #include "mutexguard.h"
+#include "sendqueuehandler.h"
 #include "util.h"
 
 #if !defined( _WIN32 ) && !defined( _WIN32_WCE )
@@ -26,6 +30,8 @@
 # include <sys/types.h>
 # include <sys/socket.h>
 # include <sys/select.h>
+# include <sys/uio.h>
+# include <poll.h>
 # include <netinet/in.h>
 # include <unistd.h>
 # include <string.h>
@@ -33,6 +39,11 @@
 # include <netdb.h>
 #endif
 
+#if defined( __linux__ )
+# include <fcntl.h>
+# include <sys/sendfile.h>
+#endif
+
 #if defined( _WIN32 ) || defined( __MINGW32__ )
 # include <winsock2.h>
 # include <ws2tcpip.h>
@@ -41,9 +52,22 @@ typedef int socklen_t;
 
 #include <ctime>
 
+#include <algorithm>
 #include <cstdlib>
 #include <string>
 
+#if defined( _WIN32 ) || !defined( MSG_DONTWAIT )
+# define GLOOX_BLOCKING_QUEUE
+#endif
+
+// recvInto() and recvToFile() check dataAvailable() first, so a plain recv() is fine where
+// there is no MSG_DONTWAIT
+#if defined( _WIN32 ) || !defined( MSG_DONTWAIT )
+# define GLOOX_RECV_DONTWAIT 0
+#else
+# define GLOOX_RECV_DONTWAIT MSG_DONTWAIT
+#endif
+
 namespace gloox
 {
 
@@ -51,7 +75,9 @@ namespace gloox
                                         const std::string& server, int port )
     : ConnectionBase( 0 ),
       m_logInstance( logInstance ), m_buf( 0 ), m_socket( -1 ), m_totalBytesIn( 0 ),
-      m_totalBytesOut( 0 ), m_bufsize( 8192 ), m_cancel( true )
+      m_totalBytesOut( 0 ), m_bufsize( 8192 ), m_cancel( true ), m_sendQueueHandler( 0 ),
+      m_sendOffset( 0 ), m_sendQueueBytes( 0 ), m_highWater( 0 ), m_nonBlocking( false ),
+      m_cork( false ), m_queueFull( false ), m_eventLoop( 0 ), m_writeInterest( false )
   {
     init( server, port );
   }
@@ -60,7 +86,9 @@ namespace gloox
                                         const std::string& server, int port )
     : ConnectionBase( cdh ),
       m_logInstance( logInstance ), m_buf( 0 ), m_socket( -1 ), m_totalBytesIn( 0 ),
-      m_totalBytesOut( 0 ), m_bufsize( 8192 ), m_cancel( true )
+      m_totalBytesOut( 0 ), m_bufsize( 8192 ), m_cancel( true ), m_sendQueueHandler( 0 ),
+      m_sendOffset( 0 ), m_sendQueueBytes( 0 ), m_highWater( 0 ), m_nonBlocking( false ),
+      m_cork( false ), m_queueFull( false ), m_eventLoop( 0 ), m_writeInterest( false )
   {
     init( server, port );
   }
@@ -71,10 +99,13 @@ namespace gloox
     prep::idna( server, m_server );
     m_port = port;
     m_buf = static_cast<char*>( calloc( m_bufsize + 1, sizeof( char ) ) );
+    m_pipe[0] = m_pipe[1] = -1;
   }
 
   ConnectionTCPBase::~ConnectionTCPBase()
   {
+    if( m_eventLoop )
+      m_eventLoop->remove( this );
     cleanup();
     free( m_buf );
     m_buf = 0;
@@ -91,6 +122,7 @@ namespace gloox
     if( m_socket < 0 )
       return true; // let recv() catch the closed fd
 
+#if defined( _WIN32 )
     fd_set fds;
     struct timeval tv;
 
@@ -104,6 +136,28 @@ namespace gloox
 
     return ( ( select( m_socket + 1, &fds, 0, 0, timeout == -1 ? 0 : &tv ) > 0 )
              && FD_ISSET( m_socket, &fds ) != 0 );
+#else
+    // poll() instead of select(): the socket may be >= FD_SETSIZE if many
+    // connections are driven by an EventLoop
+    struct pollfd pfd;
+    pfd.fd = m_socket;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if( m_nonBlocking && sendQueueSize() )
+      pfd.events |= POLLOUT;
+
+    if( poll( &pfd, 1, timeout == -1 ? -1 : ( timeout + 999 ) / 1000 ) <= 0 )
+      return false;
+
+    if( pfd.revents & POLLOUT )
+    {
+      flush();
+      pfd.revents &= ~POLLOUT;
+    }
+
+    return pfd.revents != 0;
+#endif
   }
 
   ConnectionError ConnectionTCPBase::receive()
@@ -127,6 +181,39 @@ namespace gloox
       return false;
     }
 
+    // data left over from non-blocking mode goes first
+    if( !m_nonBlocking && !m_sendQueue.empty() && !drainQueue() )
+      return finishSend( false, true );
+
+    if( m_nonBlocking )
+    {
+      size_t offset = 0;
+      bool tried = false;
+#ifndef GLOOX_BLOCKING_QUEUE
+      // nothing queued: try to write directly from the caller's buffer, queue only the rest.
+      // this costs one syscall per send(); only queued (or corked) data gets coalesced
+      if( m_sendQueue.empty() && !m_cork )
+      {
+        const ssize_t sent = ::send( m_socket, data.data(), data.length(), MSG_DONTWAIT );
+        if( sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+          return finishSend( false, true );
+
+        tried = true;
+        if( sent > 0 )
+        {
+          offset = static_cast<size_t>( sent );
+          m_totalBytesOut += sent;
+        }
+      }
+#endif
+      if( offset < data.length() )
+      {
+        m_sendQueue.push_back( offset ? data.substr( offset ) : data );
+        m_sendQueueBytes += data.length() - offset;
+      }
+      return finishSend( !m_cork && !tried );
+    }
+
     int sent = 0;
     for( size_t num = 0, len = data.length(); sent != -1 && num < len; num += sent )
     {
@@ -155,6 +242,429 @@ namespace gloox
     return sent != -1;
   }
 
+  bool ConnectionTCPBase::writeQueue()
+  {
+#ifdef GLOOX_BLOCKING_QUEUE
+    while( !m_sendQueue.empty() )
+    {
+      const std::string& front = m_sendQueue.front();
+      const int sent = static_cast<int>( ::send( m_socket, front.data() + m_sendOffset,
+                                                 static_cast<int>( front.length() - m_sendOffset ), 0 ) );
+      if( sent == -1 )
+        return false;
+#else
+    struct iovec iov[64];
+    while( !m_sendQueue.empty() )
+    {
+      int num = 0;
+      SendQueue::const_iterator it = m_sendQueue.begin();
+      for( ; it != m_sendQueue.end() && num < 64; ++it, ++num )
+      {
+        const size_t skip = num ? 0 : m_sendOffset;
+        iov[num].iov_base = const_cast<char*>( (*it).data() + skip );
+        iov[num].iov_len = (*it).length() - skip;
+      }
+
+      struct msghdr msg;
+      memset( &msg, 0, sizeof( msg ) );
+      msg.msg_iov = iov;
+      msg.msg_iovlen = num;
+      const ssize_t sent = ::sendmsg( m_socket, &msg, MSG_DONTWAIT );
+      if( sent < 0 )
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+
+      m_totalBytesOut += sent;
+      m_sendQueueBytes -= sent;
+      for( size_t left = static_cast<size_t>( sent ); left; )
+      {
+        const size_t rest = m_sendQueue.front().length() - m_sendOffset;
+        if( left < rest )
+        {
+          m_sendOffset += left;
+          break;
+        }
+        left -= rest;
+        m_sendOffset = 0;
+        m_sendQueue.pop_front();
+      }
+    }
+
+    return true;
+  }
+
+  bool ConnectionTCPBase::drainQueue()
+  {
+    // expects m_sendMutex to be locked
+    while( !m_sendQueue.empty() )
+    {
+      if( !writeQueue() )
+        return false;
+#ifndef GLOOX_BLOCKING_QUEUE
+      if( m_sendQueue.empty() )
+        break;
+
+      struct pollfd pfd;
+      pfd.fd = m_socket;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      if( poll( &pfd, 1, -1 ) < 0 && errno != EINTR )
+        return false;
+#endif
+    }
+    return true;
+  }
+
+  bool ConnectionTCPBase::finishSend( bool write, bool failed )
+  {
+    // expects m_sendMutex to be locked, unlocks it
+    const bool ok = !failed && ( !write || writeQueue() );
+    if( !ok )
+    {
+      m_sendQueue.clear();
+      m_sendQueueBytes = 0;
+      m_sendOffset = 0;
+    }
+
+    // let the EventLoop flush the queue once the socket is writable (corked data stays put)
+    const bool interest = !m_sendQueue.empty() && !m_cork;
+    EventLoop* loop = interest != m_writeInterest ? m_eventLoop : 0;
+    if( m_eventLoop )
+      m_writeInterest = interest;
+
+    bool full = false;
+    bool drained = false;
+    if( m_highWater && !m_queueFull && m_sendQueueBytes > m_highWater )
+      full = m_queueFull = true;
+    else if( m_queueFull && m_sendQueueBytes <= m_highWater / 2 )
+    {
+      m_queueFull = false;
+      drained = true;
+    }
+    const size_t queued = m_sendQueueBytes;
+    SendQueueHandler* sqh = m_sendQueueHandler;
+
+    m_sendMutex.unlock();
+
+    if( loop )
+      loop->setWriteInterest( this, interest );
+
+    if( !ok )
+    {
+      std::string message = "send() failed. "
+#if defined( _WIN32 )
+        "WSAGetLastError: " + util::int2string( ::WSAGetLastError() );
+#else
+        "errno: " + util::int2string( errno ) + ": " + strerror( errno );
+#endif
+      m_logInstance.err( LogAreaClassConnectionTCPBase, message );
+
+      if( m_handler )
+        m_handler->handleDisconnect( this, ConnIoError );
+      return false;
+    }
+
+    if( sqh && full )
+      sqh->handleSendQueueFull( this, queued );
+    else if( sqh && drained )
+      sqh->handleSendQueueDrained( this );
+
+    return true;
+  }
+
+  void ConnectionTCPBase::setNonBlockingSend( bool nonBlocking )
+  {
+    m_sendMutex.lock();
+    m_nonBlocking = nonBlocking;
+    if( nonBlocking || m_sendQueue.empty() || m_socket < 0 )
+    {
+      m_sendMutex.unlock();
+      return;
+    }
+
+    // blocking send()s must not overtake queued data
+    finishSend( false, !drainQueue() );
+  }
+
+  void ConnectionTCPBase::setEventLoop( EventLoop* loop )
+  {
+    m_sendMutex.lock();
+    m_eventLoop = loop;
+    m_writeInterest = false;
+    finishSend( false ); // registers write interest if data is queued
+  }
+
+  void ConnectionTCPBase::setSendQueueHandler( SendQueueHandler* sqh, size_t highWater )
+  {
+    util::MutexGuard m( m_sendMutex );
+    m_sendQueueHandler = sqh;
+    m_highWater = highWater;
+  }
+
+  void ConnectionTCPBase::setCork( bool cork )
+  {
+    m_sendMutex.lock();
+    m_cork = cork;
+    if( cork )
+      m_sendMutex.unlock();
+    else
+      finishSend( m_socket >= 0 );
+  }
+
+  bool ConnectionTCPBase::flush()
+  {
+    m_sendMutex.lock();
+    if( m_socket < 0 )
+    {
+      m_sendMutex.unlock();
+      return false;
+    }
+    return finishSend( true );
+  }
+
+  size_t ConnectionTCPBase::sendQueueSize()
+  {
+    util::MutexGuard m( m_sendMutex );
+    return m_sendQueueBytes;
+  }
+
+  int64_t ConnectionTCPBase::sendFile( int fd, int64_t offset, int64_t length )
+  {
+#if defined( __linux__ )
+    if( fd < 0 || offset < 0 || length < 0 )
+      return -1;
+
+    m_sendMutex.lock();
+
+    if( m_socket < 0 )
+    {
+      m_sendMutex.unlock();
+      return -1;
+    }
+
+    // data queued by a non-blocking send() goes first
+    if( !m_sendQueue.empty() && ( !writeQueue() || !m_sendQueue.empty() ) )
+    {
+      const bool ok = finishSend( false );
+      return ok ? 0 : -1;
+    }
+
+    // off_t is 64 bits wide with large file support, even on 32-bit systems
+    off_t pos = static_cast<off_t>( offset );
+    if( static_cast<int64_t>( pos ) != offset )
+    {
+      m_sendMutex.unlock();
+      return -1;
+    }
+
+    int64_t sent = 0;
+    ssize_t size = 0;
+    while( sent < length )
+    {
+      // a single call may be limited to less than size_t anyway
+      const int64_t chunk = std::min( length - sent, static_cast<int64_t>( 0x40000000 ) );
+      size = ::sendfile( m_socket, fd, &pos, static_cast<size_t>( chunk ) );
+      if( size < 0 && errno == EINTR )
+        continue;
+      if( size <= 0 ) // error or end of file
+        break;
+      sent += size;
+    }
+    m_totalBytesOut += static_cast<long>( sent );
+
+    m_sendMutex.unlock();
+
+    if( size >= 0 )
+      return sent;
+
+    // the file can not be sent this way, the connection is still fine
+    if( !sent && ( errno == EINVAL || errno == ENOSYS || errno == EBADF ) )
+      return -1;
+
+    ioError( "sendfile()", ConnIoError );
+    return -1;
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+    return -1;
+#endif
+  }
+
+  int64_t ConnectionTCPBase::recvInto( char* buffer, int64_t length, int timeout )
+  {
+    if( !buffer || length <= 0 )
+      return -1;
+
+    m_recvMutex.lock();
+
+    if( m_cancel || m_socket < 0 )
+    {
+      m_recvMutex.unlock();
+      return -1;
+    }
+
+    if( !dataAvailable( timeout ) )
+    {
+      m_recvMutex.unlock();
+      return 0;
+    }
+
+    // a single call receives at most INT_MAX bytes
+    const int64_t chunk = std::min( length, static_cast<int64_t>( 0x7fffffff ) );
+#if defined( _WIN32 ) && !defined( __SYMBIAN32__ )
+    const int64_t size = ::recv( m_socket, buffer, static_cast<int>( chunk ), 0 );
+#else
+    const int64_t size = ::recv( m_socket, buffer, static_cast<size_t>( chunk ),
+                                 GLOOX_RECV_DONTWAIT );
+#endif
+    if( size > 0 )
+      m_totalBytesIn += static_cast<long>( size );
+
+    m_recvMutex.unlock();
+
+    if( size > 0 )
+      return size;
+
+#if defined( __unix__ )
+    if( size == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+      return 0;
+#endif
+
+    ioError( "recv()", size ? ConnIoError : ConnStreamClosed );
+    return -1;
+  }
+
+#if !defined( _WIN32 )
+  static bool writeAll( int fd, const char* data, long length )
+  {
+    while( length > 0 )
+    {
+      const ssize_t written = ::write( fd, data, static_cast<size_t>( length ) );
+      if( written < 0 && errno == EINTR )
+        continue;
+      if( written <= 0 )
+        return false;
+      data += written;
+      length -= static_cast<long>( written );
+    }
+    return true;
+  }
+#endif
+
+  int64_t ConnectionTCPBase::recvToFile( int fd, int64_t length, int timeout )
+  {
+#if defined( _WIN32 )
+    (void)fd;
+    (void)length;
+    (void)timeout;
+    return -1;
+#else
+    if( fd < 0 || length <= 0 )
+      return -1;
+
+    m_recvMutex.lock();
+
+    if( m_cancel || m_socket < 0 )
+    {
+      m_recvMutex.unlock();
+      return -1;
+    }
+
+    if( !dataAvailable( timeout ) )
+    {
+      m_recvMutex.unlock();
+      return 0;
+    }
+
+    // a single call moves at most one chunk
+    const long chunk = static_cast<long>( std::min( length, static_cast<int64_t>( 65536 ) ) );
+    long size = -1;
+    bool written = true;
+# if defined( __linux__ )
+    // socket -> pipe -> file, the data never enters user space
+    if( m_pipe[0] >= 0 || pipe( m_pipe ) == 0 )
+    {
+      size = static_cast<long>( ::splice( m_socket, 0, m_pipe[1], 0,
+                                          static_cast<size_t>( chunk ),
+                                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK ) );
+      for( long left = size; left > 0; )
+      {
+        const ssize_t moved = ::splice( m_pipe[0], 0, fd, 0, static_cast<size_t>( left ),
+                                        SPLICE_F_MOVE );
+        if( moved > 0 )
+        {
+          left -= static_cast<long>( moved );
+          continue;
+        }
+        if( moved < 0 && errno == EINTR )
+          continue;
+
+        // the file does not support splice(), copy the rest
+        const ssize_t r = ::read( m_pipe[0], m_buf, static_cast<size_t>( std::min( left,
+                                                                    static_cast<long>( m_bufsize ) ) ) );
+        if( r <= 0 || !writeAll( fd, m_buf, static_cast<long>( r ) ) )
+        {
+          // discard whatever is left in the pipe
+          ::close( m_pipe[0] );
+          ::close( m_pipe[1] );
+          m_pipe[0] = m_pipe[1] = -1;
+          written = false;
+          break;
+        }
+        left -= static_cast<long>( r );
+      }
+    }
+    else
+# endif
+    {
+      size = static_cast<long>( ::recv( m_socket, m_buf,
+                                        static_cast<size_t>( std::min( chunk, static_cast<long>( m_bufsize ) ) ),
+                                        GLOOX_RECV_DONTWAIT ) );
+      if( size > 0 )
+        written = writeAll( fd, m_buf, size );
+    }
+
+    if( size > 0 )
+      m_totalBytesIn += size;
+
+    m_recvMutex.unlock();
+
+    if( size > 0 )
+    {
+      if( written )
+        return size;
+
+      m_logInstance.err( LogAreaClassConnectionTCPBase, "writing received data failed. errno: "
+                         + util::int2string( errno ) + ": " + strerror( errno ) );
+      return -1;
+    }
+
+    if( size == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+      return 0;
+
+    ioError( "recv()", size ? ConnIoError : ConnStreamClosed );
+    return -1;
+#endif
+  }
+
+  void ConnectionTCPBase::ioError( const std::string& call, ConnectionError error )
+  {
+    if( error == ConnIoError )
+    {
+      std::string message = call + " failed. "
+#if defined( _WIN32 )
+        "WSAGetLastError: " + util::int2string( ::WSAGetLastError() );
+#else
+        "errno: " + util::int2string( errno ) + ": " + strerror( errno );
+#endif
+      m_logInstance.err( LogAreaClassConnectionTCPBase, message );
+    }
+
+    if( m_handler )
+      m_handler->handleDisconnect( this, error );
+  }
+
   void ConnectionTCPBase::getStatistics( long int &totalIn, long int &totalOut )
   {
     totalIn = m_totalBytesIn;
@@ -172,16 +682,33 @@ namespace gloox
       return;
     }
 
+    // deregister while the fd is still ours, it may be reused as soon as it is closed
+    if( m_eventLoop )
+      m_eventLoop->remove( this );
+
     if( m_socket >= 0 )
     {
       DNS::closeSocket( m_socket, m_logInstance );
       m_socket = -1;
     }
 
+#if !defined( _WIN32 )
+    if( m_pipe[0] >= 0 )
+    {
+      ::close( m_pipe[0] );
+      ::close( m_pipe[1] );
+      m_pipe[0] = m_pipe[1] = -1;
+    }
+#endif
+
     m_state = StateDisconnected;
     m_cancel = true;
     m_totalBytesIn = 0;
     m_totalBytesOut = 0;
+    m_sendQueue.clear();
+    m_sendQueueBytes = 0;
+    m_sendOffset = 0;
+    m_queueFull = false;
 
     m_recvMutex.unlock(),
     m_sendMutex.unlock();
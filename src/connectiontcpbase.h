@@ -23,6 +23,7 @@
 #include <ws2tcpip.h>
 #endif
 
+#include <deque>
 #include <string>
 
 namespace gloox
@@ -33,6 +34,9 @@ namespace gloox
     class Mutex;
   }
 
+  class EventLoop;
+  class SendQueueHandler;
+
   /**
    * @brief This is a base class for a simple TCP connection.
    *
@@ -87,6 +91,25 @@ namespace gloox
       // reimplemented from ConnectionBase
       virtual void getStatistics( long int &totalIn, long int &totalOut );
 
+      /**
+       * Sends a range of a file over the wire using sendfile() on Linux. On other platforms,
+       * -1 is returned. Data queued by a non-blocking send() is written first. If that is not
+       * possible without blocking, nothing is sent and 0 is returned.
+       * @copydetails ConnectionBase::sendFile()
+       */
+      virtual int64_t sendFile( int fd, int64_t offset, int64_t length );
+
+      // reimplemented from ConnectionBase
+      virtual int64_t recvInto( char* buffer, int64_t length, int timeout = -1 );
+
+      /**
+       * Receives data directly into a file using splice() on Linux. On other POSIX platforms, the
+       * data is read into the connection's receive buffer and written to the file from there.
+       * On Windows, -1 is returned.
+       * @copydetails ConnectionBase::recvToFile()
+       */
+      virtual int64_t recvToFile( int fd, int64_t length, int timeout = -1 );
+
       /**
        * Gives access to the raw socket of this connection. Use it wisely. You can
        * select()/poll() it and use ConnectionTCPBase::recv( -1 ) to fetch the data.
@@ -114,11 +137,72 @@ namespace gloox
        */
       virtual const std::string localInterface() const;
 
+      /**
+       * Switches between blocking (the default) and non-blocking sending. In blocking mode, send()
+       * returns only after all data has been handed to the kernel, which may stall the calling
+       * thread if the peer is slow. In non-blocking mode, send() writes what the socket accepts
+       * right away and appends the remainder to an outbound queue. Queued data is written
+       * (coalesced into as few vectored writes as possible) by subsequent send() or flush() calls,
+       * by recv() once the socket is writable again, and by an EventLoop the connection is
+       * registered with.
+       * Note that only queued data is coalesced: while the queue is empty and the connection is
+       * not corked, each send() still results in one write syscall (and usually one TCP segment)
+       * per stanza. To batch many small stanzas, cork the connection (see setCork()).
+       * @param nonBlocking Whether to use non-blocking sending. Switching back to blocking mode
+       * writes out all queued data first, blocking if necessary.
+       * @note On Windows, queued data is written using blocking calls.
+       * @since 1.1
+       */
+      void setNonBlockingSend( bool nonBlocking );
+
+      /**
+       * Returns whether non-blocking sending is enabled.
+       * @return Whether non-blocking sending is enabled.
+       * @since 1.1
+       */
+      bool nonBlockingSend() const { return m_nonBlocking; }
+
+      /**
+       * Sets a handler that is notified when the outbound queue rises above the given
+       * high-water mark, and when it drains again. Only used in non-blocking mode.
+       * @param sqh The handler to notify. May be 0.
+       * @param highWater The high-water mark in bytes.
+       * @since 1.1
+       */
+      void setSendQueueHandler( SendQueueHandler* sqh, size_t highWater );
+
+      /**
+       * 'Corks' the connection: while corked, send() only queues data (in non-blocking mode).
+       * Uncorking writes everything queued in as few syscalls as possible. Use this to batch
+       * many small writes, e.g. when broadcasting presence to many contacts.
+       * @param cork Whether to cork or uncork the connection.
+       * @since 1.1
+       */
+      void setCork( bool cork );
+
+      /**
+       * Tries to write all queued data without blocking.
+       * @return @b False if writing failed, @b true otherwise (even if data is left in the queue).
+       * @since 1.1
+       */
+      bool flush();
+
+      /**
+       * Returns the number of bytes in the outbound queue.
+       * @return The number of queued bytes.
+       * @since 1.1
+       */
+      size_t sendQueueSize();
+
     protected:
       ConnectionTCPBase& operator=( const ConnectionTCPBase& );
       void init( const std::string& server, int port );
       bool dataAvailable( int timeout = -1 );
       void cancel();
+      bool writeQueue();
+      bool drainQueue();
+      bool finishSend( bool write, bool failed = false );
+      void ioError( const std::string& call, ConnectionError error );
 
       const LogSink& m_logInstance;
       util::Mutex m_sendMutex;
@@ -131,6 +215,27 @@ namespace gloox
       const int m_bufsize;
       bool m_cancel;
 
+      typedef std::deque<std::string> SendQueue;
+
+      SendQueue m_sendQueue;
+      SendQueueHandler* m_sendQueueHandler;
+      size_t m_sendOffset;         // bytes of the queue's front already written
+      size_t m_sendQueueBytes;
+      size_t m_highWater;
+      bool m_nonBlocking;
+      bool m_cork;
+      bool m_queueFull;            // above high-water mark, handler notified
+      int m_pipe[2];               // splices received data into files, created on demand
+
+    private:
+      friend class EventLoop;
+
+      // called by EventLoop::add( ConnectionTCPBase* ) and EventLoop::remove()
+      void setEventLoop( EventLoop* loop );
+
+      EventLoop* m_eventLoop;
+      bool m_writeInterest;        // m_eventLoop watches the socket for writability
+
   };
 
 }
@@ -60,7 +60,9 @@ namespace gloox
 
   ConnectionBase* ConnectionTCPClient::newInstance() const
   {
-    return new ConnectionTCPClient( m_handler, m_logInstance, m_server, m_port );
+    ConnectionTCPClient* conn = new ConnectionTCPClient( m_handler, m_logInstance, m_server, m_port );
+    conn->setTargets( m_targets );
+    return conn;
   }
 
   ConnectionError ConnectionTCPClient::connect()
@@ -83,7 +85,9 @@ namespace gloox
 
     if( m_socket < 0 )
     {
-      if( m_port == -1 )
+      if( !m_targets.empty() )
+        m_socket = DNS::connect( m_targets, m_logInstance );
+      else if( m_port == -1 )
         m_socket = DNS::connect( m_server, m_logInstance );
       else
         m_socket = DNS::connect( m_server, m_port, m_logInstance );
@@ -16,6 +16,7 @@
 
 #include "gloox.h"
 #include "connectiontcpbase.h"
+#include "dnsresolver.h"
 #include "logsink.h"
 
 #include <string>
@@ -73,9 +74,21 @@ namespace gloox
       // reimplemented from ConnectionBase
       virtual ConnectionBase* newInstance() const;
 
+      /**
+       * Sets the hosts to connect to, e.g. the result of an asynchronous DNSResolver lookup.
+       * If set, connect() does not resolve the server but tries the targets' addresses,
+       * several of them in parallel (see DNS::connect()).
+       * @param targets The targets, in order of preference. Pass an empty list to resolve
+       * the server again.
+       * @since 1.1
+       */
+      void setTargets( const DNSResolver::TargetList& targets ) { m_targets = targets; }
+
     private:
       ConnectionTCPClient &operator=( const ConnectionTCPClient & );
 
+      DNSResolver::TargetList m_targets;
+
   };
 
 }
@@ -38,6 +38,7 @@
 # include <sys/select.h>
 # include <unistd.h>
 # include <errno.h>
+# include <fcntl.h>
 #endif
 
 #if defined( _WIN32 ) || defined( __MINGW32__ )
@@ -48,6 +49,7 @@
 #endif
 
 #include <cstdlib>
+#include <list>
 #include <string>
 
 #ifndef _WIN32_WCE
@@ -65,7 +67,7 @@ namespace gloox
   ConnectionTCPServer::ConnectionTCPServer( ConnectionHandler* ch, const LogSink& logInstance,
                                             const std::string& ip, int port )
     : ConnectionTCPBase( 0, logInstance, ip, port ),
-      m_connectionHandler( ch )
+      m_connectionHandler( ch ), m_reusePort( false ), m_maxAccepts( 64 )
   {
   }
 
@@ -75,7 +77,10 @@ namespace gloox
 
   ConnectionBase* ConnectionTCPServer::newInstance() const
   {
-    return new ConnectionTCPServer( m_connectionHandler, m_logInstance, m_server, m_port );
+    ConnectionTCPServer* conn = new ConnectionTCPServer( m_connectionHandler, m_logInstance, m_server, m_port );
+    conn->setReusePort( m_reusePort );
+    conn->setMaxAccepts( m_maxAccepts );
+    return conn;
   }
 
   ConnectionError ConnectionTCPServer::connect()
@@ -105,6 +110,17 @@ namespace gloox
 
     if( ( getsockopt( m_socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char*>( &buf ), &bufbytes ) != -1 ) && ( m_bufsize > buf ) )
       setsockopt( m_socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>( &m_bufsize ), sizeof( m_bufsize ) );
+
+    if( m_reusePort )
+    {
+#ifdef SO_REUSEPORT
+      int on = 1;
+      setsockopt( m_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>( &on ), sizeof( on ) );
+      setsockopt( m_socket, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char*>( &on ), sizeof( on ) );
+#else
+      m_logInstance.warn( LogAreaClassConnectionTCPServer, "SO_REUSEPORT is not supported on this platform" );
+#endif
+    }
 #endif
 
     int status = 0;
@@ -149,7 +165,7 @@ namespace gloox
       return ConnIoError;
     }
 
-    if( listen( m_socket, 10 ) < 0 )
+    if( listen( m_socket, SOMAXCONN ) < 0 )
     {
       err = errno;
       std::string message = "listen() on " + ( m_server.empty() ? std::string( "*" ) : m_server )
@@ -165,6 +181,14 @@ namespace gloox
       return ConnIoError;
     }
 
+    // recv() accepts until there are no more pending connections
+#if defined( _WIN32 )
+    u_long nonblocking = 1;
+    ioctlsocket( static_cast<SOCKET>( m_socket ), FIONBIO, &nonblocking );
+#else
+    fcntl( m_socket, F_SETFL, fcntl( m_socket, F_GETFL ) | O_NONBLOCK );
+#endif
+
     m_cancel = false;
     return ConnNoError;
   }
@@ -185,27 +209,77 @@ namespace gloox
       return ConnNoError;
     }
 
-    struct sockaddr_storage they;
-    int addr_size = sizeof( struct sockaddr_storage );
+    // the listening socket is non-blocking: take everything that is pending now (up to
+    // m_maxAccepts) and stop at EAGAIN/EWOULDBLOCK instead of accepting one connection per call
+    std::list<ConnectionTCPClient*> accepted;
+    bool failed = false;
+    for( int tries = 0; m_maxAccepts <= 0 || tries < m_maxAccepts; ++tries )
+    {
+      struct sockaddr_storage they;
+      int addr_size = sizeof( struct sockaddr_storage );
 #if defined( _WIN32 )
-    int newfd = static_cast<int>( accept( static_cast<SOCKET>( m_socket ), reinterpret_cast<struct sockaddr*>( &they ), &addr_size ) );
+      int newfd = static_cast<int>( accept( static_cast<SOCKET>( m_socket ), reinterpret_cast<struct sockaddr*>( &they ), &addr_size ) );
+      if( newfd < 0 )
+      {
+        if( ::WSAGetLastError() != WSAEWOULDBLOCK && ::WSAGetLastError() != WSAECONNRESET )
+          failed = true;
+        break;
+      }
+      // accepted sockets inherit the non-blocking mode
+      u_long blocking = 0;
+      ioctlsocket( static_cast<SOCKET>( newfd ), FIONBIO, &blocking );
 #else
-    int newfd = accept( m_socket, reinterpret_cast<struct sockaddr*>( &they ), reinterpret_cast<socklen_t*>( &addr_size ) );
+# ifdef HAVE_ACCEPT4
+      int newfd = accept4( m_socket, reinterpret_cast<struct sockaddr*>( &they ),
+                           reinterpret_cast<socklen_t*>( &addr_size ), SOCK_CLOEXEC );
+# else
+      int newfd = accept( m_socket, reinterpret_cast<struct sockaddr*>( &they ),
+                          reinterpret_cast<socklen_t*>( &addr_size ) );
+# endif
+      if( newfd < 0 )
+      {
+        if( errno == EINTR || errno == ECONNABORTED )
+          continue;
+        if( errno != EAGAIN && errno != EWOULDBLOCK )
+        {
+          const int err = errno;
+          m_logInstance.dbg( LogAreaClassConnectionTCPServer, "accept() failed. " + std::string( strerror( err ) )
+                                                              + " (errno: " + util::int2string( err ) + ")" );
+          failed = true;
+        }
+        break;
+      }
+# ifndef HAVE_ACCEPT4
+      // some platforms pass the listening socket's O_NONBLOCK on
+      fcntl( newfd, F_SETFL, fcntl( newfd, F_GETFL ) & ~O_NONBLOCK );
+      fcntl( newfd, F_SETFD, FD_CLOEXEC );
+# endif
 #endif
 
+      char buffer[INET6_ADDRSTRLEN];
+      char portstr[NI_MAXSERV];
+      int err = getnameinfo( reinterpret_cast<struct sockaddr*>( &they ), addr_size, buffer, sizeof( buffer ),
+                             portstr, sizeof( portstr ), NI_NUMERICHOST | NI_NUMERICSERV );
+      if( err )
+      {
+        DNS::closeSocket( newfd, m_logInstance );
+        continue;
+      }
+
+      ConnectionTCPClient* conn = new ConnectionTCPClient( m_logInstance, buffer,
+                                                           atoi( portstr ) );
+      conn->setSocket( newfd );
+      accepted.push_back( conn );
+    }
+
     m_recvMutex.unlock();
 
-    char buffer[INET6_ADDRSTRLEN];
-    char portstr[NI_MAXSERV];
-    int err = getnameinfo( reinterpret_cast<struct sockaddr*>( &they ), addr_size, buffer, sizeof( buffer ),
-                           portstr, sizeof( portstr ), NI_NUMERICHOST | NI_NUMERICSERV );
-    if( err )
+    if( failed && accepted.empty() )
       return ConnIoError;
 
-    ConnectionTCPClient* conn = new ConnectionTCPClient( m_logInstance, buffer,
-                                                         atoi( portstr ) );
-    conn->setSocket( newfd );
-    m_connectionHandler->handleIncomingConnection( this, conn );
+    std::list<ConnectionTCPClient*>::const_iterator it = accepted.begin();
+    for( ; it != accepted.end(); ++it )
+      m_connectionHandler->handleIncomingConnection( this, (*it) );
 
     return ConnNoError;
   }
@@ -33,6 +33,16 @@ namespace gloox
    *
    * You should not need to use this class directly.
    *
+   * Every call to recv() that finds the socket readable accepts all pending connections,
+   * not just one, and passes them to the ConnectionHandler one after another. At most
+   * setMaxAccepts() connections are accepted per call, the rest is left for the next call.
+   *
+   * To accept connections in several threads in parallel, create one ConnectionTCPServer
+   * per thread, enable setReusePort() on all of them and call connect() and recv() from the
+   * respective thread. The kernel then distributes incoming connections across the listening
+   * sockets. newInstance() creates a server for the same address and port with the same
+   * settings and ConnectionHandler; use setConnectionHandler() to give it its own handler.
+   *
    * @author Jakob Schröter <js@camaya.net>
    * @since 0.9
    */
@@ -68,10 +78,39 @@ namespace gloox
       // reimplemented from ConnectionBase
       virtual ConnectionBase* newInstance() const;
 
+      /**
+       * Sets the SO_REUSEPORT option on the listening socket, so that several sockets (in this
+       * or other processes) can listen on the same address and port. This has no effect on
+       * platforms without SO_REUSEPORT. Call this before connect().
+       * @param reuse Whether to set SO_REUSEPORT. Default: false.
+       * @since 1.1
+       */
+      void setReusePort( bool reuse ) { m_reusePort = reuse; }
+
+      /**
+       * Sets the ConnectionHandler that incoming connections are passed to. Call this before
+       * recv(), not while another thread is inside it.
+       * @param ch The new ConnectionHandler.
+       * @since 1.1
+       */
+      void setConnectionHandler( ConnectionHandler* ch ) { m_connectionHandler = ch; }
+
+      /**
+       * Limits the number of connections a single call to recv() accepts, so that a flood of
+       * incoming connections can not keep recv() (and the thread calling it) busy indefinitely.
+       * Connections beyond the limit stay pending, the listening socket remains readable.
+       * @param max The maximum number of connections to accept per call to recv(), or 0 for
+       * no limit. Default: 64.
+       * @since 1.1
+       */
+      void setMaxAccepts( int max ) { m_maxAccepts = max; }
+
     private:
       ConnectionTCPServer &operator=( const ConnectionTCPServer & );
       
       ConnectionHandler* m_connectionHandler;
+      bool m_reusePort;
+      int m_maxAccepts;
 
   };
 
@@ -0,0 +1,155 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#include "copyonwrite.h"
+
+#include "config.h"
+
+#if defined( _WIN32 )
+# include <windows.h>
+#elif defined( HAVE_PTHREAD )
+# include <pthread.h>
+# include <time.h>
+#endif
+
+namespace gloox
+{
+
+  namespace util
+  {
+
+    typedef CopyOnWriteBase::Reader Reader;
+
+#if defined( _WIN32 )
+
+    static DWORD readerKey()
+    {
+      // constant-initialized, the slot is allocated on first use
+      static volatile LONG key = static_cast<LONG>( TLS_OUT_OF_INDEXES );
+      if( key == static_cast<LONG>( TLS_OUT_OF_INDEXES ) )
+      {
+        const LONG k = static_cast<LONG>( TlsAlloc() );
+        if( InterlockedCompareExchange( &key, k, static_cast<LONG>( TLS_OUT_OF_INDEXES ) )
+              != static_cast<LONG>( TLS_OUT_OF_INDEXES ) )
+          TlsFree( static_cast<DWORD>( k ) );
+      }
+      return static_cast<DWORD>( key );
+    }
+
+    static Reader* top()
+    {
+      return static_cast<Reader*>( TlsGetValue( readerKey() ) );
+    }
+
+    static void setTop( Reader* reader )
+    {
+      TlsSetValue( readerKey(), reader );
+    }
+
+#elif defined( HAVE_PTHREAD )
+
+    static pthread_key_t readerKey;
+    static pthread_once_t readerKeyOnce = PTHREAD_ONCE_INIT;
+
+    static void createReaderKey()
+    {
+      pthread_key_create( &readerKey, 0 );
+    }
+
+    static Reader* top()
+    {
+      pthread_once( &readerKeyOnce, createReaderKey );
+      return static_cast<Reader*>( pthread_getspecific( readerKey ) );
+    }
+
+    static void setTop( Reader* reader )
+    {
+      pthread_once( &readerKeyOnce, createReaderKey );
+      pthread_setspecific( readerKey, reader );
+    }
+
+#else
+
+    // no threads
+    static Reader* topReader = 0;
+
+    static Reader* top()
+    {
+      return topReader;
+    }
+
+    static void setTop( Reader* reader )
+    {
+      topReader = reader;
+    }
+
+#endif
+
+    void CopyOnWriteBase::pushReader( Reader* reader )
+    {
+      reader->next = top();
+      setTop( reader );
+    }
+
+    void CopyOnWriteBase::popReader( Reader* reader )
+    {
+      // ReadGuards are scoped, so this is the top entry unless guards were heap-allocated
+      Reader* r = top();
+      if( r == reader )
+      {
+        setTop( reader->next );
+        return;
+      }
+
+      for( ; r; r = r->next )
+      {
+        if( r->next == reader )
+        {
+          r->next = reader->next;
+          return;
+        }
+      }
+    }
+
+    int CopyOnWriteBase::ownReaders( const void* version )
+    {
+      int num = 0;
+      for( const Reader* r = top(); r; r = r->next )
+      {
+        if( r->version == version )
+          ++num;
+      }
+      return num;
+    }
+
+    void CopyOnWriteBase::waitForReaders( AtomicRefCount& readers, int own )
+    {
+      // increment() and decrement() read the count with a full barrier
+      while( readers.increment() - 1 > own )
+      {
+        readers.decrement();
+#if defined( _WIN32 )
+        Sleep( 1 );
+#elif defined( HAVE_PTHREAD )
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 1000000;
+        nanosleep( &ts, 0 );
+#endif
+      }
+      readers.decrement();
+    }
+
+  }
+
+}
@@ -0,0 +1,294 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#ifndef COPYONWRITE_H__
+#define COPYONWRITE_H__
+
+#include "atomicrefcount.h"
+#include "macros.h"
+#include "mutex.h"
+
+#include <list>
+
+namespace gloox
+{
+
+  namespace util
+  {
+
+    /**
+     * @brief Keeps track of the ReadGuards each thread holds, for CopyOnWrite's grace periods.
+     *
+     * You should not need to use this class directly.
+     *
+     * @author Jakob Schröter <js@camaya.net>
+     * @since 1.1
+     */
+    class GLOOX_API CopyOnWriteBase
+    {
+      public:
+        /**
+         * An entry in the calling thread's list of ReadGuards.
+         */
+        struct Reader
+        {
+          const void* version;     /**< The version being read. */
+          Reader* next;            /**< The thread's previous ReadGuard. */
+        };
+
+        /**
+         * Adds a ReadGuard to the calling thread's list.
+         * @param reader The ReadGuard's entry.
+         */
+        static void pushReader( Reader* reader );
+
+        /**
+         * Removes a ReadGuard from the calling thread's list.
+         * @param reader The ReadGuard's entry.
+         */
+        static void popReader( Reader* reader );
+
+        /**
+         * Returns how many ReadGuards of the calling thread read the given version.
+         * @param version The version.
+         * @return The number of ReadGuards.
+         */
+        static int ownReaders( const void* version );
+
+        /**
+         * Blocks until a version's reader count drops to @c own.
+         * @param readers The version's reader count.
+         * @param own The number of readers to ignore (the calling thread's own).
+         */
+        static void waitForReaders( AtomicRefCount& readers, int own );
+
+    };
+
+    /**
+     * @brief A read-mostly value that readers access without taking a lock.
+     *
+     * Readers use a ReadGuard to access the current version of the value. That version is never
+     * modified, so any number of threads can read it concurrently. Writers use a WriteGuard,
+     * which serializes them, hands out a private copy of the value and publishes that copy as
+     * the new current version when the guard goes out of scope.
+     *
+     * Publishing waits for a grace period: the WriteGuard's destructor returns only after
+     * ReadGuards in other threads that still use the previous version are gone. After that,
+     * nobody sees the old contents anymore (e.g. a removed handler can be deleted). ReadGuards
+     * of the writing thread itself are not waited for, so it is fine to write while holding a
+     * ReadGuard in the same thread; that ReadGuard keeps seeing the version it acquired.
+     * Do not write while holding a lock that a reader in another thread may be waiting for,
+     * and do not let two threads write while each holds a ReadGuard.
+     *
+     * WriteGuards nested in the same thread share the outermost guard's copy, which is
+     * published when the outermost guard goes out of scope. Replaced versions are deleted
+     * by a later writer, once no ReadGuard exists.
+     *
+     * Use this for registries that are read for every stanza but changed rarely.
+     *
+     * You should not need to use this class directly.
+     *
+     * @author Jakob Schröter <js@camaya.net>
+     * @since 1.1
+     */
+    template<typename T>
+    class CopyOnWrite : private CopyOnWriteBase
+    {
+      private:
+        struct Version
+        {
+          Version() {}
+          Version( const T& v ) : value( v ) {}
+          T value;
+          AtomicRefCount readers;    // ReadGuards using this version
+
+          private:
+            Version& operator=( const Version& );
+        };
+
+      public:
+        /**
+         * Creates a new CopyOnWrite holding a default-constructed value.
+         */
+        CopyOnWrite() : m_current( new Version() ), m_pending( 0 ), m_writers( 0 ) {}
+
+        /**
+         * Destructor. There must be no ReadGuard or WriteGuard left.
+         */
+        ~CopyOnWrite()
+        {
+          delete m_current;
+          collect();
+        }
+
+        /**
+         * @brief Gives read-only access to the current version of a CopyOnWrite value.
+         */
+        class ReadGuard
+        {
+          public:
+            /**
+             * Acquires the current version. This does not block.
+             * @param cow The value to read.
+             */
+            ReadGuard( CopyOnWrite& cow ) : m_cow( cow ), m_version( cow.acquire( m_reader ) ) {}
+
+            /**
+             * Releases the version.
+             */
+            ~ReadGuard() { m_cow.release( m_reader, m_version ); }
+
+            /**
+             * Returns the version acquired by this guard.
+             * @return The value.
+             */
+            const T& operator*() const { return m_version->value; }
+
+            /**
+             * Returns the version acquired by this guard.
+             * @return The value.
+             */
+            const T* operator->() const { return &m_version->value; }
+
+          private:
+            ReadGuard& operator=( const ReadGuard& );
+            CopyOnWrite& m_cow;
+            Reader m_reader;
+            Version* m_version;
+        };
+
+        /**
+         * @brief Gives write access to a copy of a CopyOnWrite value and publishes it on destruction.
+         */
+        class WriteGuard
+        {
+          public:
+            /**
+             * Waits for other writers and copies the current version.
+             * @param cow The value to modify.
+             */
+            WriteGuard( CopyOnWrite& cow ) : m_cow( cow ), m_value( cow.beginWrite() ) {}
+
+            /**
+             * Publishes the modified copy and waits for the grace period.
+             */
+            ~WriteGuard() { m_cow.endWrite(); }
+
+            /**
+             * Returns the modifiable copy.
+             * @return The value.
+             */
+            T& operator*() { return *m_value; }
+
+            /**
+             * Returns the modifiable copy.
+             * @return The value.
+             */
+            T* operator->() { return m_value; }
+
+          private:
+            WriteGuard& operator=( const WriteGuard& );
+            CopyOnWrite& m_cow;
+            T* m_value;
+        };
+
+      private:
+        CopyOnWrite& operator=( const CopyOnWrite& );
+
+        Version* acquire( Reader& reader )
+        {
+          // registering as a reader first makes sure no writer deletes what we get here
+          m_readers.increment();
+          Version* v = m_current;
+          v->readers.increment();
+
+          // a writer that replaced v in the meantime may have missed us, use the new version then
+          while( v != m_current )
+          {
+            v->readers.decrement();
+            v = m_current;
+            v->readers.increment();
+          }
+
+          reader.version = v;
+          pushReader( &reader );
+          return v;
+        }
+
+        void release( Reader& reader, Version* v )
+        {
+          popReader( &reader );
+          v->readers.decrement();
+          m_readers.decrement();
+        }
+
+        T* beginWrite()
+        {
+          m_writeMutex.lock();
+
+          // the mutex is recursive: a nested WriteGuard works on the outer one's copy
+          if( m_writers++ == 0 )
+            m_pending = new Version( m_current->value );
+          return &m_pending->value;
+        }
+
+        void endWrite()
+        {
+          if( --m_writers > 0 )
+          {
+            m_writeMutex.unlock();
+            return;
+          }
+
+          Version* old = m_current;
+          m_retired.push_back( old );
+          m_current = m_pending;
+          m_pending = 0;
+
+          // keeps old from being collected while we wait. also a full barrier: readers
+          // registering with old after this either show up in its count or see the new version.
+          m_readers.increment();
+          m_writeMutex.unlock();
+
+          waitForReaders( old->readers, ownReaders( old ) );
+
+          // readers registering from now on get the new version. if there are none right now,
+          // nobody can use a retired one anymore.
+          m_writeMutex.lock();
+          if( m_readers.decrement() == 0 )
+            collect();
+          m_writeMutex.unlock();
+        }
+
+        void collect()
+        {
+          typename std::list<Version*>::iterator it = m_retired.begin();
+          for( ; it != m_retired.end(); ++it )
+            delete (*it);
+          m_retired.clear();
+        }
+
+        Version* volatile m_current;
+        Version* m_pending;         // the copy being written, guarded by m_writeMutex
+        int m_writers;              // nested WriteGuards, guarded by m_writeMutex
+        std::list<Version*> m_retired; // replaced versions, guarded by m_writeMutex
+        AtomicRefCount m_readers;   // all ReadGuards, plus writers waiting for a grace period
+        Mutex m_writeMutex;
+
+    };
+
+  }
+
+}
+
+#endif // COPYONWRITE_H__
@@ -58,6 +58,13 @@ namespace gloox
     return filter;
   }
 
+  bool DelayedDelivery::equals( const StanzaExtension& other ) const
+  {
+    const DelayedDelivery& d = static_cast<const DelayedDelivery&>( other );
+    return d.m_valid == m_valid && d.m_stamp == m_stamp && d.m_from == m_from
+           && d.m_reason == m_reason;
+  }
+
   Tag* DelayedDelivery::tag() const
   {
     if( !m_valid )
@@ -120,6 +120,9 @@ namespace gloox
         return new DelayedDelivery( *this );
       }
 
+      // reimplemented from StanzaExtension
+      virtual bool equals( const StanzaExtension& other ) const;
+
     private:
       JID m_from;
       std::string m_stamp;
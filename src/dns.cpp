@@ -15,6 +15,9 @@
 
 #include "gloox.h"
 #include "dns.h"
+#include "dnsresolver.h"
+#include "mutex.h"
+#include "mutexguard.h"
 #include "util.h"
 
 #ifndef _WIN32_WCE
@@ -22,6 +25,9 @@
 #endif
 
 #include <stdio.h>
+#include <time.h>
+
+#include <vector>
 
 #if !defined( _WIN32 ) && !defined( _WIN32_WCE )
 # include <netinet/in.h>
@@ -33,6 +39,9 @@
 # include <sys/un.h>
 # include <unistd.h>
 # include <errno.h>
+# include <fcntl.h>
+# include <sys/time.h>
+# include <poll.h>
 #endif
 
 #if defined( _WIN32 ) || defined( _WIN32_WCE )
@@ -76,10 +85,126 @@
 namespace gloox
 {
 
+  namespace
+  {
+    // the process-wide cache
+    struct CacheEntry
+    {
+      DNSResolver::TargetList targets;
+      time_t expires;
+      bool complete;              // whether the targets' addresses have been resolved
+    };
+    typedef std::map<std::string, CacheEntry> Cache;
+
+    Cache s_cache;
+    util::Mutex s_cacheMutex;
+    int s_cacheHits = 0;
+    int s_cacheMisses = 0;
+
+    // a xorshift generator, seeded differently in every process. unlike rand(), this
+    // leaves the application's random sequence alone
+    unsigned int s_random = 0;
+
+    long randomUpTo( long max )
+    {
+      unsigned int x = s_random;
+      if( !x )
+      {
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+        const unsigned int pid = static_cast<unsigned int>( getpid() );
+#else
+        const unsigned int pid = static_cast<unsigned int>( GetCurrentProcessId() );
+#endif
+        x = ( static_cast<unsigned int>( time( 0 ) ) ^ ( pid << 16 ) ) | 1;
+      }
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      s_random = x;
+      return static_cast<long>( x % static_cast<unsigned int>( max + 1 ) );
+    }
+  }
+
+  std::string DNS::cacheKey( const std::string& service, const std::string& proto,
+                             const std::string& domain )
+  {
+    std::string key = service + "/" + proto + "/" + domain;
+    std::string::iterator it = key.begin();
+    for( ; it != key.end(); ++it )
+    {
+      if( (*it) >= 'A' && (*it) <= 'Z' )
+        (*it) = static_cast<char>( (*it) - 'A' + 'a' );
+    }
+    return key;
+  }
+
+  bool DNS::cacheLookup( const std::string& key, bool complete, DNSResolver::TargetList& targets )
+  {
+    util::MutexGuard m( s_cacheMutex );
+
+    Cache::iterator it = s_cache.find( key );
+    if( it != s_cache.end() && (*it).second.expires <= time( 0 ) )
+    {
+      s_cache.erase( it );
+      it = s_cache.end();
+    }
+
+    if( it == s_cache.end() || ( complete && !(*it).second.complete ) )
+    {
+      ++s_cacheMisses;
+      return false;
+    }
+
+    ++s_cacheHits;
+    targets = (*it).second.targets;
+    return true;
+  }
+
+  void DNS::cacheStore( const std::string& key, bool complete,
+                        const DNSResolver::TargetList& targets, unsigned long ttl )
+  {
+    if( !ttl || targets.empty() )
+      return;
+
+    util::MutexGuard m( s_cacheMutex );
+
+    // don't replace resolved addresses by an SRV-only result
+    Cache::iterator it = s_cache.find( key );
+    if( !complete && it != s_cache.end() && (*it).second.complete
+        && (*it).second.expires > time( 0 ) )
+      return;
+
+    CacheEntry& entry = s_cache[key];
+    entry.targets = targets;
+    entry.expires = time( 0 ) + static_cast<time_t>( ttl );
+    entry.complete = complete;
+  }
+
+  void DNS::clearCache()
+  {
+    util::MutexGuard m( s_cacheMutex );
+    s_cache.clear();
+  }
+
+  DNSResolver::CacheStatistics DNS::cacheStatistics()
+  {
+    util::MutexGuard m( s_cacheMutex );
+    DNSResolver::CacheStatistics stats;
+    stats.hits = s_cacheHits;
+    stats.misses = s_cacheMisses;
+    stats.entries = static_cast<int>( s_cache.size() );
+    return stats;
+  }
+
 #if defined( HAVE_RES_QUERYDOMAIN ) && defined( HAVE_DN_SKIPNAME ) && defined( HAVE_RES_QUERY )
   DNS::HostMap DNS::resolve( const std::string& service, const std::string& proto,
                              const std::string& domain, const LogSink& logInstance )
   {
+    const std::string key = cacheKey( service, proto, domain );
+    DNSResolver::TargetList targets;
+    if( cacheLookup( key, false, targets ) )
+      return orderedHostMap( targets );
+
     buffer srvbuf;
     bool error = false;
 
@@ -132,9 +257,7 @@ namespace gloox
       return defaultHostMap( domain, logInstance );
     }
 
-    // (q)sort here
-
-    HostMap servers;
+    unsigned long ttl = static_cast<unsigned long>( -1 );
     for( cnt = 0; cnt < srvnum; ++cnt )
     {
       char srvname[NS_MAXDNAME];
@@ -146,13 +269,30 @@ namespace gloox
         continue;
 
       unsigned char* c = srv[cnt] + SRV_PORT;
-      servers.insert( std::make_pair( static_cast<char*>( srvname ), ntohs( c[1] << 8 | c[0] ) ) );
+      DNSResolver::Target target;
+      target.host = srvname;
+      target.port = ntohs( c[1] << 8 | c[0] );
+      c = srv[cnt] + SRV_COST;
+      target.priority = ntohs( c[1] << 8 | c[0] );
+      c = srv[cnt] + SRV_WEIGHT;
+      target.weight = ntohs( c[1] << 8 | c[0] );
+      targets.push_back( target );
+
+      // the record's TTL follows its type and class
+      c = srv[cnt] + 4;
+      const unsigned long t = ( static_cast<unsigned long>( c[0] ) << 24 )
+                              | ( static_cast<unsigned long>( c[1] ) << 16 )
+                              | ( static_cast<unsigned long>( c[2] ) << 8 ) | c[3];
+      if( t < ttl )
+        ttl = t;
     }
 
-    if( !servers.size() )
+    if( targets.empty() )
       return defaultHostMap( domain, logInstance );
 
-    return servers;
+    cacheStore( key, false, targets, ttl );
+
+    return orderedHostMap( targets );
   }
 
 #elif defined( _WIN32 ) && defined( HAVE_WINDNS_H ) && !defined( __MINGW32__ )
@@ -162,7 +302,7 @@ namespace gloox
     const std::string dname = "_" +  service + "._" + proto + "." + domain;
     bool error = false;
 
-    DNS::HostMap servers;
+    DNSResolver::TargetList targets;
     DNS_RECORD* pRecord = NULL;
     DNS_STATUS status = DnsQuery_UTF8( dname.c_str(), DNS_TYPE_SRV, DNS_QUERY_STANDARD, NULL, &pRecord, NULL );
     if( status == ERROR_SUCCESS )
@@ -175,7 +315,12 @@ namespace gloox
       {
         if( pRec->wType == DNS_TYPE_SRV )
         {
-          servers[pRec->Data.SRV.pNameTarget] = pRec->Data.SRV.wPort;
+          DNSResolver::Target target;
+          target.host = pRec->Data.SRV.pNameTarget;
+          target.port = pRec->Data.SRV.wPort;
+          target.priority = pRec->Data.SRV.wPriority;
+          target.weight = pRec->Data.SRV.wWeight;
+          targets.push_back( target );
         }
         pRec = pRec->pNext;
       }
@@ -188,12 +333,10 @@ namespace gloox
       error = true;
     }
 
-    if( error || !servers.size() )
-    {
-      servers = defaultHostMap( domain, logInstance );
-    }
+    if( error || targets.empty() )
+      return defaultHostMap( domain, logInstance );
 
-    return servers;
+    return orderedHostMap( targets );
   }
 
 #else
@@ -214,116 +357,340 @@ namespace gloox
                                           + domain + ", using default port." );
 
     if( !domain.empty() )
-      server[domain] = XMPP_PORT;
+      server.push_back( std::make_pair( domain, XMPP_PORT ) );
 
     return server;
   }
 
-#ifdef HAVE_GETADDRINFO
-  void DNS::resolve( struct addrinfo** res, const std::string& service, const std::string& proto,
-                     const std::string& domain, const LogSink& logInstance )
+  void DNS::sortTargets( DNSResolver::TargetList& targets )
   {
-    logInstance.dbg( LogAreaClassDns, "Resolving: _" +  service + "._" + proto + "." + domain );
-    struct addrinfo hints;
-    if( proto == "tcp" )
-      hints.ai_socktype = SOCK_STREAM;
-    else if( proto == "udp" )
-      hints.ai_socktype = SOCK_DGRAM;
-    else
+    DNSResolver::TargetList sorted;
+    while( !targets.empty() )
     {
-      logInstance.err( LogAreaClassDns, "Unknown/Invalid protocol: " + proto );
+      int priority = targets.front().priority;
+      DNSResolver::TargetList::iterator it = targets.begin();
+      for( ; it != targets.end(); ++it )
+      {
+        if( (*it).priority < priority )
+          priority = (*it).priority;
+      }
+
+      // the targets of the lowest priority, those with a weight of 0 first
+      DNSResolver::TargetList group;
+      it = targets.begin();
+      while( it != targets.end() )
+      {
+        DNSResolver::TargetList::iterator t = it++;
+        if( (*t).priority == priority )
+          group.splice( (*t).weight ? group.end() : group.begin(), targets, t );
+      }
+
+      while( !group.empty() )
+      {
+        long sum = 0;
+        for( it = group.begin(); it != group.end(); ++it )
+          sum += (*it).weight;
+
+        const long pick = sum ? randomUpTo( sum ) : 0;
+        long running = 0;
+        for( it = group.begin(); it != group.end(); ++it )
+        {
+          running += (*it).weight;
+          if( running >= pick )
+            break;
+        }
+        sorted.splice( sorted.end(), group, it );
+      }
     }
-    memset( &hints, '\0', sizeof( hints ) );
-    hints.ai_flags = AI_ADDRCONFIG | AI_CANONNAME;
-    hints.ai_socktype = SOCK_STREAM;
-    int e = getaddrinfo( domain.c_str(), service.c_str(), &hints, res );
-    if( e )
-      logInstance.err( LogAreaClassDns, "getaddrinfo() failed" );
+    targets.swap( sorted );
+  }
+
+  DNS::HostMap DNS::orderedHostMap( DNSResolver::TargetList& targets )
+  {
+    sortTargets( targets );
+
+    HostMap servers;
+    DNSResolver::TargetList::const_iterator it = targets.begin();
+    for( ; it != targets.end(); ++it )
+      servers.push_back( std::make_pair( (*it).host, (*it).port ) );
+    return servers;
   }
 
   int DNS::connect( const std::string& host, const LogSink& logInstance )
   {
-    struct addrinfo* results = 0;
+    HostMap hosts = resolve( host, logInstance );
+    if( hosts.size() == 0 )
+      return -ConnDnsError;
 
-    resolve( &results, host, logInstance );
-    if( !results )
+    // the addresses are looked up by connect( targets ), one target at a time, so that the
+    // first attempt doesn't have to wait for all of them
+    DNSResolver::TargetList targets;
+    HostMap::const_iterator it = hosts.begin();
+    for( ; it != hosts.end(); ++it )
     {
+      DNSResolver::Target target;
+      target.host = (*it).first;
+      target.port = (*it).second;
+      target.priority = 0;
+      target.weight = 0;
+      targets.push_back( target );
+    }
+
+    const int fd = connect( targets, logInstance );
+    if( fd == -ConnDnsError )
       logInstance.err( LogAreaClassDns, "host not found: " + host );
-      return -ConnDnsError;
+    return fd;
+  }
+
+  StringList DNS::addresses( const std::string& host, const LogSink& logInstance )
+  {
+    StringList list;
+#ifdef HAVE_GETADDRINFO
+    struct addrinfo hints, *res;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    if( getaddrinfo( host.c_str(), 0, &hints, &res ) != 0 )
+    {
+      logInstance.dbg( LogAreaClassDns, "getaddrinfo() failed for " + host + "." );
+      return list;
     }
 
-    struct addrinfo* runp = results;
-    while( runp )
+    for( struct addrinfo* p = res; p != 0; p = p->ai_next )
+    {
+      char ip[NI_MAXHOST];
+      if( getnameinfo( p->ai_addr, p->ai_addrlen, ip, sizeof( ip ), 0, 0, NI_NUMERICHOST ) == 0 )
+        list.push_back( ip );
+    }
+    freeaddrinfo( res );
+#else
+    struct hostent* h = gethostbyname( host.c_str() );
+    if( !h || h->h_addrtype != AF_INET || h->h_length != sizeof( struct in_addr ) )
     {
-      int fd = DNS::connect( runp, logInstance );
-      if( fd >= 0 )
-        return fd;
+      logInstance.dbg( LogAreaClassDns, "gethostbyname() failed for " + host + "." );
+      return list;
+    }
 
-      runp = runp->ai_next;
+    for( char** a = h->h_addr_list; *a; ++a )
+    {
+      struct in_addr addr;
+      memcpy( &addr, *a, sizeof( addr ) );
+      list.push_back( inet_ntoa( addr ) );
     }
+#endif
+    return list;
+  }
 
-    freeaddrinfo( results );
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+  namespace
+  {
+    typedef std::list< std::pair<std::string, int> > AddressList;
 
-    return -ConnConnectionRefused;
+    // RFC 8305: alternate between IPv6 and IPv4 addresses of each target, IPv6 first
+    void addCandidates( AddressList& candidates, const StringList& addresses, int port )
+    {
+      StringList v6, v4;
+      StringList::const_iterator a = addresses.begin();
+      for( ; a != addresses.end(); ++a )
+        ( (*a).find( ':' ) != std::string::npos ? v6 : v4 ).push_back( (*a) );
+
+      while( !v6.empty() || !v4.empty() )
+      {
+        if( !v6.empty() )
+        {
+          candidates.push_back( std::make_pair( v6.front(), port ) );
+          v6.pop_front();
+        }
+        if( !v4.empty() )
+        {
+          candidates.push_back( std::make_pair( v4.front(), port ) );
+          v4.pop_front();
+        }
+      }
+    }
   }
 
-  int DNS::connect( struct addrinfo* res, const LogSink& logInstance )
+  int DNS::connect( const DNSResolver::TargetList& targets, const LogSink& logInstance,
+                    int delay, int timeout )
   {
-    if( !res )
-      return -1;
+    // start a new attempt every delay ms (or as soon as one fails) until one succeeds
+    typedef std::map<int, std::string> AttemptMap;      // socket -> address:port
+    AttemptMap attempts;
+    AddressList candidates;                             // resolved, but not tried yet
+    DNSResolver::TargetList::const_iterator t = targets.begin();
+    const double deadline = now() + static_cast<double>( timeout ) / 1000.0;
+    double next = 0.0;
+    int tried = 0;
+    int fd = -1;
+
+    while( fd < 0 )
+    {
+      double n = now();
+      if( attempts.empty() || n >= next )
+      {
+        // a target without addresses is looked up only when it is its turn, while the
+        // attempts to the previous targets keep running (RFC 8305, section 3)
+        while( candidates.empty() && t != targets.end() )
+        {
+          addCandidates( candidates, (*t).addresses.empty() ? addresses( (*t).host, logInstance )
+                                                           : (*t).addresses, (*t).port );
+          ++t;
+          n = now();
+        }
 
-    int fd = getSocket( res->ai_family, res->ai_socktype, res->ai_protocol, logInstance );
-    if( fd < 0 )
-      return fd;
+        if( !candidates.empty() )
+        {
+          const std::pair<std::string, int> c = candidates.front();
+          candidates.pop_front();
+          ++tried;
+          const int s = connectNonBlocking( c.first, c.second, logInstance );
+          if( s >= 0 )
+            attempts[s] = c.first + ":" + util::int2string( c.second );
+          next = n + static_cast<double>( delay ) / 1000.0;
+          continue;
+        }
+      }
 
-    if( ::connect( fd, res->ai_addr, res->ai_addrlen ) == 0 )
-    {
-      char ip[NI_MAXHOST];
-      char port[NI_MAXSERV];
+      if( attempts.empty() || n >= deadline )
+        break;
 
-      if( getnameinfo( res->ai_addr, res->ai_addrlen,
-                       ip, sizeof( ip ),
-                       port, sizeof( port ),
-                       NI_NUMERICHOST | NI_NUMERICSERV ) )
+      const bool more = !candidates.empty() || t != targets.end();
+      double wait = ( more && next < deadline ) ? next : deadline;
+      wait = wait > n ? wait - n : 0.0;
+
+      // poll() rather than select(), which can not handle descriptors >= FD_SETSIZE
+      std::vector<struct pollfd> fds;
+      fds.reserve( attempts.size() );
+      AttemptMap::const_iterator it = attempts.begin();
+      for( ; it != attempts.end(); ++it )
       {
-        //FIXME do we need to handle this? How? Can it actually happen at all?
-//         printf( "could not get numeric hostname");
+        struct pollfd pfd;
+        pfd.fd = (*it).first;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        fds.push_back( pfd );
       }
 
-      if( res->ai_canonname )
-        logInstance.dbg( LogAreaClassDns, std::string( "Connecting to " ).append( res->ai_canonname ).append( " (" ).append( ip ).append( "), port  " ).append( port ) );
-      else
-        logInstance.dbg( LogAreaClassDns, std::string( "Connecting to " ).append( ip ).append( ":" ).append( port ) );
+      if( poll( &fds[0], fds.size(), static_cast<int>( wait * 1000.0 ) + 1 ) < 0 && errno != EINTR )
+        break;
 
-      return fd;
+      std::vector<struct pollfd>::const_iterator p = fds.begin();
+      for( ; p != fds.end(); ++p )
+      {
+        if( !(*p).revents )
+          continue;
+
+        AttemptMap::iterator a = attempts.find( (*p).fd );
+        int error = 0;
+        socklen_t len = sizeof( error );
+        if( getsockopt( (*a).first, SOL_SOCKET, SO_ERROR, &error, &len ) == 0 && error == 0 )
+        {
+          fd = (*a).first;
+          logInstance.dbg( LogAreaClassDns, "Connected to " + (*a).second );
+          attempts.erase( a );
+          break;
+        }
+
+        logInstance.dbg( LogAreaClassDns, "Connection to " + (*a).second + " failed: "
+                                          + strerror( error ) );
+        closeSocket( (*a).first, logInstance );
+        attempts.erase( a );
+        next = 0.0;
+      }
     }
 
-    std::string message = "connect() failed. "
-#if defined( _WIN32 )
-        "WSAGetLastError: " + util::int2string( ::WSAGetLastError() );
-#else
-        "errno: " + util::int2string( errno ) + ": " + strerror( errno );
-#endif
-    logInstance.dbg( LogAreaClassDns, message );
+    AttemptMap::const_iterator it = attempts.begin();
+    for( ; it != attempts.end(); ++it )
+      closeSocket( (*it).first, logInstance );
 
-    closeSocket( fd, logInstance );
-    return -ConnConnectionRefused;
+    if( fd < 0 && !tried )
+    {
+      logInstance.dbg( LogAreaClassDns, "Connection failed, no addresses found" );
+      return -ConnDnsError;
+    }
+
+    if( fd < 0 )
+    {
+      logInstance.dbg( LogAreaClassDns, "Connection failed, tried "
+                       + util::int2string( tried ) + " addresses" );
+      return -ConnConnectionRefused;
+    }
+
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK );
+    return fd;
   }
 
-#else
+  int DNS::connectNonBlocking( const std::string& address, int port, const LogSink& logInstance )
+  {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    memset( &addr, 0, sizeof( addr ) );
+    struct sockaddr_in* in4 = reinterpret_cast<struct sockaddr_in*>( &addr );
+    struct sockaddr_in6* in6 = reinterpret_cast<struct sockaddr_in6*>( &addr );
+    if( inet_pton( AF_INET, address.c_str(), &in4->sin_addr ) == 1 )
+    {
+      in4->sin_family = AF_INET;
+      in4->sin_port = htons( static_cast<unsigned short>( port ) );
+      addrlen = sizeof( struct sockaddr_in );
+    }
+    else if( inet_pton( AF_INET6, address.c_str(), &in6->sin6_addr ) == 1 )
+    {
+      in6->sin6_family = AF_INET6;
+      in6->sin6_port = htons( static_cast<unsigned short>( port ) );
+      addrlen = sizeof( struct sockaddr_in6 );
+    }
+    else
+      return -1;
 
-  int DNS::connect( const std::string& host, const LogSink& logInstance )
+    const int fd = getSocket( addr.ss_family, SOCK_STREAM, IPPROTO_TCP, logInstance );
+    if( fd < 0 )
+      return -1;
+
+    logInstance.dbg( LogAreaClassDns, "Connecting to " + address + ":" + util::int2string( port ) );
+    if( fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK ) != 0
+        || ( ::connect( fd, reinterpret_cast<struct sockaddr*>( &addr ), addrlen ) != 0
+             && errno != EINPROGRESS ) )
+    {
+      logInstance.dbg( LogAreaClassDns, "connect() failed. errno: " + util::int2string( errno )
+                                        + ": " + strerror( errno ) );
+      closeSocket( fd, logInstance );
+      return -1;
+    }
+
+    return fd;
+  }
+
+  double DNS::now()
   {
-    HostMap hosts = resolve( host, logInstance );
-    if( hosts.size() == 0 )
-      return -ConnDnsError;
+    struct timeval tv;
+    gettimeofday( &tv, 0 );
+    return static_cast<double>( tv.tv_sec ) + static_cast<double>( tv.tv_usec ) / 1000000.0;
+  }
 
-    HostMap::const_iterator it = hosts.begin();
-    for( ; it != hosts.end(); ++it )
+#else
+
+  int DNS::connect( const DNSResolver::TargetList& targets, const LogSink& logInstance,
+                    int /*delay*/, int /*timeout*/ )
+  {
+    DNSResolver::TargetList::const_iterator t = targets.begin();
+    for( ; t != targets.end(); ++t )
     {
-      int fd = DNS::connect( (*it).first, (*it).second, logInstance );
-      if( fd >= 0 )
-        return fd;
+      if( (*t).addresses.empty() )
+      {
+        const int fd = DNS::connect( (*t).host, (*t).port, logInstance );
+        if( fd >= 0 )
+          return fd;
+        continue;
+      }
+
+      StringList::const_iterator a = (*t).addresses.begin();
+      for( ; a != (*t).addresses.end(); ++a )
+      {
+        int fd = DNS::connect( (*a), (*t).port, logInstance );
+        if( fd >= 0 )
+          return fd;
+      }
     }
 
     return -ConnConnectionRefused;
@@ -402,7 +769,24 @@ namespace gloox
     return static_cast<int>( fd );
   }
 
-#ifdef HAVE_GETADDRINFO
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+  int DNS::connect( const std::string& host, int port, const LogSink& logInstance )
+  {
+    // all addresses of the host take part in the race
+    DNSResolver::TargetList targets( 1 );
+    DNSResolver::Target& target = targets.front();
+    target.host = host;
+    target.port = port;
+    target.priority = 0;
+    target.weight = 0;
+    target.addresses = addresses( host, logInstance );
+    if( target.addresses.empty() )
+      return -ConnDnsError;
+
+    return connect( targets, logInstance );
+  }
+
+#elif defined( HAVE_GETADDRINFO )
   int DNS::connect( const std::string& host, int port, const LogSink& logInstance )
   {
     struct addrinfo hints, *servinfo, *p;
@@ -507,7 +891,7 @@ namespace gloox
     closeSocket( fd, logInstance );
     return -ConnConnectionRefused;
   }
-#endif // HAVE_GETADDRINFO
+#endif
 
   void DNS::closeSocket( int fd, const LogSink& logInstance )
   {
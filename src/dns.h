@@ -16,6 +16,7 @@
 
 #include "macros.h"
 #include "logsink.h"
+#include "dnsresolver.h"
 
 #ifdef __MINGW32__
 # include <windows.h>
@@ -45,6 +46,7 @@
 #endif
 
 #include <string>
+#include <list>
 #include <map>
 
 namespace gloox
@@ -63,9 +65,10 @@ namespace gloox
     public:
 
       /**
-       * A list of strings (used for server addresses) and ints (used for port numbers).
+       * A list of strings (used for server addresses) and ints (used for port numbers),
+       * in order of preference.
        */
-      typedef std::map<std::string, int> HostMap;
+      typedef std::list< std::pair<std::string, int> > HostMap;
 
       /**
        * This function resolves a service/protocol/domain tuple.
@@ -73,8 +76,8 @@ namespace gloox
        * @param proto The SRV protocol.
        * @param domain The domain to search for SRV records.
        * @param logInstance A LogSink to use for logging.
-       * @return A list of weighted hostname/port pairs from SRV records, or A records if no SRV
-       * records where found.
+       * @return A list of hostname/port pairs from SRV records, ordered by priority and
+       * weight as described in RFC 2782, or A records if no SRV records where found.
        */
       static HostMap resolve( const std::string& service, const std::string& proto,
                               const std::string& domain, const LogSink& logInstance );
@@ -92,16 +95,37 @@ namespace gloox
 
       /**
        * This is a convenience function which uses @ref resolve() to get a list of hosts
-       * and connects to one of them.
+       * and connects to one of them, using connect( const DNSResolver::TargetList&, ... ).
+       * The hosts' addresses are looked up one host at a time, when their turn comes.
        * @param host The host to resolve SRV records for.
        * @param logInstance A LogSink to use for logging.
        * @return A file descriptor for the established connection.
        */
       static int connect( const std::string& host, const LogSink& logInstance );
 
+      /**
+       * Connects to one of the addresses of the given targets. The addresses are tried in
+       * order, alternating between IPv6 and IPv4 addresses of each target. A new attempt is
+       * started every @c delay milliseconds, or as soon as the previous one failed, without
+       * giving up on the attempts already running ("Happy Eyeballs", RFC 8305). The first
+       * connection that is established wins. The addresses of a target that has none are
+       * looked up once it is the target's turn, while the earlier attempts keep running.
+       * @note On Windows, the addresses are tried one after the other.
+       * @param targets The targets to connect to, in order of preference.
+       * @param logInstance A LogSink to use for logging.
+       * @param delay The time in milliseconds to wait before starting the next attempt.
+       * @param timeout The time in milliseconds after which to give up.
+       * @return A file descriptor for the established (blocking) connection, or a negative
+       * ConnectionError (@c ConnDnsError if no addresses were found).
+       */
+      static int connect( const DNSResolver::TargetList& targets, const LogSink& logInstance,
+                          int delay = 250, int timeout = 30000 );
+
       /**
        * This is a convenience function which connects to the given host and port. No SRV
-       * records are resolved. Use this function for special setups.
+       * records are resolved. Use this function for special setups. Except on Windows, all
+       * addresses of the host are tried as described for
+       * connect( const DNSResolver::TargetList&, ... ).
        * @param host The host/IP address to connect to.
        * @param port A custom port to connect to.
        * @param logInstance A LogSink to use for logging.
@@ -123,38 +147,74 @@ namespace gloox
        */
       static void closeSocket( int fd, const LogSink& logInstance );
 
-    private:
-#ifdef HAVE_GETADDRINFO
       /**
-       * Resolves the given service for the given domain and protocol, using the IPv6-ready
-       * getaddrinfo(). The result is put into the first parameter.
-       * @param res A pointer to a pointer holding the query results.
-       * @param service A service string to query for, e.g. xmpp-client.
-       * @param proto A protocol name.
-       * @param domain The domain to query for.
-       * @param logInstance A LogSink to use for logging.
+       * Orders targets as described in RFC 2782: by ascending priority, and among targets of
+       * the same priority randomly, so that each target is picked first with a probability
+       * proportional to its weight.
+       * @param targets The targets to order.
        */
-      static void resolve( struct addrinfo** res, const std::string& service, const std::string& proto,
-                           const std::string& domain, const LogSink& logInstance );
+      static void sortTargets( DNSResolver::TargetList& targets );
 
       /**
-       * This is a convenience funtion which uses @ref resolve() to resolve SRV records
-       * for a given domain, using a service of @b xmpp-client and a proto of @b tcp.
-       * @param res A pointer to a pointer holding the query results.
-       * @param domain The domain to resolve SRV records for.
+       * Returns the key of a lookup in the process-wide cache.
+       * @param service The SRV service type.
+       * @param proto The SRV protocol.
+       * @param domain The domain.
+       * @return The key.
+       */
+      static std::string cacheKey( const std::string& service, const std::string& proto,
+                                   const std::string& domain );
+
+      /**
+       * Looks up a result in the process-wide cache. Expired entries are removed.
+       * @param key The lookup's key, as returned by cacheKey().
+       * @param complete Whether only results with resolved addresses should be returned.
+       * @param targets Is set to the cached targets.
+       * @return @b True if a result was found, @b false otherwise.
+       */
+      static bool cacheLookup( const std::string& key, bool complete, DNSResolver::TargetList& targets );
+
+      /**
+       * Stores a result in the process-wide cache.
+       * @param key The lookup's key, as returned by cacheKey().
+       * @param complete Whether the targets' addresses have been resolved.
+       * @param targets The targets to store. Empty results are not cached.
+       * @param ttl The number of seconds the result is valid. A TTL of 0 is not cached.
+       */
+      static void cacheStore( const std::string& key, bool complete,
+                              const DNSResolver::TargetList& targets, unsigned long ttl );
+
+      /**
+       * Removes all entries from the process-wide cache.
+       */
+      static void clearCache();
+
+      /**
+       * Returns statistics of the process-wide cache.
+       * @return The statistics.
+       */
+      static DNSResolver::CacheStatistics cacheStatistics();
+
+    private:
+      /**
+       * Resolves the addresses of the given host, using the system resolver.
+       * @param host The host name.
        * @param logInstance A LogSink to use for logging.
+       * @return The numeric addresses of the host.
        */
-      static void resolve( struct addrinfo** res, const std::string& domain, const LogSink& logInstance )
-        { resolve( res, "xmpp-client", "tcp", domain, logInstance ); }
+      static StringList addresses( const std::string& host, const LogSink& logInstance );
 
       /**
-       * Tries to connect to the host/address contained in the addrinfo structure.
-       * @param res The connection parameters.
+       * Starts a non-blocking connection attempt to the given address.
+       * @param address A numeric IPv4 or IPv6 address.
+       * @param port The port.
        * @param logInstance A LogSink to use for logging.
-       * @return A file descriptor for the established connection.
+       * @return The connecting socket, or -1 on error.
        */
-      static int connect( struct addrinfo* res, const LogSink& logInstance );
-#endif
+      static int connectNonBlocking( const std::string& address, int port, const LogSink& logInstance );
+
+      static double now();
+      static HostMap orderedHostMap( DNSResolver::TargetList& targets );
 
       /**
        * This function prepares and returns a socket with the given parameters.
@@ -0,0 +1,51 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#ifndef DNSHANDLER_H__
+#define DNSHANDLER_H__
+
+#include "macros.h"
+#include "dnsresolver.h"
+
+namespace gloox
+{
+
+  /**
+   * @brief A virtual interface which can be reimplemented to receive the results of
+   * asynchronous DNS lookups started with DNSResolver::resolve().
+   *
+   * @author Jakob Schröter <js@camaya.net>
+   * @since 1.1
+   */
+  class GLOOX_API DNSHandler
+  {
+    public:
+      /**
+       * Virtual Destructor.
+       */
+      virtual ~DNSHandler() {}
+
+      /**
+       * This function is called from DNSResolver::recv() when a lookup has finished.
+       * @param id The lookup's ID, as returned by DNSResolver::resolve().
+       * @param targets The hosts to connect to, ordered by priority and weight as described in
+       * RFC 2782. Pass them to ConnectionTCPClient::setTargets() to connect. Only targets
+       * with at least one address are included (except on platforms without the asynchronous
+       * resolver, see DNSResolver). The list is empty if the lookup failed.
+       */
+      virtual void handleResolved( int id, const DNSResolver::TargetList& targets ) = 0;
+  };
+
+}
+
+#endif // DNSHANDLER_H__
@@ -0,0 +1,736 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#include "config.h"
+
+#include "dnsresolver.h"
+#include "dnshandler.h"
+#include "dns.h"
+#include "logsink.h"
+#include "util.h"
+
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <sys/time.h>
+# include <poll.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#define DNS_TYPE_A     1
+#define DNS_TYPE_CNAME 5
+#define DNS_TYPE_AAAA  28
+#define DNS_TYPE_SRV   33
+
+namespace gloox
+{
+
+  namespace
+  {
+    double now()
+    {
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+      struct timeval tv;
+      gettimeofday( &tv, 0 );
+      return static_cast<double>( tv.tv_sec ) + static_cast<double>( tv.tv_usec ) / 1000000.0;
+#else
+      return static_cast<double>( time( 0 ) );
+#endif
+    }
+
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+    // query IDs must not be guessable by an off-path attacker (RFC 5452)
+    unsigned short randomId()
+    {
+      unsigned short id = 0;
+      const int fd = open( "/dev/urandom", O_RDONLY );
+      if( fd >= 0 && read( fd, &id, sizeof( id ) ) == static_cast<ssize_t>( sizeof( id ) ) )
+      {
+        close( fd );
+        return id;
+      }
+
+      if( fd >= 0 )
+        close( fd );
+
+      // no /dev/urandom (e.g. in a chroot), better than nothing
+      static unsigned int s_state = 0;
+      unsigned int x = s_state;
+      if( !x )
+      {
+        struct timeval tv;
+        gettimeofday( &tv, 0 );
+        x = static_cast<unsigned int>( tv.tv_sec ^ ( tv.tv_usec << 12 ) ^ getpid() ) | 1;
+      }
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      s_state = x ? x : 1;
+      return static_cast<unsigned short>( x >> 16 );
+    }
+#endif
+  }
+
+  DNSResolver::DNSResolver( const LogSink& logInstance )
+    : m_logInstance( logInstance ), m_nameserverPort( 53 ),
+      m_timeout( 2000 ), m_retries( 2 ), m_nextId( 0 )
+  {
+  }
+
+  DNSResolver::~DNSResolver()
+  {
+    LookupMap::iterator it = m_lookups.begin();
+    for( ; it != m_lookups.end(); ++it )
+    {
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+      close( (*it).second->socket );
+#endif
+      delete (*it).second;
+    }
+  }
+
+  void DNSResolver::setNameserver( const std::string& address, int port )
+  {
+    // pending lookups stick to the nameserver they started with
+    m_nameserver = address;
+    m_nameserverPort = port;
+  }
+
+  std::list<int> DNSResolver::sockets() const
+  {
+    std::list<int> sockets;
+    LookupMap::const_iterator it = m_lookups.begin();
+    for( ; it != m_lookups.end(); ++it )
+      sockets.push_back( (*it).second->socket );
+    return sockets;
+  }
+
+  bool DNSResolver::hasSocket( int socket ) const
+  {
+    LookupMap::const_iterator it = m_lookups.begin();
+    for( ; it != m_lookups.end(); ++it )
+    {
+      if( (*it).second->socket == socket )
+        return true;
+    }
+    return false;
+  }
+
+  void DNSResolver::setTimeout( int timeout, int retries )
+  {
+    m_timeout = timeout;
+    m_retries = retries;
+  }
+
+  void DNSResolver::clearCache()
+  {
+    DNS::clearCache();
+  }
+
+  DNSResolver::CacheStatistics DNSResolver::cacheStatistics()
+  {
+    return DNS::cacheStatistics();
+  }
+
+  int DNSResolver::pending() const
+  {
+    int num = static_cast<int>( m_results.size() );
+    LookupMap::const_iterator it = m_lookups.begin();
+    for( ; it != m_lookups.end(); ++it )
+      num += static_cast<int>( (*it).second->waiters.size() );
+    return num;
+  }
+
+  void DNSResolver::cancel( DNSHandler* dh )
+  {
+    // the lookups themselves go on, their results are still useful for the cache
+    LookupMap::iterator it = m_lookups.begin();
+    for( ; it != m_lookups.end(); ++it )
+    {
+      WaiterList& waiters = (*it).second->waiters;
+      WaiterList::iterator w = waiters.begin();
+      while( w != waiters.end() )
+      {
+        if( (*w).handler == dh )
+          waiters.erase( w++ );
+        else
+          ++w;
+      }
+    }
+
+    ResultList::iterator r = m_results.begin();
+    while( r != m_results.end() )
+    {
+      if( (*r).waiter.handler == dh )
+        m_results.erase( r++ );
+      else
+        ++r;
+    }
+  }
+
+  int DNSResolver::resolve( const std::string& service, const std::string& proto,
+                            const std::string& domain, int port, DNSHandler* dh )
+  {
+    Waiter waiter;
+    waiter.handler = dh;
+    waiter.id = ++m_nextId;
+
+    Result result;
+    result.waiter = waiter;
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+    const std::string key = DNS::cacheKey( service, proto, domain );
+    if( DNS::cacheLookup( key, true, result.targets ) )
+    {
+      DNS::sortTargets( result.targets );
+      m_results.push_back( result );
+      return waiter.id;
+    }
+
+    LookupMap::iterator it = m_lookups.find( key );
+    if( it != m_lookups.end() )
+    {
+      (*it).second->waiters.push_back( waiter );
+      return waiter.id;
+    }
+
+    const int socket = openSocket();
+    if( socket < 0 )
+    {
+      m_results.push_back( result );
+      return waiter.id;
+    }
+
+    Lookup* lookup = new Lookup;
+    lookup->key = key;
+    lookup->domain = domain;
+    lookup->port = port;
+    lookup->waiters.push_back( waiter );
+    lookup->queries = 0;
+    lookup->ttl = static_cast<unsigned long>( -1 );
+    lookup->socket = socket;
+    m_lookups[key] = lookup;
+
+    m_logInstance.dbg( LogAreaClassDns, "Resolving: _" + service + "._" + proto + "." + domain );
+    sendQuery( lookup, 0, "_" + service + "._" + proto + "." + domain, DNS_TYPE_SRV );
+#else
+    const DNS::HostMap hosts = DNS::resolve( service, proto, domain, m_logInstance );
+    DNS::HostMap::const_iterator it = hosts.begin();
+    for( ; it != hosts.end(); ++it )
+    {
+      Target target;
+      target.host = (*it).first;
+      target.port = (*it).second;
+      target.priority = 0;
+      target.weight = 0;
+      result.targets.push_back( target );
+    }
+    (void)port;
+    m_results.push_back( result );
+#endif
+
+    return waiter.id;
+  }
+
+  int DNSResolver::recv( int timeout )
+  {
+    int num = notify();
+    if( num || m_queries.empty() )
+      return num;
+
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+    const double end = timeout < 0 ? -1.0 : now() + static_cast<double>( timeout ) / 1000000.0;
+    do
+    {
+      // wake up for the next retransmission at the latest
+      double wait = m_queries.begin()->second.deadline;
+      QueryMap::const_iterator q = m_queries.begin();
+      for( ; q != m_queries.end(); ++q )
+      {
+        if( (*q).second.deadline < wait )
+          wait = (*q).second.deadline;
+      }
+      if( end >= 0.0 && end < wait )
+        wait = end;
+      wait -= now();
+      if( wait < 0.0 )
+        wait = 0.0;
+
+      std::vector<struct pollfd> fds;
+      fds.reserve( m_lookups.size() );
+      LookupMap::const_iterator l = m_lookups.begin();
+      for( ; l != m_lookups.end(); ++l )
+      {
+        struct pollfd pfd;
+        pfd.fd = (*l).second->socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back( pfd );
+      }
+
+      if( poll( &fds[0], fds.size(), static_cast<int>( wait * 1000.0 ) + 1 ) > 0 )
+      {
+        unsigned char buf[1500];
+        ssize_t size;
+        std::vector<struct pollfd>::const_iterator p = fds.begin();
+        for( ; p != fds.end(); ++p )
+        {
+          // an answer may finish the lookup, which closes its socket
+          while( (*p).revents && hasSocket( (*p).fd )
+                 && ( size = ::recv( (*p).fd, buf, sizeof( buf ), 0 ) ) > 0 )
+            handleAnswer( (*p).fd, buf, static_cast<int>( size ) );
+        }
+      }
+
+      checkTimeouts();
+      num = notify();
+    }
+    while( !num && !m_queries.empty() && ( end < 0.0 || now() < end ) );
+#else
+    (void)timeout;
+#endif
+
+    return num;
+  }
+
+  int DNSResolver::notify()
+  {
+    int num = 0;
+    // handlers may start new lookups
+    while( !m_results.empty() )
+    {
+      Result result = m_results.front();
+      m_results.pop_front();
+      if( result.waiter.handler )
+        result.waiter.handler->handleResolved( result.waiter.id, result.targets );
+      ++num;
+    }
+    return num;
+  }
+
+#if !defined( _WIN32 ) && !defined( _WIN32_WCE )
+  int DNSResolver::openSocket()
+  {
+    if( m_nameserver.empty() )
+    {
+      m_nameserver = "127.0.0.1";
+      FILE* f = fopen( "/etc/resolv.conf", "r" );
+      if( f )
+      {
+        char line[256];
+        char address[64];
+        while( fgets( line, sizeof( line ), f ) )
+        {
+          if( sscanf( line, "nameserver %63s", address ) == 1 )
+          {
+            m_nameserver = address;
+            break;
+          }
+        }
+        fclose( f );
+      }
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    memset( &addr, 0, sizeof( addr ) );
+    struct sockaddr_in* in4 = reinterpret_cast<struct sockaddr_in*>( &addr );
+    struct sockaddr_in6* in6 = reinterpret_cast<struct sockaddr_in6*>( &addr );
+    if( inet_pton( AF_INET, m_nameserver.c_str(), &in4->sin_addr ) == 1 )
+    {
+      in4->sin_family = AF_INET;
+      in4->sin_port = htons( static_cast<unsigned short>( m_nameserverPort ) );
+      addrlen = sizeof( struct sockaddr_in );
+    }
+    else if( inet_pton( AF_INET6, m_nameserver.c_str(), &in6->sin6_addr ) == 1 )
+    {
+      in6->sin6_family = AF_INET6;
+      in6->sin6_port = htons( static_cast<unsigned short>( m_nameserverPort ) );
+      addrlen = sizeof( struct sockaddr_in6 );
+    }
+    else
+    {
+      m_logInstance.err( LogAreaClassDns, "Invalid nameserver address: " + m_nameserver );
+      return -1;
+    }
+
+    // a connected socket only receives datagrams from the nameserver. the kernel picks a
+    // random source port for every new socket
+    const int fd = ::socket( addr.ss_family, SOCK_DGRAM, 0 );
+    if( fd < 0 || ::connect( fd, reinterpret_cast<struct sockaddr*>( &addr ), addrlen ) != 0
+        || fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK ) != 0 )
+    {
+      m_logInstance.err( LogAreaClassDns, "Could not open a socket to nameserver " + m_nameserver
+                                          + ": " + strerror( errno ) );
+      if( fd >= 0 )
+        close( fd );
+      return -1;
+    }
+
+    return fd;
+  }
+
+  std::string DNSResolver::buildQuery( int id, const std::string& name, int type )
+  {
+    std::string packet;
+    packet += static_cast<char>( ( id >> 8 ) & 0xff );
+    packet += static_cast<char>( id & 0xff );
+    packet.append( "\x01\x00" "\x00\x01" "\x00\x00" "\x00\x00" "\x00\x00", 10 ); // RD, 1 question
+
+    std::string::size_type start = 0;
+    while( start < name.length() )
+    {
+      std::string::size_type end = name.find( '.', start );
+      if( end == std::string::npos )
+        end = name.length();
+      const std::string::size_type len = end - start;
+      if( len > 63 )
+        return std::string();
+      if( len )
+      {
+        packet += static_cast<char>( len );
+        packet.append( name, start, len );
+      }
+      start = end + 1;
+    }
+    packet += '\0';
+
+    packet += static_cast<char>( ( type >> 8 ) & 0xff );
+    packet += static_cast<char>( type & 0xff );
+    packet.append( "\x00\x01", 2 ); // class IN
+    return packet;
+  }
+
+  void DNSResolver::sendQuery( Lookup* lookup, Target* target, const std::string& name, int type )
+  {
+    int id = randomId();
+    while( m_queries.find( id ) != m_queries.end() )
+      id = randomId();
+
+    Query query;
+    query.lookup = lookup;
+    query.target = target;
+    query.name = name;
+    query.type = type;
+    query.packet = buildQuery( id, name, type );
+    query.deadline = now() + static_cast<double>( m_timeout ) / 1000.0;
+    query.tries = 0;
+
+    ++lookup->queries;
+    if( query.packet.empty() )
+    {
+      m_logInstance.warn( LogAreaClassDns, "Invalid name: " + name );
+      if( target )
+        queryDone( lookup );
+      else
+        handleSRV( lookup, false, RecordList() );
+      return;
+    }
+
+    m_queries[id] = query;
+    ::send( lookup->socket, query.packet.data(), query.packet.length(), 0 );
+  }
+
+  bool DNSResolver::readName( const unsigned char* buf, int len, int& pos, std::string& name )
+  {
+    name = std::string();
+    int p = pos;
+    int jumps = 0;
+    while( p < len )
+    {
+      const int c = buf[p];
+      if( c == 0 )
+      {
+        if( !jumps )
+          pos = p + 1;
+        return true;
+      }
+
+      if( ( c & 0xc0 ) == 0xc0 )
+      {
+        if( p + 1 >= len || ++jumps > 32 )
+          return false;
+        if( jumps == 1 )
+          pos = p + 2;
+        p = ( ( c & 0x3f ) << 8 ) | buf[p + 1];
+        continue;
+      }
+
+      if( p + 1 + c > len )
+        return false;
+      if( !name.empty() )
+        name += '.';
+      name.append( reinterpret_cast<const char*>( buf + p + 1 ), c );
+      p += c + 1;
+    }
+    return false;
+  }
+
+  bool DNSResolver::parse( const unsigned char* buf, int len, std::string& question,
+                           int& qtype, int& rcode, RecordList& records )
+  {
+    if( len < 12 || !( buf[2] & 0x80 ) )
+      return false;
+
+    rcode = buf[3] & 0x0f;
+    const int qdcount = ( buf[4] << 8 ) | buf[5];
+    const int rrcount = ( ( buf[6] << 8 ) | buf[7] ) + ( ( buf[8] << 8 ) | buf[9] )
+                        + ( ( buf[10] << 8 ) | buf[11] );
+
+    int pos = 12;
+    if( qdcount != 1 || !readName( buf, len, pos, question ) || pos + 4 > len
+        || ( ( buf[pos + 2] << 8 ) | buf[pos + 3] ) != 1 ) // class IN
+      return false;
+    qtype = ( buf[pos] << 8 ) | buf[pos + 1];
+    pos += 4;
+
+    // answer, authority and additional records all go into one list
+    for( int i = 0; i < rrcount; ++i )
+    {
+      Record record;
+      if( !readName( buf, len, pos, record.name ) || pos + 10 > len )
+        return false;
+
+      record.type = ( buf[pos] << 8 ) | buf[pos + 1];
+      record.ttl = ( static_cast<unsigned long>( buf[pos + 4] ) << 24 )
+                   | ( static_cast<unsigned long>( buf[pos + 5] ) << 16 )
+                   | ( static_cast<unsigned long>( buf[pos + 6] ) << 8 )
+                   | static_cast<unsigned long>( buf[pos + 7] );
+      const int rdlength = ( buf[pos + 8] << 8 ) | buf[pos + 9];
+      pos += 10;
+      if( pos + rdlength > len )
+        return false;
+
+      char address[INET6_ADDRSTRLEN];
+      if( record.type == DNS_TYPE_SRV && rdlength > 6 )
+      {
+        record.priority = ( buf[pos] << 8 ) | buf[pos + 1];
+        record.weight = ( buf[pos + 2] << 8 ) | buf[pos + 3];
+        record.port = ( buf[pos + 4] << 8 ) | buf[pos + 5];
+        int p = pos + 6;
+        if( !readName( buf, len, p, record.data ) )
+          return false;
+        records.push_back( record );
+      }
+      else if( ( record.type == DNS_TYPE_A && rdlength == 4
+                 && inet_ntop( AF_INET, buf + pos, address, sizeof( address ) ) )
+               || ( record.type == DNS_TYPE_AAAA && rdlength == 16
+                 && inet_ntop( AF_INET6, buf + pos, address, sizeof( address ) ) ) )
+      {
+        record.data = address;
+        records.push_back( record );
+      }
+      else if( record.type == DNS_TYPE_CNAME )
+      {
+        // only its TTL matters
+        records.push_back( record );
+      }
+
+      pos += rdlength;
+    }
+
+    return true;
+  }
+
+  void DNSResolver::handleAnswer( int socket, const unsigned char* buf, int len )
+  {
+    if( len < 2 )
+      return;
+
+    QueryMap::iterator it = m_queries.find( ( buf[0] << 8 ) | buf[1] );
+    if( it == m_queries.end() || (*it).second.lookup->socket != socket )
+      return;
+
+    // the answer must repeat the question exactly
+    std::string question;
+    int qtype = 0;
+    int rcode = 0;
+    RecordList records;
+    if( !parse( buf, len, question, qtype, rcode, records ) || qtype != (*it).second.type
+        || DNS::cacheKey( "", "", question ) != DNS::cacheKey( "", "", (*it).second.name ) )
+    {
+      m_logInstance.dbg( LogAreaClassDns, "Ignoring invalid DNS answer" );
+      return;
+    }
+
+    const Query query = (*it).second;
+    m_queries.erase( it );
+    Lookup* lookup = query.lookup;
+
+    if( !query.target )
+    {
+      handleSRV( lookup, rcode == 0, records );
+      return;
+    }
+
+    RecordList::const_iterator r = records.begin();
+    for( ; r != records.end(); ++r )
+    {
+      if( (*r).type == query.type || (*r).type == DNS_TYPE_CNAME )
+      {
+        if( (*r).ttl < lookup->ttl )
+          lookup->ttl = (*r).ttl;
+        if( (*r).type == query.type )
+          query.target->addresses.push_back( (*r).data );
+      }
+    }
+    queryDone( lookup );
+  }
+
+  void DNSResolver::handleSRV( Lookup* lookup, bool ok, const RecordList& records )
+  {
+    RecordList::const_iterator r = records.begin();
+    for( ; ok && r != records.end(); ++r )
+    {
+      if( (*r).type != DNS_TYPE_SRV )
+        continue;
+
+      if( (*r).ttl < lookup->ttl )
+        lookup->ttl = (*r).ttl;
+
+      // a target of "." means the service is decidedly not available (RFC 2782)
+      if( (*r).data.empty() )
+        continue;
+
+      Target target;
+      target.host = (*r).data;
+      target.port = (*r).port;
+      target.priority = (*r).priority;
+      target.weight = (*r).weight;
+      lookup->targets.push_back( target );
+    }
+
+    if( ok && lookup->targets.empty() && lookup->ttl != static_cast<unsigned long>( -1 ) )
+    {
+      // only "." targets
+      queryDone( lookup );
+      return;
+    }
+
+    if( lookup->targets.empty() )
+    {
+      Target target;
+      target.host = lookup->domain;
+      target.port = lookup->port;
+      target.priority = 0;
+      target.weight = 0;
+      lookup->targets.push_back( target );
+    }
+    else
+      DNS::cacheStore( lookup->key, false, lookup->targets, lookup->ttl );
+
+    TargetList::iterator t = lookup->targets.begin();
+    for( ; t != lookup->targets.end(); ++t )
+    {
+      // use addresses from the additional section, if any
+      for( r = records.begin(); r != records.end(); ++r )
+      {
+        if( ( (*r).type == DNS_TYPE_A || (*r).type == DNS_TYPE_AAAA )
+            && DNS::cacheKey( "", "", (*r).name ) == DNS::cacheKey( "", "", (*t).host ) )
+        {
+          if( (*r).ttl < lookup->ttl )
+            lookup->ttl = (*r).ttl;
+          (*t).addresses.push_back( (*r).data );
+        }
+      }
+
+      if( (*t).addresses.empty() )
+      {
+        sendQuery( lookup, &(*t), (*t).host, DNS_TYPE_AAAA );
+        sendQuery( lookup, &(*t), (*t).host, DNS_TYPE_A );
+      }
+    }
+
+    queryDone( lookup );
+  }
+
+  void DNSResolver::queryDone( Lookup* lookup )
+  {
+    if( --lookup->queries > 0 )
+      return;
+
+    TargetList::iterator t = lookup->targets.begin();
+    while( t != lookup->targets.end() )
+    {
+      if( (*t).addresses.empty() )
+        lookup->targets.erase( t++ );
+      else
+        ++t;
+    }
+
+    DNS::cacheStore( lookup->key, true, lookup->targets, lookup->ttl );
+
+    WaiterList::const_iterator w = lookup->waiters.begin();
+    for( ; w != lookup->waiters.end(); ++w )
+    {
+      // every waiter gets its own order, to spread the load
+      Result result;
+      result.waiter = (*w);
+      result.targets = lookup->targets;
+      DNS::sortTargets( result.targets );
+      m_results.push_back( result );
+    }
+
+    m_lookups.erase( lookup->key );
+    close( lookup->socket );
+    delete lookup;
+  }
+
+  void DNSResolver::checkTimeouts()
+  {
+    const double t = now();
+    QueryMap::iterator it = m_queries.begin();
+    while( it != m_queries.end() )
+    {
+      Query& query = (*it).second;
+      if( query.deadline > t )
+      {
+        ++it;
+        continue;
+      }
+
+      if( query.tries < m_retries )
+      {
+        ++query.tries;
+        query.deadline = t + static_cast<double>( m_timeout ) / 1000.0;
+        ::send( query.lookup->socket, query.packet.data(), query.packet.length(), 0 );
+        ++it;
+        continue;
+      }
+
+      m_logInstance.dbg( LogAreaClassDns, "DNS query timed out: " + query.name );
+      Lookup* lookup = query.lookup;
+      const bool srv = !query.target;
+      m_queries.erase( it );
+      if( srv )
+        handleSRV( lookup, false, RecordList() );
+      else
+        queryDone( lookup );
+
+      // the above may have added or removed queries
+      it = m_queries.begin();
+    }
+  }
+#else
+  int DNSResolver::openSocket() { return -1; }
+#endif
+
+}
@@ -0,0 +1,265 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#ifndef DNSRESOLVER_H__
+#define DNSRESOLVER_H__
+
+#include "macros.h"
+#include "gloox.h"
+
+#include <string>
+#include <list>
+#include <map>
+
+namespace gloox
+{
+
+  class DNSHandler;
+  class LogSink;
+
+  /**
+   * @brief An asynchronous resolver for SRV, A and AAAA records with a process-wide cache.
+   *
+   * resolve() sends the queries to the nameserver and returns immediately. Call recv()
+   * periodically (or whenever one of sockets() becomes readable) to process answers. When a
+   * lookup is finished, the DNSHandler is notified from within recv().
+   *
+   * Every lookup uses its own UDP socket, and so its own source port, and every query
+   * carries a random ID. Answers are only accepted if they match the question that was
+   * sent. This makes it hard to inject forged answers (RFC 5452).
+   *
+   * A lookup first asks for SRV records of _service._proto.domain. If there are none, the
+   * domain itself is used with the given default port. The A and AAAA records of every target
+   * are then queried in parallel, unless the nameserver already sent them along with the SRV
+   * answer.
+   *
+   * Results are cached per (service, proto, domain) for the lowest TTL of all records
+   * involved. The cache is shared by all DNSResolver instances in the process (and by
+   * DNS::resolve()), so bringing up many clients for the same domain costs one lookup.
+   * Identical lookups that are started while one is in flight are answered together.
+   *
+   * By default, the first nameserver from /etc/resolv.conf is used. setNameserver()
+   * overrides this, e.g. to point the resolver at a local stub resolver.
+   *
+   * @note A DNSResolver is not thread-safe. Use it from one thread, e.g. the one running the
+   * EventLoop. The cache may be used from any number of threads.
+   *
+   * On platforms without the asynchronous implementation (e.g. Windows), resolve() falls back
+   * to the blocking DNS::resolve() and the resulting targets carry no addresses.
+   *
+   * @author Jakob Schröter <js@camaya.net>
+   * @since 1.1
+   */
+  class GLOOX_API DNSResolver
+  {
+    public:
+      /**
+       * @brief A host to connect to, as found in an SRV record (or the domain itself).
+       */
+      struct Target
+      {
+        std::string host;         /**< The host name. */
+        int port;                 /**< The port. */
+        int priority;             /**< The SRV priority. Lower values are preferred. */
+        int weight;               /**< The SRV weight. */
+        StringList addresses;     /**< Numeric IPv6 and IPv4 addresses of the host. */
+      };
+
+      /**
+       * A list of targets.
+       */
+      typedef std::list<Target> TargetList;
+
+      /**
+       * @brief Statistics of the process-wide cache.
+       */
+      struct CacheStatistics
+      {
+        int hits;                 /**< Lookups answered from the cache. */
+        int misses;               /**< Lookups that had to ask the nameserver. */
+        int entries;              /**< The number of currently cached results. */
+      };
+
+      /**
+       * Creates a new DNSResolver.
+       * @param logInstance A LogSink to use for logging.
+       */
+      DNSResolver( const LogSink& logInstance );
+
+      /**
+       * Destructor. Pending lookups are dropped without notifying their handlers.
+       */
+      virtual ~DNSResolver();
+
+      /**
+       * Sets the nameserver to send queries to.
+       * @param address The numeric IPv4 or IPv6 address of the nameserver.
+       * @param port The nameserver's port.
+       */
+      void setNameserver( const std::string& address, int port = 53 );
+
+      /**
+       * Sets the time to wait for an answer before a query is resent.
+       * @param timeout The timeout in milliseconds. Default: 2000.
+       * @param retries How often to resend a query before giving up. Default: 2.
+       */
+      void setTimeout( int timeout, int retries );
+
+      /**
+       * Starts a lookup.
+       * @param service The SRV service type, e.g. xmpp-client.
+       * @param proto The SRV protocol, e.g. tcp.
+       * @param domain The domain to look up.
+       * @param port The port to use if there are no SRV records.
+       * @param dh The handler to notify when the lookup is finished.
+       * @return The lookup's ID, which is passed to the handler.
+       */
+      int resolve( const std::string& service, const std::string& proto,
+                   const std::string& domain, int port, DNSHandler* dh );
+
+      /**
+       * Looks up the XMPP client service of the given domain.
+       * @param domain The domain to look up.
+       * @param dh The handler to notify when the lookup is finished.
+       * @return The lookup's ID, which is passed to the handler.
+       */
+      int resolve( const std::string& domain, DNSHandler* dh )
+        { return resolve( "xmpp-client", "tcp", domain, 5222, dh ); }
+
+      /**
+       * Makes sure the given handler is not notified of any pending lookups anymore.
+       * @param dh The handler to remove.
+       */
+      void cancel( DNSHandler* dh );
+
+      /**
+       * Returns the number of lookups whose handlers have not been notified yet.
+       * @return The number of pending lookups.
+       */
+      int pending() const;
+
+      /**
+       * Waits for answers from the nameserver for at most @c timeout microseconds,
+       * resends queries that timed out and notifies handlers of finished lookups.
+       * Returns immediately if there are no pending lookups.
+       * @param timeout The maximum time to wait in microseconds. The default of -1 means
+       * wait until at least one lookup has finished.
+       * @return The number of lookups that were finished.
+       */
+      int recv( int timeout = -1 );
+
+      /**
+       * Returns the sockets used to talk to the nameserver, one per pending lookup. They can
+       * be watched for readability alongside other sockets. recv() must also be called when
+       * a query times out, though. The list changes whenever a lookup is started or finished.
+       * @return The sockets of the pending lookups.
+       */
+      std::list<int> sockets() const;
+
+      /**
+       * Removes all entries from the process-wide cache.
+       */
+      static void clearCache();
+
+      /**
+       * Returns statistics of the process-wide cache.
+       * @return The statistics.
+       */
+      static CacheStatistics cacheStatistics();
+
+    private:
+      DNSResolver( const DNSResolver& );
+      DNSResolver& operator=( const DNSResolver& );
+
+      struct Lookup;
+
+      struct Waiter
+      {
+        DNSHandler* handler;
+        int id;
+      };
+      typedef std::list<Waiter> WaiterList;
+
+      struct Query
+      {
+        Lookup* lookup;
+        Target* target;           // 0 for the SRV query
+        std::string name;
+        int type;
+        std::string packet;
+        double deadline;
+        int tries;
+      };
+      typedef std::map<int, Query> QueryMap;    // DNS message ID -> query
+
+      struct Lookup
+      {
+        std::string key;
+        std::string domain;
+        int port;
+        TargetList targets;
+        WaiterList waiters;
+        int queries;              // queries that have not been answered or given up yet
+        unsigned long ttl;
+        int socket;               // a fresh socket (and source port) for every lookup
+      };
+      typedef std::map<std::string, Lookup*> LookupMap;
+
+      struct Result
+      {
+        Waiter waiter;
+        TargetList targets;
+      };
+      typedef std::list<Result> ResultList;
+
+      struct Record
+      {
+        std::string name;
+        int type;
+        unsigned long ttl;
+        int priority;
+        int weight;
+        int port;
+        std::string data;         // the SRV target or the numeric address
+      };
+      typedef std::list<Record> RecordList;
+
+      static std::string buildQuery( int id, const std::string& name, int type );
+      static bool readName( const unsigned char* buf, int len, int& pos, std::string& name );
+      static bool parse( const unsigned char* buf, int len, std::string& question,
+                         int& qtype, int& rcode, RecordList& records );
+
+      int openSocket();
+      bool hasSocket( int socket ) const;
+      void sendQuery( Lookup* lookup, Target* target, const std::string& name, int type );
+      void handleAnswer( int socket, const unsigned char* buf, int len );
+      void handleSRV( Lookup* lookup, bool ok, const RecordList& records );
+      void queryDone( Lookup* lookup );
+      void checkTimeouts();
+      int notify();
+
+      const LogSink& m_logInstance;
+      std::string m_nameserver;
+      int m_nameserverPort;
+      int m_timeout;
+      int m_retries;
+      int m_nextId;
+      QueryMap m_queries;
+      LookupMap m_lookups;
+      ResultList m_results;
+
+  };
+
+}
+
+#endif // DNSRESOLVER_H__
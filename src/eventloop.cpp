@@ -0,0 +1,472 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#include "config.h"
+
+#include "eventloop.h"
+#include "connectionbase.h"
+#include "connectiontcpbase.h"
+#include "timerhandler.h"
+
+#if defined( _WIN32 )
+# include <winsock2.h>
+# include <windows.h>
+#else
+# include <errno.h>
+# include <time.h>
+# include <unistd.h>
+# ifdef HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>
+# else
+#  include <poll.h>
+# endif
+#endif
+
+#include <vector>
+
+namespace gloox
+{
+
+#if defined( HAVE_SYS_EPOLL_H ) && !defined( _WIN32 )
+
+  struct EventLoop::Poller
+  {
+    struct Event
+    {
+      int fd;
+      bool read;
+      bool write;
+    };
+
+    Poller() : fd( epoll_create( 64 ) ), events( 64 ) {}
+    ~Poller() { if( fd >= 0 ) close( fd ); }
+
+    bool add( int s )
+    {
+      return control( EPOLL_CTL_ADD, s, EPOLLIN );
+    }
+
+    bool modify( int s, bool write )
+    {
+      return control( EPOLL_CTL_MOD, s, write ? EPOLLIN | EPOLLOUT : EPOLLIN );
+    }
+
+    void remove( int s )
+    {
+      struct epoll_event ev; // pre-2.6.9 kernels require a non-null event
+      epoll_ctl( fd, EPOLL_CTL_DEL, s, &ev );
+    }
+
+    // fills ready with the fds that have events, returns -1 on error
+    int wait( int timeout, std::vector<Event>& ready )
+    {
+      const int num = epoll_wait( fd, &events[0], static_cast<int>( events.size() ), timeout );
+      if( num < 0 )
+        return errno == EINTR ? 0 : -1;
+
+      for( int i = 0; i < num; ++i )
+      {
+        Event e;
+        e.fd = events[i].data.fd;
+        e.read = ( events[i].events & ~EPOLLOUT ) != 0;
+        e.write = ( events[i].events & EPOLLOUT ) != 0;
+        ready.push_back( e );
+      }
+
+      if( num == static_cast<int>( events.size() ) )
+        events.resize( events.size() * 2 );
+
+      return num;
+    }
+
+    bool control( int op, int s, unsigned int flags )
+    {
+      struct epoll_event ev;
+      ev.events = flags;
+      ev.data.u64 = 0;
+      ev.data.fd = s;
+      return epoll_ctl( fd, op, s, &ev ) == 0;
+    }
+
+    int fd;
+    std::vector<struct epoll_event> events;
+  };
+
+#else
+
+# if defined( _WIN32 )
+  typedef WSAPOLLFD pollfd_t;
+# else
+  typedef struct pollfd pollfd_t;
+# endif
+
+  // not a macro, that would rename EventLoop::poll() as well
+  static inline int pollSockets( pollfd_t* fds, unsigned long nfds, int timeout )
+  {
+# if defined( _WIN32 )
+    return WSAPoll( fds, nfds, timeout );
+# else
+    return ::poll( fds, static_cast<nfds_t>( nfds ), timeout );
+# endif
+  }
+
+  struct EventLoop::Poller
+  {
+    struct Event
+    {
+      int fd;
+      bool read;
+      bool write;
+    };
+
+    Poller() : fd( 0 ) {}
+
+    bool add( int s )
+    {
+      pollfd_t p;
+      p.fd = s;
+      p.events = POLLIN;
+      p.revents = 0;
+      fds.push_back( p );
+      return true;
+    }
+
+    bool modify( int s, bool write )
+    {
+      std::vector<pollfd_t>::iterator it = fds.begin();
+      for( ; it != fds.end(); ++it )
+      {
+        if( static_cast<int>( (*it).fd ) == s )
+        {
+          (*it).events = write ? POLLIN | POLLOUT : POLLIN;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void remove( int s )
+    {
+      std::vector<pollfd_t>::iterator it = fds.begin();
+      for( ; it != fds.end(); ++it )
+      {
+        if( static_cast<int>( (*it).fd ) == s )
+        {
+          fds.erase( it );
+          return;
+        }
+      }
+    }
+
+    int wait( int timeout, std::vector<Event>& ready )
+    {
+      if( fds.empty() )
+      {
+        // WSAPoll() does not accept an empty set
+#if defined( _WIN32 )
+        Sleep( timeout < 0 ? INFINITE : static_cast<DWORD>( timeout ) );
+#else
+        pollSockets( 0, 0, timeout );
+#endif
+        return 0;
+      }
+
+      const int num = pollSockets( &fds[0], static_cast<unsigned long>( fds.size() ), timeout );
+      if( num < 0 )
+      {
+#if !defined( _WIN32 )
+        if( errno == EINTR )
+          return 0;
+#endif
+        return -1;
+      }
+
+      std::vector<pollfd_t>::const_iterator it = fds.begin();
+      for( ; it != fds.end(); ++it )
+      {
+        if( !(*it).revents )
+          continue;
+
+        Event e;
+        e.fd = static_cast<int>( (*it).fd );
+        e.read = ( (*it).revents & ~POLLOUT ) != 0;
+        e.write = ( (*it).revents & POLLOUT ) != 0;
+        ready.push_back( e );
+      }
+      return num;
+    }
+
+    int fd;
+    std::vector<pollfd_t> fds;
+  };
+
+#endif
+
+  EventLoop::EventLoop()
+    : m_poller( new Poller() ), m_nextTimerId( 0 ), m_stop( false )
+  {
+  }
+
+  EventLoop::~EventLoop()
+  {
+    TCPMap::const_iterator it = m_tcp.begin();
+    for( ; it != m_tcp.end(); ++it )
+      (*it).second->setEventLoop( 0 );
+
+    delete m_poller;
+  }
+
+  bool EventLoop::usesEpoll()
+  {
+#if defined( HAVE_SYS_EPOLL_H ) && !defined( _WIN32 )
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool EventLoop::add( ConnectionBase* connection, int fd )
+  {
+    if( !connection || fd < 0 || m_poller->fd < 0 )
+      return false;
+
+    ConnectionMap::const_iterator it = m_connections.find( fd );
+    if( it != m_connections.end() )
+    {
+      if( (*it).second == connection )
+        return false;
+
+      // fd is open, so the other connection has closed it in the meantime: drop the stale entry
+      drop( fd );
+    }
+
+    if( !m_poller->add( fd ) )
+      return false;
+
+    m_connections[fd] = connection;
+    return true;
+  }
+
+  bool EventLoop::add( ConnectionTCPBase* connection )
+  {
+    if( !connection || !add( connection, connection->socket() ) )
+      return false;
+
+    m_tcp[connection->socket()] = connection;
+    connection->setEventLoop( this );
+    return true;
+  }
+
+  void EventLoop::remove( ConnectionBase* connection )
+  {
+    ConnectionMap::iterator it = m_connections.begin();
+    while( it != m_connections.end() )
+    {
+      const int fd = (*it).first;
+      const bool match = (*it).second == connection;
+      ++it;
+      if( match )
+        drop( fd );
+    }
+  }
+
+  void EventLoop::drop( int fd )
+  {
+    ConnectionMap::iterator it = m_connections.find( fd );
+    if( it == m_connections.end() )
+      return;
+
+    m_poller->remove( fd );
+    TCPMap::iterator t = m_tcp.find( fd );
+    if( t != m_tcp.end() )
+    {
+      (*t).second->setEventLoop( 0 );
+      m_tcp.erase( t );
+    }
+    m_connections.erase( it );
+  }
+
+  void EventLoop::setWriteInterest( ConnectionTCPBase* connection, bool write )
+  {
+    TCPMap::const_iterator it = m_tcp.find( connection->socket() );
+    if( it != m_tcp.end() && (*it).second == connection )
+      m_poller->modify( (*it).first, write );
+  }
+
+  int EventLoop::addTimer( TimerHandler* th, int interval, int context, bool repeat )
+  {
+    if( !th || interval < 0 )
+      return -1;
+
+    Timer t;
+    t.handler = th;
+    t.due = now() + interval;
+    t.interval = interval;
+    t.context = context;
+    t.repeat = repeat && interval > 0;
+
+    const int id = ++m_nextTimerId;
+    m_timers[id] = t;
+    m_queue.insert( std::make_pair( t.due, id ) );
+    return id;
+  }
+
+  void EventLoop::removeTimer( int id )
+  {
+    TimerMap::iterator it = m_timers.find( id );
+    if( it == m_timers.end() )
+      return;
+
+    std::pair<TimerQueue::iterator, TimerQueue::iterator> r = m_queue.equal_range( (*it).second.due );
+    for( TimerQueue::iterator q = r.first; q != r.second; ++q )
+    {
+      if( (*q).second == id )
+      {
+        m_queue.erase( q );
+        break;
+      }
+    }
+    m_timers.erase( it );
+  }
+
+  void EventLoop::removeTimers( TimerHandler* th )
+  {
+    std::vector<int> ids;
+    TimerMap::const_iterator it = m_timers.begin();
+    for( ; it != m_timers.end(); ++it )
+    {
+      if( (*it).second.handler == th )
+        ids.push_back( (*it).first );
+    }
+
+    std::vector<int>::const_iterator i = ids.begin();
+    for( ; i != ids.end(); ++i )
+      removeTimer( (*i) );
+  }
+
+  int EventLoop::nextTimeout( int timeout ) const
+  {
+    if( m_queue.empty() )
+      return timeout;
+
+    const double wait = (*m_queue.begin()).first - now();
+    const int next = wait <= 0 ? 0 : static_cast<int>( wait + 0.999 );
+    return ( timeout < 0 || next < timeout ) ? next : timeout;
+  }
+
+  int EventLoop::dispatchTimers()
+  {
+    const double current = now();
+    std::vector<int> expired;
+    while( !m_queue.empty() && (*m_queue.begin()).first <= current )
+    {
+      expired.push_back( (*m_queue.begin()).second );
+      m_queue.erase( m_queue.begin() );
+    }
+
+    int num = 0;
+    std::vector<int>::const_iterator it = expired.begin();
+    for( ; it != expired.end(); ++it )
+    {
+      // an earlier handler may have removed this timer
+      TimerMap::iterator t = m_timers.find( (*it) );
+      if( t == m_timers.end() )
+        continue;
+
+      TimerHandler* th = (*t).second.handler;
+      const int context = (*t).second.context;
+      if( (*t).second.repeat )
+      {
+        (*t).second.due = current + (*t).second.interval;
+        m_queue.insert( std::make_pair( (*t).second.due, (*it) ) );
+      }
+      else
+        m_timers.erase( t );
+
+      th->handleTimer( (*it), context );
+      ++num;
+    }
+
+    return num;
+  }
+
+  bool EventLoop::dispatch( int fd )
+  {
+    ConnectionMap::iterator it = m_connections.find( fd );
+    if( it == m_connections.end() )
+      return false; // removed by an earlier handler
+
+    ConnectionBase* connection = (*it).second;
+    if( connection->recv( 0 ) != ConnNoError )
+    {
+      // the handler may have removed (or deleted) the connection already
+      it = m_connections.find( fd );
+      if( it != m_connections.end() && (*it).second == connection )
+        remove( connection );
+    }
+
+    return true;
+  }
+
+  bool EventLoop::dispatchWrite( int fd )
+  {
+    TCPMap::const_iterator it = m_tcp.find( fd );
+    if( it == m_tcp.end() )
+      return false;
+
+    (*it).second->flush();
+    return true;
+  }
+
+  int EventLoop::poll( int timeout )
+  {
+    std::vector<Poller::Event> ready;
+    if( m_poller->wait( nextTimeout( timeout ), ready ) < 0 )
+      return -1;
+
+    int num = 0;
+    std::vector<Poller::Event>::const_iterator it = ready.begin();
+    for( ; it != ready.end(); ++it )
+    {
+      // the write handler may remove the connection, dispatch() checks for that
+      if( (*it).write && dispatchWrite( (*it).fd ) )
+        ++num;
+      if( (*it).read && dispatch( (*it).fd ) )
+        ++num;
+    }
+
+    return num + dispatchTimers();
+  }
+
+  void EventLoop::run()
+  {
+    m_stop = false;
+    while( !m_stop && ( !m_connections.empty() || !m_timers.empty() ) )
+    {
+      if( poll() < 0 )
+        break;
+    }
+  }
+
+  double EventLoop::now()
+  {
+#if defined( _WIN32 )
+    return static_cast<double>( GetTickCount64() );
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast<double>( ts.tv_sec ) * 1000 + static_cast<double>( ts.tv_nsec ) / 1000000;
+#endif
+  }
+
+}
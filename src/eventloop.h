@@ -0,0 +1,208 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+
+#ifndef EVENTLOOP_H__
+#define EVENTLOOP_H__
+
+#include "macros.h"
+
+#include <map>
+
+namespace gloox
+{
+
+  class ConnectionBase;
+  class ConnectionTCPBase;
+  class TimerHandler;
+
+  /**
+   * @brief A reactor that drives many connections (and timers) from a single thread.
+   *
+   * Instead of calling recv() on every Client or Component in turn (or running one thread
+   * per connection), register the sockets of all established connections with an EventLoop
+   * and call run() or poll(). Whenever a socket becomes readable, the EventLoop calls
+   * ConnectionBase::recv( 0 ) on the associated connection, which in turn hands the data
+   * to its ConnectionDataHandler (e.g. the Client).
+   *
+   * On Linux, epoll is used. On other platforms the EventLoop falls back to poll().
+   *
+   * Usage example:
+   * @code
+   * EventLoop loop;
+   * for( ... )
+   * {
+   *   Client* c = new Client( jid, password );
+   *   // ...
+   *   if( c->connect( false ) )
+   *     loop.add( static_cast<ConnectionTCPBase*>( c->connectionImpl() ) );
+   * }
+   * loop.addTimer( pinger, 60000, 0 ); // calls pinger->handleTimer() every minute
+   * loop.run();
+   * @endcode
+   *
+   * Timers can be used to send whitespace pings (ClientBase::whitespacePing()) or Stream
+   * Management ack requests (Client::reqStreamManagement()) at regular intervals.
+   *
+   * Connections registered with add( ConnectionTCPBase* ) may use non-blocking sending
+   * (ConnectionTCPBase::setNonBlockingSend()). While such a connection has queued data, the
+   * EventLoop also watches its socket for writability and flushes the queue.
+   *
+   * @note An EventLoop is not thread-safe. Add and remove connections and timers only from
+   * the thread that runs the loop (e.g. from within handlers). The same applies to sending
+   * on registered connections in non-blocking mode.
+   *
+   * @author Jakob Schröter <js@camaya.net>
+   * @since 1.1
+   */
+  class GLOOX_API EventLoop
+  {
+    public:
+      /**
+       * Creates a new EventLoop.
+       */
+      EventLoop();
+
+      /**
+       * Virtual destructor. Does not close any of the registered connections.
+       */
+      virtual ~EventLoop();
+
+      /**
+       * Registers a connection with the EventLoop.
+       * @param connection The connection to call recv() on if the socket is readable.
+       * This may be the outermost object of a connection chain, e.g. a ConnectionHTTPProxy.
+       * @param fd The socket to watch.
+       * @return @b True if the connection has been registered, @b false otherwise (e.g. the
+       * socket is invalid or already registered for this connection).
+       * @note If @c fd is still registered for another connection, that connection has closed it
+       * without being removed and the descriptor got reused. The stale entry is replaced.
+       */
+      bool add( ConnectionBase* connection, int fd );
+
+      /**
+       * Registers an established TCP connection with the EventLoop. This uses the connection's
+       * socket(). In non-blocking send mode, the connection's outbound queue is flushed
+       * whenever the socket becomes writable. The connection removes itself from the EventLoop
+       * when it is closed (ConnectionBase::cleanup()) or deleted. Add it again after reconnecting.
+       * @param connection The connection to watch.
+       * @return @b True if the connection has been registered, @b false otherwise.
+       */
+      bool add( ConnectionTCPBase* connection );
+
+      /**
+       * Removes a connection from the EventLoop. It is safe to call this from within a
+       * handler, also for the connection currently being dispatched.
+       * @param connection The connection to remove.
+       */
+      void remove( ConnectionBase* connection );
+
+      /**
+       * Returns the number of registered connections.
+       * @return The number of registered connections.
+       */
+      int connections() const { return static_cast<int>( m_connections.size() ); }
+
+      /**
+       * Registers a timer.
+       * @param th The object to notify when the timer expires.
+       * @param interval The timer's interval in milliseconds.
+       * @param context A user-defined value that is passed to the TimerHandler.
+       * @param repeat Whether to re-arm the timer after it expired.
+       * @return The timer's ID, to be used with removeTimer().
+       */
+      int addTimer( TimerHandler* th, int interval, int context = 0, bool repeat = true );
+
+      /**
+       * Removes a timer. It is safe to call this from within TimerHandler::handleTimer().
+       * @param id The timer's ID as returned by addTimer().
+       */
+      void removeTimer( int id );
+
+      /**
+       * Removes all timers of the given TimerHandler.
+       * @param th The TimerHandler whose timers to remove.
+       */
+      void removeTimers( TimerHandler* th );
+
+      /**
+       * Waits for at most @c timeout milliseconds for socket events or expiring timers and
+       * dispatches them.
+       * @param timeout The maximum time to wait in milliseconds. The default of -1 means
+       * wait until something happens.
+       * @return The number of dispatched events (socket events and timers), or -1 on error.
+       */
+      int poll( int timeout = -1 );
+
+      /**
+       * Dispatches events until stop() is called or there are neither connections nor
+       * timers left.
+       */
+      void run();
+
+      /**
+       * Makes run() return after the current iteration.
+       */
+      void stop() { m_stop = true; }
+
+      /**
+       * Returns whether the EventLoop uses epoll.
+       * @return @b True if epoll is used, @b false if poll() is used.
+       */
+      static bool usesEpoll();
+
+    private:
+      EventLoop( const EventLoop& );
+      EventLoop& operator=( const EventLoop& );
+
+      friend class ConnectionTCPBase;
+
+      // called by a ConnectionTCPBase when its send queue fills or drains
+      void setWriteInterest( ConnectionTCPBase* connection, bool write );
+
+      struct Timer
+      {
+        TimerHandler* handler;
+        double due;
+        int interval;
+        int context;
+        bool repeat;
+      };
+
+      int nextTimeout( int timeout ) const;
+      int dispatchTimers();
+      bool dispatch( int fd );
+      bool dispatchWrite( int fd );
+      void drop( int fd );
+      static double now();
+
+      typedef std::map<int, ConnectionBase*> ConnectionMap;  // fd -> connection
+      typedef std::map<int, ConnectionTCPBase*> TCPMap;      // fd -> connection
+      typedef std::map<int, Timer> TimerMap;                 // id -> timer
+      typedef std::multimap<double, int> TimerQueue;         // due -> id
+
+      struct Poller;               // the epoll or poll() backend
+
+      Poller* m_poller;
+      ConnectionMap m_connections;
+      TCPMap m_tcp;                // added using add( ConnectionTCPBase* )
+      TimerMap m_timers;
+      TimerQueue m_queue;
+      int m_nextTimerId;
+      bool m_stop;
+
+  };
+
+}
+
+#endif // EVENTLOOP_H__
@@ -25,6 +25,7 @@ using namespace gloox;
 #include <string>
 
 #include <cstdio> // [s]print[f]
+#include <ctime>
 
 
 class AdhocTest : public ConnectionListener, AdhocCommandProvider, LogHandler
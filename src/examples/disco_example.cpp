@@ -24,6 +24,7 @@ using namespace gloox;
 #include <string>
 
 #include <cstdio> // [s]print[f]
+#include <ctime>
 
 class DiscoTest : public DiscoHandler, ConnectionListener, LogHandler
 {
@@ -20,6 +20,7 @@
 #include "../siprofileft.h"
 #include "../siprofilefthandler.h"
 #include "../bytestreamdatahandler.h"
+#include "../inbandbytestream.h"
 #include "../socks5bytestreamserver.h"
 using namespace gloox;
 
@@ -91,6 +92,7 @@ class FTTest : public LogHandler, ConnectionListener, SIProfileFTHandler, Bytest
       if( j->connect( false ) )
       {
         char input[200024];
+        std::string chunk;
         ConnectionError ce = ConnNoError;
         ConnectionError se = ConnNoError;
         while( ce == ConnNoError )
@@ -110,19 +112,25 @@ class FTTest : public LogHandler, ConnectionListener, SIProfileFTHandler, Bytest
               m_quit = true;
             }
           }
-          if( m_bs && !ifile.eof() )
+          if( m_bs && ( !chunk.empty() || !ifile.eof() ) )
           {
             if( m_bs->isOpen() )
             {
-              ifile.read( input, 200024 );
-              std::string t( input, ifile.gcount() );
-              if( !m_bs->send( t ) )
+              if( chunk.empty() )
+              {
+                ifile.read( input, 200024 );
+                chunk.assign( input, ifile.gcount() );
+              }
+              // an In-Band Bytestream refuses data while its queue is full, retry later
+              if( m_bs->send( chunk ) )
+                chunk.clear();
+              else if( !m_bs->isOpen() )
                 m_quit = true;
             }
             m_bs->recv( 1 );
           }
           else if( m_bs )
-            m_bs->close();
+            m_bs->close(); // an In-Band Bytestream closes once everything has been acknowledged
         }
         printf( "ce: %d\n", ce );
       }
@@ -192,6 +200,8 @@ class FTTest : public LogHandler, ConnectionListener, SIProfileFTHandler, Bytest
       printf( "received bytestream of type: %s", bs->type() == Bytestream::S5B ? "s5b" : "ibb" );
       m_bs = bs;
       m_bs->registerBytestreamDataHandler( this );
+      if( bs->type() == Bytestream::IBB )
+        static_cast<InBandBytestream*>( bs )->setMaxQueuedBytes( 256 * 1024 );
       if( m_bs->connect() )
       {
         if( bs->type() == Bytestream::S5B )
@@ -22,6 +22,7 @@ using namespace gloox;
 #include <string>
 
 #include <cstdio> // [s]print[f]
+#include <ctime>
 
 class RegTest : public RegistrationHandler, ConnectionListener, LogHandler
 {
@@ -23,6 +23,7 @@ using namespace gloox;
 #include <string>
 
 #include <cstdio> // [s]print[f]
+#include <ctime>
 
 class RosterTest : public ConnectionListener, LogHandler
 {
@@ -27,6 +27,7 @@ using namespace gloox;
 #include <string>
 
 #include <cstdio> // [s]print[f]
+#include <ctime>
 
 class RosterTest : public RosterListener, ConnectionListener, LogHandler, MessageHandler
 {
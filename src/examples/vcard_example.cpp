@@ -26,6 +26,7 @@ using namespace gloox;
 #include <string>
 
 #include <cstdio> // [s]print[f]
+#include <ctime>
 
 class VCardTest : public ConnectionListener, LogHandler, VCardHandler
 {
@@ -678,7 +678,11 @@ namespace gloox
     StreamEventSessionCreation,     /**< The Client is about to create a session.
                                      * @since 0.9.1 */
     StreamEventRoster,              /**< The Client is about to request the roster. */
-    StreamEventFinished             /**< The log-in phase is completed. */
+    StreamEventFinished,            /**< The log-in phase is completed. */
+    StreamEventSMQueueFull          /**< The Stream Management (@xep{0198}) send queue hit a limit
+                                     * set with ClientBase::setSendQueueLimits(). Stanzas are not
+                                     * queued for resending until the server acknowledges some.
+                                     * @since 1.1 */
   };
 
   /**
@@ -1006,6 +1010,8 @@ namespace gloox
     std::string cipher;             /**< The cipher used for the connection. */
     std::string mac;                /**< The MAC used for the connection. */
     std::string compression;        /**< The compression used for the connection. */
+    bool resumed;                   /**< Whether a previous session was resumed instead of
+                                     * running a full handshake. @since 1.1 */
   };
 
   /**
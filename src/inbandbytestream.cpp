@@ -22,6 +22,7 @@
 #include "message.h"
 #include "util.h"
 
+#include <algorithm>
 #include <cstdlib>
 
 namespace gloox
@@ -35,30 +36,31 @@ namespace gloox
 
   InBandBytestream::IBB::IBB( const std::string& sid, int blocksize )
     : StanzaExtension( ExtIBB ), m_sid ( sid ), m_seq( 0 ), m_blockSize( blocksize ),
-      m_type( IBBOpen )
+      m_type( IBBOpen ), m_useMessages( false )
   {
   }
 
   InBandBytestream::IBB::IBB( const std::string& sid, int seq, const std::string& data )
     : StanzaExtension( ExtIBB ), m_sid ( sid ), m_seq( seq ), m_blockSize( 0 ),
-      m_data( data ), m_type( IBBData )
+      m_data( data ), m_type( IBBData ), m_useMessages( false )
   {
   }
 
   InBandBytestream::IBB::IBB( const std::string& sid )
     : StanzaExtension( ExtIBB ), m_sid ( sid ), m_seq( 0 ), m_blockSize( 0 ),
-      m_type( IBBClose )
+      m_type( IBBClose ), m_useMessages( false )
   {
   }
 
   InBandBytestream::IBB::IBB( const Tag* tag )
-    : StanzaExtension( ExtIBB ), m_type( IBBInvalid )
+    : StanzaExtension( ExtIBB ), m_type( IBBInvalid ), m_useMessages( false )
   {
     if( !tag || tag->xmlns() != XMLNS_IBB )
       return;
 
     m_type = static_cast<IBBType>( util::lookup( tag->name(), typeValues ) );
     m_blockSize = atoi( tag->findAttribute( "block-size" ).c_str() );
+    m_useMessages = tag->findAttribute( "stanza" ) == "message";
     m_seq = atoi( tag->findAttribute( "seq" ).c_str() );
     m_sid = tag->findAttribute( "sid" );
     m_data = Base64::decode64( tag->cdata() );
@@ -91,7 +93,11 @@ namespace gloox
       t->addAttribute( "seq", m_seq );
     }
     else if( m_type == IBBOpen )
+    {
       t->addAttribute( "block-size", m_blockSize );
+      if( m_useMessages )
+        t->addAttribute( "stanza", "message" );
+    }
 
     return t;
   }
@@ -101,8 +107,16 @@ namespace gloox
   InBandBytestream::InBandBytestream( ClientBase* clientbase, LogSink& logInstance, const JID& initiator,
                                       const JID& target, const std::string& sid )
     : Bytestream( Bytestream::IBB, logInstance, initiator, target, sid ),
-      m_clientbase( clientbase ), m_blockSize( 4096 ), m_sequence( -1 ), m_lastChunkReceived( -1 )
+      m_clientbase( clientbase ), m_blockSize( 4096 ), m_sequence( -1 ), m_lastChunkReceived( -1 ),
+      m_windowSize( 8 ), m_pendingBlocks( 0 ), m_sendQueuePos( 0 ), m_maxQueuedBytes( 0 ),
+      m_useMessages( false ), m_sending( false ), m_closing( false )
   {
+    m_stats.bytesSent = 0;
+    m_stats.bytesAcked = 0;
+    m_stats.blocksSent = 0;
+    m_stats.blocksAcked = 0;
+    m_stats.maxPendingBlocks = 0;
+
     if( m_clientbase )
     {
       m_clientbase->registerStanzaExtension( new IBB() );
@@ -115,10 +129,11 @@ namespace gloox
 
   InBandBytestream::~InBandBytestream()
   {
-    m_handler = 0; // to prevent handleBytestreamClose() from being called in close()
+    m_handler = 0; // to prevent handleBytestreamClose() from being called in sendClose()
 
+    // there is no waiting for queued data anymore
     if( m_open )
-      close();
+      sendClose();
 
     if( m_clientbase )
     {
@@ -138,7 +153,9 @@ namespace gloox
 
     const std::string& id = m_clientbase->getID();
     IQ iq( IQ::Set, m_target, id );
-    iq.addExtension( new IBB( m_sid, m_blockSize ) );
+    IBB* ibb = new IBB( m_sid, m_blockSize );
+    ibb->setUseMessages( m_useMessages );
+    iq.addExtension( ibb );
     m_clientbase->send( iq, this, IBBOpen );
     return true;
   }
@@ -153,9 +170,20 @@ namespace gloox
           m_handler->handleBytestreamOpen( this );
           m_open = true;
         }
-        else if( context == IBBData && m_handler )
+        else if( context == IBBData )
         {
-          m_handler->handleBytestreamDataAck( this );
+          if( m_pendingBlocks > 0 )
+            --m_pendingBlocks;
+
+          // blocks are acknowledged in order, only the last one may be short
+          const long unacked = m_stats.bytesSent - m_stats.bytesAcked;
+          m_stats.bytesAcked += unacked < m_blockSize ? unacked : m_blockSize;
+          ++m_stats.blocksAcked;
+
+          if( m_handler )
+            m_handler->handleBytestreamDataAck( this );
+
+          sendBlocks();
         }
         break;
       case IQ::Error:
@@ -216,22 +244,25 @@ namespace gloox
 
   void InBandBytestream::handleMessage( const Message& msg, MessageSession* /*session*/ )
   {
-    if( msg.from() != m_target || !m_handler )
+    if( !m_handler || msg.from() != peer() )
       return;
 
     const IBB* i = msg.findExtension<IBB>( ExtIBB );
-    if( !i )
+    if( !i || i->sid() != this->sid() )
       return;
 
     if( !m_open )
       return;
 
-    if( m_lastChunkReceived != i->seq() )
+    if( ++m_lastChunkReceived != i->seq() )
     {
       m_open = false;
       return;
     }
 
+    if( m_lastChunkReceived == 65535 )
+      m_lastChunkReceived = -1;
+
     if( i->data().empty() )
     {
       m_open = false;
@@ -239,7 +270,11 @@ namespace gloox
     }
 
     m_handler->handleBytestreamData( this, i->data() );
-    m_lastChunkReceived++;
+  }
+
+  const JID& InBandBytestream::peer() const
+  {
+    return m_clientbase && m_clientbase->jid() == m_target ? m_initiator : m_target;
   }
 
   void InBandBytestream::returnResult( const JID& to, const std::string& id )
@@ -257,25 +292,80 @@ namespace gloox
 
   bool InBandBytestream::send( const std::string& data )
   {
-    if( !m_open || !m_clientbase )
+    if( !m_open || m_closing || !m_clientbase )
       return false;
 
-    size_t pos = 0;
-    size_t len = data.length();
-    do
-    {
-      const std::string& id = m_clientbase->getID();
-      IQ iq( IQ::Set, m_clientbase->jid() == m_target ? m_initiator : m_target, id );
-      iq.addExtension( new IBB( m_sid, ++m_sequence, data.substr( pos, m_blockSize ) ) );
-      m_clientbase->send( iq, this, IBBData );
+    const std::string::size_type queued = queuedBytes();
+    if( m_maxQueuedBytes && queued && queued + data.length() > m_maxQueuedBytes )
+      return false;
+
+    m_sendQueue.append( data );
+    sendBlocks();
+
+    return true;
+  }
+
+  void InBandBytestream::sendBlocks()
+  {
+    // an acknowledgement may arrive while we are sending (e.g. from a synchronous ClientBase),
+    // the outer loop will then fill the window
+    if( m_sending )
+      return;
 
-      pos += m_blockSize;
+    m_sending = true;
+    const std::string::size_type blockSize = m_blockSize > 0 ? m_blockSize : 4096;
+    while( m_open && m_clientbase && m_sendQueuePos < m_sendQueue.length()
+           && ( m_useMessages || m_windowSize <= 0 || m_pendingBlocks < m_windowSize ) )
+    {
+      const std::string::size_type len = std::min( blockSize, m_sendQueue.length() - m_sendQueuePos );
+      IBB* ibb = new IBB( m_sid, ++m_sequence, m_sendQueue.substr( m_sendQueuePos, len ) );
+      m_sendQueuePos += len;
       if( m_sequence == 65535 )
         m_sequence = -1;
+
+      m_stats.bytesSent += static_cast<long>( len );
+      ++m_stats.blocksSent;
+
+      if( m_useMessages )
+      {
+        Message msg( Message::Normal, peer() );
+        msg.setID( m_clientbase->getID() );
+        msg.addExtension( ibb );
+        m_clientbase->send( msg );
+      }
+      else
+      {
+        IQ iq( IQ::Set, peer(), m_clientbase->getID() );
+        iq.addExtension( ibb );
+        if( ++m_pendingBlocks > m_stats.maxPendingBlocks )
+          m_stats.maxPendingBlocks = m_pendingBlocks;
+        m_clientbase->send( iq, this, IBBData );
+      }
     }
-    while( pos < len );
 
-    return true;
+    // drop sent data, without moving the queue around for every block
+    if( m_sendQueuePos == m_sendQueue.length() )
+    {
+      m_sendQueue.clear();
+      m_sendQueuePos = 0;
+    }
+    else if( m_sendQueuePos > m_sendQueue.length() / 2 )
+    {
+      m_sendQueue.erase( 0, m_sendQueuePos );
+      m_sendQueuePos = 0;
+    }
+
+    m_sending = false;
+
+    if( m_closing && !queuedBytes() && ( m_useMessages || !m_pendingBlocks ) )
+      sendClose();
+  }
+
+  void InBandBytestream::clearQueue()
+  {
+    m_sendQueue = EmptyString;
+    m_sendQueuePos = 0;
+    m_pendingBlocks = 0;
   }
 
   void InBandBytestream::closed()
@@ -283,15 +373,34 @@ namespace gloox
     if( !m_open )
       return;
 
+    // the remote entity is gone, queued data can not be delivered anymore
     m_open = false;
+    m_closing = false;
+    clearQueue();
 
     if( m_handler )
       m_handler->handleBytestreamClose( this );
   }
 
   void InBandBytestream::close()
+  {
+    if( m_closing )
+      return;
+
+    if( m_open && m_clientbase && ( queuedBytes() || ( !m_useMessages && m_pendingBlocks ) ) )
+    {
+      m_closing = true; // sendBlocks() finishes the job
+      return;
+    }
+
+    sendClose();
+  }
+
+  void InBandBytestream::sendClose()
   {
     m_open = false;
+    m_closing = false;
+    clearQueue();
 
     if( !m_clientbase )
       return;
@@ -36,8 +36,14 @@ namespace gloox
    * See SIProfileFT for a detailed description on how to implement file transfer.
    *
    * @note This class can @b receive data wrapped in Message stanzas. This will only work if you
-   * are not using MessageSessions. However, it will always send
-   * data using IQ stanzas (which will always work).
+   * are not using MessageSessions. By default, it sends data using IQ stanzas (which will always
+   * work), see setUseMessages().
+   *
+   * Data passed to send() is split into blocks of blockSize() bytes. At most windowSize() blocks
+   * are sent without having been acknowledged by the remote entity, the remaining data is queued
+   * and sent as acknowledgements arrive. Use setMaxQueuedBytes() to limit the queue, and
+   * BytestreamDataHandler::handleBytestreamDataAck() to learn when there is room again.
+   * close() waits for all queued data to be sent and acknowledged before closing the stream.
    *
    * @author Jakob Schröter <js@camaya.net>
    * @since 0.8
@@ -67,16 +73,109 @@ namespace gloox
        */
       void setBlockSize( int blockSize ) { m_blockSize = blockSize; }
 
+      /**
+       * Lets you retrieve the maximum number of unacknowledged data blocks. The default is 8.
+       * @return The send window size in blocks.
+       * @since 1.1
+       */
+      int windowSize() const { return m_windowSize; }
+
+      /**
+       * Sets the maximum number of data blocks that may be sent before their acknowledgements
+       * arrived. Data beyond that is queued by send(). Default: 8 blocks.
+       * @param windowSize The new window size. 0 sends all blocks right away.
+       * @since 1.1
+       */
+      void setWindowSize( int windowSize ) { m_windowSize = windowSize; }
+
+      /**
+       * Returns whether data is sent using Message stanzas.
+       * @return @b True if data is sent using Message stanzas, @b false if IQ stanzas are used.
+       * @since 1.1
+       */
+      bool useMessages() const { return m_useMessages; }
+
+      /**
+       * Sets whether data should be sent using Message instead of IQ stanzas. Message stanzas
+       * are not acknowledged, therefore the send window does not apply and
+       * BytestreamDataHandler::handleBytestreamDataAck() is not called. Default: @b false.
+       * @param useMessages Whether to send data using Message stanzas.
+       * @note Call this before connect(), as the stanza type is announced when opening the stream.
+       * @since 1.1
+       */
+      void setUseMessages( bool useMessages ) { m_useMessages = useMessages; }
+
+      /**
+       * Returns the number of bytes passed to send() that have not been sent yet.
+       * @return The number of queued bytes.
+       * @since 1.1
+       */
+      std::string::size_type queuedBytes() const { return m_sendQueue.length() - m_sendQueuePos; }
+
+      /**
+       * Limits the number of bytes send() queues. Once the limit is reached, send() refuses
+       * further data (and returns @b false) until acknowledgements have made room again. The
+       * stream stays open then, check isOpen() to tell this apart from an error.
+       * @param maxQueuedBytes The maximum number of queued bytes. Data passed to send() while
+       * the queue is empty is always accepted. Default: 0 (no limit).
+       * @since 1.1
+       */
+      void setMaxQueuedBytes( std::string::size_type maxQueuedBytes ) { m_maxQueuedBytes = maxQueuedBytes; }
+
+      /**
+       * Returns the maximum number of bytes send() queues.
+       * @return The maximum number of queued bytes. 0 means no limit.
+       * @since 1.1
+       */
+      std::string::size_type maxQueuedBytes() const { return m_maxQueuedBytes; }
+
+      /**
+       * Returns the number of data blocks that have been sent but not acknowledged yet.
+       * @return The number of unacknowledged blocks.
+       * @since 1.1
+       */
+      int pendingBlocks() const { return m_pendingBlocks; }
+
+      /**
+       * Counters describing the throughput of a stream.
+       */
+      struct Statistics
+      {
+        long bytesSent;                 /**< The number of payload bytes sent. */
+        long bytesAcked;                /**< The number of payload bytes acknowledged by the
+                                         * remote entity. */
+        int blocksSent;                 /**< The number of data blocks sent. */
+        int blocksAcked;                /**< The number of data blocks acknowledged by the
+                                         * remote entity. */
+        int maxPendingBlocks;           /**< The highest number of unacknowledged blocks. */
+      };
+
+      /**
+       * Returns the stream's send statistics.
+       * @return The stream's send statistics.
+       * @since 1.1
+       */
+      const Statistics& statistics() const { return m_stats; }
+
       // reimplemented from Bytestream
       virtual ConnectionError recv( int timeout = -1 ) { (void)timeout; return ConnNoError; }
 
-      // reimplemented from Bytestream
+      /**
+       * Sends data, or queues it if the send window is full.
+       * @param data The data to send.
+       * @return @b True if the data has been sent or queued, @b false if the stream is not open,
+       * is being closed, or the queue is full (see setMaxQueuedBytes()).
+       */
       bool send( const std::string& data );
 
       // reimplemented from Bytestream
       virtual bool connect();
 
-      // reimplemented from Bytestream
+      /**
+       * Closes the stream. If data is still queued or unacknowledged, the stream is closed
+       * once all of it has been acknowledged. send() does not accept any more data meanwhile.
+       * BytestreamDataHandler::handleBytestreamClose() is called when the stream is closed.
+       */
       virtual void close();
 
       // reimplemented from IqHandler
@@ -154,6 +253,20 @@ namespace gloox
            */
           int blocksize() const { return m_blockSize; }
 
+          /**
+           * Returns whether data will be sent using Message stanzas. Only meaningful if the IBB
+           * is of type() IBBOpen.
+           * @return @b True if data will be sent using Message stanzas, @b false otherwise.
+           */
+          bool useMessages() const { return m_useMessages; }
+
+          /**
+           * Announces that data will be sent using Message stanzas. Only meaningful if the IBB
+           * is of type() IBBOpen.
+           * @param useMessages Whether data will be sent using Message stanzas.
+           */
+          void setUseMessages( bool useMessages ) { m_useMessages = useMessages; }
+
           /**
            * Returns the current block's sequence number.
            * @return The current block's sequence number.
@@ -196,6 +309,7 @@ namespace gloox
           int m_blockSize;
           std::string m_data;
           IBBType m_type;
+          bool m_useMessages;
       };
 
       InBandBytestream( ClientBase* clientbase, LogSink& logInstance, const JID& initiator,
@@ -204,11 +318,24 @@ namespace gloox
       void closed(); // by remote entity
       void returnResult( const JID& to, const std::string& id );
       void returnError( const JID& to, const std::string& id, StanzaErrorType type, StanzaError error );
+      const JID& peer() const;
+      void sendBlocks();
+      void sendClose();
+      void clearQueue();
 
       ClientBase* m_clientbase;
       int m_blockSize;
       int m_sequence;
       int m_lastChunkReceived;
+      int m_windowSize;
+      int m_pendingBlocks;
+      std::string m_sendQueue;                        // data passed to send(), not yet sent
+      std::string::size_type m_sendQueuePos;          // start of the unsent data in m_sendQueue
+      std::string::size_type m_maxQueuedBytes;
+      Statistics m_stats;
+      bool m_useMessages;
+      bool m_sending;                                 // guards sendBlocks() against re-entry
+      bool m_closing;                                 // close() waits for the queue to drain
 
   };
 
@@ -10,78 +10,240 @@
   This software is distributed without any warranty.
 */
 
+#include "config.h"
+
 #include "jid.h"
 #include "prep.h"
 #include "gloox.h"
+#include "mutexguard.h"
 #include "util.h"
 
+#include <set>
+
 namespace gloox
 {
 
-  bool JID::setJID( const std::string& jid )
+  /**
+   * All interned JIDs, ordered by full JID and raw server name.
+   */
+  struct JID::InternTable
   {
-    if ( jid.empty() )
+    struct Less
     {
-      m_bare = m_full = m_server = m_username = m_serverRaw = m_resource = EmptyString;
-      m_valid = false;
-      return false;
-    }
+      bool operator()( const Data* left, const Data* right ) const
+      {
+        const int c = left->full.compare( right->full );
+        return c < 0 || ( c == 0 && raw( left ) < raw( right ) );
+      }
 
-    const std::string::size_type at = jid.find( '@' );
-    const std::string::size_type slash = jid.find( '/', at == std::string::npos ? 0 : at );
+      static const std::string& raw( const Data* d )
+      {
+        return d->serverRaw ? *d->serverRaw : d->server;
+      }
+    };
 
-    if( at != std::string::npos && !( m_valid = prep::nodeprep( jid.substr( 0, at ), m_username ) ) )
-      return false;
+    typedef std::set<Data*, Less> DataSet;
 
-    m_serverRaw = jid.substr( at == std::string::npos ? 0 : at + 1, slash - at - 1 );
-    if( !( m_valid = prep::nameprep( m_serverRaw, m_server ) ) )
-      return false;
+    util::Mutex mutex;
+    DataSet set;
+    util::AtomicRefCount interning;  // 1 if enabled, may be toggled while other threads create JIDs
+  };
 
-    if( slash != std::string::npos
-         && !( m_valid = prep::resourceprep( jid.substr( slash + 1 ), m_resource ) ) )
-      return false;
+  JID::InternTable& JID::internTable()
+  {
+    static InternTable table;
+    return table;
+  }
 
-    setStrings();
+  void JID::setInterning( bool enable )
+  {
+    // the table lock serializes callers, so the flag is always 0 or 1
+    InternTable& t = internTable(); // make sure it exists before the first JID is interned
+    util::MutexGuard m( t.mutex );
+    t.interning.reset();
+    if( enable )
+      t.interning.increment();
+  }
 
-    return m_valid;
+  size_t JID::internedJIDs()
+  {
+    InternTable& t = internTable();
+    util::MutexGuard m( t.mutex );
+    return t.set.size();
   }
 
-  bool JID::setUsername( const std::string& uname )
+  JID::JID( const JID& right )
+    : m_data( right.m_data )
   {
-    m_valid = prep::nodeprep( uname, m_username );
-    setStrings();
-    return m_valid;
+    if( m_data )
+      m_data->refs.increment();
   }
 
-  bool JID::setServer( const std::string& serv )
+  JID& JID::operator=( const JID& right )
   {
-    m_serverRaw = serv;
-    m_valid = prep::nameprep( m_serverRaw, m_server );
-    setStrings();
-    return m_valid;
+    if( right.m_data )
+      right.m_data->refs.increment();
+    release();
+    m_data = right.m_data;
+    return *this;
   }
 
-  bool JID::setResource( const std::string& res )
+  void JID::release()
+  {
+    if( !m_data )
+      return;
+
+    // whoever drops the count to zero deletes the data. lookups in the intern table never
+    // revive data with a count of zero, so the lock is only needed to unlink it.
+    if( m_data->refs.decrement() == 0 )
+    {
+      if( m_data->interned )
+      {
+        InternTable& t = internTable();
+        util::MutexGuard m( t.mutex );
+        // a lookup may have replaced the entry with a new one in the meantime
+        InternTable::DataSet::iterator it = t.set.find( const_cast<Data*>( m_data ) );
+        if( it != t.set.end() && (*it) == m_data )
+          t.set.erase( it );
+      }
+      delete m_data;
+    }
+
+    m_data = 0;
+  }
+
+  size_t JID::hash() const
   {
-    m_valid = prep::resourceprep( res, m_resource );
-    setFull();
-    return m_valid;
+    if( !m_data || m_data->full.empty() )
+      return 0;
+
+    // FNV-1a
+    size_t hash = 2166136261u;
+    const std::string& full = m_data->full;
+    for( std::string::const_iterator it = full.begin(); it != full.end(); ++it )
+      hash = ( hash ^ static_cast<unsigned char>( (*it) ) ) * 16777619u;
+    return hash;
   }
 
-  void JID::setFull()
+  JID::Data* JID::copy( std::string& serverRaw ) const
   {
-    m_full = bare();
-    if( !m_resource.empty() )
-      m_full += '/' + m_resource;
+    Data* d = new Data();
+    if( m_data )
+    {
+      d->username = m_data->username;
+      d->server = m_data->server;
+      d->resource = m_data->resource;
+      serverRaw = JID::serverRaw();
+    }
+    return d;
   }
 
-  void JID::setBare()
+  void JID::attach( Data* d, const std::string& serverRaw )
+  {
+    // sized exactly, a JID's strings are kept around for long
+    const std::string::size_type bare = d->username.length() + ( d->username.empty() ? 0 : 1 )
+                                        + d->server.length();
+    d->full.reserve( bare + ( d->resource.empty() ? 0 : d->resource.length() + 1 ) );
+    if( !d->username.empty() )
+    {
+      d->full += d->username;
+      d->full += '@';
+    }
+    d->full += d->server;
+    if( !d->resource.empty() )
+    {
+      d->bare = d->full;
+      d->full += '/';
+      d->full += d->resource;
+    }
+    if( serverRaw != d->server )
+      d->serverRaw = new std::string( serverRaw );
+    d->refs.increment();
+
+    InternTable& t = internTable();
+    if( d->valid && t.interning.value() )
+    {
+      util::MutexGuard m( t.mutex );
+      std::pair<InternTable::DataSet::iterator, bool> r = t.set.insert( d );
+      if( r.second )
+        d->interned = true;
+      else if( (*r.first)->refs.increment() == 1 )
+      {
+        // its last copy is being released and will be deleted, take its place
+        (*r.first)->refs.decrement();
+        t.set.erase( r.first );
+        t.set.insert( d );
+        d->interned = true;
+      }
+      else
+      {
+        delete d;
+        d = (*r.first);
+      }
+    }
+
+    release();
+    m_data = d;
+  }
+
+  bool JID::setJID( const std::string& jid )
+  {
+    if ( jid.empty() )
+    {
+      release();
+      return false;
+    }
+
+    std::string serverRaw;
+    Data* d = copy( serverRaw );
+    d->username = d->server = serverRaw = d->resource = EmptyString;
+
+    const std::string::size_type at = jid.find( '@' );
+    const std::string::size_type slash = jid.find( '/', at == std::string::npos ? 0 : at );
+
+    d->valid = ( at == std::string::npos || prep::nodeprep( jid.substr( 0, at ), d->username ) );
+    if( d->valid )
+    {
+      serverRaw = jid.substr( at == std::string::npos ? 0 : at + 1, slash - at - 1 );
+      d->valid = prep::nameprep( serverRaw, d->server )
+                 && ( slash == std::string::npos
+                      || prep::resourceprep( jid.substr( slash + 1 ), d->resource ) );
+    }
+
+    const bool valid = d->valid;
+    attach( d, serverRaw ); // may delete d
+    return valid;
+  }
+
+  bool JID::setUsername( const std::string& uname )
+  {
+    std::string serverRaw;
+    Data* d = copy( serverRaw );
+    d->valid = prep::nodeprep( uname, d->username );
+    const bool valid = d->valid;
+    attach( d, serverRaw ); // may delete d
+    return valid;
+  }
+
+  bool JID::setServer( const std::string& serv )
+  {
+    std::string serverRaw;
+    Data* d = copy( serverRaw );
+    serverRaw = serv;
+    d->valid = prep::nameprep( serverRaw, d->server );
+    const bool valid = d->valid;
+    attach( d, serverRaw ); // may delete d
+    return valid;
+  }
+
+  bool JID::setResource( const std::string& res )
   {
-    if( !m_username.empty() )
-      m_bare = m_username + '@';
-    else
-      m_bare = ""/*EmptyString*/;
-    m_bare += m_server;
+    std::string serverRaw;
+    Data* d = copy( serverRaw );
+    d->valid = prep::resourceprep( res, d->resource );
+    const bool valid = d->valid;
+    attach( d, serverRaw ); // may delete d
+    return valid;
   }
 
   std::string JID::escapeNode( const std::string& node )
@@ -15,7 +15,9 @@
 #ifndef JID_H__
 #define JID_H__
 
+#include "atomicrefcount.h"
 #include "macros.h"
+#include "gloox.h"
 
 #include <string>
 
@@ -24,6 +26,14 @@ namespace gloox
   /**
    * @brief An abstraction of a JID.
    *
+   * A JID is a small handle to reference-counted, immutable data. Copying a JID does not
+   * allocate, and modifying one does not affect its copies.
+   *
+   * If interning is enabled (see setInterning()), all valid JIDs with the same full JID
+   * share a single instance of that data, held in a global table. This saves memory when
+   * the same JIDs are held in many places (roster items, tracked presences, sessions, ...),
+   * and equal JIDs compare by pointer.
+   *
    * @author Jakob Schröter <js@camaya.net>
    * @since 0.4
    */
@@ -34,18 +44,30 @@ namespace gloox
       /**
        * Constructs an empty JID.
        */
-      JID() : m_valid( false ) {}
+      JID() : m_data( 0 ) {}
 
       /**
        * Constructs a new JID from a string.
        * @param jid The string containing the JID.
        */
-      JID( const std::string& jid ) : m_valid( true ) { setJID( jid ); }
+      JID( const std::string& jid ) : m_data( 0 ) { setJID( jid ); }
+
+      /**
+       * Copy constructor. Does not allocate.
+       * @param right The JID to copy.
+       */
+      JID( const JID& right );
+
+      /**
+       * Assignment operator. Does not allocate.
+       * @param right The JID to copy.
+       */
+      JID& operator=( const JID& right );
 
       /**
        * Destructor.
        */
-      ~JID() {}
+      ~JID() { release(); }
 
       /**
        * Sets the JID from a string.
@@ -58,13 +80,14 @@ namespace gloox
        * Returns the full (prepped) JID (user\@host/resource).
        * @return The full JID.
        */
-      const std::string& full() const { return m_full; }
+      const std::string& full() const { return m_data ? m_data->full : EmptyString; }
 
       /**
        * Returns the bare (prepped) JID (user\@host).
        * @return The bare JID.
        */
-      const std::string& bare() const { return m_bare; }
+      const std::string& bare() const
+        { return m_data ? ( m_data->resource.empty() ? m_data->full : m_data->bare ) : EmptyString; }
 
       /**
        * Creates and returns a JID from this JID's node and server parts.
@@ -95,25 +118,26 @@ namespace gloox
        * Returns the prepped username.
        * @return The current username.
        */
-      const std::string& username() const { return m_username; }
+      const std::string& username() const { return m_data ? m_data->username : EmptyString; }
 
       /**
        * Returns the prepped server name.
        * @return The current server.
        */
-      const std::string& server() const { return m_server; }
+      const std::string& server() const { return m_data ? m_data->server : EmptyString; }
 
       /**
        * Returns the raw (unprepped) server name.
        * @return The raw server name.
        */
-      const std::string& serverRaw() const { return m_serverRaw; }
+      const std::string& serverRaw() const
+        { return m_data ? ( m_data->serverRaw ? *m_data->serverRaw : m_data->server ) : EmptyString; }
 
       /**
        * Returns the prepped resource.
        * @return The current resource.
        */
-      const std::string& resource() const { return m_resource; }
+      const std::string& resource() const { return m_data ? m_data->resource : EmptyString; }
 
       /**
        * Compares a JID with a string.
@@ -131,13 +155,14 @@ namespace gloox
        * Compares two JIDs.
        * @param right The second JID.
        */
-      bool operator==( const JID& right ) const { return full() == right.full(); }
+      bool operator==( const JID& right ) const
+        { return m_data == right.m_data || full() == right.full(); }
 
       /**
        * Compares two JIDs.
        * @param right The second JID.
        */
-      bool operator!=( const JID& right ) const { return full() != right.full(); }
+      bool operator!=( const JID& right ) const { return !operator==( right ); }
 
       /**
        * Compares two JIDs to see if the left is less than the right.
@@ -171,7 +196,30 @@ namespace gloox
       /**
        * Converts to  @b true if the JID is valid, @b false otherwise.
        */
-      operator bool() const { return m_valid; }
+      operator bool() const { return m_data && m_data->valid; }
+
+      /**
+       * Returns a hash of the full JID. Equal JIDs have equal hashes.
+       * @return A hash of the full JID.
+       * @since 1.1
+       */
+      size_t hash() const;
+
+      /**
+       * Enables or disables interning of newly created or modified JIDs. Disabled by default.
+       * Existing JIDs are not affected.
+       * @param enable Whether to intern JIDs.
+       * @note Releasing an interned JID's last copy takes a global lock.
+       * @since 1.1
+       */
+      static void setInterning( bool enable );
+
+      /**
+       * Returns the number of distinct JIDs in the intern table.
+       * @return The number of interned JIDs.
+       * @since 1.1
+       */
+      static size_t internedJIDs();
 
       /**
        * @xep{0106}: JID Escaping
@@ -188,29 +236,45 @@ namespace gloox
       static std::string unescapeNode( const std::string& node );
 
     private:
+      // no larger than the six strings a JID used to hold
+      struct Data
+      {
+        Data() : serverRaw( 0 ), valid( false ), interned( false ) {}
+        ~Data() { delete serverRaw; }
+
+        std::string username;
+        std::string server;
+        std::string resource;
+        std::string bare;          // empty if there is no resource
+        std::string full;
+        const std::string* serverRaw; // 0 if equal to server
+        mutable util::AtomicRefCount refs;
+        bool valid;
+        bool interned;
+      };
+
+      struct InternTable;
+
+      static InternTable& internTable();
+
       /**
-       * Utility function to rebuild both the bare and full jid.
+       * Returns a modifiable copy of the current data. The raw server name is returned
+       * separately.
        */
-      void setStrings() { setBare(); setFull(); }
+      Data* copy( std::string& serverRaw ) const;
 
       /**
-       * Utility function rebuilding the bare jid.
-       * @note Do not use this function directly, instead use setStrings.
+       * Rebuilds the bare and full JIDs, interns the data if enabled, and replaces the
+       * current data with it.
        */
-      void setBare();
+      void attach( Data* data, const std::string& serverRaw );
 
       /**
-       * Utility function rebuilding the full jid.
+       * Drops the reference to the current data.
        */
-      void setFull();
+      void release();
 
-      std::string m_resource;
-      std::string m_username;
-      std::string m_server;
-      std::string m_serverRaw;
-      std::string m_bare;
-      std::string m_full;
-      bool m_valid;
+      const Data* m_data;
 
   };
 
@@ -19,6 +19,7 @@ namespace gloox
 
   LogSink::LogSink()
   {
+    updateAreas();
   }
 
   LogSink::~LogSink()
@@ -27,6 +28,9 @@ namespace gloox
 
   void LogSink::log( LogLevel level, LogArea area, const std::string& message ) const
   {
+    if( !enabled( level, area ) )
+      return;
+
     LogHandlerMap::const_iterator it = m_logHandlers.begin();
     for( ; it != m_logHandlers.end(); ++it )
     {
@@ -39,11 +43,27 @@ namespace gloox
   {
     LogInfo info = { level, areas };
     m_logHandlers[lh] = info;
+    updateAreas();
   }
 
   void LogSink::removeLogHandler( LogHandler* lh )
   {
     m_logHandlers.erase( lh );
+    updateAreas();
+  }
+
+  void LogSink::updateAreas()
+  {
+    for( int level = LogLevelDebug; level <= LogLevelError; ++level )
+    {
+      m_areas[level] = 0;
+      LogHandlerMap::const_iterator it = m_logHandlers.begin();
+      for( ; it != m_logHandlers.end(); ++it )
+      {
+        if( (*it).first && (*it).second.level <= level )
+          m_areas[level] |= (*it).second.areas;
+      }
+    }
   }
 
 }
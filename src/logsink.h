@@ -99,6 +99,18 @@ namespace gloox
        */
       void removeLogHandler( LogHandler* lh );
 
+      /**
+       * Checks whether any registered LogHandler would receive a message with the given
+       * LogLevel and LogArea. Use this to avoid building expensive log messages (such as
+       * serialized stanzas) that nobody would see. This is a cheap lookup.
+       * @param level The severity of the event to be logged.
+       * @param area The part of the program/library the message would come from.
+       * @return @b True if at least one LogHandler would receive the message, @b false otherwise.
+       * @since 1.1
+       */
+      bool enabled( LogLevel level, LogArea area ) const
+        { return ( m_areas[level] & area ) != 0; }
+
     private:
       struct LogInfo
       {
@@ -108,8 +120,11 @@ namespace gloox
 
       LogSink( const LogSink& /*copy*/ );
 
+      void updateAreas();
+
       typedef std::map<LogHandler*, LogInfo> LogHandlerMap;
       LogHandlerMap m_logHandlers;
+      int m_areas[LogLevelError + 1]; // per level, the areas anyone listens to
 
   };
 
@@ -0,0 +1,151 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#ifndef LRUCACHE_H__
+#define LRUCACHE_H__
+
+#include "mutex.h"
+#include "mutexguard.h"
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <utility>
+
+namespace gloox
+{
+
+  namespace util
+  {
+
+    /**
+     * @brief A bounded, thread-safe cache that evicts the least recently used entry.
+     *
+     * Lookups and insertions are O(log n).
+     *
+     * You should not need to use this class directly.
+     *
+     * @author Jakob Schröter <js@camaya.net>
+     * @since 1.1
+     */
+    template<typename Key, typename Value>
+    class LRUCache
+    {
+      public:
+        /**
+         * Creates a new cache.
+         * @param capacity The maximum number of entries. 0 disables the cache.
+         */
+        LRUCache( size_t capacity ) : m_capacity( capacity ) {}
+
+        /**
+         * Looks up a key and marks it as most recently used.
+         * @param key The key to look up.
+         * @param value Contains the cached value if the key was found, else untouched.
+         * @return @b True if the key was found, @b false otherwise.
+         */
+        bool get( const Key& key, Value& value )
+        {
+          MutexGuard m( m_mutex );
+          typename EntryMap::iterator it = m_map.find( key );
+          if( it == m_map.end() )
+            return false;
+
+          m_entries.splice( m_entries.begin(), m_entries, (*it).second );
+          value = (*(*it).second).second;
+          return true;
+        }
+
+        /**
+         * Adds or updates an entry, evicting the least recently used entry if the cache is full.
+         * @param key The key.
+         * @param value The value.
+         */
+        void put( const Key& key, const Value& value )
+        {
+          MutexGuard m( m_mutex );
+          if( !m_capacity )
+            return;
+
+          typename EntryMap::iterator it = m_map.find( key );
+          if( it != m_map.end() )
+          {
+            (*(*it).second).second = value;
+            m_entries.splice( m_entries.begin(), m_entries, (*it).second );
+            return;
+          }
+
+          m_entries.push_front( std::make_pair( key, value ) );
+          m_map.insert( std::make_pair( key, m_entries.begin() ) );
+          trim();
+        }
+
+        /**
+         * Changes the maximum number of entries, evicting entries as necessary.
+         * @param capacity The new capacity. 0 disables (and empties) the cache.
+         */
+        void setCapacity( size_t capacity )
+        {
+          MutexGuard m( m_mutex );
+          m_capacity = capacity;
+          trim();
+        }
+
+        /**
+         * Returns the number of cached entries.
+         * @return The number of cached entries.
+         */
+        size_t size()
+        {
+          MutexGuard m( m_mutex );
+          return m_map.size();
+        }
+
+        /**
+         * Removes all entries.
+         */
+        void clear()
+        {
+          MutexGuard m( m_mutex );
+          m_map.clear();
+          m_entries.clear();
+        }
+
+      private:
+        LRUCache( const LRUCache& );
+        LRUCache& operator=( const LRUCache& );
+
+        void trim()
+        {
+          while( m_map.size() > m_capacity )
+          {
+            m_map.erase( m_entries.back().first );
+            m_entries.pop_back();
+          }
+        }
+
+        typedef std::list<std::pair<Key, Value> > EntryList;
+        typedef std::map<Key, typename EntryList::iterator> EntryMap;
+
+        EntryList m_entries;       // most recently used first
+        EntryMap m_map;
+        size_t m_capacity;
+        Mutex m_mutex;
+
+    };
+
+  }
+
+}
+
+#endif // LRUCACHE_H__
@@ -102,11 +102,15 @@ namespace gloox
   void MessageSession::resetResource()
   {
     m_target.setResource( EmptyString );
+    if( m_parent )
+      m_parent->updateMessageSession( this );
   }
 
   void MessageSession::setResource( const std::string& resource )
   {
     m_target.setResource( resource );
+    if( m_parent )
+      m_parent->updateMessageSession( this );
   }
 
   void MessageSession::disposeMessageFilter( MessageFilter* mf )
@@ -298,7 +298,7 @@ namespace gloox
       void decorate( Message& msg );
 
       ClientBase* m_parent;
-      JID m_target;
+      JID m_target;                // indexed by ClientBase, only change via setResource()
       MessageHandler* m_messageHandler;
 
     private:
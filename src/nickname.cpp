@@ -34,6 +34,11 @@ namespace gloox
     return filter;
   }
 
+  bool Nickname::equals( const StanzaExtension& other ) const
+  {
+    return static_cast<const Nickname&>( other ).m_nick == m_nick;
+  }
+
   Tag* Nickname::tag() const
   {
     if( m_nick.empty() )
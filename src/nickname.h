@@ -80,6 +80,9 @@ namespace gloox
         return new Nickname( *this );
       }
 
+      // reimplemented from StanzaExtension
+      virtual bool equals( const StanzaExtension& other ) const;
+
     private:
       std::string m_nick;
 
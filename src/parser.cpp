@@ -15,12 +15,13 @@
 #include "parser.h"
 
 #include <cstdlib>
+#include <cstring>
 
 namespace gloox
 {
 
   Parser::Parser( TagHandler* ph, bool deleteRoot )
-    : m_tagHandler( ph ), m_current( 0 ), m_root( 0 ), m_xmlnss( 0 ), m_state( Initial ),
+    : m_tagHandler( ph ), m_arena( 0 ), m_current( 0 ), m_root( 0 ), m_xmlnss( 0 ), m_state( Initial ),
       m_preamble( 0 ), m_quote( false ), m_haveTagPrefix( false ), m_haveAttribPrefix( false ),
       m_attribIsXmlns( false ), m_deleteRoot( deleteRoot )
   {
@@ -30,20 +31,45 @@ namespace gloox
   {
     delete m_root;
     delete m_xmlnss;
+    util::clearList( m_attribs );
+    delete m_arena;
   }
 
-  Parser::DecodeState Parser::decode( std::string::size_type& pos, const std::string& data )
+  void Parser::setArenaAllocation( bool arena )
   {
-    std::string::size_type p = data.find( ';', pos );
-    std::string::size_type diff = p - pos;
+    if( arena == ( m_arena != 0 ) || ( arena && !m_deleteRoot ) )
+      return;
+
+    // objects of a partially parsed element may live in the current arena
+    cleanup();
 
-    if( p == std::string::npos )
+    if( arena )
+      m_arena = new TagArena();
+    else
     {
-      m_backBuffer = data.substr( pos );
-      return DecodeInsufficient;
+      delete m_arena;
+      m_arena = 0;
     }
+  }
 
-    if( diff < 3 || diff > 9 )
+  Parser::DecodeState Parser::decode( size_t& pos, const char* data, size_t length )
+  {
+    // the longest valid entity, '&#x10FFFF;', is 10 characters
+    const size_t window = length - pos < 10 ? length - pos : 10;
+    const char* p = static_cast<const char*>( memchr( data + pos, ';', window ) );
+
+    if( !p )
+    {
+      if( window < 10 )
+      {
+        m_backBuffer.assign( data + pos, length - pos );
+        return DecodeInsufficient;
+      }
+      return DecodeInvalid;
+    }
+
+    const size_t diff = p - ( data + pos );
+    if( diff < 3 )
       return DecodeInvalid;
 
     std::string rep;
@@ -61,7 +87,7 @@ namespace gloox
           }
 
           char* end;
-          const long int val = std::strtol( data.data() + pos + idx, &end, base );
+          const long int val = std::strtol( data + pos + idx, &end, base );
           if( *end != ';' || val < 0 )
             return DecodeInvalid;
 
@@ -104,15 +130,15 @@ namespace gloox
           return DecodeInvalid;
         break;
       case 'a':
-        if( diff == 5 && !data.compare( pos + 1, 5, "apos;" ) )
+        if( diff == 5 && !memcmp( data + pos + 1, "apos;", 5 ) )
           rep += '\'';
-        else if( diff == 4 && !data.compare( pos + 1, 4, "amp;" ) )
+        else if( diff == 4 && !memcmp( data + pos + 1, "amp;", 4 ) )
           rep += '&';
         else
           return DecodeInvalid;
         break;
       case 'q':
-        if( diff == 5 && !data.compare( pos + 1, 5, "quot;" ) )
+        if( diff == 5 && !memcmp( data + pos + 1, "quot;", 5 ) )
           rep += '"';
         else
           return DecodeInvalid;
@@ -137,14 +163,15 @@ namespace gloox
     return DecodeValid;
   }
 
-  Parser::ForwardScanState Parser::forwardScan( std::string::size_type& pos, const std::string& data,
-                                                const std::string& needle )
+  Parser::ForwardScanState Parser::forwardScan( size_t& pos, const char* data, size_t length,
+                                                const char* needle )
   {
-    if( pos + needle.length() <= data.length() )
+    const size_t needleLength = strlen( needle );
+    if( pos + needleLength <= length )
     {
-      if( !data.compare( pos, needle.length(), needle ) )
+      if( !memcmp( data + pos, needle, needleLength ) )
       {
-        pos += needle.length() - 1;
+        pos += needleLength - 1;
         return ForwardFound;
       }
       else
@@ -154,21 +181,68 @@ namespace gloox
     }
     else
     {
-      m_backBuffer = data.substr( pos );
+      m_backBuffer.assign( data + pos, length - pos );
       return ForwardInsufficientSize;
     }
   }
 
   int Parser::feed( std::string& data )
   {
+    return feed( data.data(), data.length() );
+  }
+
+  int Parser::feed( const char* data, size_t length )
+  {
+    size_t pos = 0;
+
     if( !m_backBuffer.empty() )
     {
-      data.insert( 0, m_backBuffer );
-      m_backBuffer = EmptyString;
+      // A token (entity or CDATA delimiter) was split across reads. Complete it in a
+      // small scratch buffer, then continue on the caller's buffer.
+      std::string head;
+      head.swap( m_backBuffer );
+      const size_t pending = head.length();
+      const size_t take = length < 16 ? length : 16;
+      head.append( data, take );
+
+      size_t i = 0;
+      const int ret = parse( head.data(), head.length(), i, pending );
+      if( ret >= 0 )
+        return ret >= static_cast<int>( pending ) ? ret - static_cast<int>( pending ) : 0;
+
+      if( !m_backBuffer.empty() )
+      {
+        m_backBuffer.append( data + take, length - take );
+        return -1;
+      }
+
+      pos = i - pending;
+    }
+
+    return parse( data, length, pos, length );
+  }
+
+  static inline size_t scanText( const char* data, size_t pos, size_t length, char a, char b )
+  {
+    while( pos < length && data[pos] != a && data[pos] != b )
+      ++pos;
+    return pos;
+  }
+
+  static inline size_t scanValue( const char* data, size_t pos, size_t length, bool quote )
+  {
+    for( ; pos < length; ++pos )
+    {
+      const char c = data[pos];
+      if( c == '"' || c == '&' || c == '<' || ( c == '\'' && !quote ) )
+        break;
     }
+    return pos;
+  }
 
-    std::string::size_type count = data.length();
-    for( std::string::size_type i = 0; i < count; ++i )
+  int Parser::parse( const char* data, size_t length, size_t& i, size_t stop )
+  {
+    for( ; i < stop; ++i )
     {
       const unsigned char c = data[i];
 //       printf( "found char:   %c, ", c );
@@ -193,7 +267,8 @@ namespace gloox
           break;
         case InterTag:
 //           printf( "InterTag: %c\n", c );
-          m_tag = EmptyString;
+          if( !m_tag.empty() )
+            m_tag = EmptyString;
           if( isWhitespace( c ) )
           {
             m_state = TagInside;
@@ -206,7 +281,7 @@ namespace gloox
           {
             case '&':
 //               printf( "InterTag, calling decode\n" );
-              switch( decode( i, data ) )
+              switch( decode( i, data, length ) )
               {
                 case DecodeValid:
                   m_state = TagInside;
@@ -252,7 +327,7 @@ namespace gloox
               m_preamble = 1;
               break;
             case '!':
-              switch( forwardScan( i, data, "![CDATA[" ) )
+              switch( forwardScan( i, data, length, "![CDATA[" ) )
               {
                 case ForwardFound:
                   m_state = TagCDATASection;
@@ -274,7 +349,7 @@ namespace gloox
           switch( c )
           {
             case ']':
-              switch( forwardScan( i, data, "]]>" ) )
+              switch( forwardScan( i, data, length, "]]>" ) )
               {
                 case ForwardFound:
                   m_state = TagInside;
@@ -287,8 +362,13 @@ namespace gloox
               }
               break;
             default:
-              m_cdata += c;
+            {
+              const char* end = static_cast<const char*>( memchr( data + i, ']', stop - i ) );
+              const size_t next = end ? static_cast<size_t>( end - data ) : stop;
+              m_cdata.append( data + i, next - i );
+              i = next - 1;
               break;
+            }
           }
           break;
         case TagNameCollect:          // we're collecting the tag's name, we have at least one octet already
@@ -335,7 +415,8 @@ namespace gloox
           break;
         case TagInside:                // we're inside a tag, expecting a child tag or cdata
 //           printf( "TagInside: %c\n", c );
-          m_tag = EmptyString;
+          if( !m_tag.empty() )
+            m_tag = EmptyString;
           switch( c )
           {
             case '<':
@@ -344,7 +425,7 @@ namespace gloox
               break;
             case '&':
 //               printf( "TagInside, calling decode\n" );
-              switch( decode( i, data ) )
+              switch( decode( i, data, length ) )
               {
                 case DecodeValid:
                   break;
@@ -356,8 +437,12 @@ namespace gloox
               }
               break;
             default:
-              m_cdata += c;
+            {
+              const size_t next = scanText( data, i + 1, stop, '<', '&' );
+              m_cdata.append( data + i, next - i );
+              i = next - 1;
               break;
+            }
           }
           break;
         case TagOpeningSlash:         // a slash in an opening tag has been found, initing close of the tag
@@ -580,7 +665,7 @@ namespace gloox
               break;
             case '&':
 //               printf( "TagAttributeValue, calling decode\n" );
-              switch( decode( i, data ) )
+              switch( decode( i, data, length ) )
               {
                 case DecodeValid:
                   break;
@@ -593,7 +678,12 @@ namespace gloox
               break;
             case '>':
             default:
-              m_value += c;
+            {
+              const size_t next = scanValue( data, i + 1, stop, m_quote );
+              m_value.append( data + i, next - i );
+              i = next - 1;
+              break;
+            }
           }
           break;
         case TagNameAlmostComplete:
@@ -648,13 +738,15 @@ namespace gloox
     if( !m_root )
     {
 //       printf( "created Tag named %s, ", m_tag.c_str() );
-      m_root = new Tag( m_tag );
+      m_root = new( m_arena ) Tag( m_tag );
+      m_root->m_arena = m_arena;
       m_current = m_root;
     }
     else
     {
 //       printf( "created Tag named %s, ", m_tag.c_str() );
-      m_current = new Tag( m_current, m_tag );
+      m_current = new( m_arena ) Tag( m_current, m_tag );
+      m_current->m_arena = m_arena;
     }
 
     if( m_haveTagPrefix )
@@ -666,9 +758,8 @@ namespace gloox
 
     if( m_attribs.size() )
     {
-      m_current->setAttributes( m_attribs );
-//       printf( "added %d attributes, ", m_attribs.size() );
-      m_attribs.clear();
+//       printf( "adding %d attributes, ", m_attribs.size() );
+      m_current->takeAttributes( m_attribs );
     }
 
     if( m_xmlnss )
@@ -702,7 +793,7 @@ namespace gloox
 
   void Parser::addAttribute()
   {
-    Tag::Attribute* attr = new Tag::Attribute( m_attrib, m_value );;
+    Tag::Attribute* attr = new( m_arena ) Tag::Attribute( m_attrib, m_value );
     if( m_attribIsXmlns )
     {
       if( !m_xmlnss )
@@ -793,6 +884,9 @@ namespace gloox
     m_attribs.clear();
     m_state = Initial;
     m_preamble = 0;
+
+    if( m_arena && deleteRoot )
+      m_arena->reset();
   }
 
   bool Parser::isWhitespace( unsigned char c )
@@ -49,12 +49,24 @@ namespace gloox
 
       /**
        * Use this function to feed the parser with more XML.
-       * @param data Raw xml to parse. It may be modified if backbuffering is necessary.
+       * @param data Raw xml to parse. It is not modified.
        * @return Returns @b -1 if parsing was successful. If a parse error occured, the
        * character position where the error was occured is returned.
        */
       int feed( std::string& data );
 
+      /**
+       * Use this function to feed the parser with more XML directly from a buffer,
+       * e.g. a socket's receive buffer. The data is not copied, except for the (few)
+       * bytes of a token that is split across two calls.
+       * @param data Raw xml to parse. It does not need to be zero-terminated.
+       * @param length The number of bytes in @c data.
+       * @return Returns @b -1 if parsing was successful. If a parse error occured, the
+       * character position (relative to @c data) where the error was occured is returned.
+       * @since 1.1
+       */
+      int feed( const char* data, size_t length );
+
       /**
        * Resets internal state.
        * @param deleteRoot Whether to delete the m_root member. For
@@ -62,6 +74,29 @@ namespace gloox
        */
       void cleanup( bool deleteRoot = true );
 
+      /**
+       * Enables or disables arena allocation. If enabled, the Tags, Attributes and internal
+       * nodes of each parsed top-level element are allocated from a TagArena which is
+       * released in one go after the element has been pushed upstream. This saves about a third
+       * of the heap allocations per stanza; the strings and std::list nodes held by these
+       * objects still come from the heap.
+       * @param arena Whether to use arena allocation. Has no effect if the Parser was created
+       * with @c deleteRoot set to @b false.
+       * @note If enabled, a TagHandler must not keep any part of the Tag it is handed beyond
+       * the call to TagHandler::handleTag(). Use Tag::clone() to obtain an independent copy.
+       * Tag trees must also not be moved between the parsed tree and Tags created elsewhere
+       * (e.g. using Tag::removeChild() and Tag::addChild()).
+       * @since 1.1
+       */
+      void setArenaAllocation( bool arena );
+
+      /**
+       * Returns whether arena allocation is enabled.
+       * @return Whether arena allocation is enabled.
+       * @since 1.1
+       */
+      bool arenaAllocation() const { return m_arena != 0; }
+
     private:
       enum ParserInternalState
       {
@@ -105,11 +140,13 @@ namespace gloox
       bool closeTag();
       bool isWhitespace( unsigned char c );
       void streamEvent( Tag* tag );
-      ForwardScanState forwardScan( std::string::size_type& pos, const std::string& data,
-                                    const std::string& needle );
-      DecodeState decode( std::string::size_type& pos, const std::string& data );
+      int parse( const char* data, size_t length, size_t& pos, size_t stop );
+      ForwardScanState forwardScan( size_t& pos, const char* data, size_t length,
+                                    const char* needle );
+      DecodeState decode( size_t& pos, const char* data, size_t length );
 
       TagHandler* m_tagHandler;
+      TagArena* m_arena;
       Tag* m_current;
       Tag* m_root;
       StringMap* m_xmlnss;
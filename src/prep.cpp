@@ -17,6 +17,7 @@
 #ifdef HAVE_LIBIDN
 # include <stringprep.h>
 # include <idna.h>
+# include "lrucache.h"
 #endif
 
 #include <cstdlib>
@@ -54,12 +55,121 @@ namespace gloox
       free( p );
       return rc == STRINGPREP_OK;
     }
+
+    enum JIDProfile
+    {
+      ProfileNodeprep,
+      ProfileNameprep,
+      ProfileResourceprep
+    };
+
+    /**
+     * Applies a Stringprep profile to printable ASCII input without calling LibIDN.
+     * For such input the profiles only fold case (Nodeprep, Nameprep) and prohibit
+     * a couple characters (Nodeprep).
+     * @param s The string to apply the profile to.
+     * @param out Contains the prepped string if @b true is returned, else untouched.
+     * @param profile The profile to apply.
+     * @return @b True if the input could be handled, @b false if it contains non-ASCII,
+     * control or prohibited characters. LibIDN needs to look at the input then.
+     */
+    static bool asciiPrep( const std::string& s, std::string& out, JIDProfile profile )
+    {
+      bool fold = false;
+      const std::string::size_type len = s.length();
+      for( std::string::size_type i = 0; i < len; ++i )
+      {
+        const char c = s[i];
+        if( c < 0x20 || c > 0x7e )
+          return false;
+
+        if( c >= 'A' && c <= 'Z' )
+          fold = fold || profile != ProfileResourceprep;
+        else if( profile == ProfileNodeprep && ( c == ' ' || strchr( "\"&'/:<>@", c ) ) )
+          return false;
+      }
+
+      out = s;
+      if( fold )
+      {
+        for( std::string::iterator it = out.begin(); it != out.end(); ++it )
+        {
+          if( (*it) >= 'A' && (*it) <= 'Z' )
+            (*it) = static_cast<char>( (*it) + ( 'a' - 'A' ) );
+        }
+      }
+      return true;
+    }
+
+    typedef util::LRUCache<std::string, std::string> PrepCache;
+
+    static const size_t DefaultCacheSize = 4096;
+
+    static PrepCache& nodeCache()
+    {
+      static PrepCache cache( DefaultCacheSize );
+      return cache;
+    }
+
+    static PrepCache& nameCache()
+    {
+      static PrepCache cache( DefaultCacheSize );
+      return cache;
+    }
+
+    static PrepCache& resourceCache()
+    {
+      static PrepCache cache( DefaultCacheSize );
+      return cache;
+    }
+
+    /**
+     * Applies one of the JID profiles, using the ASCII fast path and the given cache
+     * where possible.
+     */
+    static bool prepareJID( const std::string& s, std::string& out, const Stringprep_profile* profile,
+                            JIDProfile jp, PrepCache& cache )
+    {
+      if( s.empty() || s.length() > JID_PORTION_SIZE )
+        return false;
+
+      if( asciiPrep( s, out, jp ) || cache.get( s, out ) )
+        return true;
+
+      std::string prepped;
+      if( !prepare( s, prepped, profile ) )
+        return false;
+
+      cache.put( s, prepped );
+      out = prepped;
+      return true;
+    }
 #endif
 
+    void setCacheSize( size_t size )
+    {
+#ifdef HAVE_LIBIDN
+      nodeCache().setCapacity( size );
+      nameCache().setCapacity( size );
+      resourceCache().setCapacity( size );
+#else
+      (void)size;
+#endif
+    }
+
+    size_t cachedResults()
+    {
+#ifdef HAVE_LIBIDN
+      return nodeCache().size() + nameCache().size() + resourceCache().size();
+#else
+      return 0;
+#endif
+    }
+
     bool nodeprep( const std::string& node, std::string& out )
     {
 #ifdef HAVE_LIBIDN
-      return prepare( node, out, stringprep_xmpp_nodeprep );
+      return prepareJID( node, out, stringprep_xmpp_nodeprep, ProfileNodeprep, nodeCache() );
 #else
       if( node.length() > JID_PORTION_SIZE )
         return false;
@@ -71,7 +181,7 @@ namespace gloox
     bool nameprep( const std::string& domain, std::string& out )
     {
 #ifdef HAVE_LIBIDN
-      return prepare( domain, out, stringprep_nameprep );
+      return prepareJID( domain, out, stringprep_nameprep, ProfileNameprep, nameCache() );
 #else
       if( domain.length() > JID_PORTION_SIZE )
         return false;
@@ -83,7 +193,7 @@ namespace gloox
     bool resourceprep( const std::string& resource, std::string& out )
     {
 #ifdef HAVE_LIBIDN
-      return prepare( resource, out, stringprep_xmpp_resourceprep );
+      return prepareJID( resource, out, stringprep_xmpp_resourceprep, ProfileResourceprep, resourceCache() );
 #else
       if( resource.length() > JID_PORTION_SIZE )
         return false;
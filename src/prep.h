@@ -88,6 +88,25 @@ namespace gloox
      */
     bool idna( const std::string& domain, std::string& out );
 
+    /**
+     * Nodeprep, Nameprep and Resourceprep results are kept in a least-recently-used cache
+     * (one per profile, 4096 entries each by default), as the same JIDs tend to be prepped
+     * over and over. Printable ASCII input does not need the cache (or LibIDN) at all.
+     * This function changes the cache size.
+     * @param size The maximum number of cached results per profile. 0 disables caching.
+     * @note This function has no effect if LibIDN is not available.
+     * @since 1.1
+     */
+    void setCacheSize( size_t size );
+
+    /**
+     * Returns the number of results currently held by the Nodeprep, Nameprep and Resourceprep
+     * caches together.
+     * @return The number of cached results. Always 0 if LibIDN is not available.
+     * @since 1.1
+     */
+    size_t cachedResults();
+
   }
 
 }
@@ -82,16 +82,41 @@ namespace gloox
 
     private:
       void setPriority( int priority ) { m_priority = priority; }
-      void setMessage( std::string message ) { m_message = message; }
+      void setMessage( const std::string& message ) { m_message = message; }
       void setStatus( Presence::PresenceType presence ) { m_presence = presence; }
-      void setExtensions( const StanzaExtensionList& exts )
+
+      // keeps extensions that did not change since the last presence, clones the others.
+      // returns the number of clones.
+      int setExtensions( const StanzaExtensionList& exts )
       {
-        util::clearList( m_extensions );
+        int cloned = 0;
+        StanzaExtensionList::iterator old = m_extensions.begin();
         StanzaExtensionList::const_iterator it = exts.begin();
         for( ; it != exts.end(); ++it )
         {
-          m_extensions.push_back( (*it)->clone() );
+          if( old == m_extensions.end() )
+          {
+            m_extensions.push_back( (*it)->clone() );
+            ++cloned;
+            continue;
+          }
+
+          if( (*old)->extensionType() != (*it)->extensionType() || !(*old)->equals( *(*it) ) )
+          {
+            delete (*old);
+            (*old) = (*it)->clone();
+            ++cloned;
+          }
+          ++old;
+        }
+
+        while( old != m_extensions.end() )
+        {
+          delete (*old);
+          old = m_extensions.erase( old );
         }
+
+        return cloned;
       }
 
       int m_priority;
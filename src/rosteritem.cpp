@@ -141,12 +141,13 @@ namespace gloox
     return highestResource;
   }
 
-  void RosterItem::setExtensions( const std::string& resource, const StanzaExtensionList& exts )
+  int RosterItem::setExtensions( const std::string& resource, const StanzaExtensionList& exts )
   {
-    if( m_resources.find( resource ) == m_resources.end() )
-      m_resources[resource] = new Resource( 0, EmptyString, Presence::Unavailable );
+    Resource*& res = m_resources[resource];
+    if( !res )
+      res = new Resource( 0, EmptyString, Presence::Unavailable );
 
-    m_resources[resource]->setExtensions( exts );
+    return res->setExtensions( exts );
   }
 
   void RosterItem::removeResource( const std::string& resource )
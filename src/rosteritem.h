@@ -170,9 +170,11 @@ namespace gloox
       /**
        * Sets the resource's presence extensions.
        * @param resource The resource to set the extensions for.
-       * @param exts The extensions to set.
+       * @param exts The extensions to set. Extensions that did not change since the last call
+       * are kept, the others are cloned.
+       * @return The number of extensions that were cloned.
        */
-      void setExtensions( const std::string& resource, const StanzaExtensionList& exts );
+      int setExtensions( const std::string& resource, const StanzaExtensionList& exts );
 
       /**
        * Removes the 'changed' flag from the item.
@@ -111,7 +111,7 @@ namespace gloox
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_PRIVATEXML )
     m_privateXML( 0 ),
 #endif // GLOOX_MINIMAL
-    m_syncSubscribeReq( false )
+    m_self( 0 ), m_syncSubscribeReq( false ), m_extensionsCloned( 0 ), m_extensionsKept( 0 )
   {
     if( m_parent )
     {
@@ -250,7 +250,10 @@ namespace gloox
         ri->setPresence( resource, presence.presence() );
         ri->setStatus( resource, presence.status() );
         ri->setPriority( resource, presence.priority() );
-        ri->setExtensions( resource, presence.extensions() );
+        const StanzaExtensionList& exts = presence.extensions();
+        const int cloned = ri->setExtensions( resource, exts );
+        m_extensionsCloned += cloned;
+        m_extensionsKept += static_cast<long>( exts.size() ) - cloned;
       }
 
       if( m_rosterListener && !self )
@@ -267,6 +270,48 @@ namespace gloox
     }
   }
 
+  RosterManager::Statistics RosterManager::statistics() const
+  {
+    Statistics st;
+    st.items = 0;
+    st.resources = 0;
+    st.extensions = 0;
+    st.extensionBytes = 0;
+    st.extensionsCloned = m_extensionsCloned;
+    st.extensionsKept = m_extensionsKept;
+
+    std::list<const RosterItem*> items;
+    if( m_self )
+      items.push_back( m_self );
+    Roster::const_iterator it = m_roster.begin();
+    for( ; it != m_roster.end(); ++it )
+      items.push_back( (*it).second );
+
+    std::list<const RosterItem*>::const_iterator i = items.begin();
+    for( ; i != items.end(); ++i )
+    {
+      ++st.items;
+      const RosterItem::ResourceMap& rm = (*i)->resources();
+      RosterItem::ResourceMap::const_iterator r = rm.begin();
+      for( ; r != rm.end(); ++r )
+      {
+        ++st.resources;
+        const StanzaExtensionList& exts = (*r).second->extensions();
+        StanzaExtensionList::const_iterator e = exts.begin();
+        for( ; e != exts.end(); ++e )
+        {
+          ++st.extensions;
+          Tag* t = (*e)->tag();
+          if( t )
+            st.extensionBytes += static_cast<long>( t->xml().length() );
+          delete t;
+        }
+      }
+    }
+
+    return st;
+  }
+
   void RosterManager::subscribe( const JID& jid, const std::string& name,
                                  const StringList& groups, const std::string& msg )
   {
@@ -163,6 +163,32 @@ namespace gloox
       void setDelimiter( const std::string& delimiter );
 #endif // GLOOX_MINIMAL
 
+      /**
+       * Describes what the roster currently holds in memory. See statistics().
+       * @since 1.1
+       */
+      struct Statistics
+      {
+        int items;                  /**< The number of roster items, including the own account. */
+        int resources;              /**< The number of online resources. */
+        int extensions;             /**< The number of presence extensions stored with the
+                                     * resources. */
+        long extensionBytes;        /**< The serialized size of these extensions, as an
+                                     * approximation of their memory use. */
+        long extensionsCloned;      /**< The number of presence extensions copied so far. */
+        long extensionsKept;        /**< The number of presence extensions that were unchanged
+                                     * and therefore not copied again. */
+      };
+
+      /**
+       * Returns a summary of the roster's memory use and of how many presence extensions had to
+       * be copied. Computing @c extensionBytes serializes every stored extension, so this
+       * function is not meant to be called frequently.
+       * @return The roster's statistics.
+       * @since 1.1
+       */
+      Statistics statistics() const;
+
       /**
        * Lets you retrieve the RosterItem that belongs to the given JID.
        * @param jid The JID to return the RosterItem for.
@@ -292,6 +318,8 @@ namespace gloox
 
       std::string m_delimiter;
       bool m_syncSubscribeReq;
+      long m_extensionsCloned;
+      long m_extensionsKept;
 
       enum RosterContext
       {
@@ -0,0 +1,62 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+
+#ifndef SENDQUEUEHANDLER_H__
+#define SENDQUEUEHANDLER_H__
+
+#include "macros.h"
+
+#include <cstddef>
+
+namespace gloox
+{
+
+  class ConnectionBase;
+
+  /**
+   * @brief A virtual interface to be notified about the fill level of a connection's
+   * outbound queue.
+   *
+   * Used with ConnectionTCPBase::setNonBlockingSend() to apply backpressure: stop producing
+   * data when handleSendQueueFull() is called, resume after handleSendQueueDrained().
+   *
+   * @author Jakob Schröter <js@camaya.net>
+   * @since 1.1
+   */
+  class GLOOX_API SendQueueHandler
+  {
+    public:
+      /**
+       * Virtual Destructor.
+       */
+      virtual ~SendQueueHandler() {}
+
+      /**
+       * This function is called when the amount of queued data rises above the high-water mark.
+       * @param connection The connection whose queue is full.
+       * @param queued The number of queued bytes.
+       */
+      virtual void handleSendQueueFull( const ConnectionBase* connection, size_t queued ) = 0;
+
+      /**
+       * This function is called when, after handleSendQueueFull() has been called, the amount of
+       * queued data drops to half the high-water mark or below.
+       * @param connection The connection whose queue drained.
+       */
+      virtual void handleSendQueueDrained( const ConnectionBase* connection ) = 0;
+  };
+
+}
+
+#endif // SENDQUEUEHANDLER_H__
@@ -0,0 +1,143 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#include "smqueue.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace gloox
+{
+
+  SMQueue::SMQueue()
+    : m_buffer( 0 ), m_capacity( 0 ), m_head( 0 ), m_bytes( 0 ), m_maxBytes( 0 ), m_maxStanzas( 0 )
+  {
+  }
+
+  SMQueue::~SMQueue()
+  {
+    free( m_buffer );
+  }
+
+  void SMQueue::setLimits( size_t maxBytes, size_t maxStanzas )
+  {
+    m_maxBytes = maxBytes;
+    m_maxStanzas = maxStanzas;
+  }
+
+  void SMQueue::grow( size_t needed )
+  {
+    size_t capacity = m_capacity ? m_capacity * 2 : 4096;
+    while( capacity < needed )
+      capacity *= 2;
+
+    // linearize: the oldest byte goes to offset 0
+    char* buffer = static_cast<char*>( malloc( capacity ) );
+    const size_t first = m_capacity - m_head < m_bytes ? m_capacity - m_head : m_bytes;
+    if( m_bytes )
+    {
+      memcpy( buffer, m_buffer + m_head, first );
+      memcpy( buffer + first, m_buffer, m_bytes - first );
+    }
+
+    EntryQueue::iterator it = m_entries.begin();
+    for( ; it != m_entries.end(); ++it )
+      (*it).offset = ( (*it).offset + m_capacity - m_head ) % m_capacity;
+
+    free( m_buffer );
+    m_buffer = buffer;
+    m_capacity = capacity;
+    m_head = 0;
+  }
+
+  bool SMQueue::push( int seq, const std::string& xml )
+  {
+    const size_t length = xml.length();
+    if( ( m_maxStanzas && m_entries.size() >= m_maxStanzas )
+        || ( m_maxBytes && m_bytes + length > m_maxBytes ) )
+      return false;
+
+    if( m_bytes + length > m_capacity || !m_capacity )
+      grow( m_bytes + length );
+
+    Entry e;
+    e.seq = seq;
+    e.offset = ( m_head + m_bytes ) % m_capacity;
+    e.length = length;
+
+    const size_t first = m_capacity - e.offset < length ? m_capacity - e.offset : length;
+    memcpy( m_buffer + e.offset, xml.data(), first );
+    memcpy( m_buffer, xml.data() + first, length - first );
+
+    m_bytes += length;
+    m_entries.push_back( e );
+    return true;
+  }
+
+  int SMQueue::ack( int handled )
+  {
+    int num = 0;
+    while( !m_entries.empty() && m_entries.front().seq <= handled )
+    {
+      const Entry& e = m_entries.front();
+      m_head = ( e.offset + e.length ) % m_capacity;
+      m_bytes -= e.length;
+      m_entries.pop_front();
+      ++num;
+    }
+
+    if( m_entries.empty() )
+      m_head = 0;
+
+    return num;
+  }
+
+  void SMQueue::copy( const Entry& entry, std::string& target ) const
+  {
+    const size_t first = m_capacity - entry.offset < entry.length ? m_capacity - entry.offset : entry.length;
+    target.append( m_buffer + entry.offset, first );
+    target.append( m_buffer, entry.length - first );
+  }
+
+  void SMQueue::xml( std::string& target ) const
+  {
+    if( !m_bytes )
+      return;
+
+    // the stanzas are contiguous in the ring, so this is at most two appends
+    const size_t first = m_capacity - m_head < m_bytes ? m_capacity - m_head : m_bytes;
+    target.reserve( target.length() + m_bytes );
+    target.append( m_buffer + m_head, first );
+    target.append( m_buffer, m_bytes - first );
+  }
+
+  StringList SMQueue::stanzas() const
+  {
+    StringList l;
+    EntryQueue::const_iterator it = m_entries.begin();
+    for( ; it != m_entries.end(); ++it )
+    {
+      l.push_back( EmptyString );
+      copy( (*it), l.back() );
+    }
+    return l;
+  }
+
+  void SMQueue::clear()
+  {
+    m_entries.clear();
+    m_head = 0;
+    m_bytes = 0;
+  }
+
+}
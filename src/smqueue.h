@@ -0,0 +1,132 @@
+/*
+  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+  This file is part of the gloox library. http://camaya.net/gloox
+
+  This software is distributed under a license. The full license
+  agreement can be found in the file LICENSE in this distribution.
+  This software may not be copied, modified, sold or distributed
+  other than expressed in the named license agreement.
+
+  This software is distributed without any warranty.
+*/
+
+
+#ifndef SMQUEUE_H__
+#define SMQUEUE_H__
+
+#include "gloox.h"
+
+#include <deque>
+#include <string>
+
+namespace gloox
+{
+
+  /**
+   * @brief The Stream Management (@xep{0198}) send queue.
+   *
+   * Unacknowledged stanzas are stored as serialized XML in a single ring buffer, indexed by their
+   * sequence numbers. Acknowledging removes stanzas from the front in O(acknowledged stanzas),
+   * resending after stream resumption copies out the raw bytes without re-serializing.
+   *
+   * Sequence numbers must be pushed in increasing order.
+   *
+   * You should not need to use this class directly.
+   *
+   * @author Jakob Schröter <js@camaya.net>
+   * @since 1.1
+   */
+  class SMQueue
+  {
+    public:
+      /**
+       * Creates a new, unbounded SMQueue.
+       */
+      SMQueue();
+
+      /**
+       * Non-virtual destructor.
+       */
+      ~SMQueue();
+
+      /**
+       * Limits the size of the queue. If a limit is reached, push() rejects further stanzas.
+       * @param maxBytes The maximum number of bytes to keep. 0 means unlimited.
+       * @param maxStanzas The maximum number of stanzas to keep. 0 means unlimited.
+       */
+      void setLimits( size_t maxBytes, size_t maxStanzas );
+
+      /**
+       * Appends a serialized stanza.
+       * @param seq The stanza's sequence number. Must be larger than that of the previously
+       * pushed stanza.
+       * @param xml The serialized stanza.
+       * @return @b True if the stanza was queued, @b false if a limit would be exceeded.
+       */
+      bool push( int seq, const std::string& xml );
+
+      /**
+       * Removes all stanzas with a sequence number of @c handled or lower.
+       * @param handled The sequence number of the last stanza handled by the peer.
+       * @return The number of removed stanzas.
+       */
+      int ack( int handled );
+
+      /**
+       * Appends all queued stanzas, in order, to the given string.
+       * @param target The string to append to.
+       */
+      void xml( std::string& target ) const;
+
+      /**
+       * Returns the queued stanzas one by one.
+       * @return The queued stanzas.
+       */
+      StringList stanzas() const;
+
+      /**
+       * Returns the number of queued stanzas.
+       * @return The number of queued stanzas.
+       */
+      size_t count() const { return m_entries.size(); }
+
+      /**
+       * Returns the number of queued bytes.
+       * @return The number of queued bytes.
+       */
+      size_t bytes() const { return m_bytes; }
+
+      /**
+       * Removes all stanzas.
+       */
+      void clear();
+
+    private:
+      SMQueue( const SMQueue& );
+      SMQueue& operator=( const SMQueue& );
+
+      struct Entry
+      {
+        int seq;
+        size_t offset;             // position in the ring
+        size_t length;
+      };
+
+      void grow( size_t needed );
+      void copy( const Entry& entry, std::string& target ) const;
+
+      typedef std::deque<Entry> EntryQueue;
+
+      EntryQueue m_entries;
+      char* m_buffer;
+      size_t m_capacity;
+      size_t m_head;               // offset of the oldest byte
+      size_t m_bytes;
+      size_t m_maxBytes;
+      size_t m_maxStanzas;
+
+  };
+
+}
+
+#endif // SMQUEUE_H__
@@ -13,6 +13,8 @@
 
 #if !defined( GLOOX_MINIMAL ) || defined( WANT_BYTESTREAM )
 
+#include "config.h" // large file support, before any system header
+
 #include "socks5bytestream.h"
 #include "bytestreamdatahandler.h"
 #include "clientbase.h"
@@ -21,6 +23,16 @@
 #include "sha.h"
 #include "logsink.h"
 
+#if defined( _WIN32 )
+# include <io.h>
+#else
+# include <errno.h>
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
 namespace gloox
 {
 
@@ -28,7 +40,8 @@ namespace gloox
                                       LogSink& logInstance, const JID& initiator, const JID& target,
                                       const std::string& sid )
     : Bytestream( Bytestream::S5B, logInstance, initiator, target, sid ),
-      m_manager( manager ), m_connection( 0 ), m_socks5( 0 ), m_connected( false )
+      m_manager( manager ), m_connection( 0 ), m_socks5( 0 ), m_connected( false ),
+      m_capture( false )
   {
     if( connection && connection->state() == StateConnected )
       m_open = true;
@@ -99,9 +112,138 @@ namespace gloox
     if( !m_connection || !m_socks5 || !m_manager )
       return ConnNotConnected;
 
+    // left over from recvInto()
+    if( !m_readAhead.empty() && m_open && m_handler )
+    {
+      std::string data;
+      data.swap( m_readAhead );
+      m_handler->handleBytestreamData( this, data );
+      return ConnNoError;
+    }
+
     return m_socks5->recv( timeout );
   }
 
+  bool SOCKS5Bytestream::sendFile( int fd, int64_t offset, int64_t length )
+  {
+    if( !m_open || !m_connection || !m_socks5 || !m_manager || fd < 0 || offset < 0 || length < 0 )
+      return false;
+
+    const int64_t sent = m_socks5->sendFile( fd, offset, length );
+    if( sent == length )
+      return true;
+
+    if( !m_open )
+      return false;
+
+    if( sent > 0 )
+    {
+      offset += sent;
+      length -= sent;
+    }
+
+    // the connection can not send files directly (or stopped early), read the file ourselves
+#if defined( _WIN32 )
+    const int64_t pos = _lseeki64( fd, 0, SEEK_CUR );
+    if( pos < 0 || _lseeki64( fd, offset, SEEK_SET ) < 0 )
+      return false;
+#else
+    if( static_cast<int64_t>( static_cast<off_t>( offset + length ) ) != offset + length )
+      return false; // no large file support
+#endif
+
+    std::string chunk;
+    bool ok = true;
+    while( ok && length > 0 )
+    {
+      chunk.resize( static_cast<std::string::size_type>( std::min( length, static_cast<int64_t>( 65536 ) ) ) );
+#if defined( _WIN32 )
+      const long size = _read( fd, &chunk[0], static_cast<unsigned int>( chunk.length() ) );
+#else
+      const long size = static_cast<long>( ::pread( fd, &chunk[0], chunk.length(),
+                                                    static_cast<off_t>( offset ) ) );
+      if( size < 0 && errno == EINTR )
+        continue;
+#endif
+      if( size <= 0 )
+      {
+        ok = false;
+        break;
+      }
+
+      chunk.resize( static_cast<std::string::size_type>( size ) );
+      ok = m_socks5->send( chunk );
+      offset += size;
+      length -= size;
+    }
+
+#if defined( _WIN32 )
+    _lseeki64( fd, pos, SEEK_SET );
+#endif
+
+    return ok;
+  }
+
+  int64_t SOCKS5Bytestream::recvInto( char* buffer, int64_t length, int timeout )
+  {
+    if( !m_open || !m_connection || !m_socks5 || !m_manager || !buffer || length <= 0 )
+      return -1;
+
+    if( m_readAhead.empty() )
+    {
+      const int64_t size = m_socks5->recvInto( buffer, length, timeout );
+      if( size != -1 || !m_open )
+        return size;
+
+      // the connection can not receive into a buffer, catch the data in handleReceivedData()
+      m_capture = true;
+      const ConnectionError ce = m_socks5->recv( timeout );
+      m_capture = false;
+      if( ce != ConnNoError && m_readAhead.empty() )
+        return -1;
+    }
+
+    const int64_t size = std::min( length, static_cast<int64_t>( m_readAhead.length() ) );
+    if( size > 0 )
+    {
+      memcpy( buffer, m_readAhead.data(), static_cast<size_t>( size ) );
+      m_readAhead.erase( 0, static_cast<std::string::size_type>( size ) );
+    }
+    return size;
+  }
+
+  int64_t SOCKS5Bytestream::recvToFile( int fd, int64_t length, int timeout )
+  {
+    if( !m_open || !m_connection || !m_socks5 || !m_manager || fd < 0 || length <= 0 )
+      return -1;
+
+    if( m_readAhead.empty() )
+    {
+      const int64_t size = m_socks5->recvToFile( fd, length, timeout );
+      if( size != -1 || !m_open )
+        return size;
+    }
+
+    char buffer[8192];
+    const int64_t size = recvInto( buffer, std::min( length, static_cast<int64_t>( sizeof( buffer ) ) ),
+                                   timeout );
+    for( int64_t done = 0; done < size; )
+    {
+#if defined( _WIN32 )
+      const long written = _write( fd, buffer + done, static_cast<unsigned int>( size - done ) );
+#else
+      const long written = static_cast<long>( ::write( fd, buffer + done, static_cast<size_t>( size - done ) ) );
+      if( written < 0 && errno == EINTR )
+        continue;
+#endif
+      if( written <= 0 )
+        return -1;
+      done += written;
+    }
+
+    return size;
+  }
+
   void SOCKS5Bytestream::activate()
   {
     m_open = true;
@@ -115,6 +257,7 @@ namespace gloox
     {
       m_open = false;
       m_connected = false;
+      m_readAhead = EmptyString;
       m_socks5->disconnect();
       m_handler->handleBytestreamClose( this );
     }
@@ -122,6 +265,12 @@ namespace gloox
 
   void SOCKS5Bytestream::handleReceivedData( const ConnectionBase* /*connection*/, const std::string& data )
   {
+    if( m_capture )
+    {
+      m_readAhead += data;
+      return;
+    }
+
     if( !m_handler )
       return;
 
@@ -23,6 +23,8 @@
 
 #include <string>
 
+#include <stdint.h>
+
 namespace gloox
 {
 
@@ -88,6 +90,46 @@ namespace gloox
        */
       virtual ConnectionError recv( int timeout = -1 );
 
+      /**
+       * Sends a range of a file over an open bytestream. If the underlying connection supports
+       * it (a plain TCP connection on Linux), the data is handed from the file to the socket by
+       * the kernel, using sendfile(). Otherwise the file is read in chunks which are passed to
+       * send(). The function returns only after the range has been sent.
+       * @param fd A file descriptor opened for reading. Its file position is not changed.
+       * @param offset The offset of the first byte to send.
+       * @param length The number of bytes to send.
+       * @return @b True if the range has been sent, @b false if the stream is not open, the
+       * end of the file was reached early, or in case of an error.
+       * @since 1.1
+       */
+      bool sendFile( int fd, int64_t offset, int64_t length );
+
+      /**
+       * Use this function instead of recv() to receive data directly into the given buffer. The
+       * data is @b not passed to BytestreamDataHandler::handleBytestreamData().
+       * @param buffer The buffer to receive into.
+       * @param length The size of the buffer.
+       * @param timeout The timeout to use for select in microseconds. Default of -1 means blocking.
+       * @return The number of bytes received (0 if no data arrived within @c timeout), or -1
+       * if the stream is not open or has been closed.
+       * @since 1.1
+       */
+      int64_t recvInto( char* buffer, int64_t length, int timeout = -1 );
+
+      /**
+       * Use this function instead of recv() to receive data directly into a file. If the
+       * underlying connection supports it (a plain TCP connection on Linux), the data is moved
+       * from the socket to the file by the kernel, using splice(). The data is @b not passed to
+       * BytestreamDataHandler::handleBytestreamData().
+       * @param fd A file descriptor opened for writing.
+       * @param length The maximum number of bytes to receive.
+       * @param timeout The timeout to use for select in microseconds. Default of -1 means blocking.
+       * @return The number of bytes received and written (0 if no data arrived within
+       * @c timeout), or -1 if the stream is not open, has been closed, or writing the file failed.
+       * @since 1.1
+       */
+      int64_t recvToFile( int fd, int64_t length, int timeout = -1 );
+
       /**
        * Sets the connection to use.
        * @param connection The connection. The bytestream will own the connection, any
@@ -128,6 +170,8 @@ namespace gloox
       ConnectionBase* m_socks5;
       JID m_proxy;
       bool m_connected;
+      bool m_capture;               // recv() was called by recvInto(), keep the data
+      std::string m_readAhead;      // received data not yet handed out by recvInto()
 
       StreamHostList m_hosts;
 
@@ -17,12 +17,44 @@
 #include "mutexguard.h"
 #include "util.h"
 
+#if defined( _WIN32 )
+# include <winsock2.h>
+#else
+# include <errno.h>
+# include <poll.h>
+#endif
+
+#include <vector>
+
 namespace gloox
 {
 
+#if defined( _WIN32 )
+  typedef WSAPOLLFD pollfd_t;
+#else
+  typedef struct pollfd pollfd_t;
+#endif
+
+  // not a macro, that would rename any other poll in this translation unit, too
+  static inline int pollSockets( pollfd_t* fds, unsigned long nfds, int timeout )
+  {
+#if defined( _WIN32 )
+    return WSAPoll( fds, nfds, timeout );
+#else
+    return ::poll( fds, static_cast<nfds_t>( nfds ), timeout );
+#endif
+  }
+
+  struct SOCKS5BytestreamServer::PollSet
+  {
+    std::vector<pollfd_t> fds;                   // fds[0] is the listening socket
+    std::vector<ConnectionBase*> connections;    // connections[i] belongs to fds[i+1]
+  };
+
   SOCKS5BytestreamServer::SOCKS5BytestreamServer( const LogSink& logInstance, int port,
                                                   const std::string& ip )
-    : m_tcpServer( 0 ), m_logInstance( logInstance ), m_ip( ip ), m_port( port )
+    : m_tcpServer( 0 ), m_pollSet( new PollSet() ), m_pollSetDirty( true ),
+      m_logInstance( logInstance ), m_ip( ip ), m_port( port )
   {
     m_tcpServer = new ConnectionTCPServer( this, m_logInstance, m_ip, m_port );
   }
@@ -40,6 +72,8 @@ namespace gloox
     m_connections.clear();
     util::clearList( m_oldConnections );
     m_mutex.unlock();
+
+    delete m_pollSet;
   }
 
   ConnectionError SOCKS5BytestreamServer::listen()
@@ -55,25 +89,50 @@ namespace gloox
     if( !m_tcpServer )
       return ConnNotConnected;
 
-    ConnectionError ce = m_tcpServer->recv( timeout );
-    if( ce != ConnNoError )
-      return ce;
-
-    // First take a snapshot of our connections, and then iterate the snapshot
-    // (so that the live map can be modified by an erase while we
-    // iterate the snapshot of the map)
-    ConnectionMap connectionsSnapshot;
+    const int serverSocket = m_tcpServer->socket();
+    if( serverSocket < 0 )
+      return m_tcpServer->recv( timeout );
 
+    // the poll set is a snapshot of our connections (so that the live map can be modified
+    // while we iterate it), re-taken only if a connection was added or removed
     m_mutex.lock();
-    connectionsSnapshot.insert( m_connections.begin(), m_connections.end() );
+    if( m_pollSetDirty || m_pollSet->fds[0].fd != serverSocket )
+      rebuildPollSet( serverSocket );
     m_mutex.unlock();
 
-    ConnectionMap::const_iterator it = connectionsSnapshot.begin();
-    for( ; it != connectionsSnapshot.end(); ++it )
+    std::vector<pollfd_t>& fds = m_pollSet->fds;
+    const int num = pollSockets( &fds[0], static_cast<unsigned long>( fds.size() ),
+                                 timeout == -1 ? -1 : ( timeout + 999 ) / 1000 );
+    if( num < 0 )
     {
-      (*it).first->recv( timeout );
+#if !defined( _WIN32 )
+      if( errno == EINTR )
+        return ConnNoError;
+#endif
+      return ConnIoError;
+    }
+
+    if( fds[0].revents )
+    {
+      ConnectionError ce = m_tcpServer->recv( 0 );
+      if( ce != ConnNoError )
+        return ce;
+    }
+
+    for( std::vector<pollfd_t>::size_type i = 1; i < fds.size(); ++i )
+    {
+      if( !fds[i].revents )
+        continue;
+
+      // skip connections that have been handed out by getConnection() in the meantime
+      ConnectionBase* conn = m_pollSet->connections[i-1];
+      m_mutex.lock();
+      const bool known = m_connections.find( conn ) != m_connections.end();
+      m_mutex.unlock();
+
+      if( known )
+        conn->recv( 0 );
     }
-    connectionsSnapshot.clear();
 
     m_mutex.lock();
     util::clearList( m_oldConnections );
@@ -82,6 +141,28 @@ namespace gloox
     return ConnNoError;
   }
 
+  void SOCKS5BytestreamServer::rebuildPollSet( int serverSocket )
+  {
+    m_pollSet->fds.clear();
+    m_pollSet->connections.clear();
+
+    pollfd_t p;
+    p.fd = serverSocket;
+    p.events = POLLIN;
+    p.revents = 0;
+    m_pollSet->fds.push_back( p );
+
+    ConnectionMap::const_iterator it = m_connections.begin();
+    for( ; it != m_connections.end(); ++it )
+    {
+      p.fd = (*it).second.socket;
+      m_pollSet->fds.push_back( p );
+      m_pollSet->connections.push_back( (*it).first );
+    }
+
+    m_pollSetDirty = false;
+  }
+
   void SOCKS5BytestreamServer::stop()
   {
     if( m_tcpServer )
@@ -119,6 +200,7 @@ namespace gloox
         ConnectionBase* conn = (*it).first;
         conn->registerConnectionDataHandler( 0 );
         m_connections.erase( it );
+        m_pollSetDirty = true;
         return conn;
       }
     }
@@ -143,9 +225,12 @@ namespace gloox
     connection->registerConnectionDataHandler( this );
     ConnectionInfo ci;
     ci.state = StateUnnegotiated;
+    // incoming connections are always created by our ConnectionTCPServer
+    ci.socket = static_cast<ConnectionTCPBase*>( connection )->socket();
 
     m_mutex.lock();
     m_connections[connection] = ci;
+    m_pollSetDirty = true;
     m_mutex.unlock();
   }
 
@@ -243,6 +328,7 @@ namespace gloox
     util::MutexGuard mg( m_mutex );
     m_connections.erase( const_cast<ConnectionBase*>( connection ) );
     m_oldConnections.push_back( connection );
+    m_pollSetDirty = true;
   }
 
 }
@@ -63,7 +63,8 @@ namespace gloox
 
       /**
        * Call this function repeatedly to check for incoming connections and to negotiate
-       * them.
+       * them. The listening socket and all connections that are being negotiated are waited
+       * on at once, and only those that are ready are serviced.
        * @param timeout The timeout to use for select in microseconds.
        * @return The state of the listening socket.
        */
@@ -111,6 +112,7 @@ namespace gloox
       void registerHash( const std::string& hash );
       void removeHash( const std::string& hash );
       ConnectionBase* getConnection( const std::string& hash );
+      void rebuildPollSet( int serverSocket );
 
       enum NegotiationState
       {
@@ -126,6 +128,7 @@ namespace gloox
       {
         NegotiationState state;
         std::string hash;
+        int socket;
       };
 
       typedef std::map<ConnectionBase*, ConnectionInfo> ConnectionMap;
@@ -139,6 +142,10 @@ namespace gloox
 
       ConnectionTCPServer* m_tcpServer;
 
+      struct PollSet;        // the sockets recv() waits on
+      PollSet* m_pollSet;
+      bool m_pollSetDirty;   // whether m_connections changed since m_pollSet was built
+
       util::Mutex m_mutex;
       const LogSink& m_logInstance;
       std::string m_ip;
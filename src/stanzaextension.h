@@ -265,6 +265,17 @@ namespace gloox
        */
       virtual StanzaExtension* clone() const = 0;
 
+      /**
+       * Compares the extension to another one of the same extensionType(). Objects that keep
+       * copies of incoming extensions (like the Resources of a RosterItem) use this to keep an
+       * unchanged extension instead of cloning it again. The default implementation returns
+       * @b false, i.e. the extension is always considered changed.
+       * @param other An extension of the same type.
+       * @return @b True if both extensions carry the same information, @b false otherwise.
+       * @since 1.1
+       */
+      virtual bool equals( const StanzaExtension& /*other*/ ) const { return false; }
+
       /**
        * Returns the extension's type.
        * @return The extension's type.
@@ -14,7 +14,6 @@
 #include "stanzaextensionfactory.h"
 
 #include "gloox.h"
-#include "mutexguard.h"
 #include "util.h"
 #include "stanza.h"
 #include "stanzaextension.h"
@@ -23,15 +22,43 @@
 namespace gloox
 {
 
+  struct StanzaExtensionFactory::SEEntry
+  {
+    SEEntry( unsigned _serial, StanzaExtension* _ext )
+      : serial( _serial ), ext( _ext ), path( _ext->filterString() ) { refs.increment(); }
+    ~SEEntry() { delete ext; }
+
+    unsigned serial;
+    StanzaExtension* ext;
+    TagPath path;
+    util::AtomicRefCount refs;              // the number of tables containing the entry
+  };
+
+  StanzaExtensionFactory::SETable::SETable( const SETable& other )
+    : extensions( other.extensions ), index( other.index ), unindexed( other.unindexed )
+  {
+    SEEntryList::const_iterator it = extensions.begin();
+    for( ; it != extensions.end(); ++it )
+      (*it)->refs.increment();
+  }
+
+  StanzaExtensionFactory::SETable::~SETable()
+  {
+    SEEntryList::const_iterator it = extensions.begin();
+    for( ; it != extensions.end(); ++it )
+    {
+      if( (*it)->refs.decrement() == 0 )
+        delete (*it);
+    }
+  }
+
   StanzaExtensionFactory::StanzaExtensionFactory()
+    : m_serial( 0 )
   {
   }
 
   StanzaExtensionFactory::~StanzaExtensionFactory()
   {
-    m_extensionsMutex.lock();
-    util::clearList( m_extensions );
-    m_extensionsMutex.unlock();
   }
 
   void StanzaExtensionFactory::registerExtension( StanzaExtension* ext )
@@ -39,50 +66,225 @@ namespace gloox
     if( !ext )
       return;
 
-    util::MutexGuard m( m_extensionsMutex );
-    SEList::iterator it = m_extensions.begin();
-    SEList::iterator it2;
-    while( it != m_extensions.end() )
+    util::CopyOnWrite<SETable>::WriteGuard table( m_table );
+    SEEntryList::iterator it = table->extensions.begin();
+    SEEntryList::iterator it2;
+    while( it != table->extensions.end() )
     {
       it2 = it++;
-      if( ext->extensionType() == (*it2)->extensionType() )
-      {
-        delete (*it2);
-        m_extensions.erase( it2 );
-      }
+      if( ext->extensionType() == (*it2)->ext->extensionType() )
+        removeEntry( *table, it2 );
     }
-    m_extensions.push_back( ext );
+    SEEntry* entry = new SEEntry( m_serial++, ext );
+    table->extensions.push_back( entry );
+    indexExtension( *table, entry );
   }
 
   bool StanzaExtensionFactory::removeExtension( int ext )
   {
-    util::MutexGuard m( m_extensionsMutex );
-    SEList::iterator it = m_extensions.begin();
-    for( ; it != m_extensions.end(); ++it )
     {
-      if( (*it)->extensionType() == ext )
+      util::CopyOnWrite<SETable>::ReadGuard table( m_table );
+      SEEntryList::const_iterator it = table->extensions.begin();
+      while( it != table->extensions.end() && (*it)->ext->extensionType() != ext )
+        ++it;
+      if( it == table->extensions.end() )
+        return false;
+    }
+
+    util::CopyOnWrite<SETable>::WriteGuard table( m_table );
+    SEEntryList::iterator it = table->extensions.begin();
+    for( ; it != table->extensions.end(); ++it )
+    {
+      if( (*it)->ext->extensionType() == ext )
       {
-        delete (*it);
-        m_extensions.erase( it );
+        removeEntry( *table, it );
         return true;
       }
     }
     return false;
   }
 
+  void StanzaExtensionFactory::removeEntry( SETable& table, SEEntryList::iterator it )
+  {
+    SEEntry* entry = (*it);
+    unindexExtension( table, entry );
+    table.extensions.erase( it );
+    // older versions of the table may still be in use
+    if( entry->refs.decrement() == 0 )
+      delete entry;
+  }
+
+  bool StanzaExtensionFactory::compileFilter( const std::string& filter, SEKeyList& keys )
+  {
+    static const std::string xmlnsPredicate = "[@xmlns='";
+
+    // Only a union of expressions of the form '/stanza/child' or
+    // '/stanza/child[@xmlns='namespace']' is indexed. Anything else is left to
+    // full XPath evaluation.
+    std::string::size_type start = 0;
+    while( start <= filter.length() )
+    {
+      std::string::size_type end = filter.find( '|', start );
+      if( end == std::string::npos )
+        end = filter.length();
+      const std::string expr = filter.substr( start, end - start );
+      start = end + 1;
+
+      if( expr.length() < 4 || expr[0] != '/' )
+        return false;
+
+      const std::string::size_type slash = expr.find( '/', 1 );
+      if( slash == std::string::npos || slash == 1
+          || expr.find_first_of( "[]()@'=.*", 1 ) < slash )
+        return false;
+
+      const std::string::size_type pred = expr.find( '[', slash );
+      const std::string child = expr.substr( slash + 1, pred == std::string::npos
+                                                          ? std::string::npos
+                                                          : pred - slash - 1 );
+      if( child.empty() || child == "." || child == ".."
+          || child.find_first_of( "/[]()@'=" ) != std::string::npos )
+        return false;
+
+      std::string xmlns;
+      if( pred != std::string::npos )
+      {
+        const std::string::size_type nsStart = pred + xmlnsPredicate.length();
+        if( expr.compare( pred, xmlnsPredicate.length(), xmlnsPredicate ) != 0
+            || expr.length() < nsStart + 3
+            || expr.compare( expr.length() - 2, 2, "']" ) != 0 )
+          return false;
+
+        xmlns = expr.substr( nsStart, expr.length() - 2 - nsStart );
+        if( xmlns.find_first_of( "'[]" ) != std::string::npos )
+          return false;
+      }
+
+      keys.push_back( SEKey( child, xmlns ) );
+    }
+
+    return !keys.empty();
+  }
+
+  void StanzaExtensionFactory::indexExtension( SETable& table, SEEntry* entry )
+  {
+    SEKeyList keys;
+    if( !compileFilter( entry->path.expression(), keys ) )
+    {
+      table.unindexed.push_back( entry );
+      return;
+    }
+
+    SEKeyList::const_iterator it = keys.begin();
+    for( ; it != keys.end(); ++it )
+    {
+      SEEntryList& l = table.index[(*it).first][(*it).second];
+      if( l.empty() || l.back() != entry )
+        l.push_back( entry );
+    }
+  }
+
+  void StanzaExtensionFactory::unindexExtension( SETable& table, const SEEntry* entry )
+  {
+    SEEntryList::iterator itl = table.unindexed.begin();
+    while( itl != table.unindexed.end() )
+    {
+      if( (*itl) == entry )
+        itl = table.unindexed.erase( itl );
+      else
+        ++itl;
+    }
+
+    SEIndex::iterator itn = table.index.begin();
+    while( itn != table.index.end() )
+    {
+      SENamespaceIndex::iterator itx = (*itn).second.begin();
+      while( itx != (*itn).second.end() )
+      {
+        SEEntryList& l = (*itx).second;
+        itl = l.begin();
+        while( itl != l.end() )
+        {
+          if( (*itl) == entry )
+            itl = l.erase( itl );
+          else
+            ++itl;
+        }
+
+        if( l.empty() )
+          (*itn).second.erase( itx++ );
+        else
+          ++itx;
+      }
+
+      if( (*itn).second.empty() )
+        table.index.erase( itn++ );
+      else
+        ++itn;
+    }
+  }
+
+  void StanzaExtensionFactory::addCandidates( const SETable& table, SECandidates& candidates,
+                                              const std::string& name, const std::string& xmlns )
+  {
+    SEIndex::const_iterator itn = table.index.find( name );
+    if( itn == table.index.end() )
+      return;
+
+    SEEntryList::const_iterator it;
+    SENamespaceIndex::const_iterator itx = (*itn).second.find( xmlns );
+    if( itx != (*itn).second.end() )
+    {
+      for( it = (*itx).second.begin(); it != (*itx).second.end(); ++it )
+        candidates.insert( std::make_pair( (*it)->serial, (*it) ) );
+    }
+
+    if( xmlns.empty() )
+      return;
+
+    itx = (*itn).second.find( EmptyString );
+    if( itx != (*itn).second.end() )
+    {
+      for( it = (*itx).second.begin(); it != (*itx).second.end(); ++it )
+        candidates.insert( std::make_pair( (*it)->serial, (*it) ) );
+    }
+  }
+
   void StanzaExtensionFactory::addExtensions( Stanza& stanza, Tag* tag )
   {
-    ConstTagList::const_iterator it;
+    static const std::string wildcard = "*";
+
+    // the candidates stay valid while we hold the table, even if extensions get removed meanwhile
+    util::CopyOnWrite<SETable>::ReadGuard table( m_table );
+
+    SECandidates candidates;
+    SEEntryList::const_iterator itu = table->unindexed.begin();
+    for( ; itu != table->unindexed.end(); ++itu )
+      candidates.insert( std::make_pair( (*itu)->serial, (*itu) ) );
+
+    // absolute expressions are evaluated against the root of the tree
+    const Tag* root = tag;
+    while( root->parent() )
+      root = root->parent();
 
-    util::MutexGuard m( m_extensionsMutex );
-    SEList::const_iterator ite = m_extensions.begin();
-    for( ; ite != m_extensions.end(); ++ite )
+    const TagList& children = root->children();
+    TagList::const_iterator itc = children.begin();
+    for( ; itc != children.end(); ++itc )
+    {
+      const std::string& xmlns = (*itc)->findAttribute( XMLNS );
+      addCandidates( *table, candidates, (*itc)->name(), xmlns );
+      addCandidates( *table, candidates, wildcard, xmlns );
+    }
+
+    ConstTagList::const_iterator it;
+    SECandidates::const_iterator ite = candidates.begin();
+    for( ; ite != candidates.end(); ++ite )
     {
-      const ConstTagList& match = tag->findTagList( (*ite)->filterString() );
+      const ConstTagList& match = tag->findTagList( (*ite).second->path );
       it = match.begin();
       for( ; it != match.end(); ++it )
       {
-        StanzaExtension* se = (*ite)->newInstance( (*it) );
+        StanzaExtension* se = (*ite).second->ext->newInstance( (*it) );
         if( se )
         {
           stanza.addExtension( se );
@@ -14,9 +14,12 @@
 #ifndef STANZAEXTENSIONFACTORY_H__
 #define STANZAEXTENSIONFACTORY_H__
 
-#include "mutex.h"
+#include "copyonwrite.h"
 
 #include <list>
+#include <map>
+#include <string>
+#include <utility>
 
 namespace gloox
 {
@@ -76,15 +79,58 @@ namespace gloox
 
       /**
        * This function creates StanzaExtensions from the given Tag and attaches them to the given Stanza.
+       * Extensions are looked up by the name and namespace of the stanza's child elements first.
+       * Only extensions whose filterString() could match any of them are asked to evaluate it.
+       * This function does not block, it may be called from several threads at once, and
+       * concurrently with registerExtension() and removeExtension().
        * @param stanza The Stanza to attach the extensions to.
        * @param tag The Tag to parse and create the StanzaExtension from.
        */
       void addExtensions( Stanza& stanza, Tag* tag );
 
     private:
-      typedef std::list<StanzaExtension*> SEList;
-      SEList m_extensions;
-      util::Mutex m_extensionsMutex;
+      // A registered extension, its registration serial and its compiled filter string.
+      // The serial is used to keep the order of addExtensions() identical to the
+      // registration order. Entries are shared by all versions of the table that contain them.
+      struct SEEntry;
+      typedef std::list<SEEntry*> SEEntryList;
+
+      // (child element name, value of the child's xmlns attribute). Either part may be
+      // '*' resp. empty if the filter does not restrict it.
+      typedef std::pair<std::string, std::string> SEKey;
+      typedef std::list<SEKey> SEKeyList;
+
+      // child element name -> xmlns -> candidate extensions
+      typedef std::map<std::string, SEEntryList> SENamespaceIndex;
+      typedef std::map<std::string, SENamespaceIndex> SEIndex;
+
+      typedef std::map<unsigned, const SEEntry*> SECandidates;
+
+      // One version of the registry. Never modified once published.
+      struct SETable
+      {
+        SETable() {}
+        SETable( const SETable& other );
+        ~SETable();
+
+        SEEntryList extensions;
+        SEIndex index;
+        SEEntryList unindexed;
+
+        private:
+          SETable& operator=( const SETable& );
+      };
+
+      static void indexExtension( SETable& table, SEEntry* entry );
+      static void unindexExtension( SETable& table, const SEEntry* entry );
+      static void removeEntry( SETable& table, SEEntryList::iterator it );
+      static void addCandidates( const SETable& table, SECandidates& candidates,
+                                 const std::string& name, const std::string& xmlns );
+
+      static bool compileFilter( const std::string& filter, SEKeyList& keys );
+
+      util::CopyOnWrite<SETable> m_table;
+      unsigned m_serial;                      // only touched with a WriteGuard on m_table
 
   };
 
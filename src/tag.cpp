@@ -17,11 +17,104 @@
 #include <ctype.h>
 #include <stdlib.h>
 
+#include <new>
+
 #include <algorithm>
 
 namespace gloox
 {
 
+  // ---- TagArena ----
+  // Keeps everything handed out by the arena (and the objects behind the allocation
+  // header below) aligned for any type a Tag consists of.
+  static const size_t arenaAlignment = 2 * sizeof( void* );
+
+  TagArena::TagArena( size_t blockSize )
+    : m_blocks( 0 ), m_pos( 0 ), m_end( 0 ), m_blockSize( blockSize ), m_used( 0 )
+  {
+  }
+
+  TagArena::~TagArena()
+  {
+    while( m_blocks )
+    {
+      Block* b = m_blocks;
+      m_blocks = b->next;
+      ::operator delete( b );
+    }
+  }
+
+  void* TagArena::allocate( size_t size )
+  {
+    size = ( size + arenaAlignment - 1 ) & ~( arenaAlignment - 1 );
+    if( static_cast<size_t>( m_end - m_pos ) < size )
+    {
+      const size_t header = ( sizeof( Block ) + arenaAlignment - 1 ) & ~( arenaAlignment - 1 );
+      const size_t blockSize = size + header > m_blockSize ? size + header : m_blockSize;
+      Block* b = static_cast<Block*>( ::operator new( blockSize ) );
+      b->next = m_blocks;
+      b->size = blockSize;
+      m_blocks = b;
+      m_pos = reinterpret_cast<char*>( b ) + header;
+      m_end = reinterpret_cast<char*>( b ) + blockSize;
+    }
+
+    void* p = m_pos;
+    m_pos += size;
+    m_used += size;
+    return p;
+  }
+
+  void TagArena::reset()
+  {
+    if( !m_blocks )
+      return;
+
+    // keep the oldest block, it is the one of regular size
+    while( m_blocks->next )
+    {
+      Block* b = m_blocks;
+      m_blocks = b->next;
+      ::operator delete( b );
+    }
+
+    const size_t header = ( sizeof( Block ) + arenaAlignment - 1 ) & ~( arenaAlignment - 1 );
+    m_pos = reinterpret_cast<char*>( m_blocks ) + header;
+    m_end = reinterpret_cast<char*>( m_blocks ) + m_blocks->size;
+    m_used = 0;
+  }
+  // ---- ~TagArena ----
+
+  // ---- TagPath ----
+  TagPath::TagPath( const std::string& expression )
+    : m_expression( expression ), m_root( 0 )
+  {
+    unsigned len = 0;
+    m_root = Tag::parse( m_expression, len );
+  }
+
+  TagPath::TagPath( const TagPath& right )
+    : m_expression( right.m_expression ), m_root( right.m_root ? right.m_root->clone() : 0 )
+  {
+  }
+
+  TagPath::~TagPath()
+  {
+    delete m_root;
+  }
+
+  TagPath& TagPath::operator=( const TagPath& right )
+  {
+    if( this == &right )
+      return *this;
+
+    delete m_root;
+    m_expression = right.m_expression;
+    m_root = right.m_root ? right.m_root->clone() : 0;
+    return *this;
+  }
+  // ---- ~TagPath ----
+
   // ---- Tag::Attribute ----
   Tag::Attribute::Attribute( Tag* parent, const std::string& name, const std::string& value,
                              const std::string& xmlns )
@@ -115,29 +208,53 @@ namespace gloox
   }
 
   const std::string Tag::Attribute::xml() const
+  {
+    std::string xml;
+    this->xml( xml );
+    return xml;
+  }
+
+  void Tag::Attribute::xml( std::string& target ) const
   {
     if( m_name.empty() )
-      return EmptyString;
+      return;
 
-    std::string xml;
-    xml += ' ';
+    target += ' ';
     if( !m_prefix.empty() )
     {
-      xml += m_prefix;
-      xml += ':';
+      target += m_prefix;
+      target += ':';
     }
-    xml += m_name;
-    xml += "='";
-    util::appendEscaped( xml, m_value );
-    xml += '\'';
+    target += m_name;
+    target += "='";
+    util::appendEscaped( target, m_value );
+    target += '\'';
+  }
 
-    return xml;
+  void* Tag::Attribute::operator new( size_t size )
+  {
+    return Tag::allocate( size, 0 );
+  }
+
+  void* Tag::Attribute::operator new( size_t size, TagArena* arena )
+  {
+    return Tag::allocate( size, arena );
+  }
+
+  void Tag::Attribute::operator delete( void* p )
+  {
+    Tag::release( p );
+  }
+
+  void Tag::Attribute::operator delete( void* p, TagArena* )
+  {
+    Tag::release( p );
   }
   // ---- ~Tag::Attribute ----
 
   // ---- Tag ----
   Tag::Tag( const std::string& name, const std::string& cdata )
-    : m_parent( 0 ), m_children( 0 ), m_cdata( 0 ),
+    : m_arena( 0 ), m_parent( 0 ), m_children( 0 ), m_cdata( 0 ),
       m_attribs( 0 ), m_nodes( 0 ),
       m_xmlnss( 0 )
   {
@@ -148,7 +265,7 @@ namespace gloox
   }
 
   Tag::Tag( Tag* parent, const std::string& name, const std::string& cdata )
-    : m_parent( parent ), m_children( 0 ), m_cdata( 0 ),
+    : m_arena( 0 ), m_parent( parent ), m_children( 0 ), m_cdata( 0 ),
       m_attribs( 0 ), m_nodes( 0 ),
       m_xmlnss( 0 )
   {
@@ -164,7 +281,7 @@ namespace gloox
   Tag::Tag( const std::string& name,
             const std::string& attrib,
             const std::string& value )
-    : m_parent( 0 ), m_children( 0 ), m_cdata( 0 ),
+    : m_arena( 0 ), m_parent( 0 ), m_children( 0 ), m_cdata( 0 ),
       m_attribs( 0 ), m_nodes( 0 ),
       m_name( name ), m_xmlnss( 0 )
   {
@@ -177,7 +294,7 @@ namespace gloox
   Tag::Tag( Tag* parent, const std::string& name,
                          const std::string& attrib,
                          const std::string& value )
-    : m_parent( parent ), m_children( 0 ), m_cdata( 0 ),
+    : m_arena( 0 ), m_parent( parent ), m_children( 0 ), m_cdata( 0 ),
       m_attribs( 0 ), m_nodes( 0 ),
       m_name( name ), m_xmlnss( 0 )
   {
@@ -191,7 +308,7 @@ namespace gloox
   }
 
   Tag::Tag( Tag* tag )
-    : m_parent( 0 ), m_children( 0 ), m_cdata( 0 ), m_attribs( 0 ),
+    : m_arena( 0 ), m_parent( 0 ), m_children( 0 ), m_cdata( 0 ), m_attribs( 0 ),
       m_nodes( 0 ), m_xmlnss( 0 )
   {
     if( !tag )
@@ -246,6 +363,46 @@ namespace gloox
     m_parent = 0;
   }
 
+  // Every Tag, Attribute and Node is preceded by a header that records the TagArena it
+  // was allocated from, or 0 for the heap.
+  void* Tag::allocate( size_t size, TagArena* arena )
+  {
+    char* p = static_cast<char*>( arena ? arena->allocate( size + arenaAlignment )
+                                        : ::operator new( size + arenaAlignment ) );
+    *reinterpret_cast<TagArena**>( p ) = arena;
+    return p + arenaAlignment;
+  }
+
+  void Tag::release( void* p )
+  {
+    if( !p )
+      return;
+
+    char* b = static_cast<char*>( p ) - arenaAlignment;
+    if( !*reinterpret_cast<TagArena**>( b ) )
+      ::operator delete( b );
+  }
+
+  void* Tag::operator new( size_t size )
+  {
+    return allocate( size, 0 );
+  }
+
+  void* Tag::operator new( size_t size, TagArena* arena )
+  {
+    return allocate( size, arena );
+  }
+
+  void Tag::operator delete( void* p )
+  {
+    release( p );
+  }
+
+  void Tag::operator delete( void* p, TagArena* )
+  {
+    release( p );
+  }
+
   bool Tag::operator==( const Tag& right ) const
   {
     if( m_name != right.m_name || m_xmlns != right.m_xmlns )
@@ -300,11 +457,63 @@ namespace gloox
   }
 
   const std::string Tag::xml() const
+  {
+    std::string xml;
+    this->xml( xml );
+    return xml;
+  }
+
+  void Tag::xml( std::string& target ) const
   {
     if( m_name.empty() )
-      return EmptyString;
+      return;
+
+    target.reserve( target.length() + xmlSize() );
+    appendXml( target );
+  }
 
-    std::string xml = "<";
+  size_t Tag::xmlSize() const
+  {
+    const size_t name = m_prefix.empty() ? m_name.length() : m_prefix.length() + 1 + m_name.length();
+    size_t size = name + 1; // <name
+
+    if( m_attribs )
+    {
+      AttributeList::const_iterator it_a = m_attribs->begin();
+      for( ; it_a != m_attribs->end(); ++it_a )
+      {
+        const Attribute* a = (*it_a);
+        size += a->m_name.length() + a->m_value.length() + 4; // ' name='value'
+        if( !a->m_prefix.empty() )
+          size += a->m_prefix.length() + 1;
+      }
+    }
+
+    if( !m_nodes || m_nodes->empty() )
+      return size + 2; // />
+
+    size += name + 4; // ></name>
+    NodeList::const_iterator it_n = m_nodes->begin();
+    for( ; it_n != m_nodes->end(); ++it_n )
+    {
+      switch( (*it_n)->type )
+      {
+        case TypeTag:
+          if( !(*it_n)->tag->m_name.empty() )
+            size += (*it_n)->tag->xmlSize();
+          break;
+        case TypeString:
+          size += (*it_n)->str->length();
+          break;
+      }
+    }
+
+    return size;
+  }
+
+  void Tag::appendXml( std::string& xml ) const
+  {
+    xml += '<';
     if( !m_prefix.empty() )
     {
       xml += m_prefix;
@@ -316,7 +525,7 @@ namespace gloox
       AttributeList::const_iterator it_a = m_attribs->begin();
       for( ; it_a != m_attribs->end(); ++it_a )
       {
-        xml += (*it_a)->xml();
+        (*it_a)->xml( xml );
       }
     }
 
@@ -331,7 +540,8 @@ namespace gloox
         switch( (*it_n)->type )
         {
           case TypeTag:
-            xml += (*it_n)->tag->xml();
+            if( !(*it_n)->tag->m_name.empty() )
+              (*it_n)->tag->appendXml( xml );
             break;
           case TypeString:
             util::appendEscaped( xml, *((*it_n)->str) );
@@ -347,8 +557,6 @@ namespace gloox
       xml += m_name;
       xml += '>';
     }
-
-    return xml;
   }
 
   bool Tag::addAttribute( Attribute* attr )
@@ -421,6 +629,20 @@ namespace gloox
       (*it)->m_parent = this;
   }
 
+  void Tag::takeAttributes( AttributeList& attributes )
+  {
+    if( !m_attribs )
+      m_attribs = new AttributeList();
+    else
+      util::clearList( *m_attribs );
+
+    m_attribs->splice( m_attribs->end(), attributes );
+
+    AttributeList::iterator it = m_attribs->begin();
+    for( ; it != m_attribs->end(); ++it )
+      (*it)->m_parent = this;
+  }
+
   void Tag::addChild( Tag* child )
   {
     if( !child )
@@ -433,7 +655,7 @@ namespace gloox
 
     m_children->push_back( child );
     child->m_parent = this;
-    m_nodes->push_back( new Node( TypeTag, child ) );
+    m_nodes->push_back( new( m_arena ) Node( TypeTag, child ) );
   }
 
   void Tag::addChildCopy( const Tag* child )
@@ -490,7 +712,7 @@ namespace gloox
 
     std::string* str = new std::string( cdata );
     m_cdata->push_back( str );
-    m_nodes->push_back( new Node( TypeString, str ) );
+    m_nodes->push_back( new( m_arena ) Node( TypeString, str ) );
     return true;
   }
 
@@ -802,32 +1024,48 @@ namespace gloox
     return !l.empty() ? l.front()->cdata() : EmptyString;
   }
 
+  const std::string Tag::findCData( const TagPath& path ) const
+  {
+    const ConstTagList& l = findTagList( path );
+    return !l.empty() ? l.front()->cdata() : EmptyString;
+  }
+
   const Tag* Tag::findTag( const std::string& expression ) const
   {
     const ConstTagList& l = findTagList( expression );
     return !l.empty() ? l.front() : 0;
   }
 
+  const Tag* Tag::findTag( const TagPath& path ) const
+  {
+    const ConstTagList& l = findTagList( path );
+    return !l.empty() ? l.front() : 0;
+  }
+
   ConstTagList Tag::findTagList( const std::string& expression ) const
   {
-    ConstTagList l;
     if( expression == "/" || expression == "//" )
-      return l;
+      return ConstTagList();
+
+    return findTagList( TagPath( expression ) );
+  }
+
+  ConstTagList Tag::findTagList( const TagPath& path ) const
+  {
+    const std::string& expression = path.m_expression;
+    if( expression == "/" || expression == "//" )
+      return ConstTagList();
 
     if( m_parent && expression.length() >= 2 && expression[0] == '/'
                                              && expression[1] != '/' )
-      return m_parent->findTagList( expression );
+      return m_parent->findTagList( path );
 
-    unsigned len = 0;
-    Tag* p = parse( expression, len );
-//     if( p )
-//       printf( "parsed tree: %s\n", p->xml().c_str() );
-    l = evaluateTagList( p );
-    delete p;
-    return l;
+//     if( path.m_root )
+//       printf( "parsed tree: %s\n", path.m_root->xml().c_str() );
+    return evaluateTagList( path.m_root );
   }
 
-  ConstTagList Tag::evaluateTagList( Tag* token ) const
+  ConstTagList Tag::evaluateTagList( const Tag* token ) const
   {
     ConstTagList result;
     if( !token )
@@ -884,8 +1122,10 @@ namespace gloox
               }
               else if( atoi( (*cit)->findAttribute( TYPE ).c_str() ) == XTDoubleDot && m_parent )
               {
-                (*cit)->addAttribute( TYPE, XTDot );
-                add( result, m_parent->evaluateTagList( (*cit) ) );
+                Tag* t = (*cit)->clone();
+                t->addAttribute( TYPE, XTDot );
+                add( result, m_parent->evaluateTagList( t ) );
+                delete t;
               }
             }
 
@@ -985,7 +1225,7 @@ namespace gloox
     return result;
   }
 
-  bool Tag::evaluateBoolean( Tag* token ) const
+  bool Tag::evaluateBoolean( const Tag* token ) const
   {
     if( !token )
       return false;
@@ -1013,15 +1253,9 @@ namespace gloox
         break;
       case XTUnion:
       case XTElement:
-      {
-        Tag* t = new Tag( "." );
-        t->addAttribute( TYPE, XTDot );
-        t->addChild( token );
-        result = !evaluateTagList( t ).empty();
-        t->removeChild( token );
-        delete t;
+        // same as evaluating a '.' token with this token as its only child
+        result = !evaluateTagList( token ).empty();
         break;
-      }
       default:
         break;
     }
@@ -1029,7 +1263,7 @@ namespace gloox
     return result;
   }
 
-  bool Tag::evaluateEquals( Tag* token ) const
+  bool Tag::evaluateEquals( const Tag* token ) const
   {
     if( !token || token->children().size() != 2 )
       return false;
@@ -1096,7 +1330,7 @@ namespace gloox
     return result;
   }
 
-  ConstTagList Tag::evaluateUnion( Tag* token ) const
+  ConstTagList Tag::evaluateUnion( const Tag* token ) const
   {
     ConstTagList result;
     if( !token )
@@ -1111,7 +1345,7 @@ namespace gloox
     return result;
   }
 
-  void Tag::closePreviousToken( Tag** root, Tag** current, Tag::TokenType& type, std::string& tok ) const
+  void Tag::closePreviousToken( Tag** root, Tag** current, Tag::TokenType& type, std::string& tok )
   {
     if( !tok.empty() )
     {
@@ -1121,7 +1355,7 @@ namespace gloox
     }
   }
 
-  Tag* Tag::parse( const std::string& expression, unsigned& len, Tag::TokenType border ) const
+  Tag* Tag::parse( const std::string& expression, unsigned& len, Tag::TokenType border )
   {
     Tag* root = 0;
     Tag* current = root;
@@ -1263,7 +1497,7 @@ namespace gloox
   }
 
   void Tag::addToken( Tag **root, Tag **current, Tag::TokenType type,
-                      const std::string& token ) const
+                      const std::string& token )
   {
     Tag* t = new Tag( token );
     if( t->isNumber() && !t->children().size() )
@@ -1284,7 +1518,7 @@ namespace gloox
   }
 
   void Tag::addOperator( Tag** root, Tag** current, Tag* arg,
-                           Tag::TokenType type, const std::string& token ) const
+                           Tag::TokenType type, const std::string& token )
   {
     Tag* t = new Tag( token );
     t->addAttribute( TYPE, type );
@@ -1296,7 +1530,7 @@ namespace gloox
     *current = *root = t;
   }
 
-  bool Tag::addPredicate( Tag **root, Tag **current, Tag* token ) const
+  bool Tag::addPredicate( Tag **root, Tag **current, Tag* token )
   {
     if( !*root || !*current )
       return false;
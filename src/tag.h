@@ -20,6 +20,8 @@
 #include <list>
 #include <utility>
 
+#include <cstddef>
+
 namespace gloox
 {
 
@@ -35,6 +37,134 @@ namespace gloox
    */
   typedef std::list<const Tag*> ConstTagList;
 
+  /**
+   * @brief A simple bump allocator for Tag trees.
+   *
+   * Memory handed out by allocate() is released all at once by reset(). Tags, Attributes
+   * and a Tag's internal node objects can be placed in a TagArena using the placement forms
+   * of Tag::operator new() and Tag::Attribute::operator new(). Deleting such an object runs
+   * its destructor but does not release its memory. Strings and list nodes held by these
+   * objects are still allocated from the heap.
+   *
+   * Parser uses a TagArena if arena allocation is enabled. You should not need to use this
+   * class directly.
+   *
+   * @note TagArena is not thread-safe.
+   *
+   * @author Jakob Schröter <js@camaya.net>
+   * @since 1.1
+   */
+  class GLOOX_API TagArena
+  {
+    public:
+      /**
+       * Creates a new, empty TagArena.
+       * @param blockSize The size of the memory blocks requested from the heap.
+       */
+      TagArena( size_t blockSize = 8192 );
+
+      /**
+       * Destructor. Releases all memory.
+       */
+      ~TagArena();
+
+      /**
+       * Returns a chunk of memory of at least the given size. The memory is suitably
+       * aligned for any object a Tag consists of.
+       * @param size The number of bytes needed.
+       * @return A pointer to the memory.
+       */
+      void* allocate( size_t size );
+
+      /**
+       * Releases all memory handed out since the last reset. Objects placed in the arena
+       * must have been destroyed before. The first block is kept for re-use.
+       */
+      void reset();
+
+      /**
+       * Returns the number of bytes handed out since the last reset.
+       * @return The number of bytes in use.
+       */
+      size_t used() const { return m_used; }
+
+    private:
+      TagArena( const TagArena& );
+      TagArena& operator=( const TagArena& );
+
+      struct Block
+      {
+        Block* next;
+        size_t size;
+      };
+
+      Block* m_blocks;
+      char* m_pos;
+      char* m_end;
+      size_t m_blockSize;
+      size_t m_used;
+
+  };
+
+  /**
+   * @brief A pre-compiled XPath expression.
+   *
+   * Tag::findTagList(), Tag::findTag() and Tag::findCData() parse their expression on every
+   * call. If the same expression is evaluated repeatedly, compile it once into a TagPath and
+   * use the respective overloads instead.
+   *
+   * @code
+   * static const TagPath path( "/iq/query[@xmlns='jabber:iq:version']" );
+   * const Tag* query = tag->findTag( path );
+   * @endcode
+   *
+   * A TagPath is not modified during evaluation and can be shared between threads.
+   *
+   * @author Jakob Schröter <js@camaya.net>
+   * @since 1.1
+   */
+  class GLOOX_API TagPath
+  {
+
+    friend class Tag;
+
+    public:
+      /**
+       * Compiles the given XPath expression.
+       * @param expression The XPath expression to compile.
+       */
+      TagPath( const std::string& expression );
+
+      /**
+       * Copy constructor.
+       * @param right The TagPath to copy.
+       */
+      TagPath( const TagPath& right );
+
+      /**
+       * Destructor.
+       */
+      ~TagPath();
+
+      /**
+       * Assignment operator.
+       * @param right The TagPath to assign.
+       * @return A reference to this TagPath.
+       */
+      TagPath& operator=( const TagPath& right );
+
+      /**
+       * Returns the expression this TagPath was compiled from.
+       * @return The original XPath expression.
+       */
+      const std::string& expression() const { return m_expression; }
+
+    private:
+      std::string m_expression;
+      Tag* m_root;
+
+  };
+
   /**
    * @brief This is an abstraction of an XML element.
    *
@@ -47,6 +177,7 @@ namespace gloox
   {
 
     friend class Parser;
+    friend class TagPath;
 
     public:
 
@@ -97,6 +228,34 @@ namespace gloox
            */
           virtual ~Attribute() {}
 
+          /**
+           * Allocates an Attribute on the heap.
+           * @param size The size of the object.
+           */
+          static void* operator new( size_t size );
+
+          /**
+           * Allocates an Attribute in the given TagArena, or on the heap if @c arena is 0.
+           * @param size The size of the object.
+           * @param arena The arena to allocate from. May be 0.
+           * @since 1.1
+           */
+          static void* operator new( size_t size, TagArena* arena );
+
+          /**
+           * Releases an Attribute's memory unless it lives in a TagArena.
+           * @param p The memory to release.
+           */
+          static void operator delete( void* p );
+
+          /**
+           * Placement delete matching operator new( size_t, TagArena* ).
+           * @param p The memory to release.
+           * @param arena The arena the memory was allocated from. May be 0.
+           * @since 1.1
+           */
+          static void operator delete( void* p, TagArena* arena );
+
           /**
            * Returns the attribute's name.
            * @return The attribute's name.
@@ -151,6 +310,13 @@ namespace gloox
            */
           const std::string xml() const;
 
+          /**
+           * Appends the string representation of the attribute to the given string.
+           * @param target The string to append to.
+           * @since 1.1
+           */
+          void xml( std::string& target ) const;
+
           /**
            * Checks two Attributes for equality.
            * @param right The Attribute to check against the current Attribute.
@@ -225,6 +391,34 @@ namespace gloox
        */
       virtual ~Tag();
 
+      /**
+       * Allocates a Tag on the heap.
+       * @param size The size of the object.
+       */
+      static void* operator new( size_t size );
+
+      /**
+       * Allocates a Tag in the given TagArena, or on the heap if @c arena is 0.
+       * @param size The size of the object.
+       * @param arena The arena to allocate from. May be 0.
+       * @since 1.1
+       */
+      static void* operator new( size_t size, TagArena* arena );
+
+      /**
+       * Releases a Tag's memory unless it lives in a TagArena.
+       * @param p The memory to release.
+       */
+      static void operator delete( void* p );
+
+      /**
+       * Placement delete matching operator new( size_t, TagArena* ).
+       * @param p The memory to release.
+       * @param arena The arena the memory was allocated from. May be 0.
+       * @since 1.1
+       */
+      static void operator delete( void* p, TagArena* arena );
+
       /**
        * This function can be used to retrieve the complete XML of a tag as a string.
        * It includes all the attributes, child nodes and character data.
@@ -232,6 +426,16 @@ namespace gloox
        */
       const std::string xml() const;
 
+      /**
+       * Appends the complete XML of the tag to the given string in a single pass, without
+       * creating temporary strings for attributes or child elements. Room for the (unescaped)
+       * XML is reserved up front, so usually the target needs to grow at most once.
+       * @param target The string to append to. Pass the same string repeatedly (after
+       * clear()ing it) to reuse its capacity.
+       * @since 1.1
+       */
+      void xml( std::string& target ) const;
+
       /**
        * Sets the Tag's namespace prefix.
        * @param prefix The namespace prefix.
@@ -527,7 +731,8 @@ namespace gloox
 
       /**
        * This function creates a deep copy of this Tag.
-       * @return An independent copy of the Tag.
+       * @return An independent copy of the Tag. The copy is always allocated on the heap,
+       * even if this Tag lives in a TagArena.
        * @since 0.7
        */
       Tag* clone() const;
@@ -567,6 +772,33 @@ namespace gloox
        */
       ConstTagList findTagList( const std::string& expression ) const;
 
+      /**
+       * Evaluates the given pre-compiled XPath expression and returns the result Tag's
+       * character data, if any. See findCData( const std::string& ) for details.
+       * @param path A compiled XPath expression to evaluate.
+       * @return A matched Tag's character data, or the empty string.
+       * @since 1.1
+       */
+      const std::string findCData( const TagPath& path ) const;
+
+      /**
+       * Evaluates the given pre-compiled XPath expression and returns the result Tag.
+       * See findTag( const std::string& ) for details.
+       * @param path A compiled XPath expression to evaluate.
+       * @return A matched Tag, or 0.
+       * @since 1.1
+       */
+      const Tag* findTag( const TagPath& path ) const;
+
+      /**
+       * Evaluates the given pre-compiled XPath expression and returns the matched Tags.
+       * See findTagList( const std::string& ) for details.
+       * @param path A compiled XPath expression to evaluate.
+       * @return A list of matched Tags, or an empty TagList.
+       * @since 1.1
+       */
+      ConstTagList findTagList( const TagPath& path ) const;
+
       /**
        * Checks two Tags for equality. Order of attributes and child tags does matter.
        * @param right The Tag to check against the current Tag.
@@ -616,6 +848,11 @@ namespace gloox
         Node( NodeType _type, std::string* _str ) : type( _type ), str( _str ) {}
         ~Node() {}
 
+        static void* operator new( size_t size, TagArena* arena )
+          { return Tag::allocate( size, arena ); }
+        static void operator delete( void* p ) { Tag::release( p ); }
+        static void operator delete( void* p, TagArena* ) { Tag::release( p ); }
+
         NodeType type;
         union
         {
@@ -626,6 +863,19 @@ namespace gloox
 
       typedef std::list<Node*> NodeList;
 
+      size_t xmlSize() const;
+      void appendXml( std::string& xml ) const;
+
+      static void* allocate( size_t size, TagArena* arena );
+      static void release( void* p );
+
+      /**
+       * Moves the given attributes to this Tag. Any existing attributes are lost.
+       * @param attributes The attributes to move. The list will be empty afterwards.
+       */
+      void takeAttributes( AttributeList& attributes );
+
+      TagArena* m_arena;
       Tag* m_parent;
       TagList* m_children;
       StringPList* m_cdata;
@@ -679,18 +929,18 @@ namespace gloox
       void setXmlns( StringMap* xmlns )
         { delete m_xmlnss; m_xmlnss = xmlns; }
 
-      Tag* parse( const std::string& expression, unsigned& len, TokenType border = XTNone ) const;
+      static Tag* parse( const std::string& expression, unsigned& len, TokenType border = XTNone );
 
-      void closePreviousToken( Tag**, Tag**, TokenType&, std::string& ) const;
-      void addToken( Tag **root, Tag **current, TokenType type, const std::string& token ) const;
-      void addOperator( Tag **root, Tag **current, Tag* arg, TokenType type,
-                        const std::string& token ) const;
-      bool addPredicate( Tag **root, Tag **current, Tag* token ) const;
+      static void closePreviousToken( Tag**, Tag**, TokenType&, std::string& );
+      static void addToken( Tag **root, Tag **current, TokenType type, const std::string& token );
+      static void addOperator( Tag **root, Tag **current, Tag* arg, TokenType type,
+                               const std::string& token );
+      static bool addPredicate( Tag **root, Tag **current, Tag* token );
 
       TagList findChildren( const TagList& list, const std::string& name,
                             const std::string& xmlns = EmptyString ) const;
-      ConstTagList evaluateTagList( Tag* token ) const;
-      ConstTagList evaluateUnion( Tag* token ) const;
+      ConstTagList evaluateTagList( const Tag* token ) const;
+      ConstTagList evaluateUnion( const Tag* token ) const;
       ConstTagList allDescendants() const;
 
       static TokenType getType( const std::string& c );
@@ -698,9 +948,9 @@ namespace gloox
       static bool isWhitespace( const char c );
       bool isNumber() const;
 
-      bool evaluateBoolean( Tag* token ) const;
-      bool evaluatePredicate( Tag* token ) const { return evaluateBoolean( token ); }
-      bool evaluateEquals( Tag* token ) const;
+      bool evaluateBoolean( const Tag* token ) const;
+      bool evaluatePredicate( const Tag* token ) const { return evaluateBoolean( token ); }
+      bool evaluateEquals( const Tag* token ) const;
 
       static void add( ConstTagList& one, const ConstTagList& two );
   };
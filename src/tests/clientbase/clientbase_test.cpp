@@ -16,6 +16,11 @@
 // #include "../../loghandler.h"
 #include "../../connectionlistener.h"
 #include "../../gloox.h"
+#include "../../error.h"
+#include "../../iq.h"
+#include "../../message.h"
+#include "../../messagehandler.h"
+#include "../../messagesession.h"
 using namespace gloox;
 
 #include <stdio.h>
@@ -88,6 +93,75 @@ class ConnectionImpl : public ConnectionBase
 
 };
 
+class RoutingTest : public ClientBase, public MessageHandler
+{
+  public:
+    RoutingTest() : ClientBase( "a", "b", 1 ), m_last( 0 ) {}
+    virtual ~RoutingTest() {}
+    virtual void handleStartNode( const Tag* /*tag*/ ) {}
+    virtual bool handleNormalNode( gloox::Tag* ) { return false; }
+    virtual void rosterFilled() {}
+    virtual void handleMessage( const Message& /*msg*/, MessageSession* session ) { m_last = session; }
+    MessageSession* newSession( const std::string& jid, bool track = false, int types = 0, bool honorTID = true )
+    {
+      MessageSession* s = new MessageSession( this, JID( jid ), track, types, honorTID );
+      s->registerMessageHandler( this );
+      return s;
+    }
+    MessageSession* route( const std::string& from, const std::string& type = "chat",
+                           const std::string& thread = EmptyString )
+    {
+      m_last = 0;
+      Tag* t = new Tag( "message" );
+      t->addAttribute( "from", from );
+      t->addAttribute( "type", type );
+      if( !thread.empty() )
+        new Tag( t, "thread", thread );
+      handleTag( t );
+      delete t;
+      return m_last;
+    }
+
+  private:
+    MessageSession* m_last;
+};
+
+class IqTrackTest : public ClientBase
+{
+  public:
+    IqTrackTest() : ClientBase( "a", "b", 1 ), m_replies( 0 ), m_timeouts( 0 ) {}
+    virtual ~IqTrackTest() {}
+    virtual void handleStartNode( const Tag* /*tag*/ ) {}
+    virtual bool handleNormalNode( gloox::Tag* ) { return false; }
+    virtual void rosterFilled() {}
+    virtual bool handleIq( const IQ& /*iq*/ ) { return false; }
+    virtual void handleIqID( const IQ& iq, int /*context*/ )
+    {
+      if( iq.subtype() == IQ::Error && iq.error()
+          && iq.error()->error() == StanzaErrorRemoteServerTimeout && iq.from().full() == "c@d/e" )
+        ++m_timeouts;
+      else
+        ++m_replies;
+    }
+    void request( const std::string& id, IqHandler* ih, int timeout = -1 )
+    {
+      IQ iq( IQ::Get, JID( "c@d/e" ), id );
+      send( iq, ih, 0, false, timeout );
+    }
+    void reply( const std::string& id )
+    {
+      Tag* t = new Tag( "iq" );
+      t->addAttribute( "from", "c@d/e" );
+      t->addAttribute( "type", "result" );
+      t->addAttribute( "id", id );
+      handleTag( t );
+      delete t;
+    }
+    void expire( int seconds ) { checkIqTimeouts( time( 0 ) + seconds ); }
+    int m_replies;
+    int m_timeouts;
+};
+
 int main( int /*argc*/, char** /*argv*/ )
 {
   int fail = 0;
@@ -192,14 +266,110 @@ int main( int /*argc*/, char** /*argv*/ )
   c = 0;
   t = 0;
 
+  // -------
+  {
+    name = "MessageSession routing: full before bare";
+    RoutingTest r;
+    MessageSession* bare = r.newSession( "a@b" );
+    MessageSession* full = r.newSession( "a@b/r" );
+    if( r.route( "a@b/r" ) != full || r.route( "a@b/x" ) != bare || r.route( "a@c/r" ) != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
 
+  // -------
+  {
+    name = "MessageSession routing: types and registration order";
+    RoutingTest r;
+    MessageSession* gc = r.newSession( "c@d", false, Message::Groupchat );
+    MessageSession* chat1 = r.newSession( "c@d", false, Message::Chat );
+    r.newSession( "c@d", false, Message::Chat );
+    if( r.route( "c@d", "chat" ) != chat1 || r.route( "c@d", "groupchat" ) != gc
+        || r.route( "c@d", "headline" ) != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
 
+  // -------
+  {
+    name = "MessageSession routing: thread ID";
+    RoutingTest r;
+    MessageSession* s1 = r.newSession( "e@f/g", false, 0, false );
+    MessageSession* s2 = r.newSession( "e@f/g", false, 0, false );
+    s1->setThreadID( "t1" );
+    s2->setThreadID( "t2" );
+    if( r.route( "e@f/g", "chat", "t2" ) != s2 || r.route( "e@f/g", "chat", "t1" ) != s1
+        || r.route( "e@f/g", "chat", "t3" ) != 0 || r.route( "e@f/g" ) != s1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
 
+  // -------
+  {
+    name = "MessageSession routing: resource tracking and dispose";
+    RoutingTest r;
+    MessageSession* tracking = r.newSession( "h@i", true );
+    MessageSession* other = r.newSession( "h@i" );
+    MessageSession* first = r.route( "h@i/1" );
+    const std::string target = tracking->target().full();
+    tracking->resetResource();
+    MessageSession* second = r.route( "h@i/2" );
+    const std::string target2 = tracking->target().full();
+    r.disposeMessageSession( tracking );
+    if( first != tracking || target != "h@i/1" || second != tracking || target2 != "h@i/2"
+        || r.route( "h@i/2" ) != other )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
 
+  // -------
+  {
+    name = "IQ tracking: reply, timeout, default timeout";
+    IqTrackTest c;
+    c.setIqTimeout( 30 );
+    c.request( "r1", &c, 0 );
+    c.request( "r2", &c, 10 );
+    c.request( "r3", &c );
+    c.reply( "r1" );
+    c.reply( "r1" );
+    c.expire( 5 );
+    const int early = c.m_timeouts;
+    c.expire( 20 );
+    const int middle = c.m_timeouts;
+    c.reply( "r2" );
+    c.expire( 60 );
+    if( c.m_replies != 1 || early != 0 || middle != 1 || c.m_timeouts != 2 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
 
-
-
-
+  // -------
+  {
+    name = "IQ tracking: removeIDHandler()";
+    IqTrackTest c;
+    IqTrackTest other;
+    c.request( "r1", &c, 10 );
+    c.request( "r2", &other, 10 );
+    c.request( "r3", &c );
+    c.removeIDHandler( &c );
+    c.reply( "r3" );
+    c.expire( 20 );
+    if( c.m_replies != 0 || c.m_timeouts != 0 || other.m_timeouts != 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
 
 
   if( fail == 0 )
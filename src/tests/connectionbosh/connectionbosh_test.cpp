@@ -100,6 +100,16 @@ namespace gloox
 //     printf( "FakeConnection::disconnect(): %d\n", g_test );
   }
 
+  class RecordingHandler : public ConnectionDataHandler
+  {
+    public:
+      virtual void handleReceivedData( const ConnectionBase* /*connection*/, const std::string& data )
+        { m_data += data; }
+      virtual void handleConnect( const ConnectionBase* /*connection*/ ) {}
+      virtual void handleDisconnect( const ConnectionBase* /*connection*/, ConnectionError /*reason*/ ) {}
+      std::string m_data;
+  };
+
   class FakeClientBase : public ConnectionDataHandler, public LogHandler
   {
     public:
@@ -204,6 +214,49 @@ int main( int /*argc*/, char** /*argv*/ )
   delete cb;
   delete fcb;
 
+  // -------
+  {
+    name = "partial response dropped on disconnect";
+    LogSink log;
+    FakeConnection* c = new FakeConnection();
+    ConnectionBOSH* b = new ConnectionBOSH( c, log, "example.net", "example.net" );
+    RecordingHandler rh;
+    b->registerConnectionDataHandler( &rh );
+    b->handleReceivedData( c, "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n"
+                              "<body xmlns='http://jabber.org/protocol/httpbind'><mes" );
+    b->handleDisconnect( c, ConnIoError );
+
+    const std::string body = "<body xmlns='http://jabber.org/protocol/httpbind'><message/></body>";
+    char header[64];
+    sprintf( header, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n", static_cast<int>( body.length() ) );
+    b->handleReceivedData( c, header + body );
+    if( rh.m_data.find( "<message" ) == std::string::npos )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), rh.m_data.c_str() );
+    }
+    delete b;
+  }
+
+  // -------
+  {
+    name = "empty Content-Length";
+    LogSink log;
+    FakeConnection* c = new FakeConnection();
+    ConnectionBOSH* b = new ConnectionBOSH( c, log, "example.net", "example.net" );
+    RecordingHandler rh;
+    b->registerConnectionDataHandler( &rh );
+    // a response without a usable length is left in the buffer
+    b->handleReceivedData( c, "HTTP/1.1 200 OK\r\nContent-Length:\r\n\r\n"
+                              "<body xmlns='http://jabber.org/protocol/httpbind'><message/></body>" );
+    if( !rh.m_data.empty() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), rh.m_data.c_str() );
+    }
+    delete b;
+  }
+
 
   if( fail == 0 )
   {
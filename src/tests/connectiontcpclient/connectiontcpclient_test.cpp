@@ -0,0 +1,550 @@
+/*
+ *  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#ifndef _WIN32
+
+#include "../../config.h" // large file support, before any system header
+
+#include "../../connectiontcpclient.h"
+#include "../../connectiondatahandler.h"
+#include "../../sendqueuehandler.h"
+#include "../../logsink.h"
+#include "../../dns.h"
+#include "../../gloox.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+#include <cstring>
+
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <vector>
+
+class TestHandler : public ConnectionDataHandler, public SendQueueHandler
+{
+  public:
+    TestHandler() : m_full( 0 ), m_drained( 0 ), m_queued( 0 ), m_disconnects( 0 ), m_connects( 0 ) {}
+
+    virtual void handleReceivedData( const ConnectionBase* /*connection*/, const std::string& /*data*/ ) {}
+    virtual void handleConnect( const ConnectionBase* /*connection*/ )
+    {
+      ++m_connects;
+    }
+    virtual void handleDisconnect( const ConnectionBase* /*connection*/, ConnectionError /*reason*/ )
+    {
+      ++m_disconnects;
+    }
+
+    virtual void handleSendQueueFull( const ConnectionBase* /*connection*/, size_t queued )
+    {
+      ++m_full;
+      m_queued = queued;
+    }
+
+    virtual void handleSendQueueDrained( const ConnectionBase* /*connection*/ )
+    {
+      ++m_drained;
+    }
+
+    int m_full;
+    int m_drained;
+    size_t m_queued;
+    int m_disconnects;
+    int m_connects;
+};
+
+// returns a listening socket on localhost and its port
+static int listenLocal( int& port, bool listening = true )
+{
+  int s = socket( AF_INET, SOCK_STREAM, 0 );
+  struct sockaddr_in addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+  bind( s, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) );
+  socklen_t len = sizeof( addr );
+  getsockname( s, reinterpret_cast<struct sockaddr*>( &addr ), &len );
+  port = ntohs( addr.sin_port );
+  if( listening )
+    listen( s, 5 );
+  return s;
+}
+
+static DNSResolver::Target target( const std::string& host, int port, const std::string& addresses )
+{
+  DNSResolver::Target t;
+  t.host = host;
+  t.port = port;
+  t.priority = 0;
+  t.weight = 0;
+  std::string::size_type start = 0;
+  while( start < addresses.length() )
+  {
+    std::string::size_type end = addresses.find( ' ', start );
+    if( end == std::string::npos )
+      end = addresses.length();
+    t.addresses.push_back( addresses.substr( start, end - start ) );
+    start = end + 1;
+  }
+  return t;
+}
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday( &tv, 0 );
+  return static_cast<double>( tv.tv_sec ) + static_cast<double>( tv.tv_usec ) / 1000000.0;
+}
+
+// reads whatever is available without blocking
+static std::string readAll( int fd )
+{
+  std::string data;
+  char buf[4096];
+  ssize_t size;
+  while( ( size = recv( fd, buf, sizeof( buf ), MSG_DONTWAIT ) ) > 0 )
+    data.append( buf, size );
+  return data;
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  int fail = 0;
+  std::string name;
+  LogSink log;
+
+  // -------
+  {
+    name = "blocking send";
+    int fds[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    TestHandler h;
+    ConnectionTCPClient c( &h, log, "localhost" );
+    c.setSocket( fds[0] );
+    if( c.nonBlockingSend() || !c.send( "foo" ) || !c.send( "bar" ) || readAll( fds[1] ) != "foobar" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    close( fds[1] );
+  }
+
+  // -------
+  {
+    name = "cork";
+    int fds[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    TestHandler h;
+    ConnectionTCPClient c( &h, log, "localhost" );
+    c.setSocket( fds[0] );
+    c.setNonBlockingSend( true );
+    c.setCork( true );
+    c.send( "<a/>" );
+    c.send( "<b/>" );
+    c.send( "<c/>" );
+    const std::string corked = readAll( fds[1] );
+    const size_t queued = c.sendQueueSize();
+    c.setCork( false );
+    const std::string data = readAll( fds[1] );
+    if( !corked.empty() || queued != 12 || data != "<a/><b/><c/>" || c.sendQueueSize() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: '%s' %d '%s'\n", name.c_str(), corked.c_str(),
+               static_cast<int>( queued ), data.c_str() );
+    }
+    close( fds[1] );
+  }
+
+  // -------
+  {
+    name = "high-water mark";
+    int fds[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    TestHandler h;
+    ConnectionTCPClient c( &h, log, "localhost" );
+    c.setSocket( fds[0] );
+    c.setNonBlockingSend( true );
+    c.setSendQueueHandler( &h, 65536 );
+
+    // the peer does not read, so the socket buffer fills up and data gets queued
+    std::string expected;
+    int i = 0;
+    for( ; i < 100000 && !h.m_full; ++i )
+    {
+      char chunk[32];
+      sprintf( chunk, "<message id='%08d'/>", i );
+      expected += chunk;
+      if( !c.send( chunk ) )
+        break;
+    }
+    if( h.m_full != 1 || h.m_queued <= 65536 || c.sendQueueSize() != h.m_queued || h.m_drained )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d\n", name.c_str(), h.m_full, static_cast<int>( h.m_queued ) );
+    }
+
+    // -------
+    name = "drain via recv()";
+    std::string data;
+    for( int j = 0; j < 1000 && data.length() < expected.length(); ++j )
+    {
+      data += readAll( fds[1] );
+      c.recv( 10000 ); // waits for the socket to become writable, flushes
+    }
+    data += readAll( fds[1] );
+    if( h.m_drained != 1 || h.m_full != 1 || c.sendQueueSize() != 0 || data != expected
+        || h.m_disconnects )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d %d\n", name.c_str(), h.m_drained,
+               static_cast<int>( data.length() ), static_cast<int>( expected.length() ) );
+    }
+
+    long int in, out;
+    c.getStatistics( in, out );
+    if( out != static_cast<long int>( expected.length() ) )
+    {
+      ++fail;
+      fprintf( stderr, "test 'statistics' failed: %ld\n", out );
+    }
+    close( fds[1] );
+  }
+
+  // -------
+  {
+    name = "peer closed";
+    signal( SIGPIPE, SIG_IGN );
+    int fds[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    shutdown( fds[1], SHUT_RD );
+    TestHandler h;
+    ConnectionTCPClient c( &h, log, "localhost" );
+    c.setSocket( fds[0] );
+    c.setNonBlockingSend( true );
+    if( c.send( "foo" ) || h.m_disconnects != 1 || c.sendQueueSize() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    close( fds[1] );
+  }
+
+  // -------
+  {
+    name = "switch back to blocking send";
+    int fds[2];
+    int result[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    if( pipe( result ) != 0 )
+      ++fail;
+    TestHandler h;
+    ConnectionTCPClient c( &h, log, "localhost" );
+    c.setSocket( fds[0] );
+    c.setNonBlockingSend( true );
+
+    // the peer does not read yet, so most of this gets queued
+    const std::string expected( 1024 * 1024, 'x' );
+    c.send( expected );
+    const size_t queued = c.sendQueueSize();
+
+    const pid_t pid = fork();
+    if( pid == 0 )
+    {
+      // the peer starts reading a little later and reports what it got
+      close( fds[0] );
+      usleep( 50000 );
+      std::string data;
+      char buf[4096];
+      ssize_t size;
+      while( ( size = ::recv( fds[1], buf, sizeof( buf ), 0 ) ) > 0 )
+        data.append( buf, size );
+      if( write( result[1], data.data(), data.length() ) < 0 )
+        _exit( 1 );
+      _exit( 0 );
+    }
+    close( fds[1] );
+    close( result[1] );
+
+    c.setNonBlockingSend( false );
+    const size_t left = c.sendQueueSize();
+    c.send( "tail" );
+    c.cleanup();
+
+    std::string data;
+    char buf[4096];
+    ssize_t size;
+    while( ( size = read( result[0], buf, sizeof( buf ) ) ) > 0 )
+      data.append( buf, size );
+    close( result[0] );
+    waitpid( pid, 0, 0 );
+
+    if( !queued || left || data != expected + "tail" || h.m_disconnects )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d %d\n", name.c_str(), static_cast<int>( queued ),
+               static_cast<int>( left ), static_cast<int>( data.length() ) );
+    }
+  }
+
+  // -------
+  {
+    name = "sendFile";
+    char path[] = "/tmp/gloox-sendfile-XXXXXX";
+    const int file = mkstemp( path );
+    unlink( path );
+    std::string content;
+    for( int i = 0; i < 100000; ++i )
+      content += static_cast<char>( 'a' + i % 26 );
+    write( file, content.data(), content.length() );
+
+    int fds[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    TestHandler h;
+    ConnectionTCPClient c( &h, log, "localhost" );
+    c.setSocket( fds[0] );
+    const long sent = static_cast<long>( c.sendFile( file, 10, 20000 ) );
+    const std::string data = readAll( fds[1] );
+#if defined( __linux__ )
+    if( sent != 20000 || data != content.substr( 10, 20000 ) || lseek( file, 0, SEEK_CUR ) != 100000 )
+#else
+    if( sent != -1 || !data.empty() )
+#endif
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %ld\n", name.c_str(), sent );
+    }
+
+#if defined( __linux__ )
+    // -------
+    name = "sendFile beyond 2 GB";
+    const int64_t big = static_cast<int64_t>( 3 ) << 30; // sparse
+    if( pwrite( file, "tail", 4, static_cast<off_t>( big ) ) == 4 )
+    {
+      const int64_t sentBig = c.sendFile( file, big - 2, 6 );
+      const std::string tail = readAll( fds[1] );
+      if( sentBig != 6 || tail != std::string( "\0\0tail", 6 ) )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed: %ld\n", name.c_str(), static_cast<long>( sentBig ) );
+      }
+    }
+#endif
+
+    // -------
+    name = "recvToFile";
+    ftruncate( file, 0 );
+    lseek( file, 0, SEEK_SET );
+    ::send( fds[1], content.data(), 30000, 0 );
+    long received = 0;
+    for( long size = 1; size > 0 && received < 30000; received += size )
+      size = static_cast<long>( c.recvToFile( file, 30000 - received, 0 ) );
+    std::string written( 30000, '\0' );
+    const long size = pread( file, &written[0], written.length(), 0 );
+    if( received != 30000 || size != 30000 || written != content.substr( 0, 30000 ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %ld\n", name.c_str(), received );
+    }
+    close( file );
+
+    // -------
+    name = "recvInto";
+    char buf[16];
+    ::send( fds[1], "foobar", 6, 0 );
+    const int64_t first = c.recvInto( buf, 3, 0 );
+    const int64_t second = c.recvInto( buf + 3, sizeof( buf ) - 3, 0 );
+    const int64_t none = c.recvInto( buf, sizeof( buf ), 0 );
+    close( fds[1] );
+    const int64_t closed = c.recvInto( buf, sizeof( buf ), 0 );
+    if( first != 3 || second != 3 || std::string( buf, 6 ) != "foobar" || none != 0 || closed != -1
+        || h.m_disconnects != 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %ld %ld %ld %ld\n", name.c_str(), first, second, none, closed );
+    }
+  }
+
+  // -------
+  {
+    name = "connect to targets";
+    int closedPort, openPort;
+    const int closed = listenLocal( closedPort, false ); // bound, but refuses connections
+    const int open = listenLocal( openPort );
+    DNSResolver::TargetList targets;
+    targets.push_back( target( "a.example.org", closedPort, "127.0.0.1" ) );
+    targets.push_back( target( "b.example.org", openPort, "::ffff:127.0.0.1 127.0.0.1" ) );
+    TestHandler h;
+    ConnectionTCPClient c( &h, log, "example.org" );
+    c.setTargets( targets );
+    const double start = now();
+    const ConnectionError e = c.connect();
+    const double elapsed = now() - start;
+    const int peer = accept( open, 0, 0 );
+    if( e != ConnNoError || h.m_connects != 1 || peer < 0 || elapsed > 1.0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d %f\n", name.c_str(), e, peer, elapsed );
+    }
+
+    // -------
+    name = "connection of a newInstance()";
+    ConnectionBase* c2 = c.newInstance();
+    if( c2->connect() != ConnNoError || accept( open, 0, 0 ) < 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    delete c2;
+
+    // -------
+    name = "unresponsive first target";
+    // a listener with a full backlog drops SYNs, so connecting to it hangs
+    int fullPort;
+    const int full = listenLocal( fullPort, false );
+    listen( full, 0 );
+    int fillers[3];
+    for( int i = 0; i < 3; ++i )
+    {
+      fillers[i] = socket( AF_INET, SOCK_STREAM, 0 );
+      struct sockaddr_in addr;
+      memset( &addr, 0, sizeof( addr ) );
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+      addr.sin_port = htons( static_cast<unsigned short>( fullPort ) );
+      fcntl( fillers[i], F_SETFL, O_NONBLOCK );
+      connect( fillers[i], reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) );
+    }
+    usleep( 100000 );
+    targets.clear();
+    targets.push_back( target( "a.example.org", fullPort, "127.0.0.1" ) );
+    targets.push_back( target( "b.example.org", openPort, "127.0.0.1" ) );
+    const double start2 = now();
+    const int fd = DNS::connect( targets, log, 100 );
+    const double elapsed2 = now() - start2;
+    const int peer2 = accept( open, 0, 0 );
+    if( fd < 0 || peer2 < 0 || elapsed2 < 0.09 || elapsed2 > 1.0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d %f\n", name.c_str(), fd, peer2, elapsed2 );
+    }
+    close( fd );
+    close( peer2 );
+    for( int i = 0; i < 3; ++i )
+      close( fillers[i] );
+    close( full );
+
+    // -------
+    name = "descriptor above FD_SETSIZE";
+    // select() can not watch such a socket, poll() can
+    struct rlimit rl;
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_max > FD_SETSIZE + 16 )
+    {
+      const rlim_t soft = rl.rlim_cur;
+      rl.rlim_cur = FD_SETSIZE + 16;
+      setrlimit( RLIMIT_NOFILE, &rl );
+      std::vector<int> dummies;
+      int d;
+      while( ( d = dup( 0 ) ) >= 0 && d < FD_SETSIZE )
+        dummies.push_back( d );
+      if( d >= 0 )
+        dummies.push_back( d );
+      targets.clear();
+      targets.push_back( target( "a.example.org", openPort, "127.0.0.1" ) );
+      const int high = DNS::connect( targets, log );
+      const int peer3 = accept( open, 0, 0 );
+      if( high < FD_SETSIZE || peer3 < 0 )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), high );
+      }
+      close( high );
+      close( peer3 );
+      std::vector<int>::const_iterator it = dummies.begin();
+      for( ; it != dummies.end(); ++it )
+        close( (*it) );
+      rl.rlim_cur = soft;
+      setrlimit( RLIMIT_NOFILE, &rl );
+    }
+
+    // -------
+    name = "all targets refuse";
+    targets.clear();
+    targets.push_back( target( "a.example.org", closedPort, "127.0.0.1" ) );
+    targets.push_back( target( "b.example.org", closedPort, "127.0.0.1 invalid" ) );
+    ConnectionTCPClient c3( &h, log, "example.org" );
+    c3.setTargets( targets );
+    if( c3.connect() != ConnConnectionRefused || h.m_disconnects != 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "target without addresses";
+    // looked up once the first target has been tried
+    targets.clear();
+    targets.push_back( target( "a.example.org", closedPort, "127.0.0.1" ) );
+    targets.push_back( target( "localhost", openPort, "" ) );
+    const int fd2 = DNS::connect( targets, log );
+    const int peer4 = fd2 >= 0 ? accept( open, 0, 0 ) : -1;
+    if( fd2 < 0 || peer4 < 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), fd2 );
+    }
+    close( fd2 );
+    close( peer4 );
+
+    // -------
+    name = "connect to host and port";
+    const int fd3 = DNS::connect( "127.0.0.1", openPort, log );
+    const int peer5 = fd3 >= 0 ? accept( open, 0, 0 ) : -1;
+    if( fd3 < 0 || peer5 < 0 || DNS::connect( "127.0.0.1", closedPort, log ) != -ConnConnectionRefused )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), fd3 );
+    }
+    close( fd3 );
+    close( peer5 );
+
+    close( peer );
+    close( open );
+    close( closed );
+  }
+
+  if( fail == 0 )
+  {
+    printf( "ConnectionTCPClient: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "ConnectionTCPClient: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
+#else
+int main( int, char** ) { return 0; }
+#endif
@@ -24,10 +24,11 @@ using namespace gloox;
 #include <locale.h>
 #include <string>
 #include <cstdio> // [s]print[f]
+#include <unistd.h>
 class TestHandler : public gloox::ConnectionHandler, public gloox::LogHandler, public gloox::ConnectionDataHandler
 {
   public:
-    TestHandler() : m_test( 0 ) {}
+    TestHandler() : m_test( 0 ), m_incoming( 0 ) {}
 
     virtual void handleReceivedData( const ConnectionBase* /*connection*/, const std::string& data )
     {
@@ -52,6 +53,10 @@ class TestHandler : public gloox::ConnectionHandler, public gloox::LogHandler, p
 //           printf( "Incoming connection from %s:%d to %s:%d\n", connection->server().c_str(), connection->port(),
 //                                                                server->server().c_str(), server->port() );
           break;
+        case 4:
+          ++m_incoming;
+          delete connection;
+          break;
         default:
           break;
       }
@@ -62,10 +67,12 @@ class TestHandler : public gloox::ConnectionHandler, public gloox::LogHandler, p
 //       printf( "Test %d says: %s\n", m_test, message.c_str() );
     }
 
-    void setTest( int test ) { m_test = test; }
+    void setTest( int test ) { m_test = test; m_incoming = 0; }
+    int incoming() const { return m_incoming; }
 
   private:
     int m_test;
+    int m_incoming;
 
 };
 
@@ -113,6 +120,125 @@ int main( int /*argc*/, char** /*argv*/ )
   }
   // -------
 
+  name = "accept all pending connections at once";
+  h->setTest( 4 );
+  ConnectionTCPClient* clients[8];
+  for( int i = 0; i < 8; ++i )
+  {
+    clients[i] = new ConnectionTCPClient( h, log, "127.0.0.1", 54321 );
+    clients[i]->connect();
+  }
+  ret = server.recv( 1000000 );
+  if( ret != ConnNoError || h->incoming() != 8 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed: %d connections\n", name.c_str(), h->incoming() );
+  }
+  // -------
+
+  name = "recv() with nothing pending";
+  ret = server.recv( 0 );
+  if( ret != ConnNoError || h->incoming() != 8 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  for( int i = 0; i < 8; ++i )
+    delete clients[i];
+  // -------
+
+  name = "accept limit per recv()";
+  h->setTest( 4 );
+  server.setMaxAccepts( 3 );
+  for( int i = 0; i < 8; ++i )
+  {
+    clients[i] = new ConnectionTCPClient( h, log, "127.0.0.1", 54321 );
+    clients[i]->connect();
+  }
+  usleep( 100000 ); // let all handshakes complete
+  int counts[3];
+  for( int i = 0; i < 3; ++i )
+  {
+    const int before = h->incoming();
+    server.recv( 1000000 );
+    counts[i] = h->incoming() - before;
+  }
+  if( counts[0] != 3 || counts[1] != 3 || counts[2] != 2 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed: %d %d %d\n", name.c_str(), counts[0], counts[1], counts[2] );
+  }
+  for( int i = 0; i < 8; ++i )
+    delete clients[i];
+  server.setMaxAccepts( 64 );
+  // -------
+
+  name = "several listening sockets with SO_REUSEPORT";
+  h->setTest( 4 );
+  ConnectionTCPServer shard1( h, log, "127.0.0.1", 54322 );
+  shard1.setReusePort( true );
+  ConnectionTCPServer* shard2 = static_cast<ConnectionTCPServer*>( shard1.newInstance() );
+  if( shard1.connect() != ConnNoError || shard2->connect() != ConnNoError )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  for( int i = 0; i < 8; ++i )
+  {
+    clients[i] = new ConnectionTCPClient( h, log, "127.0.0.1", 54322 );
+    clients[i]->connect();
+  }
+  shard1.recv( 100000 );
+  shard2->recv( 100000 );
+  if( h->incoming() != 8 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed: %d connections\n", name.c_str(), h->incoming() );
+  }
+  for( int i = 0; i < 8; ++i )
+    delete clients[i];
+  delete shard2;
+  // -------
+
+  name = "newInstance() with its own handler";
+  h->setTest( 4 );
+  TestHandler* h2 = new TestHandler();
+  h2->setTest( 4 );
+  ConnectionTCPServer* shard3 = static_cast<ConnectionTCPServer*>( shard1.newInstance() );
+  shard3->setConnectionHandler( h2 );
+  shard1.cleanup(); // only shard3 listens now
+  if( shard3->connect() != ConnNoError )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  for( int i = 0; i < 2; ++i )
+  {
+    clients[i] = new ConnectionTCPClient( h, log, "127.0.0.1", 54322 );
+    clients[i]->connect();
+  }
+  usleep( 100000 );
+  shard3->recv( 1000000 );
+  if( h->incoming() != 0 || h2->incoming() != 2 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed: %d/%d connections\n", name.c_str(), h->incoming(), h2->incoming() );
+  }
+  for( int i = 0; i < 2; ++i )
+    delete clients[i];
+  // -------
+
+  name = "second listening socket without SO_REUSEPORT";
+  ConnectionTCPServer other( h, log, "127.0.0.1", 54322 );
+  if( other.connect() == ConnNoError )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  // -------
+  delete shard3;
+  delete h2;
+
   if( fail == 0 )
   {
     printf( "ConnectionTCPServer: OK\n" );
@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#ifndef _WIN32
+
+#include "../../copyonwrite.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <cstdio> // [s]print[f]
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef std::map<int, int> IntMap;
+typedef util::CopyOnWrite<IntMap> COW;
+
+struct ReaderThread
+{
+  COW* cow;
+  volatile bool reading;
+  volatile bool done;
+  int seen;
+};
+
+// holds a ReadGuard for a while
+static void* readSlowly( void* arg )
+{
+  ReaderThread* t = static_cast<ReaderThread*>( arg );
+  COW::ReadGuard r( *t->cow );
+  t->reading = true;
+  usleep( 100000 );
+  t->seen = static_cast<int>( r->size() );
+  t->done = true;
+  return 0;
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  int fail = 0;
+  std::string name;
+
+  // -------
+  {
+    name = "publish a write";
+    COW cow;
+    {
+      COW::WriteGuard w( cow );
+      (*w)[1] = 1;
+    }
+    COW::ReadGuard r( cow );
+    if( r->size() != 1 || r->find( 1 ) == r->end() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "nested WriteGuards";
+    COW cow;
+    {
+      COW::WriteGuard outer( cow );
+      (*outer)[1] = 1;
+      {
+        COW::WriteGuard inner( cow );
+        (*inner)[2] = 2;
+      }
+      (*outer)[3] = 3;
+    }
+    COW::ReadGuard r( cow );
+    if( r->size() != 3 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), static_cast<int>( r->size() ) );
+    }
+  }
+
+  // -------
+  {
+    name = "write while reading in the same thread";
+    COW cow;
+    COW::ReadGuard r( cow );
+    {
+      COW::WriteGuard w( cow ); // must not wait for r
+      (*w)[1] = 1;
+    }
+    COW::ReadGuard r2( cow );
+    if( !r->empty() || r2->size() != 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "grace period";
+    COW cow;
+    ReaderThread t;
+    t.cow = &cow;
+    t.reading = false;
+    t.done = false;
+    t.seen = -1;
+    pthread_t thread;
+    pthread_create( &thread, 0, readSlowly, &t );
+    while( !t.reading )
+      usleep( 1000 );
+    {
+      COW::WriteGuard w( cow );
+      (*w)[1] = 1;
+    }
+    // the reader must have left the old version before the WriteGuard returned
+    const bool done = t.done;
+    pthread_join( thread, 0 );
+    if( !done || t.seen != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d\n", name.c_str(), done, t.seen );
+    }
+  }
+
+  if( fail == 0 )
+  {
+    printf( "CopyOnWrite: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "CopyOnWrite: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
+#else
+int main( int, char** ) { return 0; }
+#endif
@@ -0,0 +1,557 @@
+/*
+ *  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#ifndef _WIN32
+
+#include "../../dnsresolver.h"
+#include "../../dnshandler.h"
+#include "../../dns.h"
+#include "../../logsink.h"
+#include "../../gloox.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// a nameserver on localhost that answers from a zone file with lines like
+// "name ttl type data", where type is A, AAAA or SRV (data: priority weight port target)
+class StubResolver
+{
+  public:
+    StubResolver( const std::string& zone ) : m_glue( false ), m_wrongType( false ), m_queries( 0 )
+    {
+      FILE* f = fopen( zone.c_str(), "r" );
+      char name[256], type[16], data[256];
+      unsigned long ttl;
+      while( f && fscanf( f, "%255s %lu %15s %255[^\n]", name, &ttl, type, data ) == 4 )
+      {
+        Record r;
+        r.ttl = ttl;
+        r.type = type;
+        r.data = data;
+        m_zone.insert( std::make_pair( std::string( name ), r ) );
+      }
+      if( f )
+        fclose( f );
+
+      m_socket = socket( AF_INET, SOCK_DGRAM, 0 );
+      struct sockaddr_in addr;
+      memset( &addr, 0, sizeof( addr ) );
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+      bind( m_socket, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) );
+      socklen_t len = sizeof( addr );
+      getsockname( m_socket, reinterpret_cast<struct sockaddr*>( &addr ), &len );
+      m_port = ntohs( addr.sin_port );
+    }
+
+    ~StubResolver() { close( m_socket ); }
+
+    int port() const { return m_port; }
+
+    // answers all queries that have arrived
+    void serve()
+    {
+      unsigned char buf[512];
+      struct sockaddr_in from;
+      socklen_t fromlen = sizeof( from );
+      ssize_t size;
+      while( ( size = recvfrom( m_socket, buf, sizeof( buf ), MSG_DONTWAIT,
+                                reinterpret_cast<struct sockaddr*>( &from ), &fromlen ) ) > 12 )
+      {
+        ++m_queries;
+        m_ids.push_back( ( buf[0] << 8 ) | buf[1] );
+        m_ports.push_back( ntohs( from.sin_port ) );
+        std::string qname;
+        size_t pos = 12;
+        while( pos < static_cast<size_t>( size ) && buf[pos] )
+        {
+          if( !qname.empty() )
+            qname += '.';
+          qname.append( reinterpret_cast<char*>( buf + pos + 1 ), buf[pos] );
+          pos += buf[pos] + 1;
+        }
+        const int qtype = ( buf[pos + 1] << 8 ) | buf[pos + 2];
+        std::string question( reinterpret_cast<char*>( buf + 12 ), pos + 5 - 12 );
+        if( m_wrongType )
+          question[pos + 2 - 12] = static_cast<char>( qtype == 1 ? 28 : 1 ); // a forged answer
+        m_log += qname + "/" + typeName( qtype ) + ";";
+
+        if( !m_drop.empty() && qname.find( m_drop ) != std::string::npos )
+          continue;
+
+        std::string answers, additional;
+        int ancount = 0, arcount = 0;
+        bool exists = false;
+        std::multimap<std::string, Record>::const_iterator it = m_zone.begin();
+        for( ; it != m_zone.end(); ++it )
+        {
+          if( (*it).first != qname )
+            continue;
+          exists = true;
+          if( (*it).second.type != typeName( qtype ) )
+            continue;
+          answers += record( qname, (*it).second );
+          ++ancount;
+          if( m_glue && qtype == 33 )
+          {
+            char target[256];
+            sscanf( (*it).second.data.c_str(), "%*d %*d %*d %255s", target );
+            std::multimap<std::string, Record>::const_iterator g = m_zone.begin();
+            for( ; g != m_zone.end(); ++g )
+            {
+              if( (*g).first == target )
+              {
+                additional += record( target, (*g).second );
+                ++arcount;
+              }
+            }
+          }
+        }
+
+        std::string packet( reinterpret_cast<char*>( buf ), 2 );
+        packet += static_cast<char>( 0x81 );
+        packet += static_cast<char>( exists ? 0x80 : 0x83 ); // NXDOMAIN
+        packet += std::string( "\x00\x01", 2 ) + u16( ancount ) + u16( 0 ) + u16( arcount );
+        packet += question + answers + additional;
+        sendto( m_socket, packet.data(), packet.length(), 0,
+                reinterpret_cast<struct sockaddr*>( &from ), fromlen );
+      }
+    }
+
+    bool m_glue;
+    bool m_wrongType;
+    int m_queries;
+    std::vector<int> m_ids;
+    std::vector<int> m_ports;
+    std::string m_log;
+    std::string m_drop;
+
+  private:
+    struct Record
+    {
+      unsigned long ttl;
+      std::string type;
+      std::string data;
+    };
+
+    static std::string typeName( int type )
+    {
+      return type == 1 ? "A" : type == 28 ? "AAAA" : type == 33 ? "SRV" : "?";
+    }
+
+    static std::string u16( int v )
+    {
+      std::string s;
+      s += static_cast<char>( ( v >> 8 ) & 0xff );
+      s += static_cast<char>( v & 0xff );
+      return s;
+    }
+
+    static std::string encodeName( const std::string& name )
+    {
+      std::string s;
+      size_t start = 0;
+      while( start < name.length() )
+      {
+        size_t end = name.find( '.', start );
+        if( end == std::string::npos )
+          end = name.length();
+        s += static_cast<char>( end - start );
+        s += name.substr( start, end - start );
+        start = end + 1;
+      }
+      return s + '\0';
+    }
+
+    static std::string record( const std::string& name, const Record& r )
+    {
+      std::string rdata;
+      int type = 0;
+      if( r.type == "A" )
+      {
+        type = 1;
+        unsigned char a[4];
+        inet_pton( AF_INET, r.data.c_str(), a );
+        rdata.assign( reinterpret_cast<char*>( a ), 4 );
+      }
+      else if( r.type == "AAAA" )
+      {
+        type = 28;
+        unsigned char a[16];
+        inet_pton( AF_INET6, r.data.c_str(), a );
+        rdata.assign( reinterpret_cast<char*>( a ), 16 );
+      }
+      else if( r.type == "SRV" )
+      {
+        type = 33;
+        int prio, weight, port;
+        char target[256];
+        sscanf( r.data.c_str(), "%d %d %d %255s", &prio, &weight, &port, target );
+        rdata = u16( prio ) + u16( weight ) + u16( port )
+                + ( std::string( target ) == "." ? std::string( 1, '\0' ) : encodeName( target ) );
+      }
+      std::string s = encodeName( name ) + u16( type ) + u16( 1 );
+      s += u16( static_cast<int>( r.ttl >> 16 ) ) + u16( static_cast<int>( r.ttl & 0xffff ) );
+      return s + u16( static_cast<int>( rdata.length() ) ) + rdata;
+    }
+
+    std::multimap<std::string, Record> m_zone;
+    int m_socket;
+    int m_port;
+};
+
+class TestHandler : public DNSHandler
+{
+  public:
+    TestHandler() : m_calls( 0 ), m_id( -1 ) {}
+
+    virtual void handleResolved( int id, const DNSResolver::TargetList& targets )
+    {
+      ++m_calls;
+      m_id = id;
+      m_result.clear();
+      DNSResolver::TargetList::const_iterator it = targets.begin();
+      for( ; it != targets.end(); ++it )
+      {
+        char buf[64];
+        sprintf( buf, ":%d/%d/%d", (*it).port, (*it).priority, (*it).weight );
+        m_result += (*it).host + buf;
+        StringList::const_iterator a = (*it).addresses.begin();
+        for( ; a != (*it).addresses.end(); ++a )
+          m_result += "," + (*a);
+        m_result += ";";
+      }
+    }
+
+    int m_calls;
+    int m_id;
+    std::string m_result;
+};
+
+// runs resolver and stub until the handler has been called or nothing is pending anymore
+static void run( DNSResolver& resolver, StubResolver& stub )
+{
+  for( int i = 0; i < 2000 && resolver.pending(); ++i )
+  {
+    stub.serve();
+    resolver.recv( 1000 );
+  }
+  stub.serve();
+}
+
+static DNSResolver::Target target( const std::string& host, int priority, int weight )
+{
+  DNSResolver::Target t;
+  t.host = host;
+  t.port = 5222;
+  t.priority = priority;
+  t.weight = weight;
+  return t;
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  int fail = 0;
+  std::string name;
+  LogSink log;
+
+  char zone[] = "/tmp/gloox-zone-XXXXXX";
+  const int fd = mkstemp( zone );
+  const std::string records =
+      "_xmpp-client._tcp.example.org 300 SRV 10 5 5222 xmpp1.example.org\n"
+      "_xmpp-client._tcp.example.org 600 SRV 20 1 5223 xmpp2.example.org\n"
+      "xmpp1.example.org 300 AAAA 2001:db8::1\n"
+      "xmpp1.example.org 300 A 192.0.2.1\n"
+      "xmpp2.example.org 60 A 192.0.2.2\n"
+      "plain.example.org 300 A 192.0.2.3\n"
+      "_xmpp-client._tcp.short.example.org 0 SRV 0 0 5222 plain.example.org\n"
+      "_xmpp-client._tcp.none.example.org 300 SRV 0 0 0 .\n";
+  write( fd, records.data(), records.length() );
+  close( fd );
+  StubResolver stub( zone );
+  unlink( zone );
+
+  // -------
+  {
+    name = "SRV and address lookup";
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h;
+    const int id = resolver.resolve( "example.org", &h );
+    run( resolver, stub );
+    if( h.m_calls != 1 || h.m_id != id
+        || h.m_result != "xmpp1.example.org:5222/10/5,2001:db8::1,192.0.2.1;"
+                         "xmpp2.example.org:5223/20/1,192.0.2.2;"
+        || stub.m_queries != 5 || resolver.pending() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s %d\n", name.c_str(), h.m_result.c_str(), stub.m_queries );
+    }
+  }
+
+  // -------
+  {
+    name = "cached result";
+    stub.m_queries = 0;
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h;
+    resolver.resolve( "EXAMPLE.org", &h );
+    const int calls = h.m_calls;
+    run( resolver, stub );
+    const DNSResolver::CacheStatistics stats = DNSResolver::cacheStatistics();
+    if( calls != 0 || h.m_calls != 1 || stub.m_queries != 0 || stats.hits != 1 || stats.entries != 1
+        || h.m_result != "xmpp1.example.org:5222/10/5,2001:db8::1,192.0.2.1;"
+                         "xmpp2.example.org:5223/20/1,192.0.2.2;" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s %d %d\n", name.c_str(), h.m_result.c_str(),
+               stub.m_queries, stats.hits );
+    }
+  }
+
+  // -------
+  {
+    name = "concurrent lookups share queries";
+    DNSResolver::clearCache();
+    stub.m_queries = 0;
+    stub.m_glue = true;
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h1, h2, h3;
+    resolver.resolve( "example.org", &h1 );
+    resolver.resolve( "example.org", &h2 );
+    resolver.resolve( "example.org", &h3 );
+    resolver.cancel( &h3 );
+    run( resolver, stub );
+    // the addresses come with the SRV answer
+    if( h1.m_calls != 1 || h2.m_calls != 1 || h3.m_calls != 0 || stub.m_queries != 1
+        || h1.m_result != h2.m_result
+        || h1.m_result != "xmpp1.example.org:5222/10/5,2001:db8::1,192.0.2.1;"
+                          "xmpp2.example.org:5223/20/1,192.0.2.2;" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s %d\n", name.c_str(), h1.m_result.c_str(), stub.m_queries );
+    }
+    stub.m_glue = false;
+  }
+
+  // -------
+  {
+    name = "no SRV records";
+    stub.m_log = std::string();
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h;
+    resolver.resolve( "xmpp-server", "tcp", "plain.example.org", 5269, &h );
+    run( resolver, stub );
+    if( h.m_result != "plain.example.org:5269/0/0,192.0.2.3;"
+        || stub.m_log != "_xmpp-server._tcp.plain.example.org/SRV;plain.example.org/AAAA;"
+                         "plain.example.org/A;" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s %s\n", name.c_str(), h.m_result.c_str(), stub.m_log.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "zero TTL is not cached";
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h;
+    resolver.resolve( "short.example.org", &h );
+    run( resolver, stub );
+    stub.m_queries = 0;
+    resolver.resolve( "short.example.org", &h );
+    run( resolver, stub );
+    if( h.m_calls != 2 || h.m_result != "plain.example.org:5222/0/0,192.0.2.3;" || stub.m_queries != 3 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s %d\n", name.c_str(), h.m_result.c_str(), stub.m_queries );
+    }
+  }
+
+  // -------
+  {
+    name = "service not available";
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h;
+    stub.m_queries = 0;
+    resolver.resolve( "none.example.org", &h );
+    run( resolver, stub );
+    if( h.m_calls != 1 || !h.m_result.empty() || stub.m_queries != 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s %d\n", name.c_str(), h.m_result.c_str(), stub.m_queries );
+    }
+  }
+
+  // -------
+  {
+    name = "random query IDs and source ports";
+    DNSResolver::clearCache();
+    stub.m_ids.clear();
+    stub.m_ports.clear();
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h;
+    resolver.resolve( "example.org", &h );
+    resolver.resolve( "short.example.org", &h );
+    resolver.resolve( "xmpp-server", "tcp", "plain.example.org", 5269, &h );
+    const std::list<int> sockets = resolver.sockets();
+    run( resolver, stub );
+    // the SRV queries come first, one per lookup
+    int sequential = 0;
+    for( size_t i = 1; i < stub.m_ids.size(); ++i )
+    {
+      if( stub.m_ids[i] == ( ( stub.m_ids[i - 1] + 1 ) & 0xffff ) )
+        ++sequential;
+    }
+    if( h.m_calls != 3 || sockets.size() != 3 || !resolver.sockets().empty() || stub.m_ids.size() < 6
+        || stub.m_ports[0] == stub.m_ports[1] || stub.m_ports[1] == stub.m_ports[2]
+        || stub.m_ports[0] == stub.m_ports[2] || sequential > 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d queries, %d sequential IDs\n", name.c_str(),
+               static_cast<int>( stub.m_ids.size() ), sequential );
+    }
+  }
+
+  // -------
+  {
+    name = "answer to a different question type";
+    DNSResolver::clearCache();
+    stub.m_wrongType = true;
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    resolver.setTimeout( 5, 0 );
+    TestHandler h;
+    resolver.resolve( "example.org", &h );
+    run( resolver, stub );
+    if( h.m_calls != 1 || !h.m_result.empty() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), h.m_result.c_str() );
+    }
+    stub.m_wrongType = false;
+    DNSResolver::clearCache();
+  }
+
+  // -------
+  {
+    name = "timeout";
+    stub.m_drop = "dead.example.org";
+    stub.m_queries = 0;
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    resolver.setTimeout( 5, 1 );
+    TestHandler h;
+    resolver.resolve( "dead.example.org", &h );
+    run( resolver, stub );
+    // SRV twice, then A and AAAA of the domain twice each
+    if( h.m_calls != 1 || !h.m_result.empty() || stub.m_queries != 6 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s %d\n", name.c_str(), h.m_result.c_str(), stub.m_queries );
+    }
+    stub.m_drop = std::string();
+  }
+
+  // -------
+  {
+    name = "resolve from handler";
+    class ChainHandler : public DNSHandler
+    {
+      public:
+        ChainHandler( DNSResolver& r, TestHandler& h ) : m_resolver( r ), m_handler( h ) {}
+        virtual void handleResolved( int /*id*/, const DNSResolver::TargetList& /*targets*/ )
+        {
+          m_resolver.resolve( "example.org", &m_handler );
+        }
+      private:
+        ChainHandler& operator=( const ChainHandler& );
+        DNSResolver& m_resolver;
+        TestHandler& m_handler;
+    };
+
+    DNSResolver resolver( log );
+    resolver.setNameserver( "127.0.0.1", stub.port() );
+    TestHandler h;
+    ChainHandler c( resolver, h );
+    resolver.resolve( "plain.example.org", &c );
+    run( resolver, stub );
+    if( h.m_calls != 1 || h.m_result.empty() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "RFC 2782 ordering";
+    std::map<std::string, int> first;
+    bool ordered = true;
+    for( int i = 0; i < 1000; ++i )
+    {
+      DNSResolver::TargetList targets;
+      targets.push_back( target( "backup1", 20, 0 ) );
+      targets.push_back( target( "heavy", 10, 90 ) );
+      targets.push_back( target( "backup2", 20, 0 ) );
+      targets.push_back( target( "light", 10, 10 ) );
+      targets.push_back( target( "none", 10, 0 ) );
+      DNS::sortTargets( targets );
+      ++first[targets.front().host];
+      DNSResolver::TargetList::const_iterator it = targets.begin();
+      for( int p = 0; it != targets.end(); p = (*it).priority, ++it )
+        ordered = ordered && (*it).priority >= p;
+      ordered = ordered && targets.size() == 5 && targets.back().host.substr( 0, 6 ) == "backup";
+    }
+    // heavy is picked first with a probability of 90/101, light 10/101 and none 1/101
+    if( !ordered || first["heavy"] < 830 || first["heavy"] > 950 || first["light"] < 50
+        || first["light"] > 150 || first["none"] > 40 || first["backup1"] || first["backup2"] )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d %d\n", name.c_str(), first["heavy"], first["light"],
+               first["none"] );
+    }
+  }
+
+  if( fail == 0 )
+  {
+    printf( "DNSResolver: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "DNSResolver: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
+#else
+int main( int, char** ) { return 0; }
+#endif
@@ -0,0 +1,326 @@
+/*
+ *  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#ifndef _WIN32
+
+#include "../../eventloop.h"
+#include "../../timerhandler.h"
+#include "../../connectiontcpclient.h"
+#include "../../connectiondatahandler.h"
+#include "../../logsink.h"
+#include "../../gloox.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// reads whatever is available without blocking
+static std::string readAll( int fd )
+{
+  std::string data;
+  char buf[4096];
+  ssize_t size;
+  while( ( size = recv( fd, buf, sizeof( buf ), MSG_DONTWAIT ) ) > 0 )
+    data.append( buf, static_cast<size_t>( size ) );
+  return data;
+}
+
+class TestHandler : public ConnectionDataHandler, public TimerHandler
+{
+  public:
+    TestHandler( EventLoop& loop ) : m_loop( loop ), m_timers( 0 ), m_lastContext( -1 ), m_removed( 0 ),
+                                     m_disconnects( 0 ), m_removeTimer( -1 ), m_stopAt( -1 ) {}
+
+    virtual void handleReceivedData( const ConnectionBase* connection, const std::string& data )
+    {
+      m_data += connection->server() + ":" + data + ";";
+    }
+
+    virtual void handleConnect( const ConnectionBase* /*connection*/ ) {}
+
+    virtual void handleDisconnect( const ConnectionBase* /*connection*/, ConnectionError /*reason*/ )
+    {
+      ++m_disconnects;
+    }
+
+    virtual void handleTimer( int id, int context )
+    {
+      ++m_timers;
+      m_lastContext = context;
+      if( id == m_removeTimer )
+      {
+        m_loop.removeTimer( id );
+        ++m_removed;
+      }
+      if( m_timers == m_stopAt )
+        m_loop.stop();
+    }
+
+    EventLoop& m_loop;
+    std::string m_data;
+    int m_timers;
+    int m_lastContext;
+    int m_removed;
+    int m_disconnects;
+    int m_removeTimer;
+    int m_stopAt;
+};
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  int fail = 0;
+  std::string name;
+  LogSink log;
+
+  // -------
+  {
+    name = "one-shot timer";
+    EventLoop loop;
+    TestHandler h( loop );
+    loop.addTimer( &h, 10, 42, false );
+    loop.run(); // returns when the timer is gone
+    if( h.m_timers != 1 || h.m_lastContext != 42 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), h.m_timers );
+    }
+  }
+
+  // -------
+  {
+    name = "repeating timer, removed from handler";
+    EventLoop loop;
+    TestHandler h( loop );
+    loop.addTimer( &h, 1, 1 );
+    h.m_removeTimer = loop.addTimer( &h, 5, 2 );
+    for( int i = 0; i < 20; ++i )
+      loop.poll( 100 );
+    const int timers = h.m_timers;
+    loop.removeTimers( &h );
+    loop.run(); // no timers left, returns immediately
+    if( timers < 3 || h.m_removed != 1 || h.m_timers != timers )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), h.m_timers );
+    }
+  }
+
+  // -------
+  {
+    name = "stop()";
+    EventLoop loop;
+    TestHandler h( loop );
+    loop.addTimer( &h, 1 );
+    h.m_stopAt = 3;
+    loop.run();
+    if( h.m_timers != 3 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), h.m_timers );
+    }
+  }
+
+  // -------
+  {
+    name = "dispatch to connections";
+    EventLoop loop;
+    TestHandler h( loop );
+    const int num = 3;
+    int fds[num][2];
+    ConnectionTCPClient* conns[num];
+    for( int i = 0; i < num; ++i )
+    {
+      socketpair( AF_UNIX, SOCK_STREAM, 0, fds[i] );
+      conns[i] = new ConnectionTCPClient( &h, log, std::string( 1, char( 'a' + i ) ) );
+      conns[i]->setSocket( fds[i][0] );
+      if( !loop.add( conns[i] ) )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed: could not add connection\n", name.c_str() );
+      }
+    }
+    if( loop.add( conns[0] ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: connection added twice\n", name.c_str() );
+    }
+
+    if( write( fds[2][1], "foo", 3 ) != 3 || write( fds[0][1], "bar", 3 ) != 3 )
+      ++fail;
+
+    int events = 0;
+    for( int i = 0; i < 10 && events < 2; ++i )
+      events += loop.poll( 100 );
+
+    if( events != 2 || ( h.m_data != "a:bar;c:foo;" && h.m_data != "c:foo;a:bar;" ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), h.m_data.c_str() );
+    }
+
+    // -------
+    name = "disconnect removes connection";
+    close( fds[1][1] );
+    for( int i = 0; i < 10 && loop.connections() == num; ++i )
+      loop.poll( 100 );
+    if( loop.connections() != num - 1 || h.m_disconnects != 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d, %d\n", name.c_str(), loop.connections(), h.m_disconnects );
+    }
+
+    // -------
+    name = "remove connection";
+    loop.remove( conns[0] );
+    h.m_data = "";
+    if( write( fds[0][1], "bar", 3 ) != 3 || loop.poll( 10 ) != 0 || !h.m_data.empty()
+        || loop.connections() != num - 2 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), h.m_data.c_str() );
+    }
+
+    for( int i = 0; i < num; ++i )
+    {
+      loop.remove( conns[i] );
+      delete conns[i];
+      close( fds[i][1] );
+    }
+  }
+
+  // -------
+  {
+    name = "flush send queue when writable";
+    EventLoop loop;
+    TestHandler h( loop );
+    int fds[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    ConnectionTCPClient* c = new ConnectionTCPClient( &h, log, "a" );
+    c->setSocket( fds[0] );
+    c->setNonBlockingSend( true );
+    loop.add( c );
+
+    // the peer does not read yet, so most of this gets queued
+    const std::string expected( 1024 * 1024, 'x' );
+    c->send( expected );
+    const size_t queued = c->sendQueueSize();
+
+    // nothing to read on the connection: only write readiness drives the queue
+    std::string data;
+    for( int i = 0; i < 1000 && data.length() < expected.length(); ++i )
+    {
+      data += readAll( fds[1] );
+      loop.poll( 100 );
+    }
+    data += readAll( fds[1] );
+    if( !queued || data != expected || c->sendQueueSize() != 0 || h.m_disconnects )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d\n", name.c_str(), static_cast<int>( queued ),
+               static_cast<int>( data.length() ) );
+    }
+
+    // -------
+    name = "write interest removed when drained";
+    if( loop.poll( 10 ) != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "deleted connection removes itself";
+    delete c;
+    if( loop.connections() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), loop.connections() );
+    }
+    close( fds[1] );
+  }
+
+  // -------
+  {
+    name = "cleanup() removes connection";
+    EventLoop loop;
+    TestHandler h( loop );
+    int fds[2];
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    ConnectionTCPClient c( &h, log, "a" );
+    c.setSocket( fds[0] );
+    loop.add( &c );
+    c.disconnect();
+    c.cleanup();
+    close( fds[1] );
+    if( loop.connections() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), loop.connections() );
+    }
+
+    // -------
+    name = "reconnect and add again";
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds ); // usually gets the old fd back
+    c.setSocket( fds[0] );
+    if( !loop.add( &c ) || loop.connections() != 1 || write( fds[1], "foo", 3 ) != 3
+        || loop.poll( 100 ) != 1 || h.m_data != "a:foo;" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %s\n", name.c_str(), loop.connections(), h.m_data.c_str() );
+    }
+    loop.remove( &c );
+    c.cleanup();
+    close( fds[1] );
+
+    // -------
+    name = "stale registration replaced";
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    ConnectionTCPClient old( &h, log, "b" );
+    old.setSocket( fds[0] );
+    loop.add( &old, fds[0] ); // not a ConnectionTCPBase registration, cleanup() can't remove it
+    old.cleanup();
+    close( fds[1] );
+
+    socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    ConnectionTCPClient fresh( &h, log, "c" );
+    fresh.setSocket( fds[0] );
+    h.m_data = "";
+    if( !loop.add( &fresh, fds[0] ) || write( fds[1], "bar", 3 ) != 3 || loop.poll( 100 ) != 1
+        || h.m_data != "c:bar;" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), h.m_data.c_str() );
+    }
+    loop.remove( &fresh );
+    close( fds[1] );
+  }
+
+  if( fail == 0 )
+  {
+    printf( "EventLoop: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "EventLoop: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
+#else
+int main( int, char** ) { return 0; }
+#endif
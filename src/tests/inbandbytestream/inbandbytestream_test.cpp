@@ -12,6 +12,7 @@
 
 #include "../../tag.h"
 #include "../../iq.h"
+#include "../../message.h"
 #include "../../iqhandler.h"
 #include "../../messagehandler.h"
 #include "../../bytestreamdatahandler.h"
@@ -22,6 +23,7 @@ using namespace gloox;
 #include <locale.h>
 #include <string>
 #include <cstdio> // [s]print[f]
+#include <list>
 
 gloox::JID g_jid( "foof" );
 
@@ -38,6 +40,7 @@ namespace gloox
       const std::string getID();
       virtual void send( IQ& ) = 0;
       virtual void send( const IQ&, IqHandler*, int ) = 0;
+      virtual void send( const Message& ) {}
       virtual void trackID( IqHandler *ih, const std::string& id, int context ) = 0;
       void removeIqHandler( IqHandler* ih, int exttype );
       void registerIqHandler( IqHandler* ih, int exttype );
@@ -124,6 +127,93 @@ void IBBTest::send( const IQ& iq, IqHandler* ih, int ctx )
   ih->handleIqID( re, ctx );
 }
 
+// Connects two InBandBytestreams. Data blocks are held back until pump() is called, which
+// delivers them to the receiver and acknowledges them to the sender.
+class IBBLoopback : public ClientBase, public BytestreamDataHandler
+{
+  public:
+    IBBLoopback() : m_receiver( 0 ), m_messages( 0 ), m_closes( 0 ), m_forwardClose( false ) {}
+    virtual ~IBBLoopback() {}
+    void setReceiver( InBandBytestream* receiver ) { m_receiver = receiver; }
+    // the receiver must outlive the sender then, as the sender closes in its dtor
+    void setForwardClose( bool forward ) { m_forwardClose = forward; }
+    virtual void send( IQ& ) {}
+    virtual void send( const IQ& iq, IqHandler* ih, int ctx )
+    {
+      const InBandBytestream::IBB* i = iq.findExtension<InBandBytestream::IBB>( ExtIBB );
+      if( i && i->type() == InBandBytestream::IBBData )
+      {
+        Pending p = { i->seq(), i->data(), ih, ctx };
+        m_pending.push_back( p );
+        return;
+      }
+
+      if( i && ( i->type() == InBandBytestream::IBBOpen
+                 || ( i->type() == InBandBytestream::IBBClose && m_forwardClose ) ) && m_receiver )
+        m_receiver->handleIq( iq );
+
+      IQ re( IQ::Result, iq.from(), iq.id() );
+      ih->handleIqID( re, ctx );
+    }
+    virtual void send( const Message& msg )
+    {
+      const InBandBytestream::IBB* i = msg.findExtension<InBandBytestream::IBB>( ExtIBB );
+      if( !i || !m_receiver )
+        return;
+
+      Message m( Message::Normal, JID( "foof" ) );
+      m.setFrom( JID( "toof" ) );
+      m.addExtension( new InBandBytestream::IBB( "sid", i->seq(), i->data() ) );
+      m_receiver->handleMessage( m );
+      ++m_messages;
+    }
+    virtual void trackID( IqHandler*, const std::string&, int ) {}
+    virtual void handleBytestreamData( Bytestream*, const std::string& data ) { m_received += data; }
+    virtual void handleBytestreamError( Bytestream*, const IQ& ) {}
+    virtual void handleBytestreamOpen( Bytestream* ) {}
+    virtual void handleBytestreamClose( Bytestream* bs )
+    {
+      ++m_closes;
+      if( bs == m_receiver )
+        m_receivedAtClose = m_received;
+    }
+    // delivers and acknowledges all blocks sent so far, returns their number
+    int pump()
+    {
+      std::list<Pending> pending;
+      pending.swap( m_pending );
+      std::list<Pending>::const_iterator it = pending.begin();
+      for( ; it != pending.end(); ++it )
+      {
+        IQ iq( IQ::Set, JID( "toof" ), getID() );
+        iq.addExtension( new InBandBytestream::IBB( "sid", (*it).seq, (*it).data ) );
+        m_receiver->handleIq( iq );
+        IQ re( IQ::Result, JID( "toof" ), getID() );
+        (*it).ih->handleIqID( re, (*it).ctx );
+      }
+      return static_cast<int>( pending.size() );
+    }
+    const std::string& received() const { return m_received; }
+    int messages() const { return m_messages; }
+    int closes() const { return m_closes; }
+    const std::string& receivedAtClose() const { return m_receivedAtClose; }
+  private:
+    struct Pending
+    {
+      int seq;
+      std::string data;
+      IqHandler* ih;
+      int ctx;
+    };
+    std::list<Pending> m_pending;
+    InBandBytestream* m_receiver;
+    std::string m_received;
+    std::string m_receivedAtClose;
+    int m_messages;
+    int m_closes;
+    bool m_forwardClose;
+};
+
 int main( int /*argc*/, char** /*argv*/ )
 {
   int fail = 0;
@@ -213,6 +303,167 @@ int main( int /*argc*/, char** /*argv*/ )
 
   delete it;
 
+  // -------
+  {
+    name = "windowed throughput";
+    IBBLoopback lb;
+    InBandBytestream sender( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    InBandBytestream receiver( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    sender.registerBytestreamDataHandler( &lb );
+    receiver.registerBytestreamDataHandler( &lb );
+    lb.setReceiver( &receiver );
+    sender.connect();
+
+    std::string data;
+    for( int i = 0; data.length() < 1024 * 1024; ++i )
+      data += static_cast<char>( 'a' + i % 26 );
+
+    sender.send( data );
+    int rounds = 0;
+    int maxInFlight = 0;
+    while( int n = lb.pump() )
+    {
+      ++rounds;
+      if( n > maxInFlight )
+        maxInFlight = n;
+    }
+
+    const InBandBytestream::Statistics& st = sender.statistics();
+    if( rounds != 32 || maxInFlight != 8 || st.maxPendingBlocks != 8 || st.blocksSent != 256
+        || st.blocksAcked != 256 || st.bytesAcked != 1024 * 1024 || sender.pendingBlocks() != 0
+        || sender.queuedBytes() != 0 || lb.received() != data )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d rounds, %d in flight, %ld bytes acked\n",
+               name.c_str(), rounds, maxInFlight, st.bytesAcked );
+    }
+  }
+
+  // -------
+  {
+    name = "windowed send queues excess data";
+    IBBLoopback lb;
+    InBandBytestream sender( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    InBandBytestream receiver( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    sender.registerBytestreamDataHandler( &lb );
+    receiver.registerBytestreamDataHandler( &lb );
+    lb.setReceiver( &receiver );
+    sender.setBlockSize( 10 );
+    sender.setWindowSize( 2 );
+    sender.connect();
+    sender.send( "0123456789abcdefghijABCDEFGHIJ!" );
+    if( sender.pendingBlocks() != 2 || sender.queuedBytes() != 11 || lb.pump() != 2
+        || lb.pump() != 2 || lb.pump() != 0 || lb.received() != "0123456789abcdefghijABCDEFGHIJ!" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "send data using messages";
+    IBBLoopback lb;
+    InBandBytestream sender( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    InBandBytestream receiver( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    sender.registerBytestreamDataHandler( &lb );
+    receiver.registerBytestreamDataHandler( &lb );
+    lb.setReceiver( &receiver );
+    sender.setBlockSize( 4 );
+    sender.setUseMessages( true );
+    sender.connect();
+    sender.send( "messagedata" );
+    if( lb.messages() != 3 || sender.pendingBlocks() != 0 || lb.received() != "messagedata" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "close waits for queued data";
+    IBBLoopback lb;
+    InBandBytestream receiver( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    InBandBytestream sender( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    sender.registerBytestreamDataHandler( &lb );
+    receiver.registerBytestreamDataHandler( &lb );
+    lb.setReceiver( &receiver );
+    lb.setForwardClose( true );
+    sender.setBlockSize( 10 );
+    sender.setWindowSize( 2 );
+    sender.connect();
+
+    // like ft_send: send() chunk by chunk, then close() right away
+    std::string data;
+    for( int i = 0; i < 10; ++i )
+    {
+      const std::string chunk( 17, static_cast<char>( 'a' + i ) );
+      data += chunk;
+      sender.send( chunk );
+    }
+    sender.close();
+    const bool refused = !sender.send( "late" );
+    const int closesBefore = lb.closes();
+    while( lb.pump() )
+      ;
+    if( !refused || closesBefore != 0 || lb.closes() != 2 || sender.isOpen() || receiver.isOpen()
+        || lb.received() != data || lb.receivedAtClose() != data )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d closes, %d of %d bytes\n", name.c_str(), lb.closes(),
+               static_cast<int>( lb.received().length() ), static_cast<int>( data.length() ) );
+    }
+  }
+
+  // -------
+  {
+    name = "close without queued data";
+    IBBLoopback lb;
+    InBandBytestream receiver( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    InBandBytestream sender( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    sender.registerBytestreamDataHandler( &lb );
+    receiver.registerBytestreamDataHandler( &lb );
+    lb.setReceiver( &receiver );
+    lb.setForwardClose( true );
+    sender.connect();
+    sender.close();
+    if( lb.closes() != 2 || sender.isOpen() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "queue limit";
+    IBBLoopback lb;
+    InBandBytestream sender( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    InBandBytestream receiver( &lb, li, JID( "foof" ), JID( "toof" ), "sid" );
+    sender.registerBytestreamDataHandler( &lb );
+    receiver.registerBytestreamDataHandler( &lb );
+    lb.setReceiver( &receiver );
+    sender.setBlockSize( 10 );
+    sender.setWindowSize( 2 );
+    sender.setMaxQueuedBytes( 20 );
+    sender.connect();
+    const std::string first( 35, 'x' );   // 20 bytes sent, 15 queued
+    const std::string second( 10, 'y' );
+    const bool ok = sender.send( first );
+    const bool full = !sender.send( second );
+    const std::string::size_type queued = sender.queuedBytes();
+    lb.pump();                            // 15 bytes sent, queue empty
+    const bool room = sender.send( second );
+    while( lb.pump() )
+      ;
+    if( !ok || !full || queued != 15 || !sender.isOpen() || !room || lb.received() != first + second )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
 
   if( fail == 0 )
   {
@@ -12,6 +12,7 @@
 
 #include "../../tag.h"
 #include "../../iq.h"
+#include "../../message.h"
 #include "../../iqhandler.h"
 #include "../../messagehandler.h"
 #include "../../base64.h"
@@ -38,6 +39,7 @@ namespace gloox
       const std::string getID();
       virtual void send( IQ& ) = 0;
       virtual void send( const IQ&, IqHandler*, int ) = 0;
+      void send( const Message& ) {}
       virtual void trackID( IqHandler *ih, const std::string& id, int context ) = 0;
       void removeIqHandler( IqHandler* ih, int exttype );
       void registerIqHandler( IqHandler* ih, int exttype );
@@ -98,6 +100,22 @@ int main( int /*argc*/, char** /*argv*/ )
     t = 0;
   }
 
+  // -------
+  {
+    name = "open ibb using messages";
+    InBandBytestream::IBB ibb( "sid", 4096 );
+    ibb.setUseMessages( true );
+    t = ibb.tag();
+    if( !t || t->xml() != "<open xmlns='" + XMLNS_IBB + "' sid='sid' block-size='4096' stanza='message'/>"
+        || !ibb.useMessages() || ibb.type() != InBandBytestream::IBBOpen )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    delete t;
+    t = 0;
+  }
+
   // -------
   {
     name = "data ibb";
@@ -152,6 +170,26 @@ int main( int /*argc*/, char** /*argv*/ )
     delete d;
   }
 
+  // -------
+  {
+    name = "open ibb using messages from tag";
+    Tag* d = new Tag( "open" );
+    d->setXmlns( XMLNS_IBB );
+    d->addAttribute( "sid", "sid" );
+    d->addAttribute( "block-size", 4096 );
+    d->addAttribute( "stanza", "message" );
+    InBandBytestream::IBB ibb( d );
+    t = ibb.tag();
+    if( !t || *t != *d || !ibb.useMessages() || ibb.blocksize() != 4096 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    delete t;
+    t = 0;
+    delete d;
+  }
+
   // -------
   {
     name = "data ibb from tag";
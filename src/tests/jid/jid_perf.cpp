@@ -13,15 +13,50 @@
 #ifndef _WIN32
 
 #include "../../jid.h"
+#include "../../prep.h"
 using namespace gloox;
 
 #include <stdio.h>
 #include <locale.h>
+#include <cstdlib>
+#include <new>
 #include <string>
+#include <vector>
 #include <cstdio> // [s]print[f]
 
 #include <sys/time.h>
 
+// live heap bytes, tracked in a header in front of each block
+static long liveBytes = 0;
+
+// called through a pointer, so the compiler does not pair it with operator new
+static void (* volatile releaseBlock)( void* ) = free;
+
+void* operator new( size_t size )
+#if __cplusplus < 201103L
+  throw( std::bad_alloc )
+#endif
+{
+  size_t* p = static_cast<size_t*>( malloc( size + 2 * sizeof( size_t ) ) );
+  if( !p )
+    throw std::bad_alloc();
+  p[0] = size;
+  liveBytes += static_cast<long>( size );
+  return p + 2;
+}
+
+void operator delete( void* p )
+#if __cplusplus < 201103L
+  throw()
+#endif
+{
+  if( !p )
+    return;
+  size_t* h = static_cast<size_t*>( p ) - 2;
+  liveBytes -= static_cast<long>( h[0] );
+  releaseBlock( h );
+}
+
 static double divider = 1000000;
 static int num = 10000;
 static double t;
@@ -34,6 +69,8 @@ static void printTime ( const char * testName, struct timeval tv1, struct timeva
 }
 
 static const std::string addr = "username@server.org/resource";
+static const std::string addrUpper = "UserName@Server.org/Resource";
+static const std::string addrIntl = "jürgen@müller.example/büro";
 
 static const int sz_s = 100;
 static const int sz_b = 1000;
@@ -120,6 +157,85 @@ int main( int /*argc*/, char** /*argv*/ )
   delete jid;
   printTime ("full", tv1, tv2);
 
+  // -----------------------------------------------------------------------
+
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    JID j( addrUpper );
+  }
+  gettimeofday( &tv2, 0 );
+  printTime ("create mixed-case ASCII", tv1, tv2);
+
+  // -----------------------------------------------------------------------
+
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    JID j( addrIntl );
+  }
+  gettimeofday( &tv2, 0 );
+  printTime ("create non-ASCII (cached)", tv1, tv2);
+
+  // -----------------------------------------------------------------------
+
+  prep::setCacheSize( 0 );
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    JID j( addrIntl );
+  }
+  gettimeofday( &tv2, 0 );
+  prep::setCacheSize( 4096 );
+  printTime ("create non-ASCII (uncached)", tv1, tv2);
+
+  // -----------------------------------------------------------------------
+
+  jid = new JID( addr );
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    JID j( *jid );
+    if( !( j == *jid ) )
+      break;
+  }
+  gettimeofday( &tv2, 0 );
+  delete jid;
+  printTime ("copy/compare", tv1, tv2);
+
+  // -----------------------------------------------------------------------
+
+  // a 10k contact roster: each contact's JID is parsed three times (roster push,
+  // presence, message) and kept in three places
+  for( int interning = 0; interning < 2; ++interning )
+  {
+    JID::setInterning( interning == 1 );
+    const int contacts = 10000;
+    const long before = liveBytes;
+    std::vector<JID>* items = new std::vector<JID>[3];
+    for( int k = 0; k < 3; ++k )
+      items[k].reserve( contacts );
+    gettimeofday( &tv1, 0 );
+    for( int k = 0; k < 3; ++k )
+    {
+      for( int i = 0; i < contacts; ++i )
+      {
+        char buf[64];
+        sprintf( buf, "contact%05d@example.org/resource", i );
+        items[k].push_back( JID( buf ) );
+      }
+    }
+    gettimeofday( &tv2, 0 );
+    printf( "10k contacts, interning %s: %.03f seconds, %ld bytes per contact\n", interning ? "on" : "off",
+            static_cast<double>( tv2.tv_sec - tv1.tv_sec )
+              + static_cast<double>( tv2.tv_usec - tv1.tv_usec ) / divider,
+            ( liveBytes - before ) / contacts );
+    delete[] items;
+    if( liveBytes != before )
+      printf( "leaked %ld bytes\n", liveBytes - before );
+  }
+  JID::setInterning( false );
+
 
 
   return 0;
@@ -18,6 +18,22 @@ using namespace gloox;
 #include <string>
 #include <cstdio> // [s]print[f]
 
+#ifndef _WIN32
+# include <pthread.h>
+
+// creates and drops copies of the same interned JID, so that the last copy is
+// released while other threads look it up again
+static void* internLoop( void* )
+{
+  for( int i = 0; i < 20000; ++i )
+  {
+    JID j( "abc@def/ghi" );
+    JID k( j );
+  }
+  return 0;
+}
+#endif
+
 int main( int /*argc*/, char** /*argv*/ )
 {
   int fail = 0;
@@ -167,6 +183,66 @@ int main( int /*argc*/, char** /*argv*/ )
     fprintf( stderr, "test '%s' failed\n", name.c_str() );
   }
 
+  // -------
+  {
+    name = "copies are independent";
+    JID a( "abc@def/ghi" );
+    JID b( a );
+    b.setResource( "jkl" );
+    if( a.full() != "abc@def/ghi" || b.full() != "abc@def/jkl" || a == b || a.bare() != b.bare() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "interning";
+    JID::setInterning( true );
+    {
+      JID a( "abc@def/ghi" );
+      JID b( "abc@def/ghi" );
+      JID c( "abc@def/xyz" );
+      if( a != b || a.hash() != b.hash() || a == c || JID::internedJIDs() != 2 )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), (int)JID::internedJIDs() );
+      }
+      c.setResource( "ghi" );
+      if( c != a || JID::internedJIDs() != 1 )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), (int)JID::internedJIDs() );
+      }
+    }
+    JID::setInterning( false );
+    if( JID::internedJIDs() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), (int)JID::internedJIDs() );
+    }
+  }
+
+#ifndef _WIN32
+  // -------
+  {
+    name = "interned JIDs released by several threads";
+    JID::setInterning( true );
+    pthread_t threads[4];
+    for( int i = 0; i < 4; ++i )
+      pthread_create( &threads[i], 0, internLoop, 0 );
+    for( int i = 0; i < 4; ++i )
+      pthread_join( threads[i], 0 );
+    JID::setInterning( false );
+    if( JID::internedJIDs() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d\n", name.c_str(), (int)JID::internedJIDs() );
+    }
+  }
+#endif
+
 
 
 
@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2004-2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#include "../../logsink.h"
+#include "../../loghandler.h"
+
+#include <string>
+#include <cstdio> // [s]print[f]
+
+using namespace gloox;
+
+class LogTest : public LogHandler
+{
+  public:
+    LogTest() : m_count( 0 ) {}
+    virtual void handleLog( LogLevel /*level*/, LogArea /*area*/, const std::string& /*message*/ )
+      { ++m_count; }
+    int m_count;
+};
+
+int main()
+{
+  int fail = 0;
+  LogSink sink;
+  LogTest debug;
+  LogTest error;
+
+  // -------
+  std::string name = "no handlers";
+  if( sink.enabled( LogLevelDebug, LogAreaXmlIncoming ) || sink.enabled( LogLevelError, LogAreaAll ) )
+  {
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    ++fail;
+  }
+
+  // -------
+  name = "debug handler";
+  sink.registerLogHandler( LogLevelDebug, LogAreaXmlIncoming, &debug );
+  if( !sink.enabled( LogLevelDebug, LogAreaXmlIncoming ) || !sink.enabled( LogLevelError, LogAreaXmlIncoming )
+      || sink.enabled( LogLevelDebug, LogAreaXmlOutgoing ) )
+  {
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    ++fail;
+  }
+
+  // -------
+  name = "error handler";
+  sink.registerLogHandler( LogLevelError, LogAreaAll, &error );
+  if( !sink.enabled( LogLevelError, LogAreaXmlOutgoing ) || !sink.enabled( LogLevelWarning, LogAreaXmlIncoming )
+      || sink.enabled( LogLevelWarning, LogAreaXmlOutgoing ) )
+  {
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    ++fail;
+  }
+
+  // -------
+  name = "log delivery";
+  sink.dbg( LogAreaXmlIncoming, "foo" );
+  sink.dbg( LogAreaXmlOutgoing, "foo" );
+  sink.err( LogAreaXmlOutgoing, "foo" );
+  if( debug.m_count != 1 || error.m_count != 1 )
+  {
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    ++fail;
+  }
+
+  // -------
+  name = "re-register with other level";
+  sink.registerLogHandler( LogLevelWarning, LogAreaXmlIncoming, &debug );
+  if( sink.enabled( LogLevelDebug, LogAreaXmlIncoming ) || !sink.enabled( LogLevelWarning, LogAreaXmlIncoming ) )
+  {
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    ++fail;
+  }
+
+  // -------
+  name = "remove handlers";
+  sink.removeLogHandler( &debug );
+  sink.removeLogHandler( &error );
+  if( sink.enabled( LogLevelError, LogAreaAll ) )
+  {
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    ++fail;
+  }
+
+  if( fail == 0 )
+  {
+    printf( "LogSink: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "LogSink: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
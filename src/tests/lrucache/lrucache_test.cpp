@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#include "../../lrucache.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  int fail = 0;
+  std::string name;
+  std::string value;
+
+  // -------
+  {
+    name = "get/put";
+    util::LRUCache<std::string, std::string> c( 2 );
+    c.put( "a", "1" );
+    c.put( "b", "2" );
+    if( !c.get( "a", value ) || value != "1" || !c.get( "b", value ) || value != "2"
+        || c.get( "c", value ) || value != "2" || c.size() != 2 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "evict least recently used";
+    c.get( "a", value );
+    c.put( "c", "3" ); // evicts b
+    if( c.get( "b", value ) || !c.get( "a", value ) || !c.get( "c", value ) || c.size() != 2 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "update";
+    c.put( "c", "4" );
+    c.put( "d", "5" ); // evicts a
+    if( !c.get( "c", value ) || value != "4" || c.get( "a", value ) || c.size() != 2 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "shrink";
+    c.setCapacity( 1 );
+    if( c.size() != 1 || !c.get( "c", value ) || c.get( "d", value ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "disable";
+    c.setCapacity( 0 );
+    c.put( "e", "6" );
+    if( c.size() != 0 || c.get( "e", value ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  if( fail == 0 )
+  {
+    printf( "LRUCache: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "LRUCache: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2004-2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#ifndef _WIN32
+
+#include "../../parser.h"
+#include "../../taghandler.h"
+#include "../../util.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <locale.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+
+#include <sys/time.h>
+
+static double divider = 1000000;
+static int num = 100;
+static double t;
+
+static void printTime ( const char * testName, struct timeval tv1, struct timeval tv2, double bytes )
+{
+  t = tv2.tv_sec - tv1.tv_sec;
+  t +=  ( tv2.tv_usec - tv1.tv_usec ) / divider;
+  printf( "%s: %.03f seconds (%.01f MB/s)\n", testName, t, bytes / t / 1048576 );
+}
+
+class ParserPerf : public TagHandler
+{
+  public:
+    ParserPerf() : m_count( 0 ) {}
+    virtual void handleTag( Tag* /*tag*/ ) { ++m_count; }
+    int m_count;
+};
+
+// a roster result with 1000 items
+static std::string roster()
+{
+  std::string s = "<iq type='result' id='roster_1' to='user@example.net/res'>"
+                  "<query xmlns='jabber:iq:roster' ver='ver11'>";
+  for( int i = 0; i < 1000; ++i )
+  {
+    const std::string n = util::int2string( i );
+    s += "<item jid='contact" + n + "@example.org' name='Contact &amp; Friend " + n + "' "
+         "subscription='both'><group>Friends</group><group>Work</group></item>";
+  }
+  s += "</query></iq>";
+  return s;
+}
+
+// a burst of 200 pubsub event notifications
+static std::string pubsub()
+{
+  std::string s;
+  for( int i = 0; i < 200; ++i )
+  {
+    const std::string n = util::int2string( i );
+    s += "<message from='pubsub.example.net' to='user@example.net' id='ev" + n + "'>"
+         "<event xmlns='http://jabber.org/protocol/pubsub#event'><items node='princely_musings'>"
+         "<item id='ae890ac52d0df67ed7cfdf51b644e901'><entry xmlns='http://www.w3.org/2005/Atom'>"
+         "<title>Soliloquy</title><summary>To be, or not to be: that is the question: "
+         "Whether &apos;tis nobler in the mind to suffer the slings and arrows of outrageous "
+         "fortune, or to take arms against a sea of troubles, and by opposing end them?</summary>"
+         "<link rel='alternate' type='text/html' href='http://denmark.lit/2003/12/13/atom03'/>"
+         "<id>tag:denmark.lit,2003:entry-32397</id><published>2003-12-13T18:30:02Z</published>"
+         "<updated>2003-12-13T18:30:02Z</updated></entry></item></items></event></message>";
+  }
+  return s;
+}
+
+static void testFeed( const std::string& name, const std::string& data, std::string::size_type chunk )
+{
+  struct timeval tv1;
+  struct timeval tv2;
+
+  ParserPerf handler;
+  Parser p( &handler );
+
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    for( std::string::size_type pos = 0; pos < data.length(); pos += chunk )
+    {
+      std::string copy = data.substr( pos, chunk );
+      p.feed( copy );
+    }
+  }
+  gettimeofday( &tv2, 0 );
+  printTime( ( name + ", feed( std::string& )" ).c_str(), tv1, tv2,
+             static_cast<double>( data.length() ) * num );
+
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    for( std::string::size_type pos = 0; pos < data.length(); pos += chunk )
+    {
+      const std::string::size_type len = data.length() - pos < chunk ? data.length() - pos : chunk;
+      p.feed( data.data() + pos, len );
+    }
+  }
+  gettimeofday( &tv2, 0 );
+  printTime( ( name + ", feed( const char*, size_t )" ).c_str(), tv1, tv2,
+             static_cast<double>( data.length() ) * num );
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  printf( "Testing %d...\n", num );
+
+  testFeed( "roster", roster(), 8192 );
+  testFeed( "pubsub burst", pubsub(), 8192 );
+
+  return 0;
+}
+#else
+int main( int, char** ) { return 0; }
+#endif
@@ -39,13 +39,14 @@ class ParserTest : private TagHandler
       }
     }
 
-    int run()
+    int run( bool arena )
     {
       int fail = 0;
       std::string name;
       std::string data;
       bool tfail = false;
       Parser *p = new Parser( this );
+      p->setArenaAllocation( arena );
 
 
       // -------
@@ -1283,6 +1284,83 @@ class ParserTest : private TagHandler
       delete m_tag;
       m_tag = 0;
 
+      //-------
+      name = "buffer feed";
+      data = "<message to='a@b/c' x=\"it's\"><body>a &lt;b&gt; &amp; c &#x263A;</body>"
+             "<x a='&quot;q&quot;'><![CDATA[<]]]>]]></x></message>";
+      const std::string expected = "<message to='a@b/c' x='it&apos;s'><body>a &lt;b&gt; &amp; c \xE2\x98\xBA"
+                                   "</body><x a='&quot;q&quot;'>&lt;]]]&gt;</x></message>";
+      if( ( i = p->feed( data.data(), data.length() ) ) >= 0 || !m_tag || m_tag->xml() != expected )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed (%d): %s\n", name.c_str(), i, m_tag ? m_tag->xml().c_str() : "" );
+      }
+      delete m_tag;
+      m_tag = 0;
+
+      //-------
+      name = "buffer feed, split at every position";
+      for( std::string::size_type n = 1; n < data.length(); ++n )
+      {
+        // the buffer is not zero-terminated at the split point
+        if( ( i = p->feed( data.data(), n ) ) >= 0 || m_tag
+            || ( i = p->feed( data.data() + n, data.length() - n ) ) >= 0
+            || !m_tag || m_tag->xml() != expected )
+        {
+          ++fail;
+          fprintf( stderr, "test '%s' failed at %d (%d): %s\n", name.c_str(), static_cast<int>( n ), i,
+                   m_tag ? m_tag->xml().c_str() : "" );
+        }
+        delete m_tag;
+        m_tag = 0;
+      }
+
+      //-------
+      name = "buffer feed, byte by byte";
+      for( std::string::size_type n = 0; n < data.length(); ++n )
+      {
+        if( ( i = p->feed( data.data() + n, 1 ) ) >= 0 )
+          break;
+      }
+      if( i >= 0 || !m_tag || m_tag->xml() != expected )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed (%d): %s\n", name.c_str(), i, m_tag ? m_tag->xml().c_str() : "" );
+      }
+      delete m_tag;
+      m_tag = 0;
+
+      //-------
+      name = "buffer feed, unterminated entity";
+      data = "<tag1>&amp123456789</tag1>";
+      if( ( i = p->feed( data.data(), data.length() ) ) != 6 || m_tag )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed (%d)\n", name.c_str(), i );
+      }
+      delete m_tag;
+      m_tag = 0;
+
+      //-------
+      name = "buffer feed, error position after split";
+      data = "<tag1>&am";
+      p->feed( data.data(), data.length() );
+      data = "p;</tag1><";
+      if( ( i = p->feed( data.data(), data.length() ) ) != -1 || !m_tag || m_tag->cdata() != "&" )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed (%d)\n", name.c_str(), i );
+      }
+      delete m_tag;
+      m_tag = 0;
+      data = "<>";
+      if( ( i = p->feed( data.data(), data.length() ) ) != 0 )
+      {
+        ++fail;
+        fprintf( stderr, "test '%s' failed (%d)\n", name.c_str(), i );
+      }
+      p->cleanup();
+
 
 
 
@@ -1310,12 +1388,12 @@ class ParserTest : private TagHandler
 
       if( fail == 0 )
       {
-        printf( "Parser: OK\n" );
+        printf( "Parser%s: OK\n", arena ? " (arena)" : "" );
         return 0;
       }
       else
       {
-        fprintf( stderr, "Parser: %d test(s) failed\n", fail );
+        fprintf( stderr, "Parser%s: %d test(s) failed\n", arena ? " (arena)" : "", fail );
         return 1;
       }
 
@@ -1331,5 +1409,7 @@ class ParserTest : private TagHandler
 int main( int /*argc*/, char** /*argv*/ )
 {
   ParserTest p;
-  return p.run();
+  int fail = p.run( false );
+  fail += p.run( true );
+  return fail;
 }
@@ -13,6 +13,8 @@
 #include "../../prep.h"
 using namespace gloox;
 
+#include "../../config.h"
+
 #include <stdio.h>
 #include <locale.h>
 #include <string>
@@ -136,6 +138,106 @@ int main( int /*argc*/, char** /*argv*/ )
   }
   result = "";
 
+  // -------
+  name = "nodeprep cached";
+  std::string cached;
+  if( !( prep::nodeprep( "jürgen", result ) && prep::nodeprep( "jürgen", cached ) && result == cached ) )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  result = "";
+
+  // -------
+  name = "nodeprep cache disabled";
+  prep::setCacheSize( 0 );
+  if( !( prep::nodeprep( "jürgen", result ) && result == cached ) )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  prep::setCacheSize( 4096 );
+  result = "";
+
+#ifdef HAVE_LIBIDN
+  // -------
+  name = "nodeprep prohibited ASCII";
+  if( prep::nodeprep( "ro@meo", result ) || prep::nodeprep( "ro meo", result )
+      || prep::nodeprep( "ro/meo", result ) || !result.empty() )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  result = "";
+
+  // -------
+  name = "resourceprep ASCII";
+  if( !( prep::resourceprep( "Bal Cony/@:", result ) && result == "Bal Cony/@:" ) )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  result = "";
+
+  // -------
+  name = "nodeprep non-ASCII casefolding";
+  if( !( prep::nodeprep( "JÜRGEN", result ) && result == "jürgen" ) )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  result = "";
+
+  // -------
+  name = "LibIDN results are cached";
+  prep::setCacheSize( 0 );
+  prep::setCacheSize( 4096 );
+  if( !( prep::cachedResults() == 0
+         && prep::nodeprep( "JÜRGEN", result ) && result == "jürgen"
+         && prep::cachedResults() == 1
+         && prep::nodeprep( "JÜRGEN", result ) && result == "jürgen"
+         && prep::cachedResults() == 1
+         && prep::nameprep( "dÖmäin.de", result ) && result == "dömäin.de"
+         && prep::resourceprep( "Bälcony", result ) && result == "Bälcony"
+         && prep::cachedResults() == 3 ) )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  result = "";
+
+  // -------
+  name = "ASCII and failed results are not cached";
+  if( !( prep::nodeprep( "Romeo", result ) && result == "romeo"
+         && !prep::nodeprep( "jü@rgen", result )
+         && prep::cachedResults() == 3 ) )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  result = "";
+
+  // -------
+  name = "LibIDN cache eviction";
+  prep::setCacheSize( 1 );
+  if( !( prep::cachedResults() == 3
+         && prep::nodeprep( "MÄX", result ) && result == "mäx"
+         && prep::cachedResults() == 3
+         && prep::nodeprep( "JÜRGEN", result ) && result == "jürgen" ) )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  prep::setCacheSize( 0 );
+  if( prep::cachedResults() != 0 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+  prep::setCacheSize( 4096 );
+  result = "";
+#endif
+
 
 
 
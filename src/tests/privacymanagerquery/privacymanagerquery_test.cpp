@@ -12,6 +12,7 @@
 
 #include "../../tag.h"
 #include "../../iq.h"
+#include "../../message.h"
 #include "../../iqhandler.h"
 #include "../../messagehandler.h"
 #include "../../base64.h"
@@ -38,6 +39,7 @@ namespace gloox
       const std::string getID();
       virtual void send( IQ& ) = 0;
       virtual void send( const IQ&, IqHandler*, int ) = 0;
+      void send( const Message& ) {}
       virtual void trackID( IqHandler *ih, const std::string& id, int context ) = 0;
       void removeIqHandler( IqHandler* ih, int exttype );
       void registerIqHandler( IqHandler* ih, int exttype );
@@ -86,6 +86,25 @@ using namespace gloox;
 #include "../../rostermanager.h"
 #include "../../rostermanager.cpp"
 #include "../../rosterlistener.h"
+
+class PresenceExt : public StanzaExtension
+{
+  public:
+    PresenceExt( const std::string& val ) : StanzaExtension( ExtUser + 2 ), m_val( val ) { ++s_instances; }
+    PresenceExt( const PresenceExt& other ) : StanzaExtension( ExtUser + 2 ), m_val( other.m_val ) { ++s_instances; }
+    virtual ~PresenceExt() { --s_instances; }
+    virtual const std::string& filterString() const { return EmptyString; }
+    virtual StanzaExtension* newInstance( const Tag* ) const { return 0; }
+    virtual Tag* tag() const { return new Tag( "x", "v", m_val ); }
+    virtual StanzaExtension* clone() const { return new PresenceExt( *this ); }
+    virtual bool equals( const StanzaExtension& other ) const
+      { return static_cast<const PresenceExt&>( other ).m_val == m_val; }
+    static int s_instances;
+  private:
+    std::string m_val;
+};
+int PresenceExt::s_instances = 0;
+
 class RosterManagerTest : public ClientBase, public RosterListener
 {
   public:
@@ -440,6 +459,48 @@ int main( int /*argc*/, char** /*argv*/ )
 
 
 
+  // -------
+  {
+    name = "unchanged presence extensions are kept";
+    RosterManager::Statistics first, second, third;
+    {
+      Presence p( Presence::Available, JID() );
+      p.setFrom( JID( "self/res" ) );
+      p.addExtension( new PresenceExt( "caps" ) );
+      p.addExtension( new PresenceExt( "photo" ) );
+      rm->handlePresence( p );
+      first = rm->statistics();
+    }
+    {
+      Presence p( Presence::Away, JID() );
+      p.setFrom( JID( "self/res" ) );
+      p.addExtension( new PresenceExt( "caps" ) );
+      p.addExtension( new PresenceExt( "photo2" ) );
+      rm->handlePresence( p );
+      second = rm->statistics();
+    }
+    {
+      Presence p( Presence::Away, JID() );
+      p.setFrom( JID( "self/res" ) );
+      p.addExtension( new PresenceExt( "caps" ) );
+      rm->handlePresence( p );
+      third = rm->statistics();
+    }
+
+    if( first.extensionsCloned != 2 || first.extensionsKept != 0 || first.extensions != 2
+        || first.resources != 1 || first.extensionBytes != 27
+        || second.extensionsCloned != 3 || second.extensionsKept != 1 || second.extensions != 2
+        || third.extensionsCloned != 3 || third.extensionsKept != 2 || third.extensions != 1
+        || PresenceExt::s_instances != 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %ld/%ld %ld/%ld %ld/%ld %ld %d\n", name.c_str(),
+               first.extensionsCloned, first.extensionsKept, second.extensionsCloned,
+               second.extensionsKept, third.extensionsCloned, third.extensionsKept,
+               first.extensionBytes, PresenceExt::s_instances );
+    }
+  }
+
   delete rm;
   delete rmt;
 
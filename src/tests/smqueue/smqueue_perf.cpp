@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#ifndef _WIN32
+
+#include "../../smqueue.h"
+#include "../../tag.h"
+#include "../../util.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <sys/time.h>
+#include <cstdio> // [s]print[f]
+
+static const double divider = 1000000;
+static const int backlog = 20000;    // unacknowledged stanzas (lossy link)
+static const int num = 100000;       // stanzas sent per test
+static const int ackEvery = 10;      // an <a/> for every 10 stanzas
+static double t;
+
+static void printTime ( const char * testName, struct timeval tv1, struct timeval tv2 )
+{
+  t = tv2.tv_sec - tv1.tv_sec;
+  t +=  ( tv2.tv_usec - tv1.tv_usec ) / divider;
+  printf( "%s: %.03f seconds\n", testName, t );
+}
+
+static Tag* newStanza( int i )
+{
+  Tag* m = new Tag( "message", "to", "juliet@example.net/balcony" );
+  m->addAttribute( "id", i );
+  m->addAttribute( "type", "chat" );
+  new Tag( m, "body", "Wherefore art thou, Romeo?" );
+  return m;
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  struct timeval tv1;
+  struct timeval tv2;
+
+  // the way ClientBase used to do it: a map of Tag trees, the whole map is
+  // walked on every ack
+  {
+    std::map<int, Tag*> queue;
+    gettimeofday( &tv1, 0 );
+    for( int i = 1; i <= num; ++i )
+    {
+      Tag* t = newStanza( i );
+      std::string xml;
+      t->xml( xml );
+      queue.insert( std::make_pair( i, t ) );
+      if( i % ackEvery == 0 )
+      {
+        const int handled = i - backlog;
+        std::map<int, Tag*>::iterator it = queue.begin();
+        while( it != queue.end() )
+        {
+          if( (*it).first <= handled )
+          {
+            delete (*it).second;
+            queue.erase( it++ );
+          }
+          else
+            ++it;
+        }
+      }
+    }
+    std::string resend;
+    std::map<int, Tag*>::iterator it = queue.begin();
+    for( ; it != queue.end(); ++it )
+      resend += (*it).second->xml();
+    gettimeofday( &tv2, 0 );
+    printTime( "map<int, Tag*> (send + ack + resend)", tv1, tv2 );
+    util::clearMap( queue );
+  }
+
+  {
+    SMQueue queue;
+    gettimeofday( &tv1, 0 );
+    for( int i = 1; i <= num; ++i )
+    {
+      Tag* t = newStanza( i );
+      std::string xml;
+      t->xml( xml );
+      queue.push( i, xml );
+      delete t;
+      if( i % ackEvery == 0 )
+        queue.ack( i - backlog );
+    }
+    std::string resend;
+    queue.xml( resend );
+    gettimeofday( &tv2, 0 );
+    printTime( "SMQueue (send + ack + resend)", tv1, tv2 );
+  }
+
+  return 0;
+}
+#else
+int main( int, char** ) { return 0; }
+#endif
@@ -0,0 +1,173 @@
+/*
+ *  Copyright (c) 2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#include "../../smqueue.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+
+static std::string stanza( int i )
+{
+  char buf[64];
+  sprintf( buf, "<message id='m%d'><body>%d</body></message>", i, i );
+  return buf;
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  int fail = 0;
+  std::string name;
+
+  // -------
+  {
+    name = "empty queue";
+    SMQueue q;
+    std::string xml;
+    q.xml( xml );
+    if( q.count() != 0 || q.bytes() != 0 || q.ack( 10 ) != 0 || !xml.empty() || !q.stanzas().empty() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "push/ack/xml";
+    SMQueue q;
+    std::string all;
+    for( int i = 1; i <= 5; ++i )
+    {
+      q.push( i, stanza( i ) );
+      if( i > 2 )
+        all += stanza( i );
+    }
+    const int acked = q.ack( 2 );
+    std::string xml;
+    q.xml( xml );
+    const StringList l = q.stanzas();
+    if( acked != 2 || q.count() != 3 || q.bytes() != all.length() || xml != all || l.size() != 3
+        || l.front() != stanza( 3 ) || l.back() != stanza( 5 ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %s\n", name.c_str(), acked, xml.c_str() );
+    }
+
+    // -------
+    name = "ack old sequence number";
+    if( q.ack( 1 ) != 0 || q.count() != 3 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "ack all";
+    if( q.ack( 100 ) != 3 || q.count() != 0 || q.bytes() != 0 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "wrap around and grow";
+    SMQueue q;
+    int seq = 0;
+    int acked = 0;
+    bool ok = true;
+    // keep a sliding window of stanzas so that data wraps around the end of the ring,
+    // and let the window grow now and then to force reallocations of a wrapped ring
+    for( int round = 0; round < 2000 && ok; ++round )
+    {
+      ++seq;
+      q.push( seq, stanza( seq ) );
+      ++seq;
+      q.push( seq, stanza( seq ) );
+      if( round % 100 != 0 )
+        acked += q.ack( acked + 2 ) ? 2 : 0;
+
+      std::string expected;
+      for( int i = acked + 1; i <= seq; ++i )
+        expected += stanza( i );
+      std::string xml;
+      q.xml( xml );
+      const StringList l = q.stanzas();
+      ok = xml == expected && q.bytes() == expected.length()
+           && static_cast<int>( q.count() ) == seq - acked && l.front() == stanza( acked + 1 )
+           && l.back() == stanza( seq );
+    }
+    if( !ok )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d %d\n", name.c_str(), seq, acked );
+    }
+  }
+
+  // -------
+  {
+    name = "stanza limit";
+    SMQueue q;
+    q.setLimits( 0, 3 );
+    if( !q.push( 1, "<a/>" ) || !q.push( 2, "<b/>" ) || !q.push( 3, "<c/>" ) || q.push( 4, "<d/>" )
+        || q.count() != 3 || q.ack( 1 ) != 1 || !q.push( 5, "<e/>" ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "byte limit";
+    SMQueue q;
+    q.setLimits( 11, 0 );
+    std::string xml;
+    if( !q.push( 1, "<a/>" ) || !q.push( 2, "<bb/>" ) || q.push( 3, "<c/>" ) || !q.push( 4, "<>" )
+        || q.bytes() != 11 || ( q.xml( xml ), xml != "<a/><bb/><>" ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), xml.c_str() );
+    }
+  }
+
+  // -------
+  {
+    name = "clear";
+    SMQueue q;
+    q.push( 1, "<a/>" );
+    q.clear();
+    std::string xml;
+    q.push( 1, "<b/>" );
+    q.xml( xml );
+    if( q.count() != 1 || xml != "<b/>" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
+  if( fail == 0 )
+  {
+    printf( "SMQueue: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "SMQueue: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
@@ -0,0 +1,365 @@
+/*
+ *  Copyright (c) 2004-2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#include "../../jid.h"
+#include "../../logsink.h"
+#include "../../connectionbase.h"
+#include "../../bytestreamdatahandler.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <locale.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+#include <cstring>
+#include <list>
+#include <algorithm>
+
+#include <unistd.h>
+
+namespace gloox
+{
+  struct StreamHost
+  {
+    JID jid;
+    std::string host;
+    int port;
+  };
+  typedef std::list<StreamHost> StreamHostList;
+
+  class SOCKS5Bytestream;
+
+  class SOCKS5BytestreamManager
+  {
+    public:
+      // creates a bytestream on top of an established connection, the bytestream owns it
+      SOCKS5Bytestream* create( ConnectionBase* connection );
+      void acknowledgeStreamHost( bool, const JID&, const std::string& ) {}
+    private:
+      LogSink m_logInstance;
+  };
+}
+
+#define SOCKS5BYTESTREAMMANAGER_H__
+#include "../../socks5bytestream.h"
+#include "../../socks5bytestream.cpp"
+
+SOCKS5Bytestream* SOCKS5BytestreamManager::create( ConnectionBase* connection )
+{
+  SOCKS5Bytestream* s5b = new SOCKS5Bytestream( this, connection, m_logInstance, JID( "foo@bar/a" ),
+                                                JID( "foo@bar/b" ), "sid" );
+  s5b->m_socks5->connect(); // the proxy handshake is done already
+  return s5b;
+}
+
+// An established connection. recv() hands whatever is in m_incoming to the data handler.
+// In direct mode, it implements sendFile(), recvInto() and recvToFile(), too.
+class FakeConnection : public ConnectionBase
+{
+  public:
+    FakeConnection( bool direct )
+      : ConnectionBase( 0 ), m_direct( direct ), m_sendFileLimit( -1 ), m_recvCalls( 0 )
+    {
+      m_state = StateConnected;
+    }
+    virtual ~FakeConnection() {}
+    virtual ConnectionError connect() { m_state = StateConnected; return ConnNoError; }
+    virtual ConnectionError recv( int /*timeout*/ )
+    {
+      ++m_recvCalls;
+      if( !m_incoming.empty() && m_handler )
+      {
+        std::string data;
+        data.swap( m_incoming );
+        m_handler->handleReceivedData( this, data );
+      }
+      return ConnNoError;
+    }
+    virtual bool send( const std::string& data ) { m_sent += data; return true; }
+    virtual ConnectionError receive() { return ConnNoError; }
+    virtual void disconnect() { m_state = StateDisconnected; }
+    virtual void getStatistics( long int& totalIn, long int& totalOut ) { totalIn = totalOut = 0; }
+    virtual ConnectionBase* newInstance() const { return new FakeConnection( m_direct ); }
+    virtual int64_t sendFile( int fd, int64_t offset, int64_t length )
+    {
+      if( !m_direct )
+        return -1;
+
+      if( m_sendFileLimit >= 0 )
+        length = std::min( length, m_sendFileLimit );
+      std::string data( static_cast<std::string::size_type>( length ), '\0' );
+      const ssize_t size = ::pread( fd, &data[0], data.length(), static_cast<off_t>( offset ) );
+      if( size < 0 )
+        return -1;
+      m_sent.append( data, 0, static_cast<std::string::size_type>( size ) );
+      return size;
+    }
+    virtual int64_t recvInto( char* buffer, int64_t length, int /*timeout*/ )
+    {
+      if( !m_direct )
+        return -1;
+
+      const int64_t size = std::min( length, static_cast<int64_t>( m_incoming.length() ) );
+      memcpy( buffer, m_incoming.data(), static_cast<size_t>( size ) );
+      m_incoming.erase( 0, static_cast<std::string::size_type>( size ) );
+      return size;
+    }
+    virtual int64_t recvToFile( int fd, int64_t length, int /*timeout*/ )
+    {
+      if( !m_direct )
+        return -1;
+
+      const int64_t size = std::min( length, static_cast<int64_t>( m_incoming.length() ) );
+      if( ::write( fd, m_incoming.data(), static_cast<size_t>( size ) ) != size )
+        return -1;
+      m_incoming.erase( 0, static_cast<std::string::size_type>( size ) );
+      return size;
+    }
+
+    bool m_direct;
+    int64_t m_sendFileLimit;
+    int m_recvCalls;
+    std::string m_incoming;
+    std::string m_sent;
+};
+
+class DataHandler : public BytestreamDataHandler
+{
+  public:
+    virtual void handleBytestreamData( Bytestream* /*bs*/, const std::string& data ) { m_data += data; }
+    virtual void handleBytestreamError( Bytestream* /*bs*/, const IQ& /*iq*/ ) {}
+    virtual void handleBytestreamOpen( Bytestream* /*bs*/ ) {}
+    virtual void handleBytestreamClose( Bytestream* /*bs*/ ) {}
+    std::string m_data;
+};
+
+// returns a temporary file holding data
+static int tempFile( const std::string& data )
+{
+  char path[] = "/tmp/gloox-s5b-XXXXXX";
+  const int fd = mkstemp( path );
+  if( fd < 0 )
+    return -1;
+  unlink( path );
+  if( ::write( fd, data.data(), data.length() ) != static_cast<ssize_t>( data.length() ) )
+  {
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+static std::string fileContents( int fd )
+{
+  char buf[256];
+  const ssize_t size = ::pread( fd, buf, sizeof( buf ), 0 );
+  return size > 0 ? std::string( buf, static_cast<std::string::size_type>( size ) ) : std::string();
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  int fail = 0;
+  std::string name;
+  SOCKS5BytestreamManager manager;
+  const std::string content( "0123456789abcdefghij" );
+
+  // -------
+  {
+    name = "sendFile, direct";
+    FakeConnection* conn = new FakeConnection( true );
+    SOCKS5Bytestream* s5b = manager.create( conn );
+    DataHandler dh;
+    s5b->registerBytestreamDataHandler( &dh );
+    const int fd = tempFile( content );
+    if( !s5b->sendFile( fd, 2, 10 ) || conn->m_sent != content.substr( 2, 10 ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), conn->m_sent.c_str() );
+    }
+
+    // -------
+    name = "sendFile, direct stops early";
+    conn->m_sent = EmptyString;
+    conn->m_sendFileLimit = 3;
+    if( !s5b->sendFile( fd, 2, 10 ) || conn->m_sent != content.substr( 2, 10 ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), conn->m_sent.c_str() );
+    }
+
+    // -------
+    name = "sendFile, closed stream";
+    conn->m_sent = EmptyString;
+    s5b->close();
+    if( s5b->sendFile( fd, 0, 10 ) || !conn->m_sent.empty() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    close( fd );
+    delete s5b;
+  }
+
+  // -------
+  {
+    name = "sendFile, fallback";
+    FakeConnection* conn = new FakeConnection( false );
+    SOCKS5Bytestream* s5b = manager.create( conn );
+    const int fd = tempFile( content );
+    if( !s5b->sendFile( fd, 5, 15 ) || conn->m_sent != content.substr( 5 ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), conn->m_sent.c_str() );
+    }
+
+    // -------
+    name = "sendFile, fallback past the end of the file";
+    conn->m_sent = EmptyString;
+    if( s5b->sendFile( fd, 15, 10 ) || conn->m_sent != content.substr( 15 ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), conn->m_sent.c_str() );
+    }
+    close( fd );
+    delete s5b;
+  }
+
+  // -------
+  {
+    name = "recvInto, direct";
+    FakeConnection* conn = new FakeConnection( true );
+    SOCKS5Bytestream* s5b = manager.create( conn );
+    DataHandler dh;
+    s5b->registerBytestreamDataHandler( &dh );
+    char buf[16];
+    conn->m_incoming = "foobar";
+    const int64_t size = s5b->recvInto( buf, 3, 0 );
+    if( size != 3 || std::string( buf, 3 ) != "foo" || conn->m_incoming != "bar"
+        || conn->m_recvCalls || !dh.m_data.empty() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    delete s5b;
+  }
+
+  // -------
+  {
+    name = "recvInto, fallback";
+    FakeConnection* conn = new FakeConnection( false );
+    SOCKS5Bytestream* s5b = manager.create( conn );
+    DataHandler dh;
+    s5b->registerBytestreamDataHandler( &dh );
+    char buf[16];
+    conn->m_incoming = "foobar";
+    const int64_t first = s5b->recvInto( buf, 3, 0 );
+    const std::string firstData( buf, 3 );
+    const int64_t second = s5b->recvInto( buf, sizeof( buf ), 0 );
+    if( first != 3 || firstData != "foo" || second != 3 || std::string( buf, 3 ) != "bar"
+        || conn->m_recvCalls != 1 || !dh.m_data.empty() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "recvInto, fallback without data";
+    if( s5b->recvInto( buf, sizeof( buf ), 0 ) != 0 || conn->m_recvCalls != 2 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "recv() hands out data read ahead by recvInto()";
+    conn->m_incoming = "foobar";
+    s5b->recvInto( buf, 2, 0 );
+    conn->m_incoming = "baz";
+    s5b->recv( 0 );
+    const std::string readAhead = dh.m_data;
+    s5b->recv( 0 );
+    if( readAhead != "obar" || dh.m_data != "obarbaz" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), dh.m_data.c_str() );
+    }
+    delete s5b;
+  }
+
+  // -------
+  {
+    name = "recvToFile, direct";
+    FakeConnection* conn = new FakeConnection( true );
+    SOCKS5Bytestream* s5b = manager.create( conn );
+    const int fd = tempFile( EmptyString );
+    conn->m_incoming = "foobar";
+    if( s5b->recvToFile( fd, 100, 0 ) != 6 || fileContents( fd ) != "foobar" || conn->m_recvCalls )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    close( fd );
+    delete s5b;
+  }
+
+  // -------
+  {
+    name = "recvToFile, fallback";
+    FakeConnection* conn = new FakeConnection( false );
+    SOCKS5Bytestream* s5b = manager.create( conn );
+    const int fd = tempFile( EmptyString );
+    conn->m_incoming = "foobar";
+    const int64_t first = s5b->recvToFile( fd, 4, 0 );
+    const int64_t second = s5b->recvToFile( fd, 100, 0 );
+    if( first != 4 || second != 2 || fileContents( fd ) != "foobar" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    close( fd );
+    delete s5b;
+  }
+
+  // -------
+  {
+    name = "recvToFile writes data read ahead first";
+    FakeConnection* conn = new FakeConnection( false );
+    SOCKS5Bytestream* s5b = manager.create( conn );
+    const int fd = tempFile( EmptyString );
+    char buf[16];
+    conn->m_incoming = "foobar";
+    s5b->recvInto( buf, 2, 0 );
+    conn->m_direct = true;
+    conn->m_incoming = "baz";
+    const int64_t first = s5b->recvToFile( fd, 100, 0 );
+    const int64_t second = s5b->recvToFile( fd, 100, 0 );
+    if( first != 4 || second != 3 || fileContents( fd ) != "obarbaz" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), fileContents( fd ).c_str() );
+    }
+    close( fd );
+    delete s5b;
+  }
+
+  if( fail == 0 )
+  {
+    printf( "SOCKS5Bytestream: OK\n" );
+    return 0;
+  }
+  else
+  {
+    fprintf( stderr, "SOCKS5Bytestream: %d test(s) failed\n", fail );
+    return 1;
+  }
+
+}
@@ -10,10 +10,13 @@
  *  This software is distributed without any warranty.
  */
 
+#ifndef _WIN32
+
 #include "../../stanzaextension.h"
 #include "../../stanzaextensionfactory.h"
 #include "../../iq.h"
 #include "../../tag.h"
+#include "../../util.h"
 using namespace gloox;
 
 #include <stdio.h>
@@ -21,72 +24,83 @@ using namespace gloox;
 #include <string>
 #include <cstdio> // [s]print[f]
 
+#include <sys/time.h>
+
+static double divider = 1000000;
+static int num = 25000;
+static double t;
+
+static void printTime ( const char * testName, struct timeval tv1, struct timeval tv2 )
+{
+  t = tv2.tv_sec - tv1.tv_sec;
+  t +=  ( tv2.tv_usec - tv1.tv_usec ) / divider;
+  printf( "%s: %.03f seconds (%.00f/s)\n", testName, t, num / t );
+}
+
 class SETest : public StanzaExtension
 {
   public:
-    SETest( const Tag* tag ) : StanzaExtension( ExtUser + 1 ), m_tag( const_cast<Tag*>( tag ) ) {}
+    SETest( int type, const Tag* tag = 0 )
+      : StanzaExtension( type ),
+        m_filter( "/iq/query[@xmlns='urn:perf:" + util::int2string( type ) + "']" ),
+        m_tag( const_cast<Tag*>( tag ) ) {}
     ~SETest() {}
 
     virtual const std::string& filterString() const
-    {
-      static const std::string filter = "/foo/bar";
-      return filter;
-    }
+    { return m_filter; }
 
     virtual StanzaExtension* newInstance( const Tag* tag ) const
-    { return new SETest( tag ); }
+    { return new SETest( extensionType(), tag ); }
 
     virtual Tag* tag() const
     { return m_tag; }
 
     virtual StanzaExtension* clone() const
-    { return new SETest( m_tag ? m_tag->clone() : 0 ); }
+    { return new SETest( extensionType(), m_tag ); }
 
   private:
+    std::string m_filter;
     Tag* m_tag;
 
 };
 
-int main( int /*argc*/, char** /*argv*/ )
+static void testExtensions( int extensions )
 {
-  int fail = 0;
-  std::string name;
+  struct timeval tv1;
+  struct timeval tv2;
+
   StanzaExtensionFactory sef;
+  for( int i = 0; i < extensions; ++i )
+    sef.registerExtension( new SETest( ExtUser + i ) );
 
-  // -------
-  name = "SEFactory test";
-  SETest* set = new SETest( 0 ); // deleted by StanzaExtensionFactory sef;
-  sef.registerExtension( set );
-  Tag* f = new Tag( "foo" );
-  Tag* b = new Tag( f, "bar", "attr", "value" );
-  IQ iq( IQ::Set, JID(), "" );
-  sef.addExtensions( iq, f );
-  const StanzaExtension* se = iq.findExtension( ExtUser + 1 );
-  if( se == 0 || se == set || se->tag() != b )
-  {
-    ++fail;
-    fprintf( stderr, "test '%s' failed\n", name.c_str() );
-  }
-  delete f;
+  Tag* iq = new Tag( "iq" );
+  iq->addAttribute( "type", "set" );
+  iq->addAttribute( "id", "abcdef" );
+  new Tag( iq, "query", XMLNS, "urn:perf:" + util::int2string( ExtUser + extensions / 2 ) );
 
-  // -------
-  name = "remove ext";
-  if( !sef.removeExtension( ExtUser + 1 ) )
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
   {
-    ++fail;
-    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    IQ stanza( IQ::Set, JID(), "" );
+    sef.addExtensions( stanza, iq );
   }
+  gettimeofday( &tv2, 0 );
+  delete iq;
 
+  const std::string name = "addExtensions, " + util::int2string( extensions ) + " extension(s)";
+  printTime( name.c_str(), tv1, tv2 );
+}
 
-  if( fail == 0 )
-  {
-    printf( "StanzaExtensionFactory: OK\n" );
-    return 0;
-  }
-  else
-  {
-    fprintf( stderr, "StanzaExtensionFactory: %d test(s) failed\n", fail );
-    return 1;
-  }
+int main( int /*argc*/, char** /*argv*/ )
+{
+  printf( "Testing %d...\n", num );
+
+  testExtensions( 1 );
+  testExtensions( 10 );
+  testExtensions( 50 );
 
+  return 0;
 }
+#else
+int main( int, char** ) { return 0; }
+#endif
@@ -47,6 +47,52 @@ class SETest : public StanzaExtension
 
 };
 
+class SEFilterTest : public StanzaExtension
+{
+  public:
+    SEFilterTest( int type, const std::string& filter, const Tag* tag = 0 )
+      : StanzaExtension( type ), m_filter( filter ), m_tag( const_cast<Tag*>( tag ) ) {}
+    ~SEFilterTest() {}
+
+    virtual const std::string& filterString() const
+    { return m_filter; }
+
+    virtual StanzaExtension* newInstance( const Tag* tag ) const
+    { return new SEFilterTest( extensionType(), m_filter, tag ); }
+
+    virtual Tag* tag() const
+    { return m_tag; }
+
+    virtual StanzaExtension* clone() const
+    { return new SEFilterTest( extensionType(), m_filter, m_tag ); }
+
+  private:
+    std::string m_filter;
+    Tag* m_tag;
+
+};
+
+// removes itself from the factory whenever it creates an instance
+class SESelfRemoving : public SEFilterTest
+{
+  public:
+    SESelfRemoving( StanzaExtensionFactory& sef, const std::string& filter, const Tag* tag = 0 )
+      : SEFilterTest( ExtUser + 7, filter, tag ), m_sef( sef ) {}
+    ~SESelfRemoving() {}
+
+    virtual StanzaExtension* newInstance( const Tag* tag ) const
+    {
+      m_sef.registerExtension( new SEFilterTest( ExtUser + 8, "/iq/query" ) );
+      m_sef.removeExtension( ExtUser + 7 );
+      return new SEFilterTest( ExtUser + 7, filterString(), tag );
+    }
+
+  private:
+    SESelfRemoving& operator=( const SESelfRemoving& );
+    StanzaExtensionFactory& m_sef;
+
+};
+
 int main( int /*argc*/, char** /*argv*/ )
 {
   int fail = 0;
@@ -77,6 +123,76 @@ int main( int /*argc*/, char** /*argv*/ )
     fprintf( stderr, "test '%s' failed\n", name.c_str() );
   }
 
+  // -------
+  {
+    name = "indexed lookup";
+    StanzaExtensionFactory sef2;
+    sef2.registerExtension( new SEFilterTest( ExtUser + 2, "/iq/query[@xmlns='foo']" ) );
+    sef2.registerExtension( new SEFilterTest( ExtUser + 3, "/iq/query[@xmlns='bar']" ) );
+    sef2.registerExtension( new SEFilterTest( ExtUser + 4, "/message/x|/iq/x" ) );
+    sef2.registerExtension( new SEFilterTest( ExtUser + 5, "/iq/*[@xmlns='bar']" ) );
+    sef2.registerExtension( new SEFilterTest( ExtUser + 6, "/iq/*/headers[@xmlns='foo']" ) );
+    Tag* i = new Tag( "iq" );
+    Tag* q = new Tag( i, "query", XMLNS, "bar" );
+    Tag* x = new Tag( i, "x", XMLNS, "foo" );
+    Tag* h = new Tag( q, "headers", XMLNS, "foo" );
+    IQ iq( IQ::Set, JID(), "" );
+    sef2.addExtensions( iq, i );
+    if( iq.findExtension( ExtUser + 2 ) != 0
+        || !iq.findExtension( ExtUser + 3 ) || iq.findExtension( ExtUser + 3 )->tag() != q
+        || !iq.findExtension( ExtUser + 4 ) || iq.findExtension( ExtUser + 4 )->tag() != x
+        || !iq.findExtension( ExtUser + 5 ) || iq.findExtension( ExtUser + 5 )->tag() != q
+        || !iq.findExtension( ExtUser + 6 ) || iq.findExtension( ExtUser + 6 )->tag() != h
+        || iq.extensions().size() != 4 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "replaced extension is re-indexed";
+    sef2.registerExtension( new SEFilterTest( ExtUser + 3, "/iq/query[@xmlns='baz']" ) );
+    IQ iq2( IQ::Set, JID(), "" );
+    sef2.addExtensions( iq2, i );
+    if( iq2.findExtension( ExtUser + 3 ) != 0 || iq2.extensions().size() != 3 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "removed extension is unindexed";
+    sef2.removeExtension( ExtUser + 4 );
+    IQ iq3( IQ::Set, JID(), "" );
+    sef2.addExtensions( iq3, i );
+    if( iq3.findExtension( ExtUser + 4 ) != 0 || iq3.extensions().size() != 2 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    delete i;
+  }
+
+  // -------
+  {
+    name = "registry changed from newInstance()";
+    StanzaExtensionFactory sef3;
+    sef3.registerExtension( new SESelfRemoving( sef3, "/iq/query" ) );
+    Tag* i = new Tag( "iq" );
+    new Tag( i, "query", XMLNS, "foo" );
+    IQ iq( IQ::Set, JID(), "" );
+    sef3.addExtensions( iq, i );
+    IQ iq2( IQ::Set, JID(), "" );
+    sef3.addExtensions( iq2, i );
+    if( !iq.findExtension( ExtUser + 7 ) || iq.findExtension( ExtUser + 8 )
+        || iq2.findExtension( ExtUser + 7 ) || !iq2.findExtension( ExtUser + 8 ) )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+    delete i;
+  }
+
 
   if( fail == 0 )
   {
@@ -13,16 +13,42 @@
 #ifndef _WIN32
 
 #include "../../tag.h"
+#include "../../parser.h"
+#include "../../taghandler.h"
 using namespace gloox;
 
 #include <stdio.h>
 #include <locale.h>
 #include <cstdlib>
+#include <ctime>
+#include <new>
 #include <string>
 #include <cstdio> // [s]print[f]
 
 #include <sys/time.h>
 
+static unsigned long allocations = 0;
+
+void* operator new( size_t size )
+#if __cplusplus < 201103L
+  throw( std::bad_alloc )
+#endif
+{
+  ++allocations;
+  void* p = malloc( size ? size : 1 );
+  if( !p )
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete( void* p )
+#if __cplusplus < 201103L
+  throw()
+#endif
+{
+  free( p );
+}
+
 static double divider = 1000000;
 static int num = 2500;
 static double t;
@@ -61,6 +87,44 @@ static inline Tag * newEscapedTag ()   { return newTag( escapedString ); }
 static inline Tag * newEscapableTag () { return newTag( escapableString ); }
 
 
+class ParserPerf : public TagHandler
+{
+  public:
+    virtual void handleTag( Tag* /*tag*/ ) {}
+};
+
+static const std::string stanza = "<message from='room@conference.example.net/nick' "
+                                  "to='user@example.net/resource' type='groupchat' id='abc123'>"
+                                  "<body>Hello, this is a reasonably long message body.</body>"
+                                  "<x xmlns='http://jabber.org/protocol/muc#user'>"
+                                  "<item affiliation='member' role='participant' jid='user@example.net'/>"
+                                  "<status code='100'/></x>"
+                                  "<delay xmlns='urn:xmpp:delay' stamp='2017-02-26T12:00:00Z'/>"
+                                  "</message>";
+
+static void parse( bool arena, const char* testName )
+{
+  struct timeval tv1;
+  struct timeval tv2;
+
+  ParserPerf handler;
+  Parser p( &handler );
+  p.setArenaAllocation( arena );
+
+  unsigned long count = 0;
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    std::string data( stanza );
+    const unsigned long before = allocations;
+    p.feed( data );
+    count += allocations - before;
+  }
+  gettimeofday( &tv2, 0 );
+  printTime( testName, tv1, tv2 );
+  printf( "%s: %.01f allocations per stanza\n", testName, static_cast<double>( count ) / num );
+}
+
 static const int sz_max = 1000;
 
 static char values[sz_max];
@@ -106,6 +170,40 @@ int main( int /*argc*/, char** /*argv*/ )
   printTime ("escaping xml", tv1, tv2);
 
 
+  // ---------------------------------------------------------------------
+
+  tag = newSimpleTag();
+  std::string buffer;
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    buffer.clear();
+    tag->xml( buffer );
+  }
+  gettimeofday( &tv2, 0 );
+  delete tag;
+  printTime ("non escaping xml, reused buffer", tv1, tv2);
+
+
+  // ---------------------------------------------------------------------
+
+  tag = new Tag( "deep" );
+  Tag* t = tag;
+  for( int i = 0; i < 50; ++i )
+  {
+    t = new Tag( t, simpleString, simpleString );
+    t->addAttribute( "attr", simpleString );
+  }
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    tag->xml();
+  }
+  gettimeofday( &tv2, 0 );
+  delete tag;
+  printTime ("deep xml", tv1, tv2);
+
+
   // ---------------------------------------------------------------------
 
   gettimeofday( &tv1, 0 );
@@ -152,6 +250,10 @@ int main( int /*argc*/, char** /*argv*/ )
   gettimeofday( &tv2, 0 );
   printTime ("clone/delete", tv1, tv2);
 
+  // -----------------------------------------------------------------------
+
+  parse( false, "parse (heap)" );
+  parse( true, "parse (arena)" );
 
 
 
@@ -437,6 +437,49 @@ int main( int /*argc*/, char** /*argv*/ )
     }
   }
 
+  //-------
+  {
+    name = "arena allocation";
+    TagArena arena( 64 );
+    Tag* a = new( &arena ) Tag( "foo" );
+    Tag* b = new( &arena ) Tag( a, "bar", "abc" );
+    b->addAttribute( new( &arena ) Tag::Attribute( "attr", "value" ) );
+    new Tag( a, "heap", "xyz" );
+    Tag* c = a->clone();
+    const std::string xml = a->xml();
+    const size_t used = arena.used();
+    delete a;
+    arena.reset();
+    if( used == 0 || arena.used() != 0
+        || xml != "<foo><bar attr='value'>abc</bar><heap>xyz</heap></foo>" || c->xml() != xml )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), c->xml().c_str() );
+    }
+    delete c;
+  }
+
+  //-------
+  {
+    name = "xml( std::string& )";
+    Tag* a = new Tag( "foo", "xmlns", "abc" );
+    a->setPrefix( "p" );
+    Tag* b = new Tag( a, "bar", "<&>" );
+    b->addAttribute( "attr", "'value'" );
+    new Tag( b, "empty" );
+    new Tag( a, "" );
+    a->addCData( "xyz" );
+    std::string xml = "prefix";
+    a->xml( xml );
+    if( xml != "prefix" + a->xml()
+        || xml != "prefix<p:foo xmlns='abc'><bar attr='&apos;value&apos;'>&lt;&amp;&gt;<empty/></bar>xyz</p:foo>" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %s\n", name.c_str(), xml.c_str() );
+    }
+    delete a;
+  }
+
 
 
 
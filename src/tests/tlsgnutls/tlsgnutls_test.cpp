@@ -12,6 +12,7 @@
 
 #include "../../gloox.h"
 #include "../../tlshandler.h"
+#include "../../tlsgnutlsclient.h"
 #include "../../tlsgnutlsclientanon.h"
 #include "../../tlsgnutlsserveranon.h"
 using namespace gloox;
@@ -20,6 +21,10 @@ using namespace gloox;
 #include <locale.h>
 #include <string>
 #include <cstdio> // [s]print[f]
+#include <cstring>
+#include <algorithm>
+#include <errno.h>
+#include <time.h>
 
 #include "../../config.h"
 
@@ -36,6 +41,8 @@ class GnuTLSTest : TLSHandler
 
     bool handshake();
     std::string send( const std::string& txt );
+    int decryptedCalls() const { return m_clientDecryptedCalls; }
+    void setBufferSize( int size ) { m_client->setBufferSize( size ); m_server->setBufferSize( size ); }
   private:
     void printfCert( CertInfo &certinfo );
     void loop();
@@ -45,6 +52,7 @@ class GnuTLSTest : TLSHandler
     std::string m_serverToClient;
     std::string m_clientDecrypted;
     std::string m_serverDecrypted;
+    int m_clientDecryptedCalls;
     bool m_clientHandshake;
     bool m_clientHandshakeResult;
     bool m_serverHandshake;
@@ -52,7 +60,7 @@ class GnuTLSTest : TLSHandler
 };
 
 GnuTLSTest::GnuTLSTest()
- : m_clientHandshake( false ), m_clientHandshakeResult( false ),
+ : m_clientDecryptedCalls( 0 ), m_clientHandshake( false ), m_clientHandshakeResult( false ),
    m_serverHandshake( false ), m_serverHandshakeResult( false )
 {
   m_client = new GnuTLSClientAnon( this );
@@ -130,6 +138,7 @@ void GnuTLSTest::handleDecryptedData( const TLSBase* base, const std::string& da
   {
 //     printf( "recv decrypted data from client: %d\n", data.length() );
     m_clientDecrypted += data;
+    ++m_clientDecryptedCalls;
 //     printf( "m_clientDecrypted: %d\n", m_clientDecrypted.length() );
     return;
   }
@@ -189,6 +198,171 @@ std::string GnuTLSTest::send( const std::string& txt )
   return t;
 }
 
+// a certificate-based server built directly on GnuTLS, with session tickets enabled, and a
+// GnuTLSClient talking to it. the server's certificate is self-signed and generated on the fly.
+class ResumeTest : TLSHandler
+{
+  public:
+    ResumeTest();
+    ~ResumeTest();
+    virtual void handleEncryptedData( const TLSBase* base, const std::string& data );
+    virtual void handleDecryptedData( const TLSBase* base, const std::string& data );
+    virtual void handleHandshakeResult( const TLSBase* base, bool success, CertInfo &certinfo );
+
+    // (re)connects the client to a fresh server session, returns whether the handshake succeeded
+    bool connect();
+    bool resumed() const { return m_resumed; }
+
+  private:
+    static ssize_t serverPush( gnutls_transport_ptr_t ptr, const void* data, size_t len );
+    static ssize_t serverPull( gnutls_transport_ptr_t ptr, void* data, size_t len );
+    void loop();
+
+    GnuTLSClient* m_client;
+    gnutls_session_t m_server;
+    gnutls_certificate_credentials_t m_credentials;
+    gnutls_x509_privkey_t m_key;
+    gnutls_x509_crt_t m_cert;
+    gnutls_datum_t m_ticketKey;
+    std::string m_clientToServer;
+    std::string m_serverToClient;
+    std::string m_clientDecrypted;
+    bool m_serverSession;
+    bool m_serverHandshakeResult;
+    bool m_serverHandshake;
+    bool m_clientHandshakeResult;
+    bool m_clientHandshake;
+    bool m_resumed;
+};
+
+ResumeTest::ResumeTest()
+  : m_serverSession( false ), m_serverHandshakeResult( false ), m_serverHandshake( false ),
+    m_clientHandshakeResult( false ), m_clientHandshake( false ), m_resumed( false )
+{
+  gnutls_x509_privkey_init( &m_key );
+  gnutls_x509_privkey_generate( m_key, GNUTLS_PK_ECDSA,
+                                GNUTLS_CURVE_TO_BITS( GNUTLS_ECC_CURVE_SECP256R1 ), 0 );
+  gnutls_x509_crt_init( &m_cert );
+  gnutls_x509_crt_set_version( m_cert, 3 );
+  gnutls_x509_crt_set_serial( m_cert, "\x01", 1 );
+  gnutls_x509_crt_set_dn_by_oid( m_cert, GNUTLS_OID_X520_COMMON_NAME, 0, "localhost", 9 );
+  gnutls_x509_crt_set_activation_time( m_cert, time( 0 ) - 3600 );
+  gnutls_x509_crt_set_expiration_time( m_cert, time( 0 ) + 3600 );
+  gnutls_x509_crt_set_key( m_cert, m_key );
+  gnutls_x509_crt_sign2( m_cert, m_cert, m_key, GNUTLS_DIG_SHA256, 0 );
+
+  gnutls_certificate_allocate_credentials( &m_credentials );
+  gnutls_certificate_set_x509_key( m_credentials, &m_cert, 1, m_key );
+  gnutls_session_ticket_key_generate( &m_ticketKey );
+
+  m_client = new GnuTLSClient( this, "localhost" );
+  m_client->init();
+}
+
+ResumeTest::~ResumeTest()
+{
+  delete m_client;
+  if( m_serverSession )
+    gnutls_deinit( m_server );
+  gnutls_free( m_ticketKey.data );
+  gnutls_certificate_free_credentials( m_credentials );
+  gnutls_x509_crt_deinit( m_cert );
+  gnutls_x509_privkey_deinit( m_key );
+}
+
+bool ResumeTest::connect()
+{
+  if( m_serverSession )
+  {
+    m_client->cleanup(); // keeps the session for resumption
+    gnutls_deinit( m_server );
+  }
+  m_clientToServer = m_serverToClient = m_clientDecrypted = "";
+  m_serverHandshakeResult = m_serverHandshake = m_clientHandshakeResult = m_clientHandshake = m_resumed = false;
+
+  gnutls_init( &m_server, GNUTLS_SERVER );
+  m_serverSession = true;
+  gnutls_set_default_priority( m_server );
+  gnutls_credentials_set( m_server, GNUTLS_CRD_CERTIFICATE, m_credentials );
+  gnutls_session_ticket_enable_server( m_server, &m_ticketKey );
+  gnutls_transport_set_ptr( m_server, this );
+  gnutls_transport_set_push_function( m_server, serverPush );
+  gnutls_transport_set_pull_function( m_server, serverPull );
+
+  m_client->handshake();
+  for( int i = 0; i < 100 && !( m_clientHandshakeResult && m_serverHandshakeResult ); ++i )
+    loop();
+
+  // with TLS 1.3 the ticket comes after the handshake, along with the first data
+  const char ping[] = "ping";
+  gnutls_record_send( m_server, ping, 4 );
+  for( int i = 0; i < 100 && m_clientDecrypted.empty(); ++i )
+    loop();
+
+  return m_clientHandshake && m_serverHandshake && m_clientDecrypted == ping;
+}
+
+void ResumeTest::loop()
+{
+  if( !m_serverHandshakeResult )
+  {
+    const int ret = gnutls_handshake( m_server );
+    m_serverHandshakeResult = ret == GNUTLS_E_SUCCESS || gnutls_error_is_fatal( ret );
+    m_serverHandshake = ret == GNUTLS_E_SUCCESS;
+  }
+  else if( !m_clientToServer.empty() )
+  {
+    char buf[1024];
+    while( gnutls_record_recv( m_server, buf, sizeof( buf ) ) > 0 )
+      ;
+  }
+
+  if( !m_serverToClient.empty() )
+  {
+    const std::string data = m_serverToClient;
+    m_serverToClient = "";
+    m_client->decrypt( data );
+  }
+}
+
+ssize_t ResumeTest::serverPush( gnutls_transport_ptr_t ptr, const void* data, size_t len )
+{
+  static_cast<ResumeTest*>( ptr )->m_serverToClient.append( static_cast<const char*>( data ), len );
+  return static_cast<ssize_t>( len );
+}
+
+ssize_t ResumeTest::serverPull( gnutls_transport_ptr_t ptr, void* data, size_t len )
+{
+  ResumeTest* t = static_cast<ResumeTest*>( ptr );
+  if( t->m_clientToServer.empty() )
+  {
+    gnutls_transport_set_errno( t->m_server, EAGAIN );
+    return -1;
+  }
+
+  const size_t size = std::min( len, t->m_clientToServer.length() );
+  memcpy( data, t->m_clientToServer.data(), size );
+  t->m_clientToServer.erase( 0, size );
+  return static_cast<ssize_t>( size );
+}
+
+void ResumeTest::handleEncryptedData( const TLSBase* /*base*/, const std::string& data )
+{
+  m_clientToServer += data;
+}
+
+void ResumeTest::handleDecryptedData( const TLSBase* /*base*/, const std::string& data )
+{
+  m_clientDecrypted += data;
+}
+
+void ResumeTest::handleHandshakeResult( const TLSBase* /*base*/, bool success, CertInfo& certinfo )
+{
+  m_clientHandshakeResult = true;
+  m_clientHandshake = success;
+  m_resumed = certinfo.resumed;
+}
+
 int main( int /*argc*/, char** /*argv*/ )
 {
   int fail = 0;
@@ -203,6 +377,15 @@ int main( int /*argc*/, char** /*argv*/ )
     fprintf( stderr, "test '%s' failed\n", name.c_str() );
   }
 
+  // -------
+  name = "handshake statistics";
+  TLSBase::HandshakeStatistics stats = GnuTLSBase::handshakeStatistics();
+  if( stats.full != 2 || stats.resumed != 0 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed: %d full, %d resumed\n", name.c_str(), stats.full, stats.resumed );
+  }
+
   // -------
   name = "simple send";
   std::string text( "text" );
@@ -233,6 +416,24 @@ int main( int /*argc*/, char** /*argv*/ )
   // -------
   name = "larger send";
   text = std::string( 170000, 'x' );
+  int calls = t->decryptedCalls();
+  if( t->send( text ) != text )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+
+  // -------
+  name = "larger send, decrypted data in one piece";
+  if( t->decryptedCalls() != calls + 1 )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed: %d calls\n", name.c_str(), t->decryptedCalls() - calls );
+  }
+
+  // -------
+  name = "larger send, small buffer";
+  t->setBufferSize( 1000 );
   if( t->send( text ) != text )
   {
     ++fail;
@@ -245,6 +446,37 @@ int main( int /*argc*/, char** /*argv*/ )
 
   delete t;
 
+  // -------
+  {
+    name = "GnuTLSClient: first connection";
+    ResumeTest r;
+    const TLSBase::HandshakeStatistics before = GnuTLSBase::handshakeStatistics();
+    if( !r.connect() || r.resumed() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "GnuTLSClient: reconnect resumes the cached session";
+    if( !r.connect() || !r.resumed() )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+
+    // -------
+    name = "GnuTLSClient: handshake statistics";
+    // the server side isn't a GnuTLSBase, so only the client's handshakes count
+    const TLSBase::HandshakeStatistics after = GnuTLSBase::handshakeStatistics();
+    if( after.full != before.full + 1 || after.resumed != before.resumed + 1 )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed: %d full, %d resumed\n", name.c_str(),
+               after.full - before.full, after.resumed - before.resumed );
+    }
+  }
+
 
 
 
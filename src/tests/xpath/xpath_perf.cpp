@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2004-2017 by Jakob Schröter <js@camaya.net>
+ *  This file is part of the gloox library. http://camaya.net/gloox
+ *
+ *  This software is distributed under a license. The full license
+ *  agreement can be found in the file LICENSE in this distribution.
+ *  This software may not be copied, modified, sold or distributed
+ *  other than expressed in the named license agreement.
+ *
+ *  This software is distributed without any warranty.
+ */
+
+#ifndef _WIN32
+
+#include "../../tag.h"
+using namespace gloox;
+
+#include <stdio.h>
+#include <locale.h>
+#include <string>
+#include <cstdio> // [s]print[f]
+
+#include <sys/time.h>
+
+static double divider = 1000000;
+static int num = 25000;
+static double t;
+
+static void printTime ( const char * testName, struct timeval tv1, struct timeval tv2 )
+{
+  t = tv2.tv_sec - tv1.tv_sec;
+  t +=  ( tv2.tv_usec - tv1.tv_usec ) / divider;
+  printf( "%s: %.03f seconds (%.00f/s)\n", testName, t, num / t );
+}
+
+// <presence from='room@conference.example.net/nick' to='user@example.net/res'>
+//   <c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://camaya.net/gloox' ver='abc'/>
+//   <x xmlns='http://jabber.org/protocol/muc#user'>
+//     <item affiliation='member' role='participant'/>
+//     <status code='110'/>
+//   </x>
+// </presence>
+static Tag* newPresence()
+{
+  Tag* p = new Tag( "presence" );
+  p->addAttribute( "from", "room@conference.example.net/nick" );
+  p->addAttribute( "to", "user@example.net/res" );
+  Tag* c = new Tag( p, "c", XMLNS, "http://jabber.org/protocol/caps" );
+  c->addAttribute( "hash", "sha-1" );
+  c->addAttribute( "node", "http://camaya.net/gloox" );
+  c->addAttribute( "ver", "abc" );
+  Tag* x = new Tag( p, "x", XMLNS, "http://jabber.org/protocol/muc#user" );
+  Tag* i = new Tag( x, "item" );
+  i->addAttribute( "affiliation", "member" );
+  i->addAttribute( "role", "participant" );
+  new Tag( x, "status", "code", "110" );
+  return p;
+}
+
+// <message from='pubsub.example.net' to='user@example.net'>
+//   <event xmlns='http://jabber.org/protocol/pubsub#event'>
+//     <items node='node'>
+//       <item id='1'><entry xmlns='http://www.w3.org/2005/Atom'><title>foo</title></entry></item>
+//       ...
+//     </items>
+//   </event>
+// </message>
+static Tag* newMessage()
+{
+  Tag* m = new Tag( "message" );
+  m->addAttribute( "from", "pubsub.example.net" );
+  m->addAttribute( "to", "user@example.net" );
+  Tag* e = new Tag( m, "event", XMLNS, "http://jabber.org/protocol/pubsub#event" );
+  Tag* is = new Tag( e, "items", "node", "node" );
+  for( int n = 0; n < 5; ++n )
+  {
+    Tag* i = new Tag( is, "item", "id", "1" );
+    Tag* a = new Tag( i, "entry", XMLNS, "http://www.w3.org/2005/Atom" );
+    new Tag( a, "title", "foo" );
+  }
+  return m;
+}
+
+static void testExpression( Tag* tag, const std::string& expression )
+{
+  struct timeval tv1;
+  struct timeval tv2;
+
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    tag->findTagList( expression );
+  }
+  gettimeofday( &tv2, 0 );
+  printTime( ( "string:   " + expression ).c_str(), tv1, tv2 );
+
+  const TagPath path( expression );
+  gettimeofday( &tv1, 0 );
+  for( int i = 0; i < num; ++i )
+  {
+    tag->findTagList( path );
+  }
+  gettimeofday( &tv2, 0 );
+  printTime( ( "compiled: " + expression ).c_str(), tv1, tv2 );
+}
+
+int main( int /*argc*/, char** /*argv*/ )
+{
+  printf( "Testing %d...\n", num );
+
+  Tag* tag = newPresence();
+  testExpression( tag, "/presence/c[@xmlns='http://jabber.org/protocol/caps']" );
+  testExpression( tag, "/presence/x[@xmlns='http://jabber.org/protocol/muc#user']"
+                       "|/message/x[@xmlns='http://jabber.org/protocol/muc#user']" );
+  testExpression( tag, "/iq/query[@xmlns='http://jabber.org/protocol/disco#info']" );
+  delete tag;
+
+  tag = newMessage();
+  testExpression( tag, "/message/event[@xmlns='http://jabber.org/protocol/pubsub#event']" );
+  testExpression( tag, "//item/entry/title" );
+  delete tag;
+
+  return 0;
+}
+#else
+int main( int, char** ) { return 0; }
+#endif
@@ -938,6 +938,44 @@ int main( int /*argc*/, char** /*argv*/ )
 
 
 
+  // -------
+  {
+    name = "compiled paths";
+    const char* expressions[] = { "/*", "/*/*", "//bbb", "/*/../*", "//ggg/..", "//ggg/../..//bbb",
+                                  "//*/*/..//*", "//bbb[2]", "//bbb[@name='b1']|//hhh[@name='h1']",
+                                  "//bbb[hhh]", "/aaa/bbb[1]", "/../*", "/", "//", 0 };
+    for( int i = 0; expressions[i]; ++i )
+    {
+      const TagPath path( expressions[i] );
+      // evaluate twice to make sure evaluation does not alter the compiled path
+      for( int j = 0; j < 2; ++j )
+      {
+        result = aaa->findTagList( path );
+        if( result != aaa->findTagList( expressions[i] ) )
+        {
+          ++fail;
+          printResult( name, result );
+          fprintf( stderr, "test '%s: %s' failed\n", name.c_str(), expressions[i] );
+        }
+      }
+    }
+  }
+
+  // -------
+  {
+    name = "compiled path: findTag/findCData";
+    TagPath path( "/aaa/ccc/ddd" );
+    TagPath copy( "/aaa/bbb" );
+    copy = path;
+    const TagPath copy2( copy );
+    if( aaa->findTag( copy2 ) != ddd || eee->findCData( copy ) != "bcd"
+        || copy2.expression() != "/aaa/ccc/ddd" )
+    {
+      ++fail;
+      fprintf( stderr, "test '%s' failed\n", name.c_str() );
+    }
+  }
+
   delete aaa;
 
   if( fail == 0 )
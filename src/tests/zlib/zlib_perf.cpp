@@ -21,6 +21,7 @@ using namespace gloox;
 #include <stdio.h>
 #include <locale.h>
 #include <cstdlib>
+#include <ctime>
 #include <string>
 #include <sys/time.h>
 #include <cstdio> // [s]print[f]
@@ -30,30 +31,31 @@ using namespace gloox;
 class ZlibTest : public CompressionDataHandler
 {
   public:
-    ZlibTest() : m_zlib( this ) {}
+    ZlibTest( int level ) : m_decompressed( 0 ), m_zlib( this, level ) { m_zlib.init(); }
     ~ZlibTest() {}
     void handleCompressedData( const std::string& data )
-      { m_zlib.decompress( data ); }
+      { m_compressed += data; }
     void handleDecompressedData( const std::string& data )
-      { m_decompressed += data; }
-    const std::string data()
-      { std::string ret = m_decompressed; m_decompressed = ""; return ret; }
-    void compress(  const std::string& data )
+      { m_decompressed += data.length(); }
+    void compress( const std::string& data )
       { m_zlib.compress( data ); }
+    void decompress( const std::string& data )
+      { m_zlib.decompress( data ); }
+    std::string m_compressed;
+    std::string::size_type m_decompressed;
   private:
     CompressionZlib m_zlib;
-    std::string m_decompressed;
 };
 
 static const double divider = 1000000;
-static const int num = 250;
+static const double total = 25 * 1048576; // bytes per test and direction
 static double t;
 
-static void printTime ( const char * testName, struct timeval tv1, struct timeval tv2 )
+static void printTime ( const char * testName, struct timeval tv1, struct timeval tv2, double bytes )
 {
   t = tv2.tv_sec - tv1.tv_sec;
   t +=  ( tv2.tv_usec - tv1.tv_usec ) / divider;
-  printf( "%s: %.03f seconds (%.00f/s)\n", testName, t, num / t );
+  printf( "%s: %.03f seconds (%.01f MB/s)\n", testName, t, bytes / t / 1048576 );
 }
 
 static const int sz_max = 1000000;
@@ -75,50 +77,73 @@ static void randomize( const int size )
   values[size] = 0;
 }
 
-int main( int, char** )
+static std::string stanzas( const std::string::size_type size )
 {
-//   int fail = 0;
-  std::string name;
-  ZlibTest t;
+  std::string s;
+  for( int i = 0; s.length() < size; ++i )
+  {
+    s += "<message to='juliet@capulet.lit/balcony' from='romeo@montague.lit/orchard' type='chat' id='";
+    s += char( 'a' + i % 26 );
+    s += "'><body>Art thou not Romeo, and a Montague?</body>"
+         "<active xmlns='http://jabber.org/protocol/chatstates'/></message>";
+  }
+  return s.substr( 0, size );
+}
 
+static void test( const char* name, const std::string& data, int level )
+{
   struct timeval tv1;
   struct timeval tv2;
+  char n[100];
+  ZlibTest z( level );
 
-  printf("testing %d run of 10^{4,5,6}...\n", num);
-
-  // -------
-  randomize( 10000 );
-  std::string s (values);
+  const int runs = static_cast<int>( total / static_cast<double>( data.length() ) );
   gettimeofday( &tv1, 0 );
-  for (int x=0; x<num; ++x)
+  for( int x = 0; x < runs; ++x )
   {
-    t.compress( s );
+    z.compress( data );
   }
   gettimeofday( &tv2, 0 );
-  printTime( "small", tv1, tv2 );
+  sprintf( n, "%s, level %d, compress", name, level );
+  printTime( n, tv1, tv2, static_cast<double>( data.length() * static_cast<std::string::size_type>( runs ) ) );
 
-  // -------
-  randomize( 100000 );
-  s = values;
+  // feed the compressed stream in chunks, as read from a socket
+  const std::string::size_type chunk = 4096;
+  const std::string compressed = z.m_compressed;
   gettimeofday( &tv1, 0 );
-  for (int x=0; x<num; ++x)
+  for( std::string::size_type pos = 0; pos < compressed.length(); pos += chunk )
   {
-    t.compress( s );
+    z.decompress( compressed.substr( pos, chunk ) );
   }
   gettimeofday( &tv2, 0 );
-  printTime( "medium", tv1, tv2 );
+  sprintf( n, "%s, level %d, decompress (%.01f%%)", name, level,
+           100.0 * static_cast<double>( compressed.length() ) / static_cast<double>( z.m_decompressed ) );
+  printTime( n, tv1, tv2, static_cast<double>( z.m_decompressed ) );
+}
+
+int main( int, char** )
+{
+  printf( "testing %.00f MB per direction...\n", total / 1048576 );
+
+  // -------
+  const std::string s = stanzas( 1000 );
+  test( "stanzas 10^3", s, Z_BEST_COMPRESSION );
+  test( "stanzas 10^3", s, Z_DEFAULT_COMPRESSION );
+  test( "stanzas 10^3", s, Z_BEST_SPEED );
+
+  // -------
+  randomize( 10000 );
+  std::string r( values );
+  test( "random 10^4", r, Z_BEST_COMPRESSION );
+  test( "random 10^4", r, Z_BEST_SPEED );
 
   // -------
   randomize( 1000000 );
-  s = values;
-  gettimeofday( &tv1, 0 );
-  for (int x=0; x<num; ++x)
-  {
-    t.compress( s );
-  }
-  gettimeofday( &tv2, 0 );
-  printTime( "large", tv1, tv2 );
+  r = values;
+  test( "random 10^6", r, Z_BEST_COMPRESSION );
+  test( "random 10^6", r, Z_BEST_SPEED );
 
+  return 0;
 }
 
 #else
@@ -32,6 +32,9 @@ class ZlibTest : public CompressionDataHandler
     virtual void handleDecompressedData( const std::string& data );
     const std::string data() { std::string ret = m_decompressed; m_decompressed = ""; return ret; }
     void compress(  const std::string& data );
+    void setParameters( int level, int strategy ) { m_zlib.setParameters( level, strategy ); }
+    int level() const { return m_zlib.level(); }
+    int strategy() const { return m_zlib.strategy(); }
   private:
     CompressionZlib m_zlib;
     std::string m_decompressed;
@@ -110,6 +113,35 @@ int main( int /*argc*/, char** /*argv*/ )
     fprintf( stderr, "test '%s' failed\n", name.c_str() );
   }
 
+  // -------
+  name = "change parameters mid-stream";
+  std::string e;
+  for( int i = 0; i < 2000; ++i )
+    e += "<message to='foo@bar' id='" + std::string( 1, char( 'a' + i % 26 ) ) + "'><body>hi</body></message>";
+  t.compress( e );
+  t.setParameters( Z_BEST_SPEED, Z_DEFAULT_STRATEGY );
+  t.compress( e );
+  t.setParameters( Z_DEFAULT_COMPRESSION, Z_FILTERED );
+  t.compress( a );
+  t.setParameters( Z_NO_COMPRESSION, Z_HUFFMAN_ONLY );
+  t.compress( e );
+  if( t.data() != e + e + a + e )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+
+  // -------
+  name = "invalid parameters";
+  t.setParameters( 42, Z_FILTERED );
+  const bool pending = t.level() == 42 && t.strategy() == Z_FILTERED;
+  t.compress( a );
+  if( !pending || t.level() != Z_NO_COMPRESSION || t.strategy() != Z_HUFFMAN_ONLY || t.data() != a )
+  {
+    ++fail;
+    fprintf( stderr, "test '%s' failed\n", name.c_str() );
+  }
+
 
 
 
@@ -31,6 +31,15 @@ namespace gloox
   class GLOOX_API TLSBase
   {
     public:
+      /**
+       * @brief Process-wide handshake counters, see TLSDefault::handshakeStatistics().
+       */
+      struct HandshakeStatistics
+      {
+        int full;                   /**< Handshakes that negotiated a new session. */
+        int resumed;                /**< Handshakes that resumed a cached session. */
+      };
+
       /**
        * Constructor.
        * @param th The TLSHandler to handle TLS-related events.
@@ -38,7 +47,7 @@ namespace gloox
        */
       TLSBase( TLSHandler* th, const std::string server )
         : m_handler( th ), m_server( server ), m_secure( false ), m_valid( false ), m_initLib( true )
-      {}
+      { m_certInfo.resumed = false; }
 
       /**
        * Virtual destructor.
@@ -142,6 +151,17 @@ namespace gloox
        */
       virtual void setClientCert( const std::string& clientKey, const std::string& clientCerts ) = 0;
 
+      /**
+       * Sets the size of the buffer used to move data in and out of the TLS library. Larger
+       * buffers mean fewer calls to the TLSHandler for bulk transfers (e.g. file transfer over
+       * a TLS-secured stream). Implementations that don't use such a buffer ignore this.
+       * Call this before init().
+       * @param size The buffer size in bytes. The default depends on the implementation
+       * (64 KiB for GnuTLS and OpenSSL).
+       * @since 1.1
+       */
+      virtual void setBufferSize( int size ) { (void)size; }
+
     protected:
       TLSHandler* m_handler;
       StringList m_cacerts;
@@ -96,6 +96,20 @@ namespace gloox
     return types;
   }
 
+  TLSBase::HandshakeStatistics TLSDefault::handshakeStatistics()
+  {
+#ifdef HAVE_GNUTLS
+    return GnuTLSBase::handshakeStatistics();
+#elif defined( HAVE_OPENSSL )
+    return OpenSSLBase::handshakeStatistics();
+#else
+    HandshakeStatistics stats;
+    stats.full = 0;
+    stats.resumed = 0;
+    return stats;
+#endif
+  }
+
   bool TLSDefault::encrypt( const std::string& data )
   {
     return m_impl ? m_impl->encrypt( data ) : false;
@@ -149,4 +163,10 @@ namespace gloox
       m_impl->setClientCert( clientKey, clientCerts );
   }
 
+  void TLSDefault::setBufferSize( int size )
+  {
+    if( m_impl )
+      m_impl->setBufferSize( size );
+  }
+
 }
@@ -96,12 +96,28 @@ namespace gloox
       // reimplemented from TLSBase
       virtual void setClientCert( const std::string& clientKey, const std::string& clientCerts );
 
+      // reimplemented from TLSBase
+      virtual void setBufferSize( int size );
+
       /**
        * Returns an ORed list of supported TLS types.
        * @return ORed TLSDefault::type members.
        */
       static int types();
 
+      /**
+       * Returns how many handshakes all TLS objects in the process have performed, split into
+       * full handshakes and resumed sessions. Client sessions are cached per server, so that
+       * a reconnect (e.g. ClientBase::connect() after a dropped connection) can resume the
+       * previous session instead of running a full handshake. Objects with the same
+       * certificate configuration also share their TLS library context, so CA certificates
+       * are loaded only once.
+       * @return The handshake statistics. Both counters are 0 if resumption is not supported
+       * by the TLS implementation.
+       * @since 1.1
+       */
+      static HandshakeStatistics handshakeStatistics();
+
     private:
       TLSBase* m_impl;
 
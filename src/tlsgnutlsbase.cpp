@@ -16,6 +16,8 @@
 
 #ifdef HAVE_GNUTLS
 
+#include "mutexguard.h"
+
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,8 +26,16 @@
 namespace gloox
 {
 
+  namespace
+  {
+    util::Mutex s_statsMutex;
+    int s_fullHandshakes = 0;
+    int s_resumedHandshakes = 0;
+  }
+
   GnuTLSBase::GnuTLSBase( TLSHandler* th, const std::string& server )
-    : TLSBase( th, server ), m_session( new gnutls_session_t ), m_buf( 0 ), m_bufsize( 17000 )
+    : TLSBase( th, server ), m_session( new gnutls_session_t ), m_recvOffset( 0 ),
+      m_collect( false ), m_buf( 0 ), m_bufsize( 65536 )
   {
     m_buf = static_cast<char*>( calloc( m_bufsize + 1, sizeof( char ) ) );
   }
@@ -42,6 +52,19 @@ namespace gloox
 //     gnutls_global_deinit();
   }
 
+  void GnuTLSBase::setBufferSize( int size )
+  {
+    if( size <= 0 || size == m_bufsize )
+      return;
+
+    char* buf = static_cast<char*>( realloc( m_buf, size + 1 ) );
+    if( !buf )
+      return;
+
+    m_buf = buf;
+    m_bufsize = size;
+  }
+
   bool GnuTLSBase::encrypt( const std::string& data )
   {
     if( !m_secure )
@@ -50,15 +73,30 @@ namespace gloox
       return true;
     }
 
+    // all records go out in one piece
+    m_collect = true;
+
     ssize_t ret = 0;
     std::string::size_type sum = 0;
     do
     {
       ret = gnutls_record_send( *m_session, data.c_str() + sum, data.length() - sum );
-      sum += ret;
+      if( ret > 0 )
+        sum += ret;
     }
-    while( ( ret == GNUTLS_E_AGAIN ) || ( ret == GNUTLS_E_INTERRUPTED ) || sum < data.length() );
-    return true;
+    while( ( ret == GNUTLS_E_AGAIN ) || ( ret == GNUTLS_E_INTERRUPTED )
+           || ( ret > 0 && sum < data.length() ) );
+
+    m_collect = false;
+
+    if( !m_encrypted.empty() && m_handler )
+    {
+      std::string out;
+      out.swap( m_encrypted );
+      m_handler->handleEncryptedData( this, out );
+    }
+
+    return ret >= 0;
   }
 
   int GnuTLSBase::decrypt( const std::string& data )
@@ -73,17 +111,31 @@ namespace gloox
 
     int sum = 0;
     int ret = 0;
+    std::string::size_type avail = 0;
     do
     {
+      avail = m_recvBuffer.length() - m_recvOffset;
       ret = static_cast<int>( gnutls_record_recv( *m_session, m_buf, m_bufsize ) );
 
-      if( ret > 0 && m_handler )
+      if( ret > 0 )
       {
-        m_handler->handleDecryptedData( this, std::string( m_buf, ret ) );
+        m_decrypted.append( m_buf, ret );
         sum += ret;
       }
     }
-    while( ret > 0 );
+    // post-handshake messages (e.g. TLS 1.3 session tickets) make gnutls_record_recv()
+    // return GNUTLS_E_AGAIN even if more records are waiting
+    while( ret > 0 || ( ( ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED )
+                        && m_recvBuffer.length() - m_recvOffset < avail
+                        && m_recvBuffer.length() - m_recvOffset > 0 ) );
+
+    if( !m_decrypted.empty() && m_handler )
+    {
+      // the handler may feed more data in
+      std::string out;
+      out.swap( m_decrypted );
+      m_handler->handleDecryptedData( this, out );
+    }
 
     return sum;
   }
@@ -135,12 +187,30 @@ namespace gloox
 
     m_secure = true;
 
+    m_certInfo.resumed = gnutls_session_is_resumed( *m_session ) != 0;
+    {
+      util::MutexGuard mg( s_statsMutex );
+      if( m_certInfo.resumed )
+        ++s_resumedHandshakes;
+      else
+        ++s_fullHandshakes;
+    }
+
     getCertInfo();
 
     m_handler->handleHandshakeResult( this, true, m_certInfo );
     return true;
   }
 
+  TLSBase::HandshakeStatistics GnuTLSBase::handshakeStatistics()
+  {
+    util::MutexGuard mg( s_statsMutex );
+    HandshakeStatistics stats;
+    stats.full = s_fullHandshakes;
+    stats.resumed = s_resumedHandshakes;
+    return stats;
+  }
+
   bool GnuTLSBase::hasChannelBinding() const
   {
 #ifdef HAVE_GNUTLS_SESSION_CHANNEL_BINDING
@@ -165,11 +235,23 @@ namespace gloox
 
   ssize_t GnuTLSBase::pullFunc( void* data, size_t len )
   {
-    ssize_t cpy = ( len > m_recvBuffer.length() ) ? ( m_recvBuffer.length() ) : ( len );
+    const std::string::size_type avail = m_recvBuffer.length() - m_recvOffset;
+    ssize_t cpy = ( len > avail ) ? ( avail ) : ( len );
     if( cpy > 0 )
     {
-      memcpy( data, static_cast<const void*>( m_recvBuffer.c_str() ), cpy );
-      m_recvBuffer.erase( 0, cpy );
+      memcpy( data, static_cast<const void*>( m_recvBuffer.data() + m_recvOffset ), cpy );
+      m_recvOffset += cpy;
+      // compact once the consumed part outweighs the rest, not on every read
+      if( m_recvOffset == m_recvBuffer.length() )
+      {
+        m_recvBuffer.clear();
+        m_recvOffset = 0;
+      }
+      else if( m_recvOffset > m_recvBuffer.length() / 2 )
+      {
+        m_recvBuffer.erase( 0, m_recvOffset );
+        m_recvOffset = 0;
+      }
       return cpy;
     }
     else
@@ -186,7 +268,9 @@ namespace gloox
 
   ssize_t GnuTLSBase::pushFunc( const void* data, size_t len )
   {
-    if( m_handler )
+    if( m_collect )
+      m_encrypted.append( static_cast<const char*>( data ), len );
+    else if( m_handler )
       m_handler->handleEncryptedData( this, std::string( static_cast<const char*>( data ), len ) );
 
     return len;
@@ -74,14 +74,29 @@ namespace gloox
       // reimplemented from TLSBase
       virtual void setClientCert( const std::string& /*clientKey*/, const std::string& /*clientCerts*/ ) {}
 
+      // reimplemented from TLSBase
+      virtual void setBufferSize( int size );
+
+      /**
+       * Returns the number of full and resumed handshakes of all GnuTLS-based TLS objects
+       * in the process.
+       * @return The handshake statistics.
+       * @since 1.1
+       */
+      static HandshakeStatistics handshakeStatistics();
+
     protected:
       virtual void getCertInfo() {}
 
       gnutls_session_t* m_session;
 
       std::string m_recvBuffer;
+      std::string::size_type m_recvOffset;  // start of the unread part of m_recvBuffer
+      std::string m_decrypted;
+      std::string m_encrypted;
+      bool m_collect;                       // whether pushFunc() collects into m_encrypted
       char* m_buf;
-      const int m_bufsize;
+      int m_bufsize;
 
       ssize_t pullFunc( void* data, size_t len );
       static ssize_t pullFunc( gnutls_transport_ptr_t ptr, void* data, size_t len );
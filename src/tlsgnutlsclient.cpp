@@ -16,44 +16,131 @@
 
 #ifdef HAVE_GNUTLS
 
+#include "mutexguard.h"
+
 #include <errno.h>
 
+#include <map>
+
 namespace gloox
 {
 
+  namespace
+  {
+    // credentials shared by all GnuTLSClient instances with the same certificates
+    struct SharedCredentials
+    {
+      gnutls_certificate_credentials_t credentials;
+      int refs;
+      std::map<std::string, std::string> sessions;  // session data by server, for resumption
+    };
+    typedef std::map<std::string, SharedCredentials*> CredentialsMap;
+
+    CredentialsMap s_credentials;
+    util::Mutex s_credentialsMutex;
+  }
+
   GnuTLSClient::GnuTLSClient( TLSHandler* th, const std::string& server )
-    : GnuTLSBase( th, server )
+    : GnuTLSBase( th, server ), m_credentials( 0 )
   {
   }
 
   GnuTLSClient::~GnuTLSClient()
   {
+    releaseCredentials();
   }
 
   void GnuTLSClient::cleanup()
   {
     GnuTLSBase::cleanup();
     if( m_credentials )
-      gnutls_certificate_free_credentials( m_credentials );
-    init();
+      initSession();
   }
 
-  bool GnuTLSClient::init( const std::string& /*clientKey*/,
-                           const std::string& /*clientCerts*/,
-                           const StringList& /*cacerts*/ )
+  bool GnuTLSClient::init( const std::string& clientKey,
+                           const std::string& clientCerts,
+                           const StringList& cacerts )
   {
     if( m_initLib && gnutls_global_init() != 0 )
       return false;
 
-    if( gnutls_certificate_allocate_credentials( &m_credentials ) < 0 )
+    m_clientKey = clientKey;
+    m_clientCerts = clientCerts;
+    m_cacerts = cacerts;
+
+    if( !acquireCredentials() )
       return false;
 
-    if( gnutls_init( m_session, GNUTLS_CLIENT ) != 0 )
+    return initSession();
+  }
+
+  bool GnuTLSClient::acquireCredentials()
+  {
+    std::string key = m_clientKey + '\n' + m_clientCerts;
+    StringList::const_iterator it = m_cacerts.begin();
+    for( ; it != m_cacerts.end(); ++it )
+      key += '\n' + (*it);
+
+    util::MutexGuard mg( s_credentialsMutex );
+
+    CredentialsMap::iterator itc = s_credentials.find( key );
+    if( itc != s_credentials.end() )
     {
-      gnutls_certificate_free_credentials( m_credentials );
+      ++(*itc).second->refs;
+      m_credentials = (*itc).second->credentials;
+      m_credentialsKey = key;
+      return true;
+    }
+
+    if( gnutls_certificate_allocate_credentials( &m_credentials ) < 0 )
+    {
+      m_credentials = 0;
       return false;
     }
 
+    for( it = m_cacerts.begin(); it != m_cacerts.end(); ++it )
+      gnutls_certificate_set_x509_trust_file( m_credentials, (*it).c_str(), GNUTLS_X509_FMT_PEM );
+
+    if( !m_clientKey.empty() && !m_clientCerts.empty() )
+    {
+      gnutls_certificate_set_x509_key_file( m_credentials, m_clientCerts.c_str(),
+                                            m_clientKey.c_str(), GNUTLS_X509_FMT_PEM );
+    }
+
+    gnutls_certificate_free_ca_names( m_credentials );
+
+    SharedCredentials* sc = new SharedCredentials;
+    sc->credentials = m_credentials;
+    sc->refs = 1;
+    s_credentials.insert( std::make_pair( key, sc ) );
+    m_credentialsKey = key;
+    return true;
+  }
+
+  void GnuTLSClient::releaseCredentials()
+  {
+    if( !m_credentials )
+      return;
+
+    util::MutexGuard mg( s_credentialsMutex );
+
+    CredentialsMap::iterator it = s_credentials.find( m_credentialsKey );
+    if( it != s_credentials.end() && !--(*it).second->refs )
+    {
+      gnutls_certificate_free_credentials( (*it).second->credentials );
+      delete (*it).second;
+      s_credentials.erase( it );
+    }
+
+    m_credentials = 0;
+    m_credentialsKey = EmptyString;
+  }
+
+  bool GnuTLSClient::initSession()
+  {
+    if( gnutls_init( m_session, GNUTLS_CLIENT ) != 0 )
+      return false;
+
 #if GNUTLS_VERSION_NUMBER >= 0x020600
     int ret = gnutls_priority_set_direct( *m_session, "SECURE128:+PFS:+COMP-ALL:+VERS-TLS-ALL:-VERS-SSL3.0:+SIGN-ALL:+CURVE-ALL", 0 );
     if( ret != GNUTLS_E_SUCCESS )
@@ -82,29 +169,98 @@ namespace gloox
     gnutls_transport_set_push_function( *m_session, pushFunc );
     gnutls_transport_set_pull_function( *m_session, pullFunc );
 
+    if( !m_server.empty() )
+    {
+      gnutls_server_name_set( *m_session, GNUTLS_NAME_DNS, m_server.c_str(), m_server.length() );
+
+      util::MutexGuard mg( s_credentialsMutex );
+      CredentialsMap::const_iterator it = s_credentials.find( m_credentialsKey );
+      if( it != s_credentials.end() )
+      {
+        std::map<std::string, std::string>::const_iterator its = (*it).second->sessions.find( m_server );
+        if( its != (*it).second->sessions.end() )
+          gnutls_session_set_data( *m_session, (*its).second.data(), (*its).second.length() );
+      }
+    }
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+    // TLS 1.3 session tickets arrive after the handshake
+    gnutls_session_set_ptr( *m_session, this );
+    gnutls_handshake_set_hook_function( *m_session, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET,
+                                        GNUTLS_HOOK_POST, ticketHook );
+#endif
+
     m_valid = true;
     return true;
   }
 
+  void GnuTLSClient::storeSession()
+  {
+    if( m_server.empty() )
+      return;
+
+    gnutls_datum_t data;
+    if( gnutls_session_get_data2( *m_session, &data ) != GNUTLS_E_SUCCESS )
+      return;
+
+    {
+      util::MutexGuard mg( s_credentialsMutex );
+      CredentialsMap::iterator it = s_credentials.find( m_credentialsKey );
+      if( it != s_credentials.end() )
+        (*it).second->sessions[m_server].assign( reinterpret_cast<const char*>( data.data ), data.size );
+    }
+
+    gnutls_free( data.data );
+  }
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+  int GnuTLSClient::ticketHook( gnutls_session_t session, unsigned int /*htype*/, unsigned /*when*/,
+                                unsigned int incoming, const gnutls_datum_t* /*msg*/ )
+  {
+    GnuTLSClient* client = static_cast<GnuTLSClient*>( gnutls_session_get_ptr( session ) );
+    if( client && incoming && ( gnutls_session_get_flags( session ) & GNUTLS_SFLAGS_SESSION_TICKET ) )
+      client->storeSession();
+    return 0;
+  }
+#endif
+
+  bool GnuTLSClient::handshake()
+  {
+    const bool secure = m_secure;
+    const bool ret = GnuTLSBase::handshake();
+
+    // with TLS 1.3, the session can only be stored once a ticket arrived, see ticketHook()
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+    if( !secure && m_secure && gnutls_protocol_get_version( *m_session ) != GNUTLS_TLS1_3 )
+#else
+    if( !secure && m_secure )
+#endif
+      storeSession();
+
+    return ret;
+  }
+
   void GnuTLSClient::setCACerts( const StringList& cacerts )
   {
     m_cacerts = cacerts;
+    if( !m_credentials )
+      return;
 
-    StringList::const_iterator it = m_cacerts.begin();
-    for( ; it != m_cacerts.end(); ++it )
-      gnutls_certificate_set_x509_trust_file( m_credentials, (*it).c_str(), GNUTLS_X509_FMT_PEM );
+    releaseCredentials();
+    if( acquireCredentials() )
+      gnutls_credentials_set( *m_session, GNUTLS_CRD_CERTIFICATE, m_credentials );
   }
 
   void GnuTLSClient::setClientCert( const std::string& clientKey, const std::string& clientCerts )
   {
     m_clientKey = clientKey;
     m_clientCerts = clientCerts;
+    if( !m_credentials )
+      return;
 
-    if( !m_clientKey.empty() && !m_clientCerts.empty() )
-    {
-      gnutls_certificate_set_x509_key_file( m_credentials, m_clientCerts.c_str(),
-                                            m_clientKey.c_str(), GNUTLS_X509_FMT_PEM );
-    }
+    releaseCredentials();
+    if( acquireCredentials() )
+      gnutls_credentials_set( *m_session, GNUTLS_CRD_CERTIFICATE, m_credentials );
   }
 
   void GnuTLSClient::getCertInfo()
@@ -112,8 +268,6 @@ namespace gloox
     unsigned int status;
     bool error = false;
 
-    gnutls_certificate_free_ca_names( m_credentials );
-
     if( gnutls_certificate_verify_peers2( *m_session, &status ) < 0 )
       error = true;
 
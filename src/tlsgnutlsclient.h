@@ -64,13 +64,28 @@ namespace gloox
       // reimplemented from TLSBase
       virtual void cleanup();
 
+      // reimplemented from TLSBase
+      virtual bool handshake();
+
     private:
       virtual void getCertInfo();
 
+      // m_credentials is shared between all instances with the same certificates,
+      // and so is the cache of sessions to resume
+      bool acquireCredentials();
+      void releaseCredentials();
+      bool initSession();
+      void storeSession();
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+      static int ticketHook( gnutls_session_t session, unsigned int htype, unsigned when,
+                             unsigned int incoming, const gnutls_datum_t* msg );
+#endif
+
       bool verifyAgainst( gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer );
       bool verifyAgainstCAs( gnutls_x509_crt_t cert, gnutls_x509_crt_t *CAList, int CAListSize );
 
       gnutls_certificate_credentials_t m_credentials;
+      std::string m_credentialsKey;
 
   };
 
@@ -20,18 +20,74 @@
 #include <cctype>
 #include <ctime>
 #include <cstdlib>
+#include <map>
 
 #include <openssl/err.h>
 #include <openssl/comp.h>
 #include <openssl/x509v3.h>
 
+#include "mutexguard.h"
+
 #include <string.h>
 
 namespace gloox
 {
 
+  namespace
+  {
+    // marks n bytes at the front of a buffer as used. the buffer is compacted only once
+    // the used part outweighs the rest, which keeps the cost linear in the amount of data
+    void consume( std::string& buffer, std::string::size_type& offset, std::string::size_type n )
+    {
+      offset += n;
+      if( offset >= buffer.length() )
+      {
+        buffer.clear();
+        offset = 0;
+      }
+      else if( offset > buffer.length() / 2 )
+      {
+        buffer.erase( 0, offset );
+        offset = 0;
+      }
+    }
+
+    typedef std::map<std::string, SSL_SESSION*> SessionMap;
+
+    // an SSL_CTX shared by all OpenSSLBase instances with the same role and certificates
+    struct SharedContext
+    {
+      SSL_CTX* ctx;
+      int refs;
+      SessionMap sessions;        // client sessions by server, for resumption
+    };
+    typedef std::map<std::string, SharedContext*> ContextMap;
+
+    ContextMap s_contexts;
+    util::Mutex s_contextMutex;
+    int s_fullHandshakes = 0;
+    int s_resumedHandshakes = 0;
+
+    // drops a reference to the context stored under key, s_contextMutex must be held
+    void unrefContext( const std::string& key )
+    {
+      ContextMap::iterator it = s_contexts.find( key );
+      if( it == s_contexts.end() || --(*it).second->refs )
+        return;
+
+      SharedContext* sc = (*it).second;
+      SessionMap::iterator its = sc->sessions.begin();
+      for( ; its != sc->sessions.end(); ++its )
+        SSL_SESSION_free( (*its).second );
+      SSL_CTX_free( sc->ctx );
+      delete sc;
+      s_contexts.erase( it );
+    }
+  }
+
   OpenSSLBase::OpenSSLBase( TLSHandler* th, const std::string& server )
-    : TLSBase( th, server ), m_ssl( 0 ), m_ctx( 0 ), m_buf( 0 ), m_bufsize( 17000 )
+    : TLSBase( th, server ), m_ssl( 0 ), m_ctx( 0 ), m_ibio( 0 ), m_nbio( 0 ),
+      m_recvOffset( 0 ), m_sendOffset( 0 ), m_buf( 0 ), m_bufsize( 65536 )
   {
     m_buf = static_cast<char*>( calloc( m_bufsize + 1, sizeof( char ) ) );
   }
@@ -39,11 +95,9 @@ namespace gloox
   OpenSSLBase::~OpenSSLBase()
   {
     m_handler = 0;
+    freeSSL();
+    releaseContext();
     free( m_buf );
-    SSL_CTX_free( m_ctx );
-    SSL_shutdown( m_ssl );
-    SSL_free( m_ssl );
-    BIO_free( m_nbio );
     cleanup();
   }
 
@@ -60,35 +114,177 @@ namespace gloox
 
     OpenSSL_add_all_algorithms();
 
+    m_clientKey = clientKey;
+    m_clientCerts = clientCerts;
+    m_cacerts = cacerts;
+
+    if( !acquireContext() || !createSSL() )
+      return false;
+
+    ERR_load_crypto_strings();
+    SSL_load_error_strings();
+
+    m_valid = true;
+    return true;
+  }
+
+  bool OpenSSLBase::acquireContext()
+  {
+    std::string key = isServer() ? "server" : "client";
+    key += '\n' + m_clientKey + '\n' + m_clientCerts;
+    StringList::const_iterator it = m_cacerts.begin();
+    for( ; it != m_cacerts.end(); ++it )
+      key += '\n' + (*it);
+
+    util::MutexGuard mg( s_contextMutex );
+
+    ContextMap::iterator itc = s_contexts.find( key );
+    if( itc != s_contexts.end() )
+    {
+      ++(*itc).second->refs;
+      m_ctx = (*itc).second->ctx;
+      m_contextKey = key;
+      return true;
+    }
+
     if( !setType() ) //inits m_ctx
       return false;
 
-    setClientCert( clientKey, clientCerts );
-    setCACerts( cacerts );
+    if( !m_clientKey.empty() && !m_clientCerts.empty() )
+    {
+      if( SSL_CTX_use_certificate_chain_file( m_ctx, m_clientCerts.c_str() ) != 1 )
+      {
+        // FIXME
+      }
+      if( SSL_CTX_use_RSAPrivateKey_file( m_ctx, m_clientKey.c_str(), SSL_FILETYPE_PEM ) != 1 )
+      {
+        // FIXME
+      }
+    }
+
+    if ( SSL_CTX_check_private_key( m_ctx ) != 1 )
+    {
+        // FIXME
+    }
 
-    if( !SSL_CTX_set_cipher_list( m_ctx, "HIGH:MEDIUM:AES:@STRENGTH" ) )
+    for( it = m_cacerts.begin(); it != m_cacerts.end(); ++it )
+      SSL_CTX_load_verify_locations( m_ctx, (*it).c_str(), 0 );
+
+    if( !SSL_CTX_set_cipher_list( m_ctx, "HIGH:MEDIUM:AES:@STRENGTH" ) || !privateInit() )
+    {
+      SSL_CTX_free( m_ctx );
+      m_ctx = 0;
       return false;
+    }
 
+    if( !isServer() )
+    {
+      // OpenSSL hands new sessions to newSessionCallback(), which keeps them per server
+      SSL_CTX_set_session_cache_mode( m_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE );
+      SSL_CTX_sess_set_new_cb( m_ctx, newSessionCallback );
+    }
+
+    SharedContext* sc = new SharedContext;
+    sc->ctx = m_ctx;
+    sc->refs = 1;
+    SSL_CTX_set_app_data( m_ctx, sc );
+    s_contexts.insert( std::make_pair( key, sc ) );
+    m_contextKey = key;
+    return true;
+  }
+
+  void OpenSSLBase::releaseContext()
+  {
+    if( !m_ctx )
+      return;
+
+    util::MutexGuard mg( s_contextMutex );
+    unrefContext( m_contextKey );
+
+    m_ctx = 0;
+    m_contextKey = EmptyString;
+  }
+
+  bool OpenSSLBase::createSSL()
+  {
     m_ssl = SSL_new( m_ctx );
     if( !m_ssl )
       return false;
 
-    if( !BIO_new_bio_pair( &m_ibio, 0, &m_nbio, 0 ) )
+    if( !BIO_new_bio_pair( &m_ibio, m_bufsize, &m_nbio, m_bufsize ) )
+    {
+      SSL_free( m_ssl );
+      m_ssl = 0;
       return false;
+    }
 
     SSL_set_bio( m_ssl, m_ibio, m_ibio );
     SSL_set_mode( m_ssl, SSL_MODE_AUTO_RETRY | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE );
+    SSL_set_app_data( m_ssl, this );
 
-    ERR_load_crypto_strings();
-    SSL_load_error_strings();
+    // the SSL object keeps its context alive, even if setCACerts() or setClientCert()
+    // switch m_ctx to another one before the next cleanup()
+    util::MutexGuard mg( s_contextMutex );
+    SharedContext* sc = static_cast<SharedContext*>( SSL_CTX_get_app_data( m_ctx ) );
+    ++sc->refs;
+    m_sslContextKey = m_contextKey;
 
-    if( !privateInit() )
-      return false;
+    if( !isServer() && !m_server.empty() )
+    {
+      SSL_set_tlsext_host_name( m_ssl, const_cast<char*>( m_server.c_str() ) );
+
+      SessionMap::const_iterator it = sc->sessions.find( m_server );
+      if( it != sc->sessions.end() )
+        SSL_set_session( m_ssl, (*it).second );
+    }
 
-    m_valid = true;
     return true;
   }
 
+  void OpenSSLBase::freeSSL()
+  {
+    if( !m_ssl )
+      return;
+
+    // a session that isn't shut down properly can't be resumed
+    if( m_secure )
+      SSL_shutdown( m_ssl );
+
+    SSL_free( m_ssl ); // frees m_ibio, too
+    BIO_free( m_nbio );
+    m_ssl = 0;
+    m_ibio = 0;
+    m_nbio = 0;
+
+    util::MutexGuard mg( s_contextMutex );
+    unrefContext( m_sslContextKey );
+    m_sslContextKey = EmptyString;
+  }
+
+  int OpenSSLBase::newSessionCallback( SSL* ssl, SSL_SESSION* session )
+  {
+    const OpenSSLBase* base = static_cast<const OpenSSLBase*>( SSL_get_app_data( ssl ) );
+    if( !base || base->m_server.empty() )
+      return 0;
+
+    util::MutexGuard mg( s_contextMutex );
+    SharedContext* sc = static_cast<SharedContext*>( SSL_CTX_get_app_data( SSL_get_SSL_CTX( ssl ) ) );
+    SSL_SESSION*& cached = sc->sessions[base->m_server];
+    if( cached )
+      SSL_SESSION_free( cached );
+    cached = session;
+    return 1; // we keep the reference
+  }
+
+  TLSBase::HandshakeStatistics OpenSSLBase::handshakeStatistics()
+  {
+    util::MutexGuard mg( s_contextMutex );
+    HandshakeStatistics stats;
+    stats.full = s_fullHandshakes;
+    stats.resumed = s_resumedHandshakes;
+    return stats;
+  }
+
   bool OpenSSLBase::encrypt( const std::string& data )
   {
     m_sendBuffer += data;
@@ -117,35 +313,47 @@ namespace gloox
     return true;
   }
 
+  void OpenSSLBase::setBufferSize( int size )
+  {
+    if( size <= 0 || size == m_bufsize )
+      return;
+
+    char* buf = static_cast<char*>( realloc( m_buf, size + 1 ) );
+    if( !buf )
+      return;
+
+    m_buf = buf;
+    m_bufsize = size;
+  }
+
   void OpenSSLBase::setCACerts( const StringList& cacerts )
   {
     m_cacerts = cacerts;
+    if( !m_ctx )
+      return;
 
-    StringList::const_iterator it = m_cacerts.begin();
-    for( ; it != m_cacerts.end(); ++it )
-      SSL_CTX_load_verify_locations( m_ctx, (*it).c_str(), 0 );
+    // switch to the context for the new configuration. an established connection keeps
+    // its SSL object, and with it the old context, until the next cleanup()
+    releaseContext();
+    if( acquireContext() && !m_secure )
+    {
+      freeSSL();
+      m_valid = createSSL();
+    }
   }
 
   void OpenSSLBase::setClientCert( const std::string& clientKey, const std::string& clientCerts )
   {
     m_clientKey = clientKey;
     m_clientCerts = clientCerts;
+    if( !m_ctx )
+      return;
 
-    if( !m_clientKey.empty() && !m_clientCerts.empty() )
+    releaseContext();
+    if( acquireContext() && !m_secure )
     {
-      if( SSL_CTX_use_certificate_chain_file( m_ctx, m_clientCerts.c_str() ) != 1 )
-      {
-        // FIXME
-      }
-      if( SSL_CTX_use_RSAPrivateKey_file( m_ctx, m_clientKey.c_str(), SSL_FILETYPE_PEM ) != 1 )
-      {
-        // FIXME
-      }
-    }
-
-    if ( SSL_CTX_check_private_key( m_ctx ) != 1 )
-    {
-        // FIXME
+      freeSSL();
+      m_valid = createSSL();
     }
   }
 
@@ -154,8 +362,16 @@ namespace gloox
     if( !m_mutex.trylock() )
       return;
 
+    // start over with a fresh SSL object so that the next handshake can resume the session
+    freeSSL();
+    m_recvBuffer = EmptyString;
+    m_recvOffset = 0;
+    m_sendBuffer = EmptyString;
+    m_sendOffset = 0;
+    m_decrypted = EmptyString;
+
     m_secure = false;
-    m_valid = false;
+    m_valid = m_ctx && createSSL();
 
     m_mutex.unlock();
   }
@@ -167,6 +383,7 @@ namespace gloox
 
     int ret = 0;
     bool onceAgain = false;
+    bool writeAgain = false;
 
     do
     {
@@ -176,7 +393,8 @@ namespace gloox
           ret = handshakeFunction();
           break;
         case TLSWrite:
-          ret = SSL_write( m_ssl, m_sendBuffer.c_str(), static_cast<int>( m_sendBuffer.length() ) );
+          ret = SSL_write( m_ssl, m_sendBuffer.data() + m_sendOffset,
+                           static_cast<int>( m_sendBuffer.length() - m_sendOffset ) );
           break;
         case TLSRead:
           ret = SSL_read( m_ssl, m_buf, m_bufsize );
@@ -185,22 +403,30 @@ namespace gloox
 
       switch( SSL_get_error( m_ssl, ret ) )
       {
-        case SSL_ERROR_WANT_READ:
         case SSL_ERROR_WANT_WRITE:
+          // pushFunc() makes room in the BIO pair, so the rest can be written right away
+          writeAgain = ( op == TLSWrite );
+          pushFunc();
+          break;
+        case SSL_ERROR_WANT_READ:
+          writeAgain = false;
           pushFunc();
           break;
         case SSL_ERROR_NONE:
+          writeAgain = false;
           if( op == TLSHandshake )
             m_secure = true;
           else if( op == TLSWrite )
-            m_sendBuffer.erase( 0, ret );
+            consume( m_sendBuffer, m_sendOffset, ret );
           else if( op == TLSRead )
-            m_handler->handleDecryptedData( this, std::string( m_buf, ret ) );
+            m_decrypted.append( m_buf, ret );
           pushFunc();
           break;
         default:
           if( !m_secure )
             m_handler->handleHandshakeResult( this, false, m_certInfo );
+          else
+            passDecrypted();
           return;
           break;
       }
@@ -210,7 +436,20 @@ namespace gloox
         onceAgain = false;
     }
     while( ( ( onceAgain || m_recvBuffer.length() ) && ( !m_secure || op == TLSRead ) )
-           || ( ( op == TLSWrite ) && ( ret > 0 ) ));
+           || ( ( op == TLSWrite ) && ( ret > 0 || writeAgain ) && m_sendBuffer.length() ) );
+
+    passDecrypted();
+  }
+
+  void OpenSSLBase::passDecrypted()
+  {
+    if( m_decrypted.empty() || !m_handler )
+      return;
+
+    // the handler may well feed more data in
+    std::string data;
+    data.swap( m_decrypted );
+    m_handler->handleDecryptedData( this, data );
   }
 
   int OpenSSLBase::ASN1Time2UnixTime( ASN1_TIME* time )
@@ -342,6 +581,15 @@ namespace gloox
     if( tmp )
       m_certInfo.compression = tmp;
 
+    m_certInfo.resumed = SSL_session_reused( m_ssl ) != 0;
+    {
+      util::MutexGuard mg( s_contextMutex );
+      if( m_certInfo.resumed )
+        ++s_resumedHandshakes;
+      else
+        ++s_fullHandshakes;
+    }
+
     m_valid = true;
 
     m_handler->handleHandshakeResult( this, true, m_certInfo );
@@ -371,14 +619,17 @@ namespace gloox
 
     while( ( wantread = BIO_ctrl_get_read_request( m_nbio ) ) > 0 )
     {
-      if( wantread > m_recvBuffer.length() )
-        wantread = m_recvBuffer.length();
+      if( wantread > m_recvBuffer.length() - m_recvOffset )
+        wantread = m_recvBuffer.length() - m_recvOffset;
 
       if( !wantread )
         break;
 
-      tobio = BIO_write( m_nbio, m_recvBuffer.c_str(), static_cast<int>( wantread ) );
-      m_recvBuffer.erase( 0, tobio );
+      tobio = BIO_write( m_nbio, m_recvBuffer.data() + m_recvOffset, static_cast<int>( wantread ) );
+      if( tobio <= 0 )
+        break;
+
+      consume( m_recvBuffer, m_recvOffset, tobio );
     }
   }
 
@@ -71,6 +71,17 @@ namespace gloox
       // reimplemented from TLSBase
       virtual void setClientCert( const std::string& clientKey, const std::string& clientCerts );
 
+      // reimplemented from TLSBase
+      virtual void setBufferSize( int size );
+
+      /**
+       * Returns the number of full and resumed handshakes of all OpenSSL-based TLS objects
+       * in the process.
+       * @return The handshake statistics.
+       * @since 1.1
+       */
+      static HandshakeStatistics handshakeStatistics();
+
     protected:
       virtual bool setType() = 0;
       virtual int handshakeFunction() = 0;
@@ -82,7 +93,18 @@ namespace gloox
 
     private:
       void pushFunc();
+      void passDecrypted();
+
+      // m_ctx is shared between all instances with the same role and certificates.
+      // privateInit() is called once for every new context
+      bool acquireContext();
+      void releaseContext();
+      bool createSSL();
+      void freeSSL();
+      static int newSessionCallback( SSL* ssl, SSL_SESSION* session );
+
       virtual bool privateInit() { return true; }
+      virtual bool isServer() const { return false; }
 
       enum TLSOperation
       {
@@ -94,10 +116,17 @@ namespace gloox
       void doTLSOperation( TLSOperation op );
       int ASN1Time2UnixTime( ASN1_TIME* time );
 
+      // the unread part of m_recvBuffer and m_sendBuffer starts at m_recvOffset and
+      // m_sendOffset, respectively, so that consuming data doesn't move the rest
       std::string m_recvBuffer;
+      std::string::size_type m_recvOffset;
       std::string m_sendBuffer;
+      std::string::size_type m_sendOffset;
+      std::string m_decrypted;
+      std::string m_contextKey;
+      std::string m_sslContextKey;  // the context m_ssl was created from
       char* m_buf;
-      const int m_bufsize;
+      int m_bufsize;
 
   };
 
@@ -49,6 +49,9 @@ namespace gloox
     private:
       // reimplemented from OpenSSLBase
       virtual bool privateInit();
+
+      // reimplemented from OpenSSLBase
+      virtual bool isServer() const { return true; }
       // reimplemented from OpenSSLBase
       virtual bool setType();
 
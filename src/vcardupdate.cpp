@@ -63,6 +63,13 @@ namespace gloox
     return filter;
   }
 
+  bool VCardUpdate::equals( const StanzaExtension& other ) const
+  {
+    const VCardUpdate& v = static_cast<const VCardUpdate&>( other );
+    return v.m_valid == m_valid && v.m_notReady == m_notReady && v.m_noImage == m_noImage
+           && v.m_hasPhoto == m_hasPhoto && v.m_hash == m_hash;
+  }
+
   Tag* VCardUpdate::tag() const
   {
     if( !m_valid )
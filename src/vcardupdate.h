@@ -94,6 +94,9 @@ namespace gloox
         return new VCardUpdate( *this );
       }
 
+      // reimplemented from StanzaExtension
+      virtual bool equals( const StanzaExtension& other ) const;
+
     private:
       std::string m_hash;
       bool m_notReady;